@@ -1,9 +1,17 @@
+import collections
+import hashlib
 import shutil
 import zipfile
 import yaml
 import argparse
+import socket
+import sys
 
 from utils import *
+from blame import bisect, bisect_command, bisect_supported
+from campaign import CampaignCoordinator, CampaignWorker
+from func_check import function_hash, read_library, validate, write_library
+from results import SegmentWriter, options_hash, read_case_seed
 from StateEnum import State
 from StateEnum import state_to_str
 
@@ -12,6 +20,12 @@ parser = argparse.ArgumentParser()
 # 用于设置仅编译的选项
 parser.add_argument("--compile-only", action="store_true", help="only compile, won't execute")
 
+# 分布式测试：协调器把用例分配给各个 worker，并汇总结果
+parser.add_argument("--coordinator", metavar="HOST:PORT", help="lease the cases of the campaign to the workers")
+parser.add_argument("--worker", metavar="HOST:PORT", help="test the cases leased by the coordinator")
+parser.add_argument("--local-workers", type=int, default=0,
+                    help="with --coordinator, also start this many workers on this machine")
+
 # 传入 YAML 路径
 parser.add_argument('yaml_file', type=str, help='Path to the YAML file', nargs='?', default='default.yaml')
 
@@ -30,10 +44,50 @@ run_count = config.get('run_count')
 
 # 获取函数注入的参数
 func_source_path = config.get('func_source_path')
-func_batch_size = config.get('func_batch_size')
-func_total = config.get('func_total')
+func_batch_size = config.get('func_batch_size', 0)
+func_validate = config.get('func_validate', True)
+func_cache_path = config.get('func_cache_path', '../Testing/func_check_cache.json')
+# 交给生成器的函数库（校验后为校验通过的函数库）
+FUNC_LIB = func_source_path
+
+# 获取代价模型的参数
+max_run_cost = config.get('max_run_cost', 0)
+max_compile_cost = config.get('max_compile_cost', 0)
+cost_weights = config.get('cost_weights')
+max_regen_count = config.get('max_regen_count', 10)
+max_dynamic_ops = config.get('max_dynamic_ops', 0)
+
+# 获取性能差分测试的参数
+perf_reps = config.get('perf_reps', 0)
+perf_slowdown = config.get('perf_slowdown', 2.0)
+perf_min_cycles = config.get('perf_min_cycles', 100000)
+
+# 获取本地执行器的参数（可执行文件不存在时退回到 Python 实现）
+executor_path = config.get('executor_path', '../build/yarpgen-exec')
+mem_limit_mb = config.get('mem_limit_mb', 0)
+cpu_limit = config.get('cpu_limit', 0)
+parallel_jobs = config.get('parallel_jobs', 0)
+pipeline_depth = config.get('pipeline_depth', 4)
+zero_disk = config.get('zero_disk', False)
+crash_handler_path = config.get('crash_handler_path', '../build/yarpgen-crash-handler.so')
+
+# 获取优化定位（blame）的参数
+blame = config.get('blame', False)
+blame_jobs = config.get('blame_jobs', 0)
+
+# 获取分布式测试的参数
+campaign_seed = config.get('campaign_seed', 1)
+lease_size = config.get('lease_size', 10)
+lease_timeout = config.get('lease_timeout', 600)
+checkpoint_path = config.get('checkpoint_path', '../Testing/campaign.json')
+
+# yarpgen exits with this code if the test doesn't fit into the cost budget
+COST_BUDGET_EXIT_CODE = 3
 
 TIME_STR = get_current_time_str()
+# 同一台机器上的多个 worker 使用各自的测试文件夹
+if args.worker:
+    TIME_STR += '-w' + str(os.getpid())
 
 if not TEST_PATH.endswith('/'):
     TEST_PATH += '/'
@@ -43,21 +97,50 @@ GENERATOR_OUTPUT_FOLDER = TEST_FOLDER + 'cases/'
 BACKUP_FOLDER = TEST_FOLDER + 'backup/'
 LOG_FOLDER = TEST_FOLDER + 'log/'
 
-if not os.path.exists(TEST_FOLDER):
-    os.makedirs(TEST_FOLDER)
+# 协调器自己不测试用例，其结果保存在 checkpoint_path 旁边
+for folder in ([] if args.coordinator else [TEST_FOLDER, GENERATOR_OUTPUT_FOLDER, BACKUP_FOLDER, LOG_FOLDER]):
+    if not os.path.exists(folder):
+        os.makedirs(folder)
 
-if not os.path.exists(GENERATOR_OUTPUT_FOLDER):
-    os.makedirs(GENERATOR_OUTPUT_FOLDER)
+# 测试结果记录在二进制结果日志中，每个进程写自己的段文件，分布式测试的 worker 共用一个 campaign 文件夹
+RESULTS = None
+if not args.coordinator:
+    campaign_name = os.path.splitext(os.path.basename(checkpoint_path))[0] if args.worker else TIME_STR
+    RESULTS = SegmentWriter(TEST_PATH + 'results/' + campaign_name, socket.gethostname() + '-' + str(os.getpid()))
 
-if not os.path.exists(BACKUP_FOLDER):
-    os.makedirs(BACKUP_FOLDER)
+# 编译时间基线和崩溃分类在多次测试之间共享
+COMPILE_BASELINE = CompileTimeBaseline(TEST_PATH + 'compile_baseline.json')
+CRASH_BUCKETS = CrashBuckets(TEST_PATH + 'crash_buckets.json')
 
-if not os.path.exists(LOG_FOLDER):
-    os.makedirs(LOG_FOLDER)
+# 测试运行时预加载崩溃处理库，崩溃时直接输出信号和调用栈，不需要再用 gdb 重新运行
+CRASH_HANDLER = None
+if crash_handler_path and os.path.exists(crash_handler_path):
+    CRASH_HANDLER = os.path.abspath(crash_handler_path)
 
+EXECUTOR = None
+if executor_path and os.path.exists(executor_path) and not args.coordinator:
+    EXECUTOR = NativeExecutor(executor_path, mem_limit_mb, cpu_limit, parallel_jobs)
+
+# 零磁盘模式：流水线中编译出的可执行文件只存在于执行器的内存文件中
+ZERO_DISK = bool(zero_disk and EXECUTOR and not perf_reps)
+
+
+def run_job(command: list, working_dir: str, timeout: int):
+    """Runs a compile or run job with the native executor if it is available"""
+    if EXECUTOR:
+        return EXECUTOR.run(command, working_dir, timeout)
+    return run_cmd_with_usage(command, working_dir, timeout)
+
+
+def test_command(exe_cmd: str):
+    """Command that runs a compiled test"""
+    if CRASH_HANDLER:
+        return ['env', 'LD_PRELOAD=' + CRASH_HANDLER, exe_cmd]
+    return [exe_cmd]
 
-def generator_runner(test_num: int = 1):
 
+def generator_options():
+    """Checks the generator settings, returns the extension of the cases and the extra generator options"""
     global GENERATOR_ELF, GENERATOR_OUTPUT_FOLDER
 
     if not os.path.exists(GENERATOR_ELF):
@@ -73,46 +156,211 @@ def generator_runner(test_num: int = 1):
     else :
         raise ValueError('You should choose a supported language')
 
+    cost_options = ""
+    if max_run_cost:
+        cost_options += " --max-run-cost=" + str(max_run_cost)
+    if max_compile_cost:
+        cost_options += " --max-compile-cost=" + str(max_compile_cost)
+    if cost_weights:
+        cost_options += " --cost-weights=" + str(cost_weights)
+    if max_dynamic_ops:
+        cost_options += " --max-dynamic-ops=" + str(max_dynamic_ops)
+    if perf_reps:
+        cost_options += " --perf-reps=" + str(perf_reps)
+    # 生成器用测试的种子从函数库中选取函数，不再由脚本写 functions.yaml
+    if FUNC_LIB:
+        cost_options += " --func-lib=" + os.path.abspath(FUNC_LIB)
+        cost_options += " --func-batch=" + str(func_batch_size)
+    return file_ext, cost_options
+
+
+def is_binary_library(path: str):
+    """Binary libraries (see func_lib.h) are recognized by the header, like the generator does"""
+    if not os.path.isfile(path):
+        return False
+    with open(path, 'rb') as file:
+        return file.read(4) == b'YFLB'
+
+
+def validated_library():
+    """Checks the functions of the library with the compilers and optimization levels of the test
+    (see func_check.py), returns the path of the library of the valid functions"""
+    if not os.path.exists(GENERATOR_ELF):
+        raise ValueError('You must have a legal generator elf')
+    functions = read_library(func_source_path)
+    valid, failures = validate(functions, config.get('compiler'), config.get('optimization'),
+                               config.get('extra_option') or [], func_cache_path, parallel_jobs, timeout)
+    print('function library: {} of {} functions are valid {}'.format(len(valid), len(functions), failures))
+    # 文件名由校验通过的函数决定，同一个 campaign 的各个 worker 使用同一个函数库（选项哈希相同）
+    digest = hashlib.sha256(''.join(function_hash(func) for func in valid).encode('utf-8')).hexdigest()
+    lib_path = TEST_PATH + 'functions-' + digest[:16] + '.yflb'
+    if not os.path.exists(lib_path):
+        tmp_name = lib_path + '.' + str(os.getpid())
+        write_library(valid, tmp_name + '.yaml')
+        # 二进制函数库映射到内存，生成器不需要每次解析整个 YAML
+        ret = subprocess.call([GENERATOR_ELF, '--func-lib=' + tmp_name + '.yaml', '--save-func-lib=' + tmp_name])
+        os.remove(tmp_name + '.yaml')
+        if ret:
+            raise ValueError("Can't convert the validated function library")
+        os.replace(tmp_name, lib_path)
+    return lib_path
+
+
+def generate_case(i: int, file_ext: str, cost_options: str, seed: int = 0):
+    """Generates the i-th case, returns its file name, seed (0 if it is random) and the reason of the failure.
+    With a seed, the attempts use the seeds seed, seed + 1, ...
+    If there is no case (all attempts are over the cost budget or the generator has failed), the file name
+    is None and the reason is "REJECTED" or "GENERATOR FAILED", otherwise the reason is None"""
+    case_file = TIME_STR + '--' + str(i+1) + file_ext
+    output_file = GENERATOR_OUTPUT_FOLDER + case_file
+    print("generating " + output_file)
+    cmd = GENERATOR_ELF + " -o " + output_file + cost_options
+    ret = COST_BUDGET_EXIT_CODE
+    attempt = 0
+    # Tests over the cost budget are rejected, so we try another seed
+    for attempt in range(max_regen_count):
+        seed_option = " --seed=" + str(seed + attempt) if seed else ""
+        ret = subprocess.call(cmd + seed_option, shell=True)
+        if ret != COST_BUDGET_EXIT_CODE:
+            break
+    seed = seed + attempt if seed else 0
+    if ret == 0 and os.path.exists(output_file):
+        return case_file, seed, None
+    reason = "REJECTED" if ret == COST_BUDGET_EXIT_CODE else "GENERATOR FAILED"
+    print("{}: {} (exit code {})".format(reason, output_file, ret))
+    # 生成器失败时可能留下不完整的文件
+    if os.path.exists(output_file):
+        os.remove(output_file)
+    return None, seed, reason
+
+
+def generator_runner(test_num: int = 1):
+    file_ext, cost_options = generator_options()
     for i in range(test_num):
-        output_file = GENERATOR_OUTPUT_FOLDER + TIME_STR + '--' + str(i+1) + file_ext
-        generate_random_function_batch_from_zip(func_source_path, func_batch_size, func_total)
-        print("generating " + output_file)
-        cmd = GENERATOR_ELF + " -o " + output_file
-        os.system(cmd)
+        generate_case(i, file_ext, cost_options)
+
 
-def compile_elf(compile_cmd: str):
+def compile_elf(compile_cmd: str, run=run_job):
     global GENERATOR_OUTPUT_FOLDER, timeout
 
     try:
         print("COMPILE: " + compile_cmd)
-        ret, _, _ = run_cmd(compile_cmd.split(' '), GENERATOR_OUTPUT_FOLDER, timeout)
+        ret, _, stderr, wall_time, max_rss = run(compile_cmd.split(' '), GENERATOR_OUTPUT_FOLDER, timeout)
     except subprocess.TimeoutExpired:
         print("COMPILER TIMEOUT: {}".format(compile_cmd))
-        return State.COMPILE_TIMEOUT
+        return State.COMPILE_TIMEOUT, timeout, 0, None
     else:
         if ret != 0:
             print("COMPILER CRASH BY CMD: {}".format(compile_cmd))
-            return State.COMPILE_CRASH
+            # 第一次编译的错误输出就是崩溃信息，不再重新编译
+            return State.COMPILE_CRASH, wall_time, max_rss, (ret, stderr)
         else:
-            return State.COMPILE_SUCC
+            return State.COMPILE_SUCC, wall_time, max_rss, None
 
 
-def execute_elf(elf_name: str):
+def record_compile_stats(case_file: str, compiler: str, opt: str, march: str, compile_cmd: str,
+                         wall_time: float, max_rss: int, cta_file: str):
+    """Adds the compile time to the baseline and reports compilations that are much slower than it.
+    Returns True for such compilations (the time and memory go to the results log)"""
+    global GENERATOR_OUTPUT_FOLDER, COMPILE_BASELINE
+
+    size = os.path.getsize(GENERATOR_OUTPUT_FOLDER + case_file)
+    key = CompileTimeBaseline.config_key(compiler, opt, march)
+    expected = COMPILE_BASELINE.add(key, size, wall_time)
+    if expected is not None:
+        print("COMPILE TIME ANOMALY {}: {:.2f}s, expected {:.2f}s".format(compile_cmd, wall_time, expected))
+        write_file("{} -> {:.2f}s (expected {:.2f}s, {:.1f}x), {} KB\n".format(
+            compile_cmd, wall_time, expected, wall_time / expected, max_rss), cta_file)
+        backup_file(case_file)
+        return True
+    return False
+
+
+def execute_elf(elf_name: str, run=run_job):
     global GENERATOR_OUTPUT_FOLDER, timeout
     try:
         exe_cmd = './' + elf_name
         print("RUN TEST: " + exe_cmd)
-        ret, stdout, stderr = run_cmd([exe_cmd], GENERATOR_OUTPUT_FOLDER, timeout)
+        ret, stdout, stderr, wall_time, max_rss = run(test_command(exe_cmd), GENERATOR_OUTPUT_FOLDER, timeout)
     except subprocess.TimeoutExpired:
         print("GENERATED DEAD-LOOP FILE: {}".format(elf_name))
-        return State.EXECUTION_TIMEOUT, state_to_str(State.EXECUTION_TIMEOUT)
+        return State.EXECUTION_TIMEOUT, state_to_str(State.EXECUTION_TIMEOUT), None, timeout, 0, None
 
     if ret != 0:
         print("EXECUTABLE CRASH: {}".format(elf_name))
-        return State.EXECUTION_CRASH, state_to_str(State.EXECUTION_CRASH)
+        # 崩溃处理库输出的信号和调用栈在 stderr 中
+        return State.EXECUTION_CRASH, state_to_str(State.EXECUTION_CRASH), None, wall_time, max_rss, (ret, stderr)
     else:
         checksum = stdout[0]
-        return State.EXECUTION_SUCC, checksum
+        return State.EXECUTION_SUCC, checksum, parse_cycles(stdout), wall_time, max_rss, None
+
+
+def run_bisect_probes(compile_cmd: str, elf_name: str, reference, limits: list):
+    """Compiles the job with every limit of the optimization passes and runs it if there is a reference
+    checksum. The probes run in parallel with the native executor.
+    Returns {limit: (failed, compiler stderr)}"""
+    probes = []
+    for limit in limits:
+        probe_elf = elf_name + '-bisect' + str(limit)
+        compile_command = bisect_command(compile_cmd, limit, probe_elf)
+        exe_command = test_command('./' + probe_elf) if reference is not None else None
+        if EXECUTOR:
+            # ahead of the jobs of the pipeline
+            compile_id = EXECUTOR.submit(compile_command, GENERATOR_OUTPUT_FOLDER, timeout, priority=-1,
+                                         dependents=1 if exe_command else 0)
+            execute_id = None
+            if exe_command:
+                execute_id = EXECUTOR.submit(exe_command, GENERATOR_OUTPUT_FOLDER, timeout, deps=[compile_id],
+                                             priority=-1)
+            probes.append((limit, compile_command, exe_command, EXECUTOR.result_runner(compile_id),
+                           EXECUTOR.result_runner(execute_id) if execute_id else None, execute_id))
+        else:
+            probes.append((limit, compile_command, exe_command, run_job, run_job, None))
+
+    results = {}
+    for limit, compile_command, exe_command, compile_run, execute_run, execute_id in probes:
+        try:
+            ret, _, stderr, _, _ = compile_run(compile_command, GENERATOR_OUTPUT_FOLDER, timeout)
+            compile_failed = ret != 0
+        except subprocess.TimeoutExpired:
+            # a compiler timeout isn't the crash that we look for, but the run can't pass without ELF
+            compile_failed, stderr = exe_command is not None, []
+            ret = None
+        if ret != 0 or exe_command is None:
+            if execute_id:
+                EXECUTOR.discard_result(execute_id)
+            results[limit] = (compile_failed, stderr)
+            continue
+        try:
+            ret, stdout, _, _, _ = execute_run(exe_command, GENERATOR_OUTPUT_FOLDER, timeout)
+            failed = ret != 0 or not stdout or stdout[0] != reference
+        except subprocess.TimeoutExpired:
+            failed = True
+        results[limit] = (failed, stderr)
+    return results
+
+
+def blame_job(case_file: str, compiler: str, opt: str, compile_cmd: str, elf_name: str, reference, blame_file: str):
+    """Finds the optimization pass that causes the failure of the job (a compiler crash without a reference
+    checksum, a wrong checksum, a crash or a timeout of the test otherwise) and logs it with the minimal
+    reproducer command"""
+    k = 1
+    if EXECUTOR:
+        k = blame_jobs or parallel_jobs or os.cpu_count()
+    start = time.time()
+    result = bisect(lambda limits: run_bisect_probes(compile_cmd, elf_name, reference, limits), k)
+    if result is None:
+        print("CAN NOT BLAME {} {} {}".format(compiler, opt, case_file))
+        return
+    if result.limit == 0:
+        culprit = "fails without optimization passes"
+    else:
+        culprit = "pass ({}) {}".format(result.limit, result.pass_name)
+    reproducer = ' '.join(bisect_command(compile_cmd, result.limit))
+    print("BLAME {} {} {}: {}".format(compiler, opt, case_file, culprit))
+    write_file("{} {} {}: {}\n  reproducer: {}\n  {} rounds, {} probes, {:.1f}s\n".format(
+        case_file, compiler, opt, culprit, reproducer, result.rounds, result.probes, time.time() - start),
+        blame_file)
 
 
 def backup_file(case_name: str):
@@ -122,143 +370,152 @@ def backup_file(case_name: str):
         shutil.copyfile(GENERATOR_OUTPUT_FOLDER + case_name, BACKUP_FOLDER + case_name)
 
 
-def process_compiler(compilers: list, optimization: list, marches: list, extra_options: list):
+def build_case_jobs(case_file: str, compilers: list, optimization: list, marches: list, extra_options: list):
+    """Jobs of a case in the order of comparison: (compiler, opt, march, compile_cmd, elf_name, need_execute)"""
+    jobs = []
+    for compiler in compilers:
+        for opt in optimization:
+            # march 只在仅编译模式下使用
+            for march in (marches if args.compile_only else [""]):
+                elf_name = case_name_to_elf_name(compiler.split('/')[-1], case_file, opt, march)
+                compile_strings = []
+                compile_strings.append(compiler)
+                compile_strings.append(opt)
+                compile_strings.extend(extra_options)
+                if march:
+                    compile_strings.append(march)
+                if not args.compile_only:
+                    # 导出测试中的函数名，崩溃处理库打印的栈才能定位到崩溃的函数
+                    compile_strings.append("-rdynamic")
+                compile_strings.append(case_file)
+                compile_strings.append("-o")
+                compile_strings.append(elf_name)
+                compile_cmd = " ".join(compile_strings)
+                jobs.append((compiler, opt, march, compile_cmd, elf_name, not args.compile_only))
+    return jobs
+
+
+def check_case(case_file: str, jobs: list, results: list):
+    """Logs and compares the results of all jobs of a case.
+    results[i] is (compile result, execute result or None) of jobs[i], see compile_elf and execute_elf.
+    Returns the kinds of the found problems (see results.FINDINGS: CIE, COE, DIFF, ...)"""
     global GENERATOR_OUTPUT_FOLDER , LOG_FOLDER
 
-    # for each test case
-    files = os.listdir(GENERATOR_OUTPUT_FOLDER)
-    sorted_files = sorted(files, key=filename_sort_key)
-
-    for case_file in sorted_files:
-        if not (case_file.endswith('.c') or case_file.endswith('.cpp')):
+    execution_res = {}
+    compilation_timeout_files = {}
+    execution_timeout_files = {}
+    compiler_internal_error = {}
+    compiler_opt_error = {}
+    tail = TIME_STR + '.txt'
+
+    checksum_array = []
+    diff_file = LOG_FOLDER + case_file + '.diff'
+
+    cta_file = LOG_FOLDER + 'CTA-' + tail  # compile time anomaly
+    perf_file = LOG_FOLDER + 'PERF-' + tail  # run time slowdown
+    perf_timings = {}
+    # 每个编译配置发现的问题，最后写入结果日志
+    job_findings = [set() for _ in jobs]
+    # 新的编译器崩溃，需要定位到优化
+    new_crashes = set()
+
+    for job_index, ((compiler, opt, march, compile_cmd, elf_name, _), (compile_res, execute_res)) in \
+            enumerate(zip(jobs, results)):
+        findings = job_findings[job_index]
+        compile_state, wall_time, max_rss, compile_crash = compile_res
+        # 编译器崩溃的耗时不代表正常编译，不计入基线
+        if compile_state == State.COMPILE_SUCC:
+            if record_compile_stats(case_file, compiler, opt, march, compile_cmd, wall_time, max_rss,
+                                    cta_file):
+                findings.add('CTA')
+        if compile_state == State.COMPILE_TIMEOUT:
+            findings.add('CT')
+            insert_to_dict(case_file, compilation_timeout_files, elf_name)
+            #backup_file(case_file)
+            continue
+        elif compile_state == State.COMPILE_CRASH:
+            insert_to_dict(case_file, compiler_internal_error, elf_name)
+            findings.add('CIE')
+            ret, stderr = compile_crash
+            signature = compile_crash_signature(compiler, ret, stderr)
+            # 重复的崩溃只计数
+            if not CRASH_BUCKETS.add(signature, case_file):
+                print("DUPLICATE CRASH: {}".format(signature))
+                continue
+            new_crashes.add(job_index)
+            cie_log = LOG_FOLDER + "log-cie-" + compiler.split('/')[-1] + case_file + opt + march + '.txt'
+            log_string = "CMD:" + compile_cmd + '\n' + "SIGNATURE:" + signature + '\n' + "ERROR:" + '\n'.join(stderr)
+            write_file(log_string + '\n', cie_log)
+            backup_file(case_file)
             continue
-        execution_res = {}
-        compilation_timeout_files = {}
-        execution_timeout_files = {}
-        compiler_internal_error = {}
-        compiler_opt_error = {}
-        tail = TIME_STR + '.txt'
-
-        checksum_array = []
-        diff_file = LOG_FOLDER + case_file + '.diff'
-
-        cie_file = LOG_FOLDER + 'CIE-' + tail  # compiler_internal_error
-        ct_file = LOG_FOLDER + 'CT-' + tail  # compiler_timeout
-        coe_file = LOG_FOLDER + 'COE-' + tail  # compiler_opt_error
-        et_file = LOG_FOLDER + 'ET-' + tail  # execution_timeout
-        er_file = LOG_FOLDER + 'LOG-' + tail  # execution_res
-
-        for compiler in compilers:
-            for opt in optimization:
-                if not args.compile_only:
-                    elf_name = case_name_to_elf_name(compiler.split('/')[-1], case_file, opt)
-                    compile_strings = []
-                    compile_strings.append(compiler)
-                    compile_strings.append(opt)
-                    compile_strings.extend(extra_options)
-                    compile_strings.append(case_file)
-                    compile_strings.append("-o")
-                    compile_strings.append(elf_name)
-                    compile_cmd = " ".join(compile_strings)
-                    compile_state = compile_elf(compile_cmd)
-                    if compile_state == State.COMPILE_TIMEOUT:
-                        write_file(compile_cmd + '\n', ct_file)
-                        insert_to_dict(case_file, compilation_timeout_files, elf_name)
-                        #backup_file(case_file)
-                        continue
-                    elif compile_state == State.COMPILE_CRASH:
-                        insert_to_dict(case_file, compiler_internal_error, elf_name)
-                        write_file(compile_cmd + '\n', cie_file)
-                        cie_log = LOG_FOLDER + "log-cie-" + compiler.split('/')[-1] + case_file + opt + '.txt'
-                        process = subprocess.Popen(compile_cmd, cwd=GENERATOR_OUTPUT_FOLDER, shell=True, stdout=subprocess.PIPE, stderr=subprocess.PIPE, universal_newlines=True)
-                        output, errors = process.communicate()
-                        log_string = "OUTPUT:" + output + '\n' + "ERROR:" + errors
-                        write_file(log_string, cie_log)
-                        backup_file(case_file)
-                        continue
-
-                    execute_state, ret_val = execute_elf(elf_name)
-                    # record all
-                    write_file(compile_cmd + ' -> ' + ret_val + '\n', er_file)
-                    # process state
-                    if execute_state == State.EXECUTION_SUCC:
-                        if case_file not in execution_res:
-                            execution_res[case_file] = []
-                        elf_and_checksum = (elf_name, ret_val)
-                        # compare with timeout historical results
-                        if case_file in execution_timeout_files:
-                            print("{} OPT ERROR {} AT {}, "
-                                  "both timeout and checksum are generated!".format(compiler, case_file, opt))
-                            insert_to_dict(case_file, compiler_opt_error, elf_name)
-                            write_file(compile_cmd + ' -> ' + ret_val + '\n', coe_file)
-                            #backup_file(case_file)
-                        # compare with historical results
-                        for (k, v) in execution_res[case_file]:
-                            if ret_val != v:
-                                print("{} OPT ERROR {} AT {}!".format(compiler, case_file, opt))
-                                insert_to_dict(case_file, compiler_opt_error, elf_name)
-                                write_file(compile_cmd + ' -> ' + ret_val + '\n', coe_file)
-                                backup_file(case_file)
-                        execution_res[case_file].append(elf_and_checksum)
-                        checksum_array.append(ret_val)
-
-                    elif execute_state == State.EXECUTION_TIMEOUT:
-                        insert_to_dict(case_file, execution_timeout_files, elf_name)
-                        write_file(compile_cmd + '\n', et_file)
-                        # compare with timeout historical results
-                        if case_file in execution_res:
-                            print("{} OPT ERROR {} AT {}, "
-                                  "both timeout and checksum are generated!".format(compiler, case_file, opt))
-                            insert_to_dict(case_file, compiler_opt_error, elf_name)
-                            write_file(compile_cmd + ' -> EXECUTION_TIMEOUT\n', coe_file)
-                            #backup_file(case_file)
-                    elif execute_state == State.EXECUTION_CRASH:
-                        insert_to_dict(case_file, compiler_opt_error, elf_name)
-                        write_file(compile_cmd + ' -> EXECUTION_CRASH\n', coe_file)
-                        gdb_cmd = "gdb -q -batch -ex \"run\" -ex \"bt\" ./" + elf_name
-                        crash_log = LOG_FOLDER + "log-crash-" + compiler.split('/')[-1] + case_file + '.txt'
-                        process = subprocess.Popen(gdb_cmd, cwd=GENERATOR_OUTPUT_FOLDER,shell=True, stdout=subprocess.PIPE, stderr=subprocess.PIPE,universal_newlines=True)
-                        output, errors = process.communicate()
-                        log_string = "OUTPUT:" + output + '\n' + "ERROR:" + errors
-                        write_file(log_string, crash_log)
-                        backup_file(case_file)
-
-                else:
-                    for march in marches:
-                        elf_name = case_name_to_elf_name(compiler.split('/')[-1], case_file, opt, march)
-                        compile_strings = []
-                        compile_strings.append(compiler)
-                        compile_strings.append(opt)
-                        compile_strings.extend(extra_options)
-                        compile_strings.append(march)
-                        compile_strings.append(case_file)
-                        compile_strings.append("-o")
-                        compile_strings.append(elf_name)
-                        compile_cmd = " ".join(compile_strings)
-
-                        compile_state = compile_elf(compile_cmd)
-                        if compile_state == State.COMPILE_TIMEOUT:
-                            write_file(compile_cmd + '\n', ct_file)
-                            insert_to_dict(case_file, compilation_timeout_files, elf_name)
-                            # backup_file(case_file)
-                            continue
-                        elif compile_state == State.COMPILE_CRASH:
-                            insert_to_dict(case_file, compiler_internal_error, elf_name)
-                            write_file(compile_cmd + '\n', cie_file)
-                            cie_log = LOG_FOLDER + "log-cie-" + compiler.split('/')[-1] + case_file + opt + march + '.txt'
-                            process = subprocess.Popen(compile_cmd, cwd=GENERATOR_OUTPUT_FOLDER, shell=True,
-                                                       stdout=subprocess.PIPE, stderr=subprocess.PIPE,
-                                                       universal_newlines=True)
-                            output, errors = process.communicate()
-                            log_string = "OUTPUT:" + output + '\n' + "ERROR:" + errors
-                            write_file(log_string, cie_log)
-                            backup_file(case_file)
-                            continue
-
-        delete_files_with_substring(GENERATOR_OUTPUT_FOLDER, "ELF")
 
-        if args.compile_only:
+        if execute_res is None:
             continue
+        execute_state, ret_val, cycles, _, _, execute_crash = execute_res
+        if cycles is not None:
+            perf_timings[(compiler, opt)] = cycles[0]
+        # process state
+        if execute_state == State.EXECUTION_SUCC:
+            if case_file not in execution_res:
+                execution_res[case_file] = []
+            elf_and_checksum = (elf_name, ret_val)
+            # compare with timeout historical results
+            if case_file in execution_timeout_files:
+                print("{} OPT ERROR {} AT {}, "
+                      "both timeout and checksum are generated!".format(compiler, case_file, opt))
+                insert_to_dict(case_file, compiler_opt_error, elf_name)
+                findings.add('COE')
+                #backup_file(case_file)
+            # compare with historical results
+            for (k, v) in execution_res[case_file]:
+                if ret_val != v:
+                    print("{} OPT ERROR {} AT {}!".format(compiler, case_file, opt))
+                    insert_to_dict(case_file, compiler_opt_error, elf_name)
+                    findings.add('COE')
+                    backup_file(case_file)
+            execution_res[case_file].append(elf_and_checksum)
+            checksum_array.append(ret_val)
+
+        elif execute_state == State.EXECUTION_TIMEOUT:
+            insert_to_dict(case_file, execution_timeout_files, elf_name)
+            findings.add('ET')
+            # compare with timeout historical results
+            if case_file in execution_res:
+                print("{} OPT ERROR {} AT {}, "
+                      "both timeout and checksum are generated!".format(compiler, case_file, opt))
+                insert_to_dict(case_file, compiler_opt_error, elf_name)
+                findings.add('COE')
+                #backup_file(case_file)
+        elif execute_state == State.EXECUTION_CRASH:
+            insert_to_dict(case_file, compiler_opt_error, elf_name)
+            findings.add('COE')
+            ret, stderr = execute_crash
+            # 测试崩溃的栈只能定位到测试中的函数，不能区分不同用例中的 bug，所以不分类，每次都记录和备份
+            signature = execution_crash_signature(compiler, opt, ret, stderr)
+            crash_log = LOG_FOLDER + "log-crash-" + compiler.split('/')[-1] + case_file + opt + '.txt'
+            log_string = "CMD:" + compile_cmd + '\n' + "SIGNATURE:" + signature + '\n' + "ERROR:" + '\n'.join(stderr)
+            write_file(log_string + '\n', crash_log)
+            backup_file(case_file)
+
+    if blame:
+        blame_failures(case_file, jobs, results, new_crashes)
+
+    # ELF of other cases can be still in use by the pipeline
+    delete_files_with_substring(GENERATOR_OUTPUT_FOLDER, "-" + case_file + "-")
+    COMPILE_BASELINE.save()
+
+    if not args.compile_only:
+        # compare run time between compilers and optimization levels
+        for slow_key, fast_key, ratio in find_perf_slowdowns(perf_timings, perf_slowdown, perf_min_cycles):
+            print("PERF SLOWDOWN {}: {} {} is {:.1f}x slower than {} {}".format(
+                case_file, slow_key[0], slow_key[1], ratio, fast_key[0], fast_key[1]))
+            write_file("{}: {} {} ({} cycles) is {:.1f}x slower than {} {} ({} cycles)\n".format(
+                case_file, slow_key[0], slow_key[1], perf_timings[slow_key], ratio,
+                fast_key[0], fast_key[1], perf_timings[fast_key]), perf_file)
+            for (compiler, opt, _, _, _, _), findings in zip(jobs, job_findings):
+                if (compiler, opt) == slow_key:
+                    findings.add('PERF')
+            backup_file(case_file)
         # compare all checksum
         print("comparing checksum from:{}\n".format(case_file))
             # if the checksums are not all same
@@ -267,8 +524,210 @@ def process_compiler(compilers: list, optimization: list, marches: list, extra_o
                 print("find checksum difference in {}".format(case_file))
                 for checksum in checksum_array:
                     write_file(str(checksum)+"\n", diff_file)
+                for (_, execute_res), findings in zip(results, job_findings):
+                    if execute_res is not None and execute_res[0] == State.EXECUTION_SUCC:
+                        findings.add('DIFF')
                 backup_file(case_file)
 
+    record_results(case_file, jobs, results, job_findings)
+    return sorted(set().union(*job_findings))
+
+
+def blame_failures(case_file: str, jobs: list, results: list, new_crashes: set):
+    """Bisects the optimization passes of the new compiler crashes and of the runs that differ from the
+    most common checksum of the case"""
+    checksums = collections.Counter(execute_res[1] for _, execute_res in results
+                                    if execute_res is not None and execute_res[0] == State.EXECUTION_SUCC)
+    reference = checksums.most_common(1)[0][0] if checksums else None
+    blame_file = LOG_FOLDER + 'BLAME-' + TIME_STR + '.txt'
+    for job_index, ((compiler, opt, _, compile_cmd, elf_name, _), (_, execute_res)) in \
+            enumerate(zip(jobs, results)):
+        if not bisect_supported(compiler, opt):
+            continue
+        if job_index in new_crashes:
+            blame_job(case_file, compiler, opt, compile_cmd, elf_name, None, blame_file)
+        elif execute_res is not None and reference is not None and execute_res[1] != reference:
+            blame_job(case_file, compiler, opt, compile_cmd, elf_name, reference, blame_file)
+
+
+def record_results(case_file: str, jobs: list, results: list, job_findings: list):
+    """Appends a record for every job of the case to the results log"""
+    seed = read_case_seed(GENERATOR_OUTPUT_FOLDER + case_file)
+    opts_hash = options_hash(generator_options()[1] + ' ' + ' '.join(config.get('extra_option') or []))
+    for (compiler, opt, march, _, _, _), (compile_res, execute_res), findings in zip(jobs, results, job_findings):
+        compile_state, compile_time, compile_rss, _ = compile_res
+        state, checksum, run_time, run_rss = compile_state, None, 0, 0
+        if execute_res is not None:
+            state, ret_val, _, run_time, run_rss, _ = execute_res
+            if state == State.EXECUTION_SUCC and ret_val.strip().isdigit():
+                checksum = int(ret_val)
+        RESULTS.append(case_file, compiler, opt, march, state, findings, seed, opts_hash, checksum,
+                       compile_time, run_time, compile_rss, run_rss)
+
+
+def process_compiler(compilers: list, optimization: list, marches: list, extra_options: list):
+    global GENERATOR_OUTPUT_FOLDER , LOG_FOLDER
+
+    # for each test case
+    files = os.listdir(GENERATOR_OUTPUT_FOLDER)
+    sorted_files = sorted(files, key=filename_sort_key)
+
+    for case_file in sorted_files:
+        if not (case_file.endswith('.c') or case_file.endswith('.cpp')):
+            continue
+        process_case(case_file, compilers, optimization, marches, extra_options)
+
+
+def process_case(case_file: str, compilers: list, optimization: list, marches: list, extra_options: list):
+    """Compiles, runs and compares a case sequentially, returns the found problems (see check_case)"""
+    jobs = build_case_jobs(case_file, compilers, optimization, marches, extra_options)
+    results = []
+    for (_, _, _, compile_cmd, elf_name, need_execute) in jobs:
+        compile_res = compile_elf(compile_cmd)
+        execute_res = None
+        if need_execute and compile_res[0] == State.COMPILE_SUCC:
+            execute_res = execute_elf(elf_name)
+        results.append((compile_res, execute_res))
+    return check_case(case_file, jobs, results)
+
+
+def run_sequential(case_indices, compilers: list, optimization: list, marches: list, extra_options: list,
+                   case_seed=None, on_checked=None, on_skipped=None):
+    """Generates and tests the cases one by one (see run_pipeline for the arguments)"""
+    file_ext, cost_options = generator_options()
+    for i in case_indices:
+        case_file, seed, failure = generate_case(i, file_ext, cost_options, case_seed(i) if case_seed else 0)
+        if failure:
+            if on_skipped:
+                on_skipped(i, seed, failure)
+            continue
+        findings = process_case(case_file, compilers, optimization, marches, extra_options)
+        if on_checked:
+            on_checked(i, seed, case_file, findings)
+
+
+def finish_cases(in_flight: collections.OrderedDict, block: bool, on_checked=None):
+    """Checks the cases whose jobs are all finished. With block it waits until at least one case is finished"""
+    EXECUTOR.poll(0)
+    while True:
+        finished = [case_file for case_file, (_, job_ids, _, _) in in_flight.items()
+                    if all(EXECUTOR.has_result(job_id) for ids in job_ids for job_id in ids if job_id)]
+        for case_file in finished:
+            jobs, job_ids, i, seed = in_flight.pop(case_file)
+            results = []
+            for (_, _, _, compile_cmd, elf_name, _), (compile_id, execute_id) in zip(jobs, job_ids):
+                compile_res = compile_elf(compile_cmd, EXECUTOR.result_runner(compile_id))
+                execute_res = None
+                if execute_id and compile_res[0] == State.COMPILE_SUCC:
+                    execute_res = execute_elf(elf_name, EXECUTOR.result_runner(execute_id))
+                elif execute_id:
+                    # the run is skipped by the executor
+                    EXECUTOR.discard_result(execute_id)
+                results.append((compile_res, execute_res))
+            findings = check_case(case_file, jobs, results)
+            if ZERO_DISK:
+                # 错误代码或崩溃的用例保留所有可执行文件以便复现
+                if 'COE' in findings or 'DIFF' in findings:
+                    save_executables(jobs, results)
+                EXECUTOR.run_op('release', names=[job[4] for job in jobs])
+            if on_checked:
+                on_checked(i, seed, case_file, findings)
+        if finished or not block or not in_flight:
+            return
+        EXECUTOR.poll()
+
+
+def save_executables(jobs: list, results: list):
+    """Copies the in-memory executables of the compiled jobs of a case to the backup folder"""
+    for (_, _, _, _, elf_name, _), (compile_res, _) in zip(jobs, results):
+        if compile_res[0] == State.COMPILE_SUCC:
+            EXECUTOR.run_op('save', name=elf_name, path=os.path.abspath(BACKUP_FOLDER + elf_name))
+
+
+def run_pipeline(case_indices, compilers: list, optimization: list, marches: list, extra_options: list,
+                 case_seed=None, on_checked=None, on_skipped=None):
+    """Generates, compiles, runs and compares the cases as a job graph: the executor compiles and runs
+    the jobs of the previous cases in parallel while the next case is generated, and the jobs of the
+    earlier cases have higher priority, so the results come out case by case.
+    case_seed(i) gives the seed of the i-th case (random seeds by default), on_checked(i, seed, case_file,
+    findings) is called when the case is checked, on_skipped(i, seed, reason) when the case can't be
+    generated (see generate_case)"""
+    file_ext, cost_options = generator_options()
+    in_flight = collections.OrderedDict()
+    for i in case_indices:
+        case_file, seed, failure = generate_case(i, file_ext, cost_options, case_seed(i) if case_seed else 0)
+        if failure:
+            if on_skipped:
+                on_skipped(i, seed, failure)
+            continue
+        jobs = build_case_jobs(case_file, compilers, optimization, marches, extra_options)
+        job_ids = []
+        for (_, _, _, compile_cmd, elf_name, need_execute) in jobs:
+            compile_command = compile_cmd.split(' ')
+            exe_cmd = './' + elf_name
+            if ZERO_DISK:
+                # compile_cmd ends with "-o elf_name"
+                compile_command[-1] = exe_cmd = NativeExecutor.memfd_arg(elf_name)
+            compile_id = EXECUTOR.submit(compile_command, GENERATOR_OUTPUT_FOLDER, timeout, priority=i,
+                                         dependents=1 if need_execute else 0)
+            execute_id = None
+            if need_execute:
+                execute_id = EXECUTOR.submit(test_command(exe_cmd), GENERATOR_OUTPUT_FOLDER, timeout,
+                                             deps=[compile_id], priority=i)
+            job_ids.append((compile_id, execute_id))
+        in_flight[case_file] = (jobs, job_ids, i, seed)
+        finish_cases(in_flight, len(in_flight) > pipeline_depth, on_checked)
+    while in_flight:
+        finish_cases(in_flight, True, on_checked)
+
+
+def run_cases(case_indices, case_seed=None, on_checked=None, on_skipped=None):
+    """Tests the cases with the pipeline if it is available"""
+    test_args = (config.get('compiler'), config.get('optimization'), config.get('march'),
+                 config.get('extra_option'), case_seed, on_checked, on_skipped)
+    # 计时运行需要独占 CPU，所以性能差分测试时不并行
+    if EXECUTOR and not perf_reps:
+        run_pipeline(case_indices, *test_args)
+    else:
+        run_sequential(case_indices, *test_args)
+
+
+def run_worker(address: str):
+    """Tests the cases leased by the coordinator and reports the results to it"""
+    global max_regen_count
+    worker = CampaignWorker(address, socket.gethostname() + ':' + str(os.getpid()))
+    worker.connect()
+    # 用例的种子由协调器决定，各个 worker 生成的用例相同
+    max_regen_count = worker.max_regen_count
+
+    def report(i: int, seed: int, case_file: str, findings: list):
+        source = None
+        if findings and os.path.exists(BACKUP_FOLDER + case_file):
+            with open(BACKUP_FOLDER + case_file, 'r') as file:
+                source = file.read()
+        worker.report(i, seed, case_file, findings, source)
+
+    # 没有生成的用例不报告为已测试，协调器单独统计
+    for indices in worker.leases():
+        run_cases(indices, worker.seed, report, worker.skip)
+    worker.close()
+
+
+def run_coordinator(address: str):
+    coordinator = CampaignCoordinator(address, checkpoint_path, run_count, campaign_seed, max_regen_count,
+                                      lease_size, lease_timeout)
+    workers = []
+    # 本机的工作进程共用 testing_path 下的编译时间基线和崩溃分类，两者都在文件锁下合并更新（见 utils.py），
+    # 所以异常判定和崩溃去重与工作进程数无关
+    for _ in range(args.local_workers):
+        worker_cmd = [sys.executable, os.path.dirname(os.path.abspath(__file__)), '--worker',
+                      coordinator.address, args.yaml_file]
+        if args.compile_only:
+            worker_cmd.append('--compile-only')
+        workers.append(subprocess.Popen(worker_cmd))
+    coordinator.serve()
+    for worker in workers:
+        worker.wait()
 
 
 def compile_and_execute():
@@ -297,7 +756,27 @@ def compress():
 
 
 if __name__ == '__main__':
-    generator_runner(run_count)
-    compile_and_execute()
+    if args.coordinator:
+        run_coordinator(args.coordinator)
+        sys.exit(0)
+    # 源函数库（zip、文件夹或 YAML）中可能有其他语言或无法编译的函数，必须校验后才能注入；
+    # 二进制函数库只能由函数库转换得到，按已校验处理
+    if func_source_path and not is_binary_library(func_source_path):
+        if not func_validate:
+            raise ValueError("Functions of {} aren't validated: set func_validate to true or use a binary "
+                             "library of the validated functions".format(func_source_path))
+        FUNC_LIB = validated_library()
+    if args.worker:
+        run_worker(args.worker)
+    # 计时运行需要独占 CPU，所以性能差分测试时不并行
+    elif EXECUTOR and not perf_reps:
+        run_pipeline(range(run_count), config.get('compiler'), config.get('optimization'), config.get('march'),
+                     config.get('extra_option'))
+    else:
+        generator_runner(run_count)
+        compile_and_execute()
+    if EXECUTOR:
+        EXECUTOR.close()
+    RESULTS.close()
     compress()
 
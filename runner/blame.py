@@ -0,0 +1,78 @@
+"""Optimization bisection (blame) of the failing compilations.
+
+The compilers of the LLVM family can run only the first N optimization passes
+(-mllvm -opt-bisect-limit=N) and print every pass with its number. The culprit of a miscompilation or
+a compiler crash is the pass N such that the test fails with the limit N and passes with the limit
+N - 1. scripts/blame_opt.py finds it by binary search, one compile and run at a time. Here every round
+tests k limits at once (k-ary search), so it takes log_(k+1)(N) rounds instead of log2(N).
+"""
+import collections
+import re
+
+# Compilers (by the name of the executable) that support -opt-bisect-limit
+BISECT_COMPILERS = ('clang', 'icx', 'icpx')
+PASS_LINE = re.compile(r'BISECT: running pass \((\d+)\) (.*)')
+
+BisectResult = collections.namedtuple('BisectResult', ['limit', 'pass_name', 'rounds', 'probes'])
+
+
+def bisect_supported(compiler: str, opt: str):
+    return compiler.split('/')[-1].startswith(BISECT_COMPILERS) and opt != '-O0'
+
+
+def bisect_command(compile_cmd: str, limit: int, elf_name: str = None):
+    """Compile command of the job (see build_case_jobs) that runs only the first limit passes (-1 for all).
+    With elf_name the output is written to it"""
+    command = compile_cmd.split(' ')
+    # after the compiler and the optimization level
+    command[2:2] = ['-mllvm', '-opt-bisect-limit=' + str(limit)]
+    if elf_name:
+        command[-1] = elf_name
+    return command
+
+
+def parse_passes(stderr: list):
+    """Number -> description of the passes that the compiler has run"""
+    passes = {}
+    for line in stderr:
+        match = PASS_LINE.match(line)
+        if match:
+            passes[int(match.group(1))] = match.group(2)
+    return passes
+
+
+def probe_limits(lo: int, hi: int, k: int):
+    """Up to k limits that split (lo, hi) evenly"""
+    return sorted({lo + (hi - lo) * j // (k + 1) for j in range(1, k + 1)} - {lo, hi})
+
+
+def narrow(lo: int, hi: int, failed: dict):
+    """The new (lo, hi) after the probes: hi is the first failing limit, lo is the last passing one before it"""
+    for limit in sorted(failed):
+        if failed[limit]:
+            return lo, limit
+        lo = limit
+    return lo, hi
+
+
+def bisect(run_probes, k: int):
+    """Finds the culprit pass. run_probes(limits) compiles (and runs) the failing job with every limit
+    concurrently and returns {limit: (failed, compiler stderr)}.
+    Returns BisectResult (limit 0 if the test fails without any optimization pass) or None if the
+    failure can't be bisected"""
+    # all passes: the list of the passes; no passes: the failure isn't caused by an optimization
+    results = run_probes([-1, 0])
+    rounds, probes = 1, 2
+    passes = parse_passes(results[-1][1])
+    if results[0][0]:
+        return BisectResult(0, None, rounds, probes)
+    if not passes or not results[-1][0]:
+        return None
+    lo, hi = 0, max(passes)
+    while hi - lo > 1:
+        limits = probe_limits(lo, hi, k)
+        results = run_probes(limits)
+        rounds += 1
+        probes += len(limits)
+        lo, hi = narrow(lo, hi, {limit: failed for limit, (failed, _) in results.items()})
+    return BisectResult(hi, passes.get(hi), rounds, probes)
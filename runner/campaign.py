@@ -0,0 +1,326 @@
+import json
+import os
+import selectors
+import socket
+import time
+
+
+def parse_address(address: str):
+    """"host:port" -> (host, port)"""
+    host, _, port = address.rpartition(':')
+    return host or 'localhost', int(port)
+
+
+def add_to_ranges(ranges: list, index: int):
+    """Adds index to a sorted list of disjoint [start, end) ranges, merges the neighbours"""
+    for i, (start, end) in enumerate(ranges):
+        if start <= index < end:
+            return
+        if index == end:
+            ranges[i][1] += 1
+            if i + 1 < len(ranges) and ranges[i + 1][0] == index + 1:
+                ranges[i][1] = ranges.pop(i + 1)[1]
+            return
+        if index + 1 == start:
+            ranges[i][0] = index
+            return
+        if index < start:
+            ranges.insert(i, [index, index + 1])
+            return
+    ranges.append([index, index + 1])
+
+
+def in_ranges(ranges: list, index: int):
+    return any(start <= index < end for start, end in ranges)
+
+
+def case_seed(seed_base: int, max_regen_count: int, index: int):
+    """Seed of the first attempt to generate the index-th case. Every case has max_regen_count seeds
+    for the tests that exceed the cost budget, so the seeds of the cases never overlap"""
+    return seed_base + index * max_regen_count
+
+
+class CampaignCoordinator:
+    """Leases the cases of a campaign to the workers and collects their results.
+
+    Case i is generated with the seeds starting from case_seed(i), so a case is the same no matter
+    which worker tests it. The progress is saved in the checkpoint after every result, so a restarted
+    coordinator leases only the cases that were not tested yet. The cases that can't be generated (see
+    generate_case) are skipped: they are finished, but they are counted apart from the tested ones.
+    The leases of a worker are taken back when its connection is closed or when it is silent for
+    lease_timeout seconds.
+
+    Protocol: one JSON object per line over TCP, every request gets one reply.
+      {"op": "hello", "worker": name}  -> {"seed_base": S, "max_regen_count": R}
+      {"op": "lease"}                  -> {"indices": [...]} or {"wait": seconds} or {"done": true}
+      {"op": "report", "index": i, "seed": s, "case": name, "findings": [...], "source": text or null}
+                                       -> {"ok": true}
+      {"op": "skip", "index": i, "seed": s, "reason": "REJECTED" or "GENERATOR FAILED"}
+                                       -> {"ok": true}
+    """
+
+    def __init__(self, address: str, checkpoint_path: str, run_count: int, seed_base: int,
+                 max_regen_count: int, lease_size: int, lease_timeout: float):
+        self.checkpoint_path = checkpoint_path
+        self.lease_size = max(lease_size, 1)
+        self.lease_timeout = lease_timeout
+        self.state = {'run_count': run_count, 'seed_base': seed_base, 'max_regen_count': max_regen_count,
+                      'done': [], 'skipped': [],
+                      'summary': {'cases': 0, 'interesting': 0, 'findings': {}, 'skipped': {}}}
+        if os.path.exists(checkpoint_path):
+            with open(checkpoint_path, 'r') as file:
+                saved = json.load(file)
+            # The seeds of the cases are defined by the campaign, so they can't change on resume
+            self.state.update({k: saved[k] for k in ('seed_base', 'max_regen_count', 'done', 'summary')})
+            self.state['skipped'] = saved.get('skipped', [])
+            self.state['summary'].setdefault('skipped', {})
+            self.state['run_count'] = max(run_count, saved['run_count'])
+            print('RESUME CAMPAIGN: {} of {} cases are tested'.format(
+                self.state['summary']['cases'], self.state['run_count']))
+
+        self.result_dir = os.path.splitext(checkpoint_path)[0] + '/'
+        os.makedirs(self.result_dir + 'interesting', exist_ok=True)
+
+        self.next_index = 0
+        self.returned = []
+        # worker connection -> set of leased indices
+        self.leases = {}
+        self.buffers = {}
+        self.names = {}
+        self.selector = selectors.DefaultSelector()
+        self.server = socket.create_server(parse_address(address))
+        self.server.setblocking(False)
+        self.selector.register(self.server, selectors.EVENT_READ)
+        self.address = '{}:{}'.format(*self.server.getsockname()[:2])
+
+    def is_finished(self, index: int):
+        return in_ranges(self.state['done'], index) or in_ranges(self.state['skipped'], index)
+
+    def all_reported(self):
+        # The ranges of the tested and the skipped cases are disjoint
+        finished = sum(min(end, self.state['run_count']) - start
+                       for start, end in self.state['done'] + self.state['skipped']
+                       if start < self.state['run_count'])
+        return finished >= self.state['run_count']
+
+    def is_leased(self, index: int):
+        return any(index in lease for lease in self.leases.values())
+
+    def take_indices(self):
+        indices = []
+        while self.returned and len(indices) < self.lease_size:
+            index = self.returned.pop()
+            if not self.is_finished(index) and not self.is_leased(index):
+                indices.append(index)
+        while self.next_index < self.state['run_count'] and len(indices) < self.lease_size:
+            if not self.is_finished(self.next_index):
+                indices.append(self.next_index)
+            self.next_index += 1
+        return indices
+
+    def release(self, conn):
+        """Returns the unfinished cases of the worker back to the pool"""
+        lease = self.leases.pop(conn, set())
+        returned = [index for index in lease if not self.is_finished(index)]
+        if returned:
+            print('RECLAIM {} CASES FROM {}'.format(len(returned), self.names.get(conn, '?')))
+        self.returned.extend(sorted(returned, reverse=True))
+
+    def save_checkpoint(self):
+        tmp_path = self.checkpoint_path + '.tmp'
+        with open(tmp_path, 'w') as file:
+            json.dump(self.state, file)
+        os.replace(tmp_path, self.checkpoint_path)
+
+    def record(self, conn, request: dict):
+        index = request['index']
+        if conn in self.leases:
+            self.leases[conn].discard(index)
+        # The case could be reclaimed and tested by another worker
+        if self.is_finished(index) or index >= self.state['run_count']:
+            return
+        findings = sorted(request.get('findings') or [])
+        summary = self.state['summary']
+        summary['cases'] += 1
+        if findings:
+            summary['interesting'] += 1
+            for finding in findings:
+                summary['findings'][finding] = summary['findings'].get(finding, 0) + 1
+            case_name = 'case-{}-seed-{}{}'.format(index + 1, request['seed'],
+                                                   os.path.splitext(request['case'])[1])
+            if request.get('source') is not None:
+                with open(self.result_dir + 'interesting/' + case_name, 'w') as file:
+                    file.write(request['source'])
+            with open(self.result_dir + 'findings.txt', 'a') as file:
+                file.write('{} {} {} {}\n'.format(case_name, self.names.get(conn, '?'), request['case'],
+                                                  ','.join(findings)))
+        add_to_ranges(self.state['done'], index)
+        self.save_checkpoint()
+
+    def record_skip(self, conn, request: dict):
+        index = request['index']
+        if conn in self.leases:
+            self.leases[conn].discard(index)
+        if self.is_finished(index) or index >= self.state['run_count']:
+            return
+        skipped = self.state['summary']['skipped']
+        skipped[request['reason']] = skipped.get(request['reason'], 0) + 1
+        print('SKIP CASE {} (seed {}): {}'.format(index + 1, request['seed'], request['reason']))
+        add_to_ranges(self.state['skipped'], index)
+        self.save_checkpoint()
+
+    def handle(self, conn, request: dict):
+        op = request.get('op')
+        if op == 'hello':
+            self.names[conn] = request.get('worker', '?')
+            return {'seed_base': self.state['seed_base'], 'max_regen_count': self.state['max_regen_count']}
+        if op == 'report':
+            self.record(conn, request)
+            return {'ok': True}
+        if op == 'skip':
+            self.record_skip(conn, request)
+            return {'ok': True}
+        if op == 'lease':
+            indices = self.take_indices()
+            if indices:
+                self.leases.setdefault(conn, set()).update(indices)
+                return {'indices': indices}
+            if self.all_reported():
+                return {'done': True}
+            return {'wait': 1.0}
+        return {'error': 'unknown operation {}'.format(op)}
+
+    def close_conn(self, conn):
+        self.release(conn)
+        self.selector.unregister(conn)
+        self.buffers.pop(conn, None)
+        self.names.pop(conn, None)
+        conn.close()
+
+    def serve(self, on_tick=None):
+        """Serves the workers until all cases are tested. on_tick is called about once a second"""
+        print('COORDINATOR ON {}: {} cases'.format(self.address, self.state['run_count']))
+        deadlines = {}
+        finish_time = None
+        while self.buffers or not self.all_reported():
+            # Workers get "done" on their next lease request, but we don't wait for the hung ones
+            if self.all_reported():
+                finish_time = finish_time or time.time() + 10
+                if time.time() > finish_time:
+                    break
+            for key, _ in self.selector.select(timeout=1.0):
+                if key.fileobj is self.server:
+                    conn, _ = self.server.accept()
+                    self.selector.register(conn, selectors.EVENT_READ)
+                    self.buffers[conn] = b''
+                    deadlines[conn] = time.time() + self.lease_timeout
+                    continue
+                conn = key.fileobj
+                try:
+                    data = conn.recv(1 << 20)
+                except OSError:
+                    data = b''
+                if not data:
+                    self.close_conn(conn)
+                    continue
+                deadlines[conn] = time.time() + self.lease_timeout
+                self.buffers[conn] += data
+                lines = self.buffers[conn].split(b'\n')
+                self.buffers[conn] = lines.pop()
+                for line in lines:
+                    reply = self.handle(conn, json.loads(line.decode('utf-8')))
+                    conn.sendall((json.dumps(reply) + '\n').encode('utf-8'))
+            # Silent workers are considered dead
+            now = time.time()
+            for conn in [conn for conn in self.buffers if deadlines.get(conn, now) < now]:
+                print('WORKER {} TIMED OUT'.format(self.names.get(conn, '?')))
+                self.close_conn(conn)
+            if on_tick:
+                on_tick()
+        for conn in list(self.buffers):
+            self.close_conn(conn)
+        self.server.close()
+        self.write_summary()
+
+    def write_summary(self):
+        summary = self.state['summary']
+        lines = ['cases: {}'.format(summary['cases']), 'interesting: {}'.format(summary['interesting'])]
+        lines += ['{}: {}'.format(finding, count) for finding, count in sorted(summary['findings'].items())]
+        lines += ['skipped {}: {}'.format(reason, count) for reason, count in sorted(summary['skipped'].items())]
+        with open(self.result_dir + 'summary.txt', 'w') as file:
+            file.write('\n'.join(lines) + '\n')
+        print('CAMPAIGN DONE: ' + ', '.join(lines))
+
+
+class CampaignWorker:
+    """Client side of CampaignCoordinator. Reconnects if the coordinator is restarted"""
+
+    def __init__(self, address: str, name: str, retry_time: float = 60):
+        self.address = parse_address(address)
+        self.name = name
+        self.retry_time = retry_time
+        self.sock = None
+        self.buf = b''
+        self.seed_base = None
+        self.max_regen_count = None
+
+    def connect(self):
+        deadline = time.time() + self.retry_time
+        while True:
+            try:
+                self.sock = socket.create_connection(self.address)
+                break
+            except OSError:
+                if time.time() > deadline:
+                    raise
+                time.sleep(1)
+        self.buf = b''
+        reply = self.call_once({'op': 'hello', 'worker': self.name})
+        self.seed_base = reply['seed_base']
+        self.max_regen_count = reply['max_regen_count']
+
+    def call_once(self, request: dict):
+        self.sock.sendall((json.dumps(request) + '\n').encode('utf-8'))
+        while b'\n' not in self.buf:
+            data = self.sock.recv(1 << 16)
+            if not data:
+                raise ConnectionError('coordinator has closed the connection')
+            self.buf += data
+        line, self.buf = self.buf.split(b'\n', 1)
+        return json.loads(line.decode('utf-8'))
+
+    def call(self, request: dict):
+        if self.sock is None:
+            self.connect()
+        try:
+            return self.call_once(request)
+        except OSError:
+            # The reply may be lost, but both requests are safe to repeat
+            self.sock.close()
+            self.connect()
+            return self.call_once(request)
+
+    def seed(self, index: int):
+        return case_seed(self.seed_base, self.max_regen_count, index)
+
+    def leases(self):
+        """Yields lists of case indices until the campaign is done"""
+        while True:
+            reply = self.call({'op': 'lease'})
+            if reply.get('done'):
+                return
+            if 'wait' in reply:
+                time.sleep(reply['wait'])
+                continue
+            yield reply['indices']
+
+    def report(self, index: int, seed: int, case_file: str, findings: list, source: str = None):
+        self.call({'op': 'report', 'index': index, 'seed': seed, 'case': case_file,
+                   'findings': findings, 'source': source})
+
+    def skip(self, index: int, seed: int, reason: str):
+        self.call({'op': 'skip', 'index': index, 'seed': seed, 'reason': reason})
+
+    def close(self):
+        if self.sock:
+            self.sock.close()
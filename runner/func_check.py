@@ -0,0 +1,238 @@
+"""Offline validation of the function library.
+
+Every function is compiled with a small driver that calls it twice with the recorded input and prints
+both results. This is done with every compiler and optimization level of the test matrix, and each
+driver is run. A function is valid if it compiles everywhere and every run prints the recorded output
+twice; the second call catches the functions that keep a state between the calls. Only the valid
+functions are written to the validated library that is given to the generator.
+
+The verdicts are cached by the compiler version, the compile options and the hash of the function, so a
+library is checked only once per compiler, and only the new functions are checked when it grows.
+"""
+import argparse
+import concurrent.futures
+import hashlib
+import json
+import os
+import shutil
+import subprocess
+import tempfile
+import zipfile
+
+import yaml
+
+# The same headers as in the tests, so the functions see the same declarations
+DRIVER_HEADERS = ('stdio.h', 'algorithm', 'memory', 'string')
+# Verdict of a valid function in the cache, other verdicts describe the failure
+VALID = 'ok'
+
+
+def read_library(path: str):
+    """Functions (dicts) of a zip archive or a directory of YAML files or of a YAML file with a list, in
+    the order of the generator (see FunctionLibrary in src/func_lib.h). Unreadable entries are skipped"""
+    is_yaml = lambda name: name.endswith(('.yaml', '.yml'))
+    if os.path.isdir(path):
+        texts = []
+        for name in sorted(os.listdir(path)):
+            if is_yaml(name) and os.path.isfile(os.path.join(path, name)):
+                with open(os.path.join(path, name), 'r') as file:
+                    texts.append(file.read())
+    elif is_yaml(path):
+        with open(path, 'r') as file:
+            texts = [file.read()]
+    else:
+        with zipfile.ZipFile(path) as archive:
+            texts = [archive.read(info) for info in archive.infolist() if is_yaml(info.filename)]
+
+    functions = []
+    for text in texts:
+        try:
+            data = yaml.safe_load(text)
+        except yaml.YAMLError:
+            continue
+        functions += [func for func in (data if isinstance(data, list) else [data]) if isinstance(func, dict)]
+    return functions
+
+
+def function_hash(func: dict):
+    return hashlib.sha256(json.dumps(func, sort_keys=True).encode('utf-8')).hexdigest()
+
+
+def compiler_version(compiler: str):
+    """First line of "compiler --version", e.g. "g++ (GCC) 12.2.0" """
+    try:
+        res = subprocess.run([compiler, '--version'], stdout=subprocess.PIPE, stderr=subprocess.DEVNULL,
+                             timeout=60)
+    except (OSError, subprocess.TimeoutExpired):
+        return None
+    lines = res.stdout.decode('utf-8', 'replace').splitlines()
+    return lines[0].strip() if res.returncode == 0 and lines else None
+
+
+def literal(param_type: str, value: str):
+    """Argument of the call: integers are written so that they fit into unsigned long long or long long
+    before the conversion to the parameter type"""
+    text = value.strip()
+    try:
+        int_val = int(text)
+    except ValueError:
+        return '(' + param_type + ')(' + text + ')'
+    if int_val >= 0:
+        return '(' + param_type + ')(' + str(int_val) + 'ULL)'
+    return '(' + param_type + ')(-' + str(-int_val - 1) + 'LL - 1)'
+
+
+def driver_source(func: dict):
+    params = [param for param in func.get('parameter_types') or [] if param != 'void']
+    inputs = [str(value) for value in func.get('input') or []]
+    if len(params) != len(inputs):
+        return None
+    call = func['function_name'] + '(' + ', '.join(literal(p, v) for p, v in zip(params, inputs)) + ')'
+    lines = ['#include <' + header + '>' for header in DRIVER_HEADERS]
+    lines += func.get('misc') or []
+    lines += [func['function'], '',
+              'int main() {',
+              '    std::string first = std::to_string(' + call + ');',
+              '    std::string second = std::to_string(' + call + ');',
+              '    printf("%s\\n%s\\n", first.c_str(), second.c_str());',
+              '}']
+    return '\n'.join(lines) + '\n'
+
+
+def same_output(printed: str, recorded: str):
+    try:
+        return int(printed) == int(recorded)
+    except ValueError:
+        return printed.strip() == recorded.strip()
+
+
+def check_function(func: dict, compile_cmd: list, work_dir: str, name: str, timeout: int):
+    """Compiles and runs the driver of the function with compile_cmd (compiler and options), returns
+    the verdict"""
+    try:
+        source = driver_source(func)
+    except (KeyError, TypeError):
+        source = None
+    if source is None:
+        return 'malformed'
+    src_file = os.path.join(work_dir, name + '.cpp')
+    exe_file = os.path.join(work_dir, name)
+    with open(src_file, 'w') as file:
+        file.write(source)
+    try:
+        res = subprocess.run(compile_cmd + [src_file, '-o', exe_file], stdout=subprocess.DEVNULL,
+                             stderr=subprocess.DEVNULL, timeout=timeout)
+        if res.returncode != 0:
+            return 'compile error'
+        res = subprocess.run([exe_file], stdout=subprocess.PIPE, stderr=subprocess.DEVNULL, timeout=timeout)
+        if res.returncode != 0:
+            return 'exit code ' + str(res.returncode)
+    except subprocess.TimeoutExpired:
+        return 'timeout'
+    finally:
+        for file in (src_file, exe_file):
+            if os.path.exists(file):
+                os.remove(file)
+    outputs = res.stdout.decode('utf-8', 'replace').split()
+    if len(outputs) != 2 or outputs[0] != outputs[1]:
+        return 'state between calls'
+    if not same_output(outputs[0], str(func.get('output'))):
+        return 'output ' + outputs[0]
+    return VALID
+
+
+def load_cache(path: str):
+    if path and os.path.exists(path):
+        with open(path, 'r') as file:
+            return json.load(file)
+    return {}
+
+
+def save_cache(path: str, cache: dict):
+    # Several runners on one machine may share the cache
+    tmp_path = path + '.' + str(os.getpid())
+    with open(tmp_path, 'w') as file:
+        json.dump(cache, file)
+    os.replace(tmp_path, path)
+
+
+def validate(functions: list, compilers: list, optimization: list, extra_options: list, cache_path: str,
+             jobs: int = 0, timeout: int = 10):
+    """Checks every function with every (compiler, opt), returns the list of the valid functions and
+    {verdict: number of functions} of the invalid ones"""
+    cache = load_cache(cache_path)
+    configs = []
+    for compiler in compilers:
+        version = compiler_version(compiler)
+        if version is None:
+            raise ValueError("Can't get the version of " + compiler)
+        for opt in optimization:
+            key = ' '.join([version, opt] + list(extra_options))
+            configs.append((key, [compiler, opt, '-w'] + list(extra_options)))
+    hashes = [function_hash(func) for func in functions]
+
+    work_dir = tempfile.mkdtemp(prefix='yarpgen-func-check-')
+    try:
+        with concurrent.futures.ThreadPoolExecutor(jobs or os.cpu_count() or 1) as executor:
+            futures = {}
+            for key, compile_cmd in configs:
+                verdicts = cache.setdefault(key, {})
+                for i, func in enumerate(functions):
+                    if hashes[i] not in verdicts and (key, hashes[i]) not in futures:
+                        name = 'func_' + str(len(futures))
+                        futures[(key, hashes[i])] = executor.submit(check_function, func, compile_cmd, work_dir,
+                                                                    name, timeout)
+            for done, ((key, func_hash), future) in enumerate(futures.items()):
+                cache[key][func_hash] = future.result()
+                if (done + 1) % 1000 == 0:
+                    print('checked {} of {} functions'.format(done + 1, len(futures)))
+                    save_cache(cache_path, cache)
+    finally:
+        shutil.rmtree(work_dir, ignore_errors=True)
+        if cache_path:
+            save_cache(cache_path, cache)
+
+    valid = []
+    failures = {}
+    for func, func_hash in zip(functions, hashes):
+        verdict = next((cache[key][func_hash] for key, _ in configs if cache[key][func_hash] != VALID), VALID)
+        if verdict == VALID:
+            valid.append(func)
+        else:
+            # "output 42" -> "output"
+            kind = verdict.split(' ')[0] if verdict.startswith(('output', 'exit')) else verdict
+            failures[kind] = failures.get(kind, 0) + 1
+    return valid, failures
+
+
+def write_library(functions: list, path: str):
+    """Writes the functions as a YAML file with a list, one of the formats of the generator"""
+    with open(path, 'w') as file:
+        yaml.safe_dump(functions, file, default_flow_style=False, allow_unicode=True, sort_keys=False)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('library', help='zip archive, directory of YAML files or YAML file with a list')
+    parser.add_argument('-o', '--output', required=True, help='validated library (YAML file with a list)')
+    # The lists are comma-separated, e.g. --opt=-O0,-O2
+    parser.add_argument('--compiler', default='g++', help='compilers')
+    parser.add_argument('--opt', default='-O0,-O2', help='optimization levels')
+    parser.add_argument('--extra', default='', help='extra compiler options')
+    parser.add_argument('--cache', default='func_check_cache.json', help='cache of the verdicts')
+    parser.add_argument('-j', '--jobs', type=int, default=0, help='parallel checks (0 is the number of CPUs)')
+    parser.add_argument('--timeout', type=int, default=10, help='timeout of a compilation or a run (seconds)')
+    args = parser.parse_args()
+
+    functions = read_library(args.library)
+    split = lambda arg: [item for item in arg.split(',') if item]
+    valid, failures = validate(functions, split(args.compiler), split(args.opt), split(args.extra), args.cache,
+                               args.jobs, args.timeout)
+    write_library(valid, args.output)
+    print('{} of {} functions are valid'.format(len(valid), len(functions)))
+    for kind, num in sorted(failures.items(), key=lambda item: -item[1]):
+        print('  {}: {}'.format(kind, num))
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,391 @@
+"""Binary log of the test results.
+
+Every compile (and run) of a case is one fixed-size record. The records of a campaign are kept in
+the folder <results root>/<campaign>/, every writer (runner or campaign worker) appends only to its
+own segment file, so concurrent workers don't need any locks. A segment is a sequence of entries:
+
+  string:  'S', 0, length (u16), id (u32), UTF-8 bytes          -- defines a string id of the segment
+  record:  'R', state, findings, flags, case id (u32),
+           compiler id, opt id, march id (u16 each), 0 (u16),
+           seed, options hash, checksum (u64 each),
+           compile time, run time (f32, seconds),
+           compile RSS, run RSS (u32, KB), timestamp (u32), 0 (u32)
+
+The strings are defined before the first record that uses them. A segment that was cut off by a
+crash is read up to the last complete entry.
+
+The index of a segment (<segment>.idx) keeps the size of the indexed part of the segment, the offsets
+of the records and of the strings, and maps the seeds, the states and the findings to the offsets of
+the records. The reader unpacks only the records it needs from the mapped segment. When the segment
+has grown, only the entries after the indexed size are parsed and added to the index.
+
+Usage:
+  python3 results.py query [--campaign last] [--state EXECUTION_CRASH] [--finding COE]
+                           [--compiler clang] [--opt=-O3] [--seed 42] [--count]
+  python3 results.py campaigns
+"""
+import argparse
+import array
+import bisect
+import mmap
+import os
+import struct
+import time
+
+from StateEnum import State
+
+SEGMENT_EXT = '.seg'
+INDEX_EXT = '.idx'
+SEGMENT_MAGIC = b'YRES\x01\x00\x00\x00'
+INDEX_MAGIC = b'YIDX\x02\x00\x00\x00'
+
+STRING_HEADER = struct.Struct('<cxHI')
+RECORD = struct.Struct('<cBBBIHHHxxQQQffIIIxxxx')
+INDEX_HEADER = struct.Struct('<8sQII')
+
+# Kinds of the problems (the prefixes of the old text logs), bit i of the findings field
+FINDINGS = ['CT', 'CIE', 'COE', 'ET', 'CTA', 'PERF', 'DIFF']
+CHECKSUM_VALID = 1
+
+
+def findings_mask(findings) -> int:
+    mask = 0
+    for finding in findings:
+        mask |= 1 << FINDINGS.index(finding)
+    return mask
+
+
+def mask_findings(mask: int) -> list:
+    return [finding for i, finding in enumerate(FINDINGS) if mask & (1 << i)]
+
+
+def options_hash(options: str) -> int:
+    """64-bit FNV-1a hash of the options of the test"""
+    value = 14695981039346656037
+    for byte in options.encode('utf-8'):
+        value = ((value ^ byte) * 1099511628211) & 0xFFFFFFFFFFFFFFFF
+    return value
+
+
+def read_case_seed(path: str) -> int:
+    """Seed of a generated test from its header comment (0 if it is not there)"""
+    try:
+        with open(path, 'r') as file:
+            for _ in range(10):
+                line = file.readline()
+                if line.startswith('Seed: '):
+                    return int(line[len('Seed: '):])
+    except (OSError, ValueError):
+        pass
+    return 0
+
+
+class Result:
+    __slots__ = ('case', 'compiler', 'opt', 'march', 'state', 'findings', 'seed', 'options_hash',
+                 'checksum', 'compile_time', 'run_time', 'compile_rss', 'run_rss', 'timestamp')
+
+    def __init__(self, **fields):
+        for name in self.__slots__:
+            setattr(self, name, fields.get(name))
+
+    def __str__(self):
+        checksum = str(self.checksum) if self.checksum is not None else '-'
+        return '{} seed={} {} {} {} {} [{}] checksum={} compile={:.3f}s/{}KB run={:.3f}s/{}KB'.format(
+            self.case, self.seed, self.compiler, self.opt, self.march or '-', self.state.name,
+            ','.join(self.findings), checksum, self.compile_time, self.compile_rss, self.run_time,
+            self.run_rss)
+
+
+class SegmentWriter:
+    """Appends the results of one writer to its own segment"""
+
+    def __init__(self, folder: str, name: str):
+        os.makedirs(folder, exist_ok=True)
+        self.path = os.path.join(folder, name + SEGMENT_EXT)
+        self.strings = {}
+        self.file = open(self.path, 'ab')
+        if self.file.tell() == 0:
+            self.file.write(SEGMENT_MAGIC)
+            self.file.flush()
+        else:
+            # The writer is restarted with the same name, so the ids continue after the last complete entry
+            reader = SegmentReader(self.path)
+            self.file.truncate(reader.size)
+            self.strings = {result_string: string_id for string_id, result_string in reader.string_table().items()}
+            reader.close()
+
+    def string_id(self, value: str, data: bytearray) -> int:
+        value = value or ''
+        if value not in self.strings:
+            self.strings[value] = len(self.strings)
+            encoded = value.encode('utf-8')
+            data += STRING_HEADER.pack(b'S', len(encoded), self.strings[value]) + encoded
+        return self.strings[value]
+
+    def append(self, case: str, compiler: str, opt: str, march: str, state: State, findings, seed: int,
+               opts_hash: int, checksum, compile_time: float, run_time: float, compile_rss: int,
+               run_rss: int):
+        data = bytearray()
+        case_id = self.string_id(case, data)
+        compiler_id = self.string_id(compiler, data)
+        opt_id = self.string_id(opt, data)
+        march_id = self.string_id(march, data)
+        flags = CHECKSUM_VALID if checksum is not None else 0
+        data += RECORD.pack(b'R', state.value, findings_mask(findings), flags, case_id, compiler_id, opt_id,
+                            march_id, seed, opts_hash, checksum or 0, compile_time or 0, run_time or 0,
+                            compile_rss or 0, run_rss or 0, int(time.time()))
+        # One write per record, so a crash can't leave a record without its strings
+        self.file.write(data)
+        self.file.flush()
+
+    def close(self):
+        self.file.close()
+
+
+class SegmentReader:
+    """Reads the records of a segment with the help of its index. The segment is mapped into memory and
+    only the records that match the keys are unpacked. Only the tail of the segment that was written after
+    the index is parsed, then the index is updated"""
+
+    def __init__(self, path: str):
+        self.path = path
+        with open(path, 'rb') as file:
+            segment_size = os.fstat(file.fileno()).st_size
+            self.data = mmap.mmap(file.fileno(), 0, access=mmap.ACCESS_READ) if segment_size else b''
+        # A writer that was stopped before its first record may leave an empty segment
+        if self.data and self.data[:len(SEGMENT_MAGIC)] != SEGMENT_MAGIC:
+            raise ValueError('{} is not a results segment'.format(path))
+        self.decoded_strings = {}
+        if not self.load_index():
+            # size of the indexed part of the segment, offsets of the records and of the string entries
+            # (by string id), seeds sorted together with the offsets of their records, and the offsets of
+            # the records by state value and by finding bit
+            self.size = len(SEGMENT_MAGIC)
+            self.record_offsets = array.array('Q')
+            self.string_offsets = array.array('Q')
+            self.seeds = array.array('Q')
+            self.seed_offsets = array.array('Q')
+            self.states = {state.value: array.array('Q') for state in State}
+            self.findings = {bit: array.array('Q') for bit in range(len(FINDINGS))}
+        if self.parse_tail():
+            self.save_index()
+
+    def close(self):
+        if isinstance(self.data, mmap.mmap):
+            self.data.close()
+
+    def load_index(self):
+        """Loads the index if it describes a prefix of the segment"""
+        index_path = self.path + INDEX_EXT
+        try:
+            with open(index_path, 'rb') as file:
+                data = file.read()
+        except OSError:
+            return False
+        if len(data) < INDEX_HEADER.size:
+            return False
+        magic, size, records_count, strings_count = INDEX_HEADER.unpack_from(data, 0)
+        # The segment could be replaced or cut off after the index was written
+        if magic != INDEX_MAGIC or not len(SEGMENT_MAGIC) <= size <= len(self.data):
+            return False
+        pos = INDEX_HEADER.size
+
+        def take(typecode: str, length: int):
+            nonlocal pos
+            values = array.array(typecode)
+            end = pos + length * values.itemsize
+            if end > len(data):
+                raise ValueError('index is too short')
+            values.frombytes(data[pos:end])
+            pos = end
+            return values
+
+        try:
+            record_offsets = take('Q', records_count)
+            string_offsets = take('Q', strings_count)
+            seeds = take('Q', records_count)
+            seed_offsets = take('Q', records_count)
+            groups = []
+            for group_size in (len(State), len(FINDINGS)):
+                lengths = take('I', group_size)
+                groups.append([take('Q', length) for length in lengths])
+        except ValueError:
+            return False
+        if pos != len(data):
+            return False
+        # The last entries of the index have to be in the segment
+        if records_count and (record_offsets[-1] + RECORD.size > size or
+                              self.data[record_offsets[-1]:record_offsets[-1] + 1] != b'R'):
+            return False
+        if strings_count and (string_offsets[-1] + STRING_HEADER.size > size or
+                              self.data[string_offsets[-1]:string_offsets[-1] + 1] != b'S'):
+            return False
+
+        self.size = size
+        self.record_offsets = record_offsets
+        self.string_offsets = string_offsets
+        self.seeds = seeds
+        self.seed_offsets = seed_offsets
+        self.states = {state.value: offsets for state, offsets in zip(State, groups[0])}
+        self.findings = dict(enumerate(groups[1]))
+        return True
+
+    def parse_tail(self):
+        """Adds the complete entries after the indexed part to the index, returns True if there are any"""
+        pos = self.size
+        while pos < len(self.data):
+            kind = self.data[pos:pos + 1]
+            if kind == b'S':
+                if pos + STRING_HEADER.size > len(self.data):
+                    break
+                _, length, string_id = STRING_HEADER.unpack_from(self.data, pos)
+                if pos + STRING_HEADER.size + length > len(self.data):
+                    break
+                # The writer numbers the strings in the order of their definitions
+                if string_id != len(self.string_offsets):
+                    raise ValueError('{} is corrupted at offset {}'.format(self.path, pos))
+                self.string_offsets.append(pos)
+                pos += STRING_HEADER.size + length
+            elif kind == b'R':
+                if pos + RECORD.size > len(self.data):
+                    break
+                record = RECORD.unpack_from(self.data, pos)
+                self.record_offsets.append(pos)
+                seed_pos = bisect.bisect_right(self.seeds, record[8])
+                self.seeds.insert(seed_pos, record[8])
+                self.seed_offsets.insert(seed_pos, pos)
+                self.states[record[1]].append(pos)
+                for bit in range(len(FINDINGS)):
+                    if record[2] & (1 << bit):
+                        self.findings[bit].append(pos)
+                pos += RECORD.size
+            else:
+                raise ValueError('{} is corrupted at offset {}'.format(self.path, pos))
+        grown = pos != self.size
+        self.size = pos
+        return grown
+
+    def save_index(self):
+        data = bytearray(INDEX_HEADER.pack(INDEX_MAGIC, self.size, len(self.record_offsets),
+                                           len(self.string_offsets)))
+        data += self.record_offsets.tobytes() + self.string_offsets.tobytes()
+        data += self.seeds.tobytes() + self.seed_offsets.tobytes()
+        for group in (self.states, self.findings):
+            data += array.array('I', [len(offsets) for _, offsets in sorted(group.items())]).tobytes()
+            for _, offsets in sorted(group.items()):
+                data += offsets.tobytes()
+        index_path = self.path + INDEX_EXT
+        tmp_path = index_path + '.tmp.' + str(os.getpid())
+        try:
+            with open(tmp_path, 'wb') as file:
+                file.write(data)
+            os.replace(tmp_path, index_path)
+        except OSError:
+            # The index is only a cache, e.g. the results can be on a read-only share
+            pass
+
+    def string(self, string_id: int) -> str:
+        if string_id not in self.decoded_strings:
+            pos = self.string_offsets[string_id]
+            _, length, _ = STRING_HEADER.unpack_from(self.data, pos)
+            start = pos + STRING_HEADER.size
+            self.decoded_strings[string_id] = bytes(self.data[start:start + length]).decode('utf-8')
+        return self.decoded_strings[string_id]
+
+    def string_table(self) -> dict:
+        """All strings of the segment by their ids"""
+        return {string_id: self.string(string_id) for string_id in range(len(self.string_offsets))}
+
+    def offsets(self, seed=None, state=None, finding=None):
+        """Offsets of the records that match all of the given keys (all records if there are none)"""
+        candidates = None
+        if seed is not None:
+            start = bisect.bisect_left(self.seeds, seed)
+            end = bisect.bisect_right(self.seeds, seed)
+            candidates = set(self.seed_offsets[start:end])
+        for offsets in ([self.states.get(state.value, [])] if state is not None else []) + \
+                       ([self.findings[FINDINGS.index(finding)]] if finding is not None else []):
+            candidates = set(offsets) if candidates is None else candidates & set(offsets)
+        if candidates is None:
+            return list(self.record_offsets)
+        return sorted(candidates)
+
+    def result(self, offset: int) -> Result:
+        (_, state, findings, flags, case_id, compiler_id, opt_id, march_id, seed, opts_hash, checksum,
+         compile_time, run_time, compile_rss, run_rss, timestamp) = RECORD.unpack_from(self.data, offset)
+        return Result(case=self.string(case_id), compiler=self.string(compiler_id), opt=self.string(opt_id),
+                      march=self.string(march_id), state=State(state), findings=mask_findings(findings),
+                      seed=seed, options_hash=opts_hash, checksum=checksum if flags & CHECKSUM_VALID else None,
+                      compile_time=compile_time, run_time=run_time, compile_rss=compile_rss, run_rss=run_rss,
+                      timestamp=timestamp)
+
+
+def list_campaigns(root: str) -> list:
+    """Campaign folders from the oldest to the latest"""
+    if not os.path.isdir(root):
+        return []
+    folders = [name for name in os.listdir(root) if os.path.isdir(os.path.join(root, name))]
+    return sorted(folders, key=lambda name: os.path.getmtime(os.path.join(root, name)))
+
+
+def query(folder: str, seed=None, state=None, finding=None, compiler=None, opt=None, march=None):
+    """Yields the results of a campaign that match the filters"""
+    for name in sorted(os.listdir(folder)):
+        if not name.endswith(SEGMENT_EXT):
+            continue
+        reader = SegmentReader(os.path.join(folder, name))
+        try:
+            for offset in reader.offsets(seed, state, finding):
+                result = reader.result(offset)
+                if compiler is not None and compiler not in result.compiler:
+                    continue
+                if opt is not None and result.opt != opt:
+                    continue
+                if march is not None and result.march != march:
+                    continue
+                yield result
+        finally:
+            reader.close()
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Queries the binary results log of the runner')
+    parser.add_argument('--root', default='../Testing/results', help='results folder (testing_path/results)')
+    subparsers = parser.add_subparsers(dest='command', required=True)
+    subparsers.add_parser('campaigns', help='list the campaigns')
+    query_parser = subparsers.add_parser('query', help='print the matching results')
+    query_parser.add_argument('--campaign', default='last', help='campaign name, "last" or "all"')
+    query_parser.add_argument('--seed', type=int)
+    query_parser.add_argument('--state', choices=[state.name for state in State])
+    query_parser.add_argument('--finding', choices=FINDINGS)
+    query_parser.add_argument('--compiler', help='substring of the compiler, e.g. clang')
+    query_parser.add_argument('--opt', help='optimization option, e.g. -O3')
+    query_parser.add_argument('--march')
+    query_parser.add_argument('--count', action='store_true', help='print only the number of the results')
+    args = parser.parse_args()
+
+    campaigns = list_campaigns(args.root)
+    if args.command == 'campaigns':
+        for name in campaigns:
+            print(name)
+        return
+    if args.campaign == 'all':
+        selected = campaigns
+    elif args.campaign == 'last':
+        selected = campaigns[-1:]
+    else:
+        selected = [args.campaign]
+    count = 0
+    state = State[args.state] if args.state else None
+    for name in selected:
+        for result in query(os.path.join(args.root, name), args.seed, state, args.finding, args.compiler,
+                            args.opt, args.march):
+            count += 1
+            if not args.count:
+                print(('{}: '.format(name) if len(selected) > 1 else '') + str(result))
+    if args.count:
+        print(count)
+
+
+if __name__ == '__main__':
+    main()
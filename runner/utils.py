@@ -1,3 +1,5 @@
+import contextlib
+import fcntl
 import subprocess
 import tempfile
 import traceback
@@ -7,6 +9,10 @@ import os
 import zipfile
 import yaml
 import random
+import json
+import math
+import re
+import select
 
 
 def run_cmd(command: list, working_dir: str, timeout: int = 5):
@@ -48,6 +54,383 @@ def run_cmd(command: list, working_dir: str, timeout: int = 5):
             stderr_tmp.close()
 
 
+def run_cmd_with_usage(command: list, working_dir: str, timeout: int = 5):
+    """Same as run_cmd, but also returns wall time (seconds) and peak RSS (KB) of the child"""
+    stdout_tmp = None
+    stderr_tmp = None
+    try:
+        stdout_tmp = tempfile.SpooledTemporaryFile(buffering=16384)
+        stderr_tmp = tempfile.SpooledTemporaryFile(buffering=1024)
+        t_beginning = time.time()
+        p = subprocess.Popen(command, cwd=working_dir, stdout=stdout_tmp.fileno(), stderr=stderr_tmp.fileno(),
+                             shell=False, close_fds=True)
+
+        while True:
+            # wait4 reaps the child and gives us its resource usage
+            pid, status, usage = os.wait4(p.pid, os.WNOHANG)
+            if pid != 0:
+                wall_time = time.time() - t_beginning
+                returncode = os.waitstatus_to_exitcode(status)
+                p.returncode = returncode
+                break
+            if timeout and time.time() - t_beginning > timeout:
+                p.terminate()
+                p.wait()
+                raise subprocess.TimeoutExpired(' '.join(command), timeout)
+            time.sleep(0.01)
+
+        stdout_tmp.seek(0)
+        stdout = [x.decode('utf-8').strip() for x in stdout_tmp.readlines()]
+        stderr_tmp.seek(0)
+        stderr = [x.decode('utf-8').strip() for x in stderr_tmp.readlines()]
+        return returncode, stdout, stderr, wall_time, usage.ru_maxrss
+
+    except IOError:
+        print(traceback.format_exc())
+        return -1, [], [], 0.0, 0
+    finally:
+        if stdout_tmp:
+            stdout_tmp.close()
+        if stderr_tmp:
+            stderr_tmp.close()
+
+
+class NativeExecutor:
+    """Client of the native executor (yarpgen-exec).
+
+    Jobs are sent as JSON lines, the executor waits for them with pidfd/epoll instead of
+    polling, so there is no sleep latency per compile and per run. run() has the same
+    interface as run_cmd_with_usage. submit() and poll() drive a job graph: the executor runs
+    up to `jobs` jobs in parallel, a job starts after its deps have succeeded and ready jobs
+    with smaller priority start first. `dependents` is the number of the jobs that will list the
+    job in their deps, the executor forgets the job when all of them are submitted and resolved.
+    """
+
+    def __init__(self, path: str, mem_limit_mb: int = 0, cpu_limit: int = 0, jobs: int = 0):
+        command = [path] + (['--jobs=' + str(jobs)] if jobs else [])
+        self.proc = subprocess.Popen(command, stdin=subprocess.PIPE, stdout=subprocess.PIPE)
+        self.mem_limit = mem_limit_mb * 1024 * 1024
+        self.cpu_limit = cpu_limit
+        self.next_id = 0
+        self.out_buf = b''
+        self.results = {}
+        self.requests = {}
+
+    def submit(self, command: list, working_dir: str, timeout: int, deps: list = None, priority: int = 0,
+               dependents: int = 0):
+        self.next_id += 1
+        job_id = str(self.next_id)
+        request = {'id': job_id, 'cmd': command, 'cwd': working_dir, 'timeout': timeout or 0,
+                   'mem_limit': self.mem_limit, 'cpu_limit': self.cpu_limit, 'deps': deps or [],
+                   'priority': priority, 'dependents': dependents}
+        self.proc.stdin.write((json.dumps(request) + '\n').encode('utf-8'))
+        self.proc.stdin.flush()
+        self.requests[job_id] = (command, timeout)
+        return job_id
+
+    def poll(self, timeout=None):
+        """Reads the finished jobs, waits at most timeout seconds (None means until any job finishes)"""
+        fd = self.proc.stdout.fileno()
+        while True:
+            ready, _, _ = select.select([fd], [], [], timeout)
+            if not ready:
+                return
+            data = os.read(fd, 1 << 20)
+            if not data:
+                raise IOError('yarpgen-exec has terminated')
+            self.out_buf += data
+            lines = self.out_buf.split(b'\n')
+            self.out_buf = lines.pop()
+            for line in lines:
+                result = json.loads(line.decode('utf-8', 'replace'))
+                self.results[result['id']] = result
+            if lines:
+                return
+
+    def has_result(self, job_id: str):
+        return job_id in self.results
+
+    def pop_result(self, job_id: str):
+        """Returns the result of the job in the run_cmd_with_usage format"""
+        while job_id not in self.results:
+            self.poll()
+        result = self.results.pop(job_id)
+        command, timeout = self.requests.pop(job_id)
+        return self.unpack_result(result, command, timeout)
+
+    def discard_result(self, job_id: str):
+        self.results.pop(job_id, None)
+        self.requests.pop(job_id, None)
+
+    def result_runner(self, job_id: str):
+        """run_job replacement that returns the result of an already submitted job"""
+        return lambda command, working_dir, timeout: self.pop_result(job_id)
+
+    def run(self, command: list, working_dir: str, timeout: int = 5):
+        return self.pop_result(self.submit(command, working_dir, timeout))
+
+    @staticmethod
+    def memfd_arg(name: str):
+        """Argument that the executor replaces with the path of the in-memory file name"""
+        return '{memfd:' + name + '}'
+
+    def run_op(self, op: str, **fields):
+        """Runs an operation on the in-memory files (save, release), returns True on success"""
+        self.next_id += 1
+        op_id = str(self.next_id)
+        request = dict(fields, id=op_id, op=op)
+        self.proc.stdin.write((json.dumps(request) + '\n').encode('utf-8'))
+        self.proc.stdin.flush()
+        while op_id not in self.results:
+            self.poll()
+        result = self.results.pop(op_id)
+        if result['status'] != 'done':
+            print('EXECUTOR {} FAILED: {}'.format(op, result.get('error', result['status'])))
+        return result['status'] == 'done'
+
+    @staticmethod
+    def unpack_result(result: dict, command: list, timeout: int):
+        if result['status'] == 'timeout':
+            raise subprocess.TimeoutExpired(' '.join(command), timeout)
+        if result['status'] in ('spawn_error', 'bad_request', 'skipped'):
+            print('CAN NOT RUN {}: {}'.format(' '.join(command), result.get('error', result['status'])))
+            return -1, [], [], 0.0, 0
+        # the same convention as subprocess: negative return code for a signal
+        returncode = -result['signal'] if result['status'] == 'signaled' else result['exit_code']
+        stdout = [x.strip() for x in result['stdout'].splitlines()]
+        stderr = [x.strip() for x in result['stderr'].splitlines()]
+        return returncode, stdout, stderr, result['wall_time'], result['max_rss']
+
+    def close(self):
+        self.proc.stdin.close()
+        self.proc.wait()
+
+
+@contextlib.contextmanager
+def locked_file(path: str):
+    """Exclusive lock of a file that is shared by the runners and the workers of a testing_path
+    (the lock is taken on <path>.lock, the file itself is replaced by write_json)"""
+    with open(path + '.lock', 'a') as lock_file:
+        fcntl.flock(lock_file, fcntl.LOCK_EX)
+        try:
+            yield
+        finally:
+            fcntl.flock(lock_file, fcntl.LOCK_UN)
+
+
+def read_json(path: str, default):
+    if not os.path.exists(path):
+        return default
+    with open(path, 'r') as file:
+        return json.load(file)
+
+
+def write_json(path: str, data):
+    """Replaces the file at once, so the readers never see a partially written file"""
+    tmp_path = path + '.tmp.' + str(os.getpid())
+    with open(tmp_path, 'w') as file:
+        json.dump(data, file, indent=2)
+    os.replace(tmp_path, path)
+
+
+class CompileTimeBaseline:
+    """Running per-configuration baseline of compile time normalized by program size.
+
+    For each configuration we keep the mean and variance (Welford's algorithm) of
+    log(compile time / program size), so a compilation is an outlier if it is both
+    statistically unusual and much slower than the size-predicted time.
+
+    The baseline file is shared by the runners and the workers of a testing_path, so
+    save() merges the measurements added since the last save into the current file.
+    """
+
+    def __init__(self, path: str, min_samples: int = 10, sigma: float = 3.0, min_ratio: float = 5.0):
+        self.path = path
+        self.min_samples = min_samples
+        self.sigma = sigma
+        self.min_ratio = min_ratio
+        self.stats = read_json(path, {})
+        # Measurements that aren't in the file yet, in the same form as the stats
+        self.pending = {}
+
+    @staticmethod
+    def config_key(compiler: str, opt: str, march: str = ""):
+        return ' '.join(x for x in (compiler, opt, march) if x)
+
+    def expected_time(self, key: str, size: int):
+        entry = self.stats.get(key)
+        if entry is None or entry['n'] == 0:
+            return None
+        return math.exp(entry['mean']) * size
+
+    def add(self, key: str, size: int, wall_time: float):
+        """Adds a measurement and returns the expected time if it is an outlier, otherwise None"""
+        size = max(size, 1)
+        value = math.log(max(wall_time, 1e-6) / size)
+        entry = self.stats.setdefault(key, {'n': 0, 'mean': 0.0, 'm2': 0.0})
+
+        outlier_expected = None
+        if entry['n'] >= self.min_samples:
+            std = math.sqrt(entry['m2'] / (entry['n'] - 1))
+            if value > entry['mean'] + self.sigma * std and value - entry['mean'] > math.log(self.min_ratio):
+                outlier_expected = math.exp(entry['mean']) * size
+
+        # Outliers are not added, so they don't skew the baseline
+        if outlier_expected is None:
+            for stats in (self.stats, self.pending):
+                entry = stats.setdefault(key, {'n': 0, 'mean': 0.0, 'm2': 0.0})
+                entry['n'] += 1
+                delta = value - entry['mean']
+                entry['mean'] += delta / entry['n']
+                entry['m2'] += delta * (value - entry['mean'])
+        return outlier_expected
+
+    @staticmethod
+    def merge_entry(first: dict, second: dict):
+        """Mean and variance of the union of two sets of measurements (Chan et al.)"""
+        n = first['n'] + second['n']
+        if n == 0:
+            return {'n': 0, 'mean': 0.0, 'm2': 0.0}
+        delta = second['mean'] - first['mean']
+        return {'n': n, 'mean': first['mean'] + delta * second['n'] / n,
+                'm2': first['m2'] + second['m2'] + delta * delta * first['n'] * second['n'] / n}
+
+    def save(self):
+        if not self.pending:
+            return
+        # Other workers save their measurements to the same file, so the file is read again under the lock
+        with locked_file(self.path):
+            self.stats = read_json(self.path, {})
+            for key, entry in self.pending.items():
+                self.stats[key] = self.merge_entry(self.stats.get(key, {'n': 0, 'mean': 0.0, 'm2': 0.0}), entry)
+            write_json(self.path, self.stats)
+        self.pending = {}
+
+
+# 崩溃签名：同一个 bug 的编译器崩溃（相同的 ICE 信息、断言或栈顶函数）签名相同，只在第一次出现时记录和备份
+CRASH_SIGNATURE_FRAMES = 4
+# 编译器错误输出中能区分 bug 的行
+ICE_MARKERS = ('internal compiler error', 'Assertion', 'LLVM ERROR', 'UNREACHABLE', 'Segmentation fault',
+               'Killed', 'killed by signal', 'terminate called', 'fatal error')
+# 编译器打印栈的辅助函数，对区分 bug 没有帮助
+ICE_FRAME_SKIP = ('PrintStackTrace', 'SignalHandler', 'RunSignalHandlers', 'CrashRecoveryContext',
+                  'crash_signal', 'diagnostic_', 'libc.so', 'libpthread', '__restore_rt')
+ICE_FRAME = re.compile(r'^\s*(?:#\d+\s+)?0x[0-9a-fA-F]+\s+(.+)$')
+CRASH_FRAME = re.compile(r'^(.*?)\((.*?)\)\s*\[0x[0-9a-fA-F]+\]$')
+
+
+def normalize_crash_line(line: str):
+    """Removes the parts that differ from case to case: the location in the test, addresses and numbers"""
+    line = re.sub(r'^\S+:\d+:(?:\d+:)?\s*', '', line.strip())
+    line = re.sub(r'0x[0-9a-fA-F]+', '0x', line)
+    line = re.sub(r'\(/[^)]*\)$', '', line)
+    return re.sub(r'\b\d+\b', 'N', line).strip()
+
+
+def compile_crash_signature(compiler: str, ret: int, stderr: list):
+    """Signature of a compiler crash: the ICE message or assertion and the top frames of the stack dump"""
+    messages = []
+    frames = []
+    for line in stderr:
+        frame = ICE_FRAME.match(line)
+        if frame:
+            name = frame.group(1)
+            if not any(skip in name for skip in ICE_FRAME_SKIP) and len(frames) < CRASH_SIGNATURE_FRAMES:
+                frames.append(normalize_crash_line(name))
+        elif any(marker in line for marker in ICE_MARKERS) and len(messages) < 2:
+            messages.append(normalize_crash_line(line))
+    if not messages and not frames:
+        # 没有可识别的信息时使用最后一行错误输出和返回值
+        last_line = normalize_crash_line(stderr[-1]) if stderr else ''
+        messages.append('exit {} {}'.format(ret, last_line).strip())
+    return 'CIE {}: {}'.format(compiler.split('/')[-1], ' | '.join(messages + frames))
+
+
+def execution_crash_signature(compiler: str, opt: str, ret: int, stderr: list):
+    """Signature of a test crash: the signal and the top frames reported by yarpgen-crash-handler.so.
+    The tests are linked with -rdynamic, so the frames of the test carry the function and the offset in it.
+    The signature only describes the crash in the log, test crashes are not bucketed"""
+    signal_name = 'signal {}'.format(-ret) if ret < 0 else 'exit {}'.format(ret)
+    frames = []
+    in_backtrace = False
+    for line in stderr:
+        if line.startswith('=== yarpgen-crash: signal'):
+            signal_name = line.split()[4]
+            in_backtrace = True
+        elif line.startswith('=== yarpgen-crash: end'):
+            in_backtrace = False
+        elif in_backtrace and len(frames) < CRASH_SIGNATURE_FRAMES:
+            frame = CRASH_FRAME.match(line)
+            if not frame:
+                continue
+            module, symbol = os.path.basename(frame.group(1)), frame.group(2).split('+')[0]
+            # 测试的文件名每个用例都不同（零磁盘模式下为 /proc/<pid>/fd/<N>），保留函数名和偏移以定位崩溃的位置
+            if module.startswith('ELF-') or frame.group(1).startswith('/proc/'):
+                module = '<test>'
+                symbol = frame.group(2)
+            frames.append(module + (':' + symbol if symbol else ''))
+    return 'CRASH {} {}: {}'.format(compiler.split('/')[-1], opt, ' | '.join([signal_name] + frames))
+
+
+class CrashBuckets:
+    """Compiler crashes grouped by signature. Only the first case of a bucket is logged and backed up,
+    the duplicates are only counted. The buckets are shared between the runs and the workers (like the
+    compile baseline)"""
+
+    def __init__(self, path: str):
+        self.path = path
+        self.buckets = read_json(path, {})
+
+    def add(self, signature: str, case_file: str):
+        """Returns True if the signature is new"""
+        # Other workers add their crashes to the same file, so the buckets are read again under the lock
+        with locked_file(self.path):
+            self.buckets = read_json(self.path, {})
+            bucket = self.buckets.get(signature)
+            is_new = bucket is None
+            if is_new:
+                bucket = self.buckets[signature] = {'count': 0, 'first_case': case_file}
+            bucket['count'] += 1
+            bucket['last_case'] = case_file
+            write_json(self.path, self.buckets)
+        return is_new
+
+
+def parse_cycles(stdout: list):
+    """解析 --perf-reps 模式下测试输出的 "cycles: min X median Y" 行，返回 (min, median)"""
+    for line in stdout:
+        if line.startswith('cycles:'):
+            fields = line.split()
+            return int(fields[2]), int(fields[4])
+    return None
+
+
+# 优化等级由弱到强的顺序；-Os 等以代码体积为目标的等级不参与同一编译器内的比较
+OPT_RANK = {'-O0': 0, '-O1': 1, '-O2': 2, '-O3': 3, '-Ofast': 3}
+
+
+def find_perf_slowdowns(timings: dict, slowdown: float, min_cycles: int):
+    """timings 为 {(compiler, opt): 最小周期数}。
+    返回明显变慢的 (慢的配置, 快的配置, 倍数)：同一编译器中更高的优化等级比更低的慢，
+    或者同一优化等级下一个编译器比另一个慢。太短的运行时间噪声太大，不参与比较"""
+    slowdowns = []
+    for slow_key, slow in timings.items():
+        if slow < min_cycles:
+            continue
+        for fast_key, fast in timings.items():
+            if slow_key == fast_key or slow < slowdown * max(fast, 1):
+                continue
+            (slow_compiler, slow_opt), (fast_compiler, fast_opt) = slow_key, fast_key
+            if slow_compiler == fast_compiler:
+                if slow_opt not in OPT_RANK or fast_opt not in OPT_RANK or \
+                        OPT_RANK[slow_opt] <= OPT_RANK[fast_opt]:
+                    continue
+            elif slow_opt != fast_opt:
+                continue
+            slowdowns.append((slow_key, fast_key, slow / max(fast, 1)))
+    return slowdowns
+
+
 def get_current_time_str():
     now = datetime.datetime.now()
     return datetime.datetime.strftime(now, '%Y-%m-%d-%H-%M')
@@ -87,40 +470,3 @@ def delete_files_with_substring(directory, substring):
     for filename in os.listdir(directory):
         if substring in filename and os.path.isfile(os.path.join(directory, filename)):
             os.remove(os.path.join(directory, filename))
-
-
-class LiteralString(str):
-    pass
-
-def literal_representer(dumper, data):
-    return dumper.represent_scalar('tag:yaml.org,2002:str', data, style='|')
-
-# 注册自定义的LiteralString
-yaml.add_representer(LiteralString, literal_representer)
-
-def generate_random_function_batch_from_zip(zip_path, batch_size, total_files):
-    output_dir= "./"
-    output_yaml_name= "functions.yaml"
-    # 随机抽取不同编号
-    random_ids = random.sample(range(1, total_files + 1), min(batch_size, total_files))
-
-    merged_data = []
-
-    with zipfile.ZipFile(zip_path, 'r') as zipf:
-        for idx in random_ids:
-            filename = f"func_{idx}.yaml"
-            try:
-                with zipf.open(filename) as file:
-                    yaml_data = yaml.safe_load(file)
-                    # 把 function 字段处理成 LiteralString，以便输出成 |- 样式
-                    if 'function' in yaml_data:
-                        yaml_data['function'] = LiteralString(yaml_data['function'].strip())
-                    merged_data.append(yaml_data)
-            except KeyError:
-                print(f"Warning: {filename} not found in zip archive.")
-
-    # 写出到一个新的yaml文件
-    os.makedirs(output_dir, exist_ok=True)
-    output_path = os.path.join(output_dir, output_yaml_name)
-    with open(output_path, 'w', encoding='utf-8') as f:
-        yaml.dump(merged_data, f, sort_keys=False, allow_unicode=True)
\ No newline at end of file
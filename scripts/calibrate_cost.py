@@ -0,0 +1,181 @@
+#!/usr/bin/python3
+###############################################################################
+#
+# Copyright (c) 2015-2020, Intel Corporation
+# Copyright (c) 2019-2020, University of Utah
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#      http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+#
+###############################################################################
+"""
+Calibration of the generator cost model.
+It generates a corpus of tests with cost sidecar files, measures compile and
+run time of each test and fits the weights for yarpgen's --cost-weights option,
+so the estimated compile cost is expressed in seconds of compilation.
+"""
+###############################################################################
+
+import argparse
+import collections
+import os
+import subprocess
+import sys
+import tempfile
+import time
+
+###############################################################################
+
+scripts_dir = os.path.dirname(os.path.abspath(__file__))
+yarpgen_home = os.environ["YARPGEN_HOME"] if "YARPGEN_HOME" in os.environ else os.path.dirname(scripts_dir)
+default_yarpgen = os.path.join(yarpgen_home, "build", "yarpgen")
+
+# Features of the compile cost in the same order as in --cost-weights
+features = ["expr_num", "stmt_num", "arrays_num"]
+
+###############################################################################
+
+
+def read_sidecar(path):
+    info = {}
+    with open(path, "r") as sidecar:
+        for line in sidecar:
+            key, value = line.split(":", 1)
+            info[key.strip()] = float(value)
+    return info
+
+
+def solve(matrix, vector):
+    """ Gauss elimination with partial pivoting for small dense systems """
+    size = len(vector)
+    aug = [list(matrix[i]) + [vector[i]] for i in range(size)]
+    for col in range(size):
+        pivot = max(range(col, size), key=lambda row: abs(aug[row][col]))
+        if abs(aug[pivot][col]) < 1e-12:
+            return None
+        aug[col], aug[pivot] = aug[pivot], aug[col]
+        for row in range(size):
+            if row == col:
+                continue
+            factor = aug[row][col] / aug[col][col]
+            for k in range(col, size + 1):
+                aug[row][k] -= factor * aug[col][k]
+    return [aug[i][size] / aug[i][i] for i in range(size)]
+
+
+def fit_weights(samples):
+    """ Least squares fit of compile_time = sum(weight_i * feature_i) """
+    size = len(features)
+    xtx = [[0.0] * size for _ in range(size)]
+    xty = [0.0] * size
+    for sample in samples:
+        row = [sample.info[name] for name in features]
+        for i in range(size):
+            xty[i] += row[i] * sample.compile_time
+            for j in range(size):
+                xtx[i][j] += row[i] * row[j]
+    weights = solve(xtx, xty)
+    if weights is None:
+        return None
+    # Negative weights don't make sense for the cost model
+    return [max(weight, 0.0) for weight in weights]
+
+
+# Measurement of one test. The time of a step that hit the timeout is the
+# timeout itself, so it is only a lower bound (compile_capped / run_capped).
+# The run time is None if the test wasn't run, because it didn't compile.
+Sample = collections.namedtuple("Sample", ["info", "compile_time", "compile_capped", "run_time", "run_capped"])
+
+
+def timed_run(cmd, work_dir, timeout):
+    """ Returns the wall time of the command and whether it hit the timeout """
+    start = time.perf_counter()
+    try:
+        ret = subprocess.run(cmd, cwd=work_dir, timeout=timeout, stdout=subprocess.DEVNULL,
+                             stderr=subprocess.DEVNULL)
+    except subprocess.TimeoutExpired:
+        return timeout, True, None
+    return time.perf_counter() - start, False, ret.returncode
+
+
+def measure(yarpgen, seed, compiler, opt, work_dir, timeout):
+    src = os.path.join(work_dir, "test_" + str(seed) + ".cpp")
+    exe = os.path.join(work_dir, "test_" + str(seed))
+    ret = subprocess.run([yarpgen, "-s", str(seed), "-o", src, "--cost-sidecar"],
+                         cwd=work_dir, stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+    if ret.returncode != 0:
+        return None
+    info = read_sidecar(src + ".cost")
+
+    # The most expensive tests are the ones that hit the timeout, so they are
+    # kept with the timeout as their time. Dropping them would bias the fit low.
+    compile_time, compile_capped, returncode = timed_run([compiler, opt, src, "-o", exe], work_dir, timeout)
+    if compile_capped or returncode != 0:
+        return Sample(info, compile_time, compile_capped, None, False)
+
+    # A test that fails at runtime still ran for the measured time
+    run_time, run_capped, _ = timed_run([exe], work_dir, timeout)
+    return Sample(info, compile_time, compile_capped, run_time, run_capped)
+
+
+def calibrate(yarpgen, seeds, compiler, opt, timeout):
+    samples = []
+    with tempfile.TemporaryDirectory() as work_dir:
+        for seed in seeds:
+            sample = measure(yarpgen, seed, compiler, opt, work_dir, timeout)
+            if sample is not None:
+                samples.append(sample)
+    if len(samples) < len(features):
+        sys.stderr.write("Not enough successful measurements for calibration\n")
+        sys.exit(-1)
+
+    weights = fit_weights(samples)
+    if weights is None:
+        sys.stderr.write("Can't fit the cost model, try a bigger seed corpus\n")
+        sys.exit(-1)
+
+    # Run time per executed expression node. We use the median ratio, because
+    # process startup dominates small tests.
+    run_samples = [sample for sample in samples if sample.run_time is not None]
+    ratios = sorted(sample.run_time / sample.info["dynamic_ops"] for sample in run_samples
+                    if sample.info["dynamic_ops"] > 0)
+    ns_per_op = ratios[len(ratios) // 2] * 1e9 if ratios else 0.0
+
+    print("Samples: {} (compiled and ran: {})".format(len(samples), len(run_samples)))
+    compile_capped = sum(sample.compile_capped for sample in samples)
+    run_capped = sum(sample.run_capped for sample in samples)
+    if compile_capped or run_capped:
+        print("Timed out: {} compilations, {} runs (counted as {} s, so the weights are lower bounds)".format(
+            compile_capped, run_capped, timeout))
+    print("Compile cost weights (seconds per {}): --cost-weights={}".format(
+        ", ".join(features), ",".join("{:.6g}".format(weight) for weight in weights)))
+    print("Run cost: {:.3g} ns per dynamic op".format(ns_per_op))
+    print("Use --max-compile-cost=<seconds> and --max-run-cost=<seconds> / (ns per op * 1e-9) as budgets")
+
+###############################################################################
+
+if __name__ == '__main__':
+    description = 'Calibration of the generator cost model'
+    parser = argparse.ArgumentParser(description=description, formatter_class=argparse.ArgumentDefaultsHelpFormatter)
+    parser.add_argument("--yarpgen", dest="yarpgen", default=default_yarpgen, type=str,
+                        help="Path to yarpgen binary")
+    parser.add_argument("--seeds", dest="seeds", default=50, type=int,
+                        help="Size of the seed corpus (seeds 1..N are used)")
+    parser.add_argument("--compiler", dest="compiler", default="g++", type=str,
+                        help="Compiler to calibrate for")
+    parser.add_argument("--opt", dest="opt", default="-O2", type=str,
+                        help="Optimization level to calibrate for")
+    parser.add_argument("--timeout", dest="timeout", default=60, type=int,
+                        help="Timeout for compilation and execution (seconds)")
+    args = parser.parse_args()
+
+    calibrate(os.path.abspath(args.yarpgen), list(range(1, args.seeds + 1)), args.compiler, args.opt, args.timeout)
@@ -0,0 +1,183 @@
+#!/usr/bin/python3
+###############################################################################
+#
+# Copyright (c) 2015-2020, Intel Corporation
+# Copyright (c) 2019-2020, University of Utah
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#      http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+#
+###############################################################################
+"""
+Generator throughput benchmark.
+It runs yarpgen over a fixed seed corpus under several option profiles,
+reports throughput and per-seed latency and checks that every generated
+program matches the hash recorded in the manifest.
+"""
+###############################################################################
+
+import argparse
+import collections
+import hashlib
+import os
+import subprocess
+import sys
+import tempfile
+import time
+
+###############################################################################
+
+scripts_dir = os.path.dirname(os.path.abspath(__file__))
+yarpgen_home = os.environ["YARPGEN_HOME"] if "YARPGEN_HOME" in os.environ else os.path.dirname(scripts_dir)
+
+default_manifest = os.path.join(scripts_dir, "gen_bench_manifest.txt")
+default_yarpgen = os.path.join(yarpgen_home, "build", "yarpgen")
+
+# Name of the profile -> extra options for yarpgen
+profiles = collections.OrderedDict([
+    ("default", []),
+    ("asserts", ["--check-algo=asserts"]),
+    ("inp_as_args", ["--inp-as-args=all"]),
+    ("mutation", ["--mutate=all", "--mutation-seed=42"]),
+])
+
+###############################################################################
+
+
+def strip_header(text):
+    """ Header comment contains build version, date and invocation, so it is
+    not a part of the generated program. """
+    header_start = text.find("/*\nyarpgen version")
+    if header_start == -1:
+        return text
+    header_end = text.find("*/\n", header_start)
+    if header_end == -1:
+        return text
+    return text[header_end + len("*/\n"):]
+
+
+def percentile(values, pct):
+    if not values:
+        return 0.0
+    values = sorted(values)
+    idx = min(len(values) - 1, max(0, int(round(pct / 100.0 * len(values) + 0.5)) - 1))
+    return values[idx]
+
+
+def load_manifest(path):
+    manifest = {}
+    if not os.path.exists(path):
+        return manifest
+    with open(path, "r") as manifest_file:
+        for line in manifest_file:
+            line = line.strip()
+            if not line or line.startswith("#"):
+                continue
+            profile, seed, digest = line.split()
+            manifest[(profile, int(seed))] = digest
+    return manifest
+
+
+def dump_manifest(path, hashes):
+    with open(path, "w") as manifest_file:
+        manifest_file.write("# profile seed sha256 (header comment excluded)\n")
+        manifest_file.write("# Regenerate with: scripts/gen_bench.py --update-manifest\n")
+        for (profile, seed), digest in hashes.items():
+            manifest_file.write("{} {} {}\n".format(profile, seed, digest))
+
+
+def run_profile(yarpgen, profile_name, seeds, work_dir):
+    out_file = os.path.join(work_dir, profile_name + ".cpp")
+    latencies = []
+    total_bytes = 0
+    hashes = collections.OrderedDict()
+    for seed in seeds:
+        cmd = [yarpgen, "-s", str(seed), "-o", out_file] + profiles[profile_name]
+        start = time.perf_counter()
+        ret = subprocess.run(cmd, cwd=work_dir, stdout=subprocess.DEVNULL, stderr=subprocess.PIPE)
+        latencies.append(time.perf_counter() - start)
+        if ret.returncode != 0:
+            sys.stderr.write("yarpgen failed for profile {}, seed {}:\n{}\n".
+                             format(profile_name, seed, ret.stderr.decode("utf-8", "replace")))
+            sys.exit(-1)
+        with open(out_file, "r") as gen_file:
+            text = gen_file.read()
+        total_bytes += len(text)
+        hashes[(profile_name, seed)] = hashlib.sha256(strip_header(text).encode("utf-8")).hexdigest()
+    return latencies, total_bytes, hashes
+
+
+def bench(yarpgen, seeds, profile_names, manifest_path, update_manifest):
+    if not os.path.isfile(yarpgen):
+        sys.stderr.write("Can't find yarpgen binary: " + yarpgen + "\n")
+        sys.exit(-1)
+
+    all_hashes = collections.OrderedDict()
+    print("{:<12} {:>10} {:>10} {:>10} {:>10}".format("profile", "prog/s", "MB/s", "p50 ms", "p99 ms"))
+    # Run in an empty directory, so the generator doesn't pick up any files
+    # (e.g. function library) relative to the current directory
+    with tempfile.TemporaryDirectory() as work_dir:
+        for profile_name in profile_names:
+            latencies, total_bytes, hashes = run_profile(yarpgen, profile_name, seeds, work_dir)
+            all_hashes.update(hashes)
+            total_time = sum(latencies)
+            print("{:<12} {:>10.2f} {:>10.2f} {:>10.1f} {:>10.1f}".format(
+                profile_name, len(seeds) / total_time, total_bytes / total_time / 1e6,
+                percentile(latencies, 50) * 1e3, percentile(latencies, 99) * 1e3))
+
+    if update_manifest:
+        dump_manifest(manifest_path, all_hashes)
+        print("Manifest was written to " + manifest_path)
+        return 0
+
+    manifest = load_manifest(manifest_path)
+    mismatches = 0
+    missing = 0
+    for key, digest in all_hashes.items():
+        if key not in manifest:
+            missing += 1
+        elif manifest[key] != digest:
+            mismatches += 1
+            print("MISMATCH: profile {}, seed {}".format(key[0], key[1]))
+    if missing:
+        print("{} outputs are not in the manifest".format(missing))
+    if mismatches:
+        print("{} generated programs differ from the manifest".format(mismatches))
+        return 1
+    print("All checked programs match the manifest")
+    return 0
+
+###############################################################################
+
+if __name__ == '__main__':
+    description = 'Benchmark of the generator throughput with the check of output stability'
+    parser = argparse.ArgumentParser(description=description, formatter_class=argparse.ArgumentDefaultsHelpFormatter)
+    parser.add_argument("--yarpgen", dest="yarpgen", default=default_yarpgen, type=str,
+                        help="Path to yarpgen binary")
+    parser.add_argument("--seeds", dest="seeds", default=40, type=int,
+                        help="Size of the seed corpus (seeds 1..N are used)")
+    parser.add_argument("--profiles", dest="profiles", default=" ".join(profiles.keys()), type=str,
+                        help="Option profiles to run. Possible variants are " + str(list(profiles.keys()))[1:-1])
+    parser.add_argument("--manifest", dest="manifest", default=default_manifest, type=str,
+                        help="Manifest with hashes of the generated programs")
+    parser.add_argument("--update-manifest", dest="update_manifest", default=False, action="store_true",
+                        help="Write the hashes to the manifest instead of checking them")
+    args = parser.parse_args()
+
+    chosen_profiles = args.profiles.split()
+    for name in chosen_profiles:
+        if name not in profiles:
+            sys.stderr.write("Unknown profile: " + name + "\n")
+            sys.exit(-1)
+
+    sys.exit(bench(os.path.abspath(args.yarpgen), list(range(1, args.seeds + 1)), chosen_profiles,
+                   args.manifest, args.update_manifest))
@@ -0,0 +1,157 @@
+/*
+Copyright (c) 2015-2020, Intel Corporation
+Copyright (c) 2019-2020, University of Utah
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+//////////////////////////////////////////////////////////////////////////////
+
+#include "yarpgen.h"
+#include "options.h"
+#include "program.h"
+#include "utils.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <new>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace yarpgen;
+
+struct yarpgen_generator {
+    std::vector<std::string> args;
+    std::string error;
+};
+
+// The generator keeps its state in singletons, so only one test can be
+// generated at a time, whatever handle it belongs to. Every generation starts from a reset state, so
+// nothing leaks from one generator (or one call) to another.
+static std::mutex generation_mutex;
+
+// Must be called with generation_mutex held
+static bool applyOptions(yarpgen_generator *gen,
+                         const std::vector<std::string> &extra_args) {
+    std::vector<std::string> args = {"yarpgen"};
+    args.insert(args.end(), gen->args.begin(), gen->args.end());
+    args.insert(args.end(), extra_args.begin(), extra_args.end());
+    std::vector<char *> argv;
+    for (auto &arg : args)
+        argv.push_back(&arg[0]);
+    argv.push_back(nullptr);
+
+    ProgramGenerator::resetGlobalState();
+    OptionParser::setExitOnError(false);
+    try {
+        OptionParser::parse(args.size(), argv.data());
+    }
+    catch (OptionError &e) {
+        gen->error = e.what();
+        return false;
+    }
+    gen->error.clear();
+    return true;
+}
+
+static uint64_t hashText(const std::string &text) {
+    size_t header_end = text.find("*/\n");
+    size_t start = header_end == std::string::npos ? 0 : header_end + 3;
+    uint64_t hash = 14695981039346656037ULL;
+    for (size_t i = start; i < text.size(); ++i) {
+        hash ^= static_cast<unsigned char>(text[i]);
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+extern "C" {
+
+yarpgen_generator *yarpgen_create(int argc, const char *const *argv) {
+    auto gen = new (std::nothrow) yarpgen_generator;
+    if (!gen)
+        return nullptr;
+    for (int i = 0; i < argc; ++i)
+        gen->args.emplace_back(argv[i]);
+    std::lock_guard<std::mutex> lock(generation_mutex);
+    // Check the options right away
+    applyOptions(gen, {});
+    return gen;
+}
+
+void yarpgen_destroy(yarpgen_generator *gen) { delete gen; }
+
+const char *yarpgen_error(yarpgen_generator *gen) {
+    return gen->error.empty() ? nullptr : gen->error.c_str();
+}
+
+int yarpgen_generate(yarpgen_generator *gen, uint64_t seed,
+                     uint64_t mutation_seed, char **test, size_t *size,
+                     yarpgen_metadata *metadata) {
+    std::lock_guard<std::mutex> lock(generation_mutex);
+    std::vector<std::string> extra_args = {"--seed=" + std::to_string(seed)};
+    if (mutation_seed != 0)
+        extra_args.push_back("--mutation-seed=" +
+                             std::to_string(mutation_seed));
+    if (!applyOptions(gen, extra_args))
+        return YARPGEN_ERROR;
+
+    // The seeds are returned in the metadata, stdout belongs to the embedding
+    // application
+    std::ostringstream seeds_log;
+    Options &options = Options::getInstance();
+    ProgramGenerator::initRandValGen(seeds_log);
+
+    ProgramGenerator new_program;
+    ProgramGenerator::CostInfo cost_info = new_program.getCostInfo();
+    if (metadata) {
+        metadata->seed = options.getSeed();
+        metadata->mutation_seed = rand_val_gen->getMutationSeed();
+        metadata->text_hash = 0;
+        metadata->expected_checksum = 0;
+        metadata->has_expected_checksum = 0;
+        metadata->expr_num = cost_info.expr_num;
+        metadata->stmt_num = cost_info.stmt_num;
+        metadata->arrays_num = cost_info.arrays_num;
+        metadata->dynamic_ops = cost_info.dynamic_ops;
+        metadata->compile_cost = cost_info.compile_cost;
+    }
+    if (!new_program.fitsCostBudget()) {
+        gen->error = "Test exceeds the cost budget";
+        return YARPGEN_REJECTED;
+    }
+
+    std::ostringstream stream;
+    new_program.emit(stream);
+    std::string test_str = stream.str();
+    *test = static_cast<char *>(std::malloc(test_str.size() + 1));
+    if (!*test) {
+        gen->error = "Out of memory";
+        return YARPGEN_ERROR;
+    }
+    std::memcpy(*test, test_str.c_str(), test_str.size() + 1);
+    *size = test_str.size();
+    if (metadata) {
+        metadata->text_hash = hashText(test_str);
+        // The checksum is computed while the test is emitted
+        metadata->expected_checksum = new_program.getExpectedChecksum();
+        metadata->has_expected_checksum =
+            options.getCheckAlgo() != CheckAlgo::HASH;
+    }
+    return YARPGEN_OK;
+}
+
+void yarpgen_free_buffer(char *buffer) { std::free(buffer); }
+}
@@ -18,6 +18,7 @@ limitations under the License.
 //////////////////////////////////////////////////////////////////////////////
 #include "context.h"
 
+#include <algorithm>
 #include <utility>
 
 using namespace yarpgen;
@@ -89,6 +90,24 @@ void SymbolTable::addArray(std::shared_ptr<Array> array) {
     array_dim_map[array_type->getDimensions().size()].push_back(array);
 }
 
+void SymbolTable::removeVar(const std::shared_ptr<ScalarVar> &var) {
+    vars.erase(std::remove(vars.begin(), vars.end(), var), vars.end());
+    avail_vars.erase(std::remove_if(avail_vars.begin(), avail_vars.end(),
+                                    [&var](const auto &var_use) {
+                                        return var_use->getValue() == var;
+                                    }),
+                     avail_vars.end());
+}
+
+void SymbolTable::removeArray(const std::shared_ptr<Array> &array) {
+    arrays.erase(std::remove(arrays.begin(), arrays.end(), array),
+                 arrays.end());
+    for (auto &dim_arrays : array_dim_map)
+        dim_arrays.second.erase(std::remove(dim_arrays.second.begin(),
+                                            dim_arrays.second.end(), array),
+                                dim_arrays.second.end());
+}
+
 std::vector<std::shared_ptr<Array>>
 SymbolTable::getArraysWithDimNum(size_t dim) {
     auto find_res = array_dim_map.find(dim);
@@ -36,7 +36,8 @@ namespace yarpgen {
 class EvalCtx {
   public:
     EvalCtx()
-        : total_iter_num(-1), mul_vals_iter(nullptr), use_main_vals(true) {}
+        : total_iter_num(-1), mul_vals_iter(nullptr),
+          lane(Options::main_val_idx), memo_stamp(0) {}
     // TODO: we use string as a unique identifier and it is not a right way to
     // do it
     std::map<std::string, DataType> input;
@@ -47,8 +48,16 @@ class EvalCtx {
 
     // Iterator that is used to iterate over multiple values
     std::shared_ptr<Iterator> mul_vals_iter;
-    // If true, we use main values for evaluation
-    bool use_main_vals;
+    // The lane of multiple values that is used for evaluation
+    size_t lane;
+    // Data that is written by the assignment which is evaluated in all lanes
+    // at once (see Expr::evaluateLanes). The lanes can't be computed together
+    // if the assigned value reads it.
+    std::shared_ptr<Data> lanes_written_data;
+    // The evaluations with the same non-zero stamp see the same values of the
+    // variables, so the values of the subtrees can be reused (see
+    // Expr::isMemoValid). Zero disables it.
+    uint64_t memo_stamp;
 };
 
 class GenCtx {
@@ -133,6 +142,9 @@ class SymbolTable {
   public:
     void addVar(std::shared_ptr<ScalarVar> var) { vars.push_back(var); }
     void addArray(std::shared_ptr<Array> array);
+    // The test reducer removes the variables that are not used anymore
+    void removeVar(const std::shared_ptr<ScalarVar> &var);
+    void removeArray(const std::shared_ptr<Array> &array);
     void addIters(std::shared_ptr<Iterator> iter) { iters.push_back(iter); }
     void deleteLastIters() { iters.pop_back(); }
 
@@ -0,0 +1,108 @@
+/*
+Copyright (c) 2015-2020, Intel Corporation
+Copyright (c) 2019-2020, University of Utah
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+//////////////////////////////////////////////////////////////////////////////
+
+// yarpgen-crash-handler.so is preloaded into the tests by the runner
+// (LD_PRELOAD), so a crashing test reports its own backtrace and the runner
+// doesn't have to re-run it under gdb. On a fatal signal the handler writes
+//   === yarpgen-crash: signal 11 SIGSEGV ===
+//   ./test(+0x1189)[0x55d0c8a5c189]
+//   ...
+//   === yarpgen-crash: end ===
+// to stderr and re-raises the signal, so the exit status stays the same.
+// Only async-signal-safe functions are used in the handler.
+
+#include <csignal>
+#include <cstring>
+
+#include <execinfo.h>
+#include <unistd.h>
+
+namespace {
+
+int constexpr max_frames = 32;
+// Stack overflows are handled on the alternative stack
+char alt_stack[1 << 16];
+
+struct FatalSignal {
+    int sig;
+    const char *name;
+};
+
+FatalSignal const fatal_signals[] = {{SIGSEGV, "SIGSEGV"}, {SIGBUS, "SIGBUS"},
+                                     {SIGFPE, "SIGFPE"},   {SIGILL, "SIGILL"},
+                                     {SIGABRT, "SIGABRT"}, {SIGTRAP, "SIGTRAP"}};
+
+void writeStr(const char *str) {
+    if (write(STDERR_FILENO, str, strlen(str)) == -1) {
+    }
+}
+
+void writeInt(int value) {
+    char buf[16];
+    int pos = sizeof(buf);
+    buf[--pos] = '\0';
+    do {
+        buf[--pos] = static_cast<char>('0' + value % 10);
+        value /= 10;
+    } while (value > 0 && pos > 0);
+    writeStr(buf + pos);
+}
+
+void handleFatalSignal(int sig) {
+    const char *name = "UNKNOWN";
+    for (auto &fatal : fatal_signals)
+        if (fatal.sig == sig)
+            name = fatal.name;
+    writeStr("=== yarpgen-crash: signal ");
+    writeInt(sig);
+    writeStr(" ");
+    writeStr(name);
+    writeStr(" ===\n");
+
+    void *frames[max_frames];
+    int frames_num = backtrace(frames, max_frames);
+    // The first two frames are the handler and the signal trampoline
+    int skip = frames_num > 2 ? 2 : 0;
+    backtrace_symbols_fd(frames + skip, frames_num - skip, STDERR_FILENO);
+    writeStr("=== yarpgen-crash: end ===\n");
+
+    signal(sig, SIG_DFL);
+    raise(sig);
+}
+
+__attribute__((constructor)) void installCrashHandler() {
+    // backtrace() loads libgcc on the first call, which is not safe in a
+    // signal handler, so it is done here
+    void *frame;
+    backtrace(&frame, 1);
+
+    stack_t stack{};
+    stack.ss_sp = alt_stack;
+    stack.ss_size = sizeof(alt_stack);
+    sigaltstack(&stack, nullptr);
+
+    struct sigaction action {};
+    action.sa_handler = handleFatalSignal;
+    sigemptyset(&action.sa_mask);
+    action.sa_flags = SA_ONSTACK | SA_RESETHAND;
+    for (auto &fatal : fatal_signals)
+        sigaction(fatal.sig, &action, nullptr);
+}
+
+} // namespace
@@ -124,8 +124,11 @@ void Array::dbgDump() {
     if (mul_vals_axis_idx != -1) {
         std::cout << "Multiple vals axis idx: " << mul_vals_axis_idx
                   << std::endl;
-        std::cout << "Second init: " << init_vals.back() << std::endl;
-        std::cout << "Second cur: " << cur_vals.back() << std::endl;
+        size_t vals_number = Options::getInstance().getValsNumber();
+        for (size_t i = 1; i < vals_number; ++i) {
+            std::cout << "Lane " << i << " init: " << init_vals[i] << std::endl;
+            std::cout << "Lane " << i << " cur: " << cur_vals[i] << std::endl;
+        }
     }
 }
 
@@ -147,27 +150,23 @@ Array::Array(std::string _name, const std::shared_ptr<ArrayType> &_type,
     ub_code = init_vals[Options::main_val_idx].getUBCode();
 }
 
-void Array::setInitValue(IRValue _val, bool use_main_vals,
+void Array::setInitValue(IRValue _val, size_t lane,
                          int64_t _mul_vals_axis_idx) {
     assert(type->isArrayType() && "Array should have array type");
+    assert(lane < Options::max_vals_number && "Lane is out of range");
     auto arr_type = std::static_pointer_cast<ArrayType>(type);
     mul_vals_axis_idx = _mul_vals_axis_idx;
-    init_vals[use_main_vals ? Options::main_val_idx : Options::alt_val_idx] =
-        _val;
-    ub_code =
-        init_vals[use_main_vals ? Options::main_val_idx : Options::alt_val_idx]
-            .getUBCode();
+    init_vals[lane] = _val;
+    ub_code = init_vals[lane].getUBCode();
 }
 
-void Array::setCurrentValue(IRValue _val, bool use_main_vals) {
+void Array::setCurrentValue(IRValue _val, size_t lane) {
     assert(type->isArrayType() && "Array should have array type");
+    assert(lane < Options::max_vals_number && "Lane is out of range");
     auto arr_type = std::static_pointer_cast<ArrayType>(type);
     if (mul_vals_axis_idx != -1) {
-        cur_vals[use_main_vals ? Options::main_val_idx : Options::alt_val_idx] =
-            _val;
-        ub_code = cur_vals[use_main_vals ? Options::main_val_idx
-                                         : Options::alt_val_idx]
-                      .getUBCode();
+        cur_vals[lane] = _val;
+        ub_code = cur_vals[lane].getUBCode();
     }
     else {
         cur_vals[Options::main_val_idx] = _val;
@@ -219,11 +218,17 @@ std::shared_ptr<Array> Array::create(std::shared_ptr<PopulateCtx> ctx,
     mul_vals |= !inp && ctx->getMulValsIter() != nullptr;
 
     if (mul_vals) {
-        init_val = rand_val_gen->getRandValue(int_type->getIntTypeId());
+        std::vector<IRValue> lane_init_vals;
+        size_t vals_number = Options::getInstance().getValsNumber();
+        for (size_t i = 1; i < vals_number; ++i)
+            lane_init_vals.push_back(
+                rand_val_gen->getRandValue(int_type->getIntTypeId()));
         auto mul_val_idx = static_cast<int64_t>(rand_val_gen->getRandValue(
             static_cast<size_t>(0), array_type->getDimensions().size() - 1));
-        new_array->setInitValue(init_val, false, mul_val_idx);
-        new_array->setCurrentValue(init_val, false);
+        for (size_t i = 1; i < vals_number; ++i) {
+            new_array->setInitValue(lane_init_vals.at(i - 1), i, mul_val_idx);
+            new_array->setCurrentValue(lane_init_vals.at(i - 1), i);
+        }
     }
     return new_array;
 }
@@ -319,12 +324,15 @@ std::shared_ptr<Iterator> Iterator::create(std::shared_ptr<PopulateCtx> ctx,
         nh.getIterName(), type, start, left_span, end, right_span, step,
         end_val == left_span, total_iters_num);
 
-    bool supports_mul_vals = step_val % 2 != Options::main_val_idx ||
-                             left_span % 2 != Options::main_val_idx;
+    // The lane of the values is the iterator value modulo the number of
+    // lanes, so the iterator has to reach other lanes than the main one
+    size_t vals_number = Options::getInstance().getValsNumber();
+    bool supports_mul_vals = step_val % vals_number != Options::main_val_idx ||
+                             left_span % vals_number != Options::main_val_idx;
     if (supports_mul_vals) {
         iter->setSupportsMulValues(supports_mul_vals);
         size_t last_val = (total_iters_num - 1) * step_val + left_span;
-        iter->setMainValsOnLastIter(last_val % 2 == Options::main_val_idx);
+        iter->setLastIterLane(last_val % vals_number);
     }
 
     return iter;
@@ -173,19 +173,18 @@ class Array : public Data {
   public:
     Array(std::string _name, const std::shared_ptr<ArrayType> &_type,
           IRValue _val);
-    IRValue getInitValues(bool use_main_vals) {
-        return mul_vals_axis_idx == -1 || use_main_vals
-                   ? init_vals[Options::main_val_idx]
-                   : init_vals[Options::alt_val_idx];
+    // Values of the lane (see Options::max_vals_number). The arrays with
+    // uniform values have only the main lane.
+    IRValue getInitValues(size_t lane) {
+        return init_vals[mul_vals_axis_idx == -1 ? Options::main_val_idx
+                                                 : lane];
     }
-    IRValue getCurrentValues(bool use_main_vals) {
-        return mul_vals_axis_idx == -1 || use_main_vals
-                   ? cur_vals[Options::main_val_idx]
-                   : cur_vals[Options::alt_val_idx];
+    IRValue getCurrentValues(size_t lane) {
+        return cur_vals[mul_vals_axis_idx == -1 ? Options::main_val_idx
+                                                : lane];
     }
-    void setInitValue(IRValue _val, bool use_main_vals,
-                      int64_t mul_val_axis_idx);
-    void setCurrentValue(IRValue _val, bool use_main_vals);
+    void setInitValue(IRValue _val, size_t lane, int64_t mul_val_axis_idx);
+    void setCurrentValue(IRValue _val, size_t lane);
     int64_t getMulValsAxisIdx() { return mul_vals_axis_idx; }
 
     bool isArray() final { return true; }
@@ -215,8 +214,9 @@ class Array : public Data {
 
     // Span of initialization value can always be determined from array
     // dimensions and current value span
-    std::array<IRValue, Options::vals_number> init_vals;
-    std::array<IRValue, Options::vals_number> cur_vals;
+    // Only the first Options::getValsNumber() lanes are used
+    std::array<IRValue, Options::max_vals_number> init_vals;
+    std::array<IRValue, Options::max_vals_number> cur_vals;
     // We use int64_t to use negative values as poison values that
     // indicate that the values are uniform
     int64_t mul_vals_axis_idx;
@@ -236,7 +236,8 @@ class Iterator : public Data {
           max_left_offset(_max_left_offset), end(std::move(_end)),
           max_right_offset(_max_right_offset), step(std::move(_step)),
           degenerate(_degenerate), total_iters_num(_total_iters_num),
-          supports_mul_values(false), main_vals_on_last_iter(true) {}
+          supports_mul_values(false),
+          last_iter_lane(Options::main_val_idx) {}
 
     bool isIterator() final { return true; }
     DataKind getKind() final { return DataKind::ITER; }
@@ -255,10 +256,8 @@ class Iterator : public Data {
         supports_mul_values = _supports_mul_values;
     }
     bool getSupportsMulValues() { return supports_mul_values; }
-    void setMainValsOnLastIter(bool _main_vals_on_last_iter) {
-        main_vals_on_last_iter = _main_vals_on_last_iter;
-    }
-    bool getMainValsOnLastIter() { return main_vals_on_last_iter; }
+    void setLastIterLane(size_t _lane) { last_iter_lane = _lane; }
+    size_t getLastIterLane() { return last_iter_lane; }
 
     void dbgDump() final;
 
@@ -285,9 +284,8 @@ class Iterator : public Data {
     size_t total_iters_num;
     // A flag that indicates whether the iterator supports multiple values
     bool supports_mul_values;
-    // A flag that indicates whether the iterator has main values on the last
-    // iteration
-    bool main_vals_on_last_iter;
+    // The lane of the values on the last iteration
+    size_t last_iter_lane;
 };
 
 } // namespace yarpgen
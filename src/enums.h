@@ -203,6 +203,21 @@ enum class OptionKind {
     MUTATE,
     MUTATION_SEED,
     UB_IN_DC,
+    VALS_NUMBER,
+    HASH_CONS,
+    MAX_RUN_COST,
+    MAX_COMPILE_COST,
+    COST_WEIGHTS,
+    COST_SIDECAR,
+    MAX_DYNAMIC_OPS,
+    PERF_REPS,
+    SERVE,
+    SERVE_WORKERS,
+    REDUCE,
+    REDUCE_JOBS,
+    FUNC_LIB,
+    FUNC_BATCH,
+    SAVE_FUNC_LIB,
     MAX_OPTION_ID
 };
 
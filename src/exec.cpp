@@ -0,0 +1,357 @@
+/*
+Copyright (c) 2015-2020, Intel Corporation
+Copyright (c) 2019-2020, University of Utah
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+//////////////////////////////////////////////////////////////////////////////
+
+// yarpgen-exec is a native executor of compile and run jobs for the test
+// runner. It reads one JSON request per line from stdin:
+//   {"id": "1", "cmd": ["g++", "-O2", "t.cpp", "-o", "t"], "cwd": "cases",
+//    "timeout": 60, "mem_limit": 0, "cpu_limit": 0, "input": ""}
+// and writes one JSON result per line to stdout when the job finishes:
+//   {"id": "1", "status": "exited", "exit_code": 0, "signal": 0,
+//    "wall_time": 0.52, "user_time": 0.47, "sys_time": 0.04,
+//    "max_rss": 81234, "stdout": "...", "stderr": "..."}
+// Only "cmd" is required. Jobs run concurrently (at most --jobs=N at once, the
+// number of CPUs by default), so results can come in any order. Status is one
+// of "exited", "signaled", "timeout", "spawn_error" (with an "error" field),
+// "skipped" or "bad_request". The executor exits when stdin is closed and all
+// jobs are finished.
+//
+// A request can also describe a node of a job graph:
+//   {"id": "t1-run-O2", "cmd": ["./t1-O2"], "deps": ["t1-compile-O2"],
+//    "priority": 1}
+// The job starts only after all of its dependencies have exited with zero
+// exit code and is skipped if any of them has failed. Ready jobs with smaller
+// priority are started first (see JobScheduler). Ids of the jobs in a graph
+// should be unique. A dependency has to be submitted before the job and its
+// result must not be dropped yet, otherwise the job is a bad request. A job
+// can declare how many jobs will list it in their deps ("dependents": 1); its
+// result is dropped when all of them have seen it. Without the field the
+// result is kept until the executor exits.
+//
+// Zero-disk mode: every "{memfd:NAME}" in "cmd" is replaced with a path of
+// the in-memory file NAME (see MemFileRegistry), e.g. a compile job
+//   {"id": "c", "cmd": ["g++", "t.cpp", "-o", "{memfd:t}"]}
+// and a run job {"id": "r", "cmd": ["{memfd:t}"], "deps": ["c"]}. The files
+// are managed with operations, which are answered with "done" or "error":
+//   {"id": "s", "op": "save", "name": "t", "path": "/tmp/t"}
+//   {"id": "f", "op": "release", "names": ["t"]}
+
+#include "process.h"
+#include "scheduler.h"
+#include "utils.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "yaml-cpp/yaml.h"
+
+using namespace yarpgen;
+
+static std::string escapeJson(const std::string &str) {
+    std::ostringstream res;
+    for (unsigned char c : str) {
+        switch (c) {
+            case '"':
+                res << "\\\"";
+                break;
+            case '\\':
+                res << "\\\\";
+                break;
+            case '\n':
+                res << "\\n";
+                break;
+            case '\r':
+                res << "\\r";
+                break;
+            case '\t':
+                res << "\\t";
+                break;
+            default:
+                if (c < 0x20)
+                    res << "\\u" << std::hex << std::setw(4)
+                        << std::setfill('0') << static_cast<int>(c)
+                        << std::dec;
+                else
+                    res << c;
+        }
+    }
+    return res.str();
+}
+
+// Writer of the results. stdout is non-blocking: the lines that the reader
+// hasn't taken yet are kept and written when stdout becomes writable, so a
+// slow reader doesn't stall the event loop (and the timeouts of the jobs).
+class ResultWriter {
+  public:
+    explicit ResultWriter(ProcessExecutor &_executor)
+        : executor(_executor), watched(false) {
+        fcntl(STDOUT_FILENO, F_SETFL,
+              fcntl(STDOUT_FILENO, F_GETFL) | O_NONBLOCK);
+    }
+
+    void writeLine(const std::string &line) {
+        pending.append(line);
+        if (!watched)
+            flush();
+    }
+    bool hasPending() { return !pending.empty(); }
+
+  private:
+    void flush() {
+        size_t pos = 0;
+        while (pos < pending.size()) {
+            ssize_t len = write(STDOUT_FILENO, pending.data() + pos,
+                                pending.size() - pos);
+            if (len > 0) {
+                pos += len;
+                continue;
+            }
+            if (len == -1 && errno == EINTR)
+                continue;
+            if (len == -1 && errno == EAGAIN)
+                break;
+            ERROR(std::string("Can't write the result: ") + strerror(errno));
+        }
+        pending.erase(0, pos);
+
+        if (!pending.empty() && !watched) {
+            executor.watchFd(
+                STDOUT_FILENO, [this]() { flush(); }, /*writable*/ true);
+            watched = true;
+        }
+        else if (pending.empty() && watched) {
+            executor.unwatchFd(STDOUT_FILENO);
+            watched = false;
+        }
+    }
+
+    ProcessExecutor &executor;
+    std::string pending;
+    bool watched;
+};
+
+static void reportResult(ResultWriter &writer, const ProcessResult &result) {
+    std::ostringstream line;
+    line << "{\"id\": \"" << escapeJson(result.id) << "\", \"status\": \""
+         << statusToStr(result.status) << "\"";
+    if (result.status == ProcessStatus::SPAWN_ERROR)
+        line << ", \"error\": \"" << escapeJson(result.error) << "\"";
+    line << ", \"exit_code\": " << result.exit_code
+         << ", \"signal\": " << result.signal
+         << ", \"wall_time\": " << result.wall_time
+         << ", \"user_time\": " << result.user_time
+         << ", \"sys_time\": " << result.sys_time
+         << ", \"max_rss\": " << result.max_rss << ", \"stdout\": \""
+         << escapeJson(result.out) << "\", \"stderr\": \""
+         << escapeJson(result.err) << "\"}\n";
+    writer.writeLine(line.str());
+}
+
+static void reportBadRequest(ResultWriter &writer, const std::string &id,
+                             const std::string &error) {
+    writer.writeLine("{\"id\": \"" + escapeJson(id) +
+                     "\", \"status\": \"bad_request\", \"error\": \"" +
+                     escapeJson(error) + "\"}\n");
+}
+
+static void reportOpResult(ResultWriter &writer, const std::string &id,
+                           bool success, const std::string &error) {
+    if (!success) {
+        writer.writeLine("{\"id\": \"" + escapeJson(id) +
+                         "\", \"status\": \"error\", \"error\": \"" +
+                         escapeJson(error) + "\"}\n");
+        return;
+    }
+    writer.writeLine("{\"id\": \"" + escapeJson(id) +
+                     "\", \"status\": \"done\"}\n");
+}
+
+// Operations on in-memory files. They are executed immediately, so the
+// runner sends them only when the jobs that use the files are finished.
+static void runOp(const YAML::Node &node, const std::string &id,
+                  MemFileRegistry &mem_files, ResultWriter &writer) {
+    std::string op = node["op"].as<std::string>();
+    std::string error;
+    if (op == "release" && node["names"] && node["names"].IsSequence()) {
+        for (const auto &name : node["names"])
+            mem_files.release(name.as<std::string>());
+        reportOpResult(writer, id, true, "");
+    }
+    else if (op == "save" && node["name"] && node["path"]) {
+        bool success = mem_files.save(node["name"].as<std::string>(),
+                                      node["path"].as<std::string>(), error);
+        reportOpResult(writer, id, success, error);
+    }
+    else
+        reportBadRequest(writer, id, "Unknown operation " + op);
+}
+
+// JSON is a subset of YAML, so we reuse yaml-cpp for the requests.
+// Returns false if the request is malformed or if it was an operation.
+static bool parseRequest(const std::string &line, MemFileRegistry &mem_files,
+                         ResultWriter &writer, ProcessRequest &request,
+                         std::vector<std::string> &deps, int64_t &priority,
+                         int64_t &dependents_num,
+                         std::string &error) {
+    try {
+        YAML::Node node = YAML::Load(line);
+        if (!node.IsMap()) {
+            error = "Request should be a JSON object";
+            return false;
+        }
+        if (node["id"])
+            request.id = node["id"].as<std::string>();
+        if (node["op"]) {
+            runOp(node, request.id, mem_files, writer);
+            return false;
+        }
+        if (!node["cmd"] || !node["cmd"].IsSequence()) {
+            error = "Request should have a \"cmd\" list";
+            return false;
+        }
+        for (const auto &arg : node["cmd"])
+            request.cmd.push_back(mem_files.substitute(arg.as<std::string>()));
+        if (node["cwd"])
+            request.cwd = node["cwd"].as<std::string>();
+        if (node["timeout"])
+            request.timeout = node["timeout"].as<double>();
+        if (node["mem_limit"])
+            request.mem_limit = node["mem_limit"].as<uint64_t>();
+        if (node["cpu_limit"])
+            request.cpu_limit = node["cpu_limit"].as<uint64_t>();
+        if (node["input"])
+            request.input = node["input"].as<std::string>();
+        if (node["deps"]) {
+            if (!node["deps"].IsSequence()) {
+                error = "\"deps\" should be a list";
+                return false;
+            }
+            for (const auto &dep : node["deps"])
+                deps.push_back(dep.as<std::string>());
+        }
+        if (node["priority"])
+            priority = node["priority"].as<int64_t>();
+        if (node["dependents"])
+            dependents_num = node["dependents"].as<int64_t>();
+    }
+    catch (YAML::Exception &e) {
+        error = e.what();
+        return false;
+    }
+    return true;
+}
+
+static std::string getSelfPath() {
+    char buf[4096];
+    ssize_t len = readlink("/proc/self/exe", buf, sizeof(buf) - 1);
+    if (len == -1)
+        ERROR(std::string("Can't find the executable: ") + strerror(errno));
+    return std::string(buf, len);
+}
+
+int main(int argc, char *argv[]) {
+    if (argc > 1 && std::string(argv[1]) == "--limited")
+        ProcessExecutor::execLimited(argc - 2, argv + 2);
+    size_t max_parallel = std::max(1U, std::thread::hardware_concurrency());
+    std::string jobs_prefix = "--jobs=";
+    if (argc == 2 && std::string(argv[1]).rfind(jobs_prefix, 0) == 0) {
+        max_parallel = std::strtoul(argv[1] + jobs_prefix.size(), nullptr, 10);
+    }
+    else if (argc > 1) {
+        std::cerr << "Usage: " << argv[0] << " [--jobs=N] < requests"
+                  << std::endl;
+        std::cerr << "Executes jobs described by JSON lines from stdin"
+                  << std::endl;
+        return -1;
+    }
+
+    ProcessExecutor executor(getSelfPath());
+    JobScheduler scheduler(executor, max_parallel);
+    MemFileRegistry mem_files;
+    ResultWriter writer(executor);
+    auto report_result = [&writer](const ProcessResult &result) {
+        reportResult(writer, result);
+    };
+    std::string in_buf;
+    bool input_closed = false;
+    fcntl(STDIN_FILENO, F_SETFL, fcntl(STDIN_FILENO, F_GETFL) | O_NONBLOCK);
+
+    auto read_requests = [&]() {
+        char buf[65536];
+        while (true) {
+            ssize_t len = read(STDIN_FILENO, buf, sizeof(buf));
+            if (len > 0) {
+                in_buf.append(buf, len);
+                continue;
+            }
+            if (len == -1 && errno == EINTR)
+                continue;
+            if (len == -1 && errno == EAGAIN)
+                break;
+            input_closed = true;
+            executor.unwatchFd(STDIN_FILENO);
+            break;
+        }
+
+        size_t line_end;
+        while ((line_end = in_buf.find('\n')) != std::string::npos) {
+            std::string line = in_buf.substr(0, line_end);
+            in_buf.erase(0, line_end + 1);
+            if (line.find_first_not_of(" \t\r") == std::string::npos)
+                continue;
+            ProcessRequest request;
+            std::vector<std::string> deps;
+            int64_t priority = 0;
+            int64_t dependents_num = JobScheduler::unknown_dependents_num;
+            std::string error;
+            bool parsed = parseRequest(line, mem_files, writer, request, deps,
+                                       priority, dependents_num, error);
+            if (parsed && scheduler.submit(request, deps, priority,
+                                           dependents_num, report_result,
+                                           error))
+                continue;
+            if (!error.empty())
+                reportBadRequest(writer, request.id, error);
+        }
+    };
+
+    executor.watchFd(STDIN_FILENO, read_requests);
+    while (!input_closed || scheduler.getPendingNum() > 0 ||
+           writer.hasPending()) {
+        // Dependencies of the remaining jobs will never come
+        if (input_closed && executor.getActiveNum() == 0 &&
+            scheduler.getPendingNum() > 0) {
+            scheduler.skipWaiting();
+            continue;
+        }
+        executor.runOnce(-1);
+    }
+
+    return 0;
+}
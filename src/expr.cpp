@@ -21,8 +21,10 @@ limitations under the License.
 #include "context.h"
 #include "options.h"
 #include <algorithm>
+#include <cctype>
 #include <deque>
 #include <numeric>
+#include <sstream>
 #include <utility>
 
 using namespace yarpgen;
@@ -43,11 +45,130 @@ replaceValueWith(std::shared_ptr<Data> &_value,
     return _new_value;
 }
 
+uint64_t yarpgen::Expr::total_expr_count = 0;
+uint64_t yarpgen::Expr::memo_clock = 0;
+std::unordered_map<ExprKey, std::shared_ptr<Expr>, ExprKeyHasher>
+    yarpgen::Expr::expr_set;
+
 std::shared_ptr<Data> Expr::getValue() {
     // TODO: it might cause some problems in the future, but it is good for now
     return value;
 }
 
+bool Expr::isMemoValid(EvalCtx &ctx, std::initializer_list<Expr *> children) {
+    if (ctx.memo_stamp == 0 || memo_stamp != ctx.memo_stamp ||
+        memo_lane != ctx.lane)
+        return false;
+    for (auto child : children)
+        if (child->getValueTime() > value_time)
+            return false;
+    value = memo_value;
+    return true;
+}
+
+void Expr::setMemo(EvalCtx &ctx) {
+    value_time = ++memo_clock;
+    // The types were propagated before the evaluation
+    types_time = value_time;
+    memo_stamp = ctx.memo_stamp;
+    memo_lane = ctx.lane;
+    memo_value = value;
+}
+
+bool Expr::areTypesValid(std::initializer_list<Expr *> children) {
+    if (types_time == 0)
+        return false;
+    for (auto child : children)
+        if (child->getValueTime() > types_time)
+            return false;
+    return true;
+}
+
+const std::shared_ptr<Expr> &Expr::share(const std::shared_ptr<Expr> &child) {
+    child->shared = true;
+    return child;
+}
+
+static uint64_t getTreeSize(std::shared_ptr<Expr> &expr) {
+    uint64_t size = 1;
+    expr->forEachChild(
+        [&size](std::shared_ptr<Expr> &child) { size += getTreeSize(child); });
+    return size;
+}
+
+std::shared_ptr<Expr> Expr::copyTree() {
+    // copy() counts only the new node, the children that it shares are
+    // counted as if they were copied too
+    auto self = copy();
+    self->forEachChild([](std::shared_ptr<Expr> &child) {
+        total_expr_count += getTreeSize(child);
+    });
+    return self;
+}
+
+Expr::EvalResType Expr::rebuildChild(std::shared_ptr<Expr> &child,
+                                     EvalCtx &ctx) {
+    if (child->shared) {
+        if (child->shows_subtree_ub) {
+            EvalResType eval_res = child->evaluate(ctx);
+            if (!eval_res->hasUB())
+                return eval_res;
+        }
+        // The shared node is counted already (by copyTree() for the lane
+        // trees), the copy only replaces it
+        child = child->copy();
+        --total_expr_count;
+    }
+    return child->rebuild(ctx);
+}
+
+void Expr::unshare(std::shared_ptr<Expr> &expr) {
+    if (expr->shared) {
+        // The copy keeps the value for the parts of the tree that aren't
+        // evaluated again (e.g. the branches that aren't taken)
+        auto old_value = expr->value;
+        expr = expr->copy();
+        expr->value = old_value;
+    }
+    expr->forEachChild(unshare);
+}
+
+std::shared_ptr<Expr> Expr::intern(std::shared_ptr<Expr> expr) {
+    auto key = expr->getKey();
+    if (key == nullptr)
+        return expr;
+    // The new expression creates the type casts of its operands anyway, so
+    // the count of the created expressions doesn't depend on the sharing
+    expr->propagateType();
+    // Folding set lookup
+    auto find_result = expr_set.find(*key);
+    if (find_result != expr_set.end())
+        return find_result->second;
+    // The first tree that uses the expression doesn't own it either
+    expr->shared = true;
+    expr_set.emplace(std::move(*key), expr);
+    return expr;
+}
+
+void Expr::setShowsSubtreeUB(std::initializer_list<Expr *> children) {
+    shows_subtree_ub = true;
+    for (auto child : children)
+        shows_subtree_ub &= child->shows_subtree_ub;
+}
+
+bool Expr::LaneValues::hasUB() const {
+    size_t vals_number = Options::getInstance().getValsNumber();
+    return std::any_of(ub_codes.begin(), ub_codes.begin() + vals_number,
+                       [](UBKind ub) { return ub != UBKind::NoUB; });
+}
+
+void Expr::setUniformLanes(LaneValues &lanes) {
+    assert(value->isScalarVar() && "Only scalar values can be split in lanes");
+    lanes.vals.fill(
+        std::static_pointer_cast<ScalarVar>(value)->getCurrentValue());
+    lanes.ub_codes.fill(value->getUBCode());
+}
+
 std::vector<std::shared_ptr<ConstantExpr>> yarpgen::ConstantExpr::used_consts;
 
 ConstantExpr::ConstantExpr(IRValue _value) {
@@ -55,12 +176,18 @@ ConstantExpr::ConstantExpr(IRValue _value) {
     // variable
     value = std::make_shared<ScalarVar>(
         "", IntegralType::init(_value.getIntTypeID()), _value);
+    setShowsSubtreeUB({});
 }
 
 Expr::EvalResType ConstantExpr::evaluate(EvalCtx &ctx) { return value; }
 
 Expr::EvalResType ConstantExpr::rebuild(EvalCtx &ctx) { return evaluate(ctx); }
 
+bool ConstantExpr::evaluateLanes(EvalCtx &ctx, LaneValues &lanes) {
+    setUniformLanes(lanes);
+    return true;
+}
+
 void ConstantExpr::emit(std::shared_ptr<EmitCtx> ctx, std::ostream &stream,
                         std::string offset) {
     assert(value->isScalarVar() &&
@@ -286,8 +413,11 @@ void ScalarVarUseExpr::setValue(std::shared_ptr<Expr> _expr) {
     if (value->getType() != new_val->getType())
         ERROR("Can't assign different types!");
 
-    std::static_pointer_cast<ScalarVar>(value)->setCurrentValue(
-        std::static_pointer_cast<ScalarVar>(new_val)->getCurrentValue());
+    setValue(std::static_pointer_cast<ScalarVar>(new_val)->getCurrentValue());
+}
+
+void ScalarVarUseExpr::setValue(IRValue _val) {
+    std::static_pointer_cast<ScalarVar>(value)->setCurrentValue(_val);
 }
 
 Expr::EvalResType ScalarVarUseExpr::evaluate(EvalCtx &ctx) {
@@ -302,6 +432,14 @@ Expr::EvalResType ScalarVarUseExpr::rebuild(EvalCtx &ctx) {
     return evaluate(ctx);
 }
 
+bool ScalarVarUseExpr::evaluateLanes(EvalCtx &ctx, LaneValues &lanes) {
+    evaluate(ctx);
+    if (value == ctx.lanes_written_data)
+        return false;
+    setUniformLanes(lanes);
+    return true;
+}
+
 std::shared_ptr<ScalarVarUseExpr>
 ScalarVarUseExpr::create(std::shared_ptr<PopulateCtx> ctx) {
     auto avail_vars = ctx->getExtInpSymTable()->getAvailVars();
@@ -324,7 +462,7 @@ std::shared_ptr<ArrayUseExpr> ArrayUseExpr::init(std::shared_ptr<Data> _val) {
     return ret;
 }
 
-void ArrayUseExpr::setValue(std::shared_ptr<Expr> _expr, bool main_val) {
+void ArrayUseExpr::setValue(std::shared_ptr<Expr> _expr, size_t lane) {
     /*
     std::shared_ptr<Data> new_val = _expr->getValue();
     assert(new_val->isArray() && "ArrayUseExpr can store only Arrays");
@@ -333,12 +471,16 @@ void ArrayUseExpr::setValue(std::shared_ptr<Expr> _expr, bool main_val) {
         ERROR("Can't assign incompatible types");
     }
     */
-    auto arr_val = std::static_pointer_cast<Array>(value);
     if (!_expr->getValue()->isScalarVar())
         ERROR("Only scalar variables are supported for now");
     auto expr_scalar_var =
         std::static_pointer_cast<ScalarVar>(_expr->getValue());
-    arr_val->setCurrentValue(expr_scalar_var->getCurrentValue(), main_val);
+    setValue(expr_scalar_var->getCurrentValue(), lane);
+}
+
+void ArrayUseExpr::setValue(IRValue _val, size_t lane) {
+    auto arr_val = std::static_pointer_cast<Array>(value);
+    arr_val->setCurrentValue(_val, lane);
 }
 
 Expr::EvalResType ArrayUseExpr::evaluate(EvalCtx &ctx) {
@@ -401,6 +543,7 @@ TypeCastExpr::TypeCastExpr(std::shared_ptr<Expr> _expr,
     if (!to_type->isUniform())
         to_int_type->makeVarying();
     value = std::make_shared<TypedData>(to_int_type);
+    setShowsSubtreeUB({expr.get()});
 }
 
 bool TypeCastExpr::propagateType() {
@@ -438,6 +581,8 @@ TypeCastExpr::create(std::shared_ptr<PopulateCtx> ctx) {
 }
 
 Expr::EvalResType TypeCastExpr::evaluate(EvalCtx &ctx) {
+    if (isMemoValid(ctx, {expr.get()}))
+        return value;
     EvalResType expr_eval_res = expr->evaluate(ctx);
     std::shared_ptr<Type> base_type = expr_eval_res->getType();
     // Check that we try to convert between compatible types.
@@ -468,12 +613,13 @@ Expr::EvalResType TypeCastExpr::evaluate(EvalCtx &ctx) {
         // TODO: extend it
         ERROR("We can cast only integer scalar variables for now");
     }
+    setMemo(ctx);
     return value;
 }
 
 Expr::EvalResType TypeCastExpr::rebuild(EvalCtx &ctx) {
     propagateType();
-    expr->rebuild(ctx);
+    rebuildChild(expr, ctx);
     std::shared_ptr<Data> eval_res = evaluate(ctx);
     assert(eval_res->getKind() == DataKind::VAR &&
            "Type Cast operations are only supported for Scalar Variables");
@@ -496,9 +642,43 @@ Expr::EvalResType TypeCastExpr::rebuild(EvalCtx &ctx) {
     return value;
 }
 
+bool TypeCastExpr::evaluateLanes(EvalCtx &ctx, LaneValues &lanes) {
+    LaneValues expr_lanes;
+    if (!expr->evaluateLanes(ctx, expr_lanes))
+        return false;
+    std::shared_ptr<Type> base_type = expr->getValue()->getType();
+    if (!base_type->isIntType() || !to_type->isIntType())
+        ERROR("We can cast only integer scalar variables for now");
+
+    std::shared_ptr<IntegralType> to_int_type =
+        std::static_pointer_cast<IntegralType>(to_type);
+    Options &options = Options::getInstance();
+    if (options.isISPC() && to_int_type->isUniform() &&
+        !base_type->isUniform())
+        ERROR("Can't cast varying to uniform");
+
+    size_t vals_number = options.getValsNumber();
+    for (size_t i = 0; i < vals_number; ++i) {
+        lanes.vals[i] =
+            expr_lanes.vals[i].castToType(to_int_type->getIntTypeId());
+        lanes.ub_codes[i] = lanes.vals[i].getUBCode();
+    }
+
+    auto scalar_val = std::make_shared<ScalarVar>(
+        "", to_int_type, IRValue(to_int_type->getIntTypeId()));
+    scalar_val->setCurrentValue(lanes.vals[Options::main_val_idx]);
+    value = replaceValueWith(value, scalar_val);
+    return true;
+}
+
 std::shared_ptr<Expr> TypeCastExpr::copy() {
-    auto new_expr = expr->copy();
-    return std::make_shared<TypeCastExpr>(new_expr, to_type, is_implicit);
+    return std::make_shared<TypeCastExpr>(share(expr), to_type, is_implicit);
+}
+
+std::shared_ptr<ExprKey> TypeCastExpr::getKey() {
+    return std::make_shared<ExprKey>(
+        getKind(), is_implicit, to_type,
+        std::vector<std::shared_ptr<Expr>>{expr});
 }
 
 std::shared_ptr<Expr> ArithmeticExpr::integralProm(std::shared_ptr<Expr> arg) {
@@ -1230,7 +1410,11 @@ std::shared_ptr<Expr> ArithmeticExpr::create(std::shared_ptr<PopulateCtx> ctx) {
         new_node = BinaryExpr::create(active_ctx);
     }
     else if (node_kind == IRNodeKind::CALL) {
-        new_node = LibCallExpr::create(active_ctx);
+        if (InjectedCallExpr::hasFunctions() &&
+            rand_val_gen->getRandId(gen_pol->injected_call_prob))
+            new_node = InjectedCallExpr::create(active_ctx);
+        else
+            new_node = LibCallExpr::create(active_ctx);
     }
     else if (node_kind == IRNodeKind::TERNARY) {
         new_node = TernaryExpr::create(active_ctx);
@@ -1257,11 +1441,17 @@ std::shared_ptr<Expr> ArithmeticExpr::create(std::shared_ptr<PopulateCtx> ctx) {
             new_node->rebuild(eval_ctx);
         }
     }
+    // Identical operands are shared. The root is rebuilt in place, so it
+    // always stays unique.
+    else if (Options::getInstance().getHashCons())
+        new_node = intern(new_node);
 
     return new_node;
 }
 
 bool UnaryExpr::propagateType() {
+    if (areTypesValid({arg.get()}))
+        return true;
     arg->propagateType();
     switch (op) {
         case UnaryOp::PLUS:
@@ -1277,33 +1467,41 @@ bool UnaryExpr::propagateType() {
             break;
     }
     value = std::make_shared<TypedData>(arg->getValue()->getType());
+    setTypesValid();
     return true;
 }
 
-Expr::EvalResType UnaryExpr::evaluate(EvalCtx &ctx) {
-    propagateType();
-    EvalResType eval_res = arg->evaluate(ctx);
-    assert(eval_res->getKind() == DataKind::VAR &&
-           "Unary operations are supported for Scalar Variables only");
-    auto scalar_arg = std::static_pointer_cast<ScalarVar>(arg->getValue());
+static IRValue applyUnaryOp(UnaryOp op, IRValue arg_val) {
     IRValue new_val;
     switch (op) {
         case UnaryOp::PLUS:
-            new_val = +scalar_arg->getCurrentValue();
+            new_val = +arg_val;
             break;
         case UnaryOp::NEGATE:
-            new_val = -scalar_arg->getCurrentValue();
+            new_val = -arg_val;
             break;
         case UnaryOp::LOG_NOT:
-            new_val = !scalar_arg->getCurrentValue();
+            new_val = !arg_val;
             break;
         case UnaryOp::BIT_NOT:
-            new_val = ~scalar_arg->getCurrentValue();
+            new_val = ~arg_val;
             break;
         case UnaryOp::MAX_UN_OP:
             ERROR("Bad unary operator");
             break;
     }
+    return new_val;
+}
+
+Expr::EvalResType UnaryExpr::evaluate(EvalCtx &ctx) {
+    if (isMemoValid(ctx, {arg.get()}))
+        return value;
+    propagateType();
+    EvalResType eval_res = arg->evaluate(ctx);
+    assert(eval_res->getKind() == DataKind::VAR &&
+           "Unary operations are supported for Scalar Variables only");
+    auto scalar_arg = std::static_pointer_cast<ScalarVar>(arg->getValue());
+    IRValue new_val = applyUnaryOp(op, scalar_arg->getCurrentValue());
     assert(scalar_arg->getType()->isIntType() &&
            "Unary operations are supported for Scalar Variables of Integral "
            "Types only");
@@ -1314,12 +1512,13 @@ Expr::EvalResType UnaryExpr::evaluate(EvalCtx &ctx) {
             IntegralType::init(new_val.getIntTypeID(), false, CVQualifier::NONE,
                                arg->getValue()->getType()->isUniform()),
             new_val));
+    setMemo(ctx);
     return value;
 }
 
 Expr::EvalResType UnaryExpr::rebuild(EvalCtx &ctx) {
     propagateType();
-    arg->rebuild(ctx);
+    rebuildChild(arg, ctx);
     EvalResType eval_res = evaluate(ctx);
     assert(eval_res->getKind() == DataKind::VAR &&
            "Unary operations are supported for Scalar Variables of Integral "
@@ -1330,6 +1529,7 @@ Expr::EvalResType UnaryExpr::rebuild(EvalCtx &ctx) {
         return value;
     }
 
+    invalidateMemo();
     if (op == UnaryOp::NEGATE) {
         op = UnaryOp::PLUS;
     }
@@ -1349,6 +1549,29 @@ Expr::EvalResType UnaryExpr::rebuild(EvalCtx &ctx) {
     return value;
 }
 
+bool UnaryExpr::evaluateLanes(EvalCtx &ctx, LaneValues &lanes) {
+    propagateType();
+    LaneValues arg_lanes;
+    if (!arg->evaluateLanes(ctx, arg_lanes))
+        return false;
+    size_t vals_number = Options::getInstance().getValsNumber();
+    for (size_t i = 0; i < vals_number; ++i) {
+        lanes.vals[i] = applyUnaryOp(op, arg_lanes.vals[i]);
+        lanes.ub_codes[i] = lanes.vals[i].getUBCode();
+    }
+
+    IRValue &main_val = lanes.vals[Options::main_val_idx];
+    value = replaceValueWith(
+        value,
+        std::make_shared<ScalarVar>(
+            "",
+            IntegralType::init(main_val.getIntTypeID(), false,
+                               CVQualifier::NONE,
+                               arg->getValue()->getType()->isUniform()),
+            main_val));
+    return true;
+}
+
 void UnaryExpr::emit(std::shared_ptr<EmitCtx> ctx, std::ostream &stream,
                      std::string offset) {
     stream << offset << "(";
@@ -1381,14 +1604,23 @@ std::shared_ptr<UnaryExpr> UnaryExpr::create(std::shared_ptr<PopulateCtx> ctx) {
 }
 
 UnaryExpr::UnaryExpr(UnaryOp _op, std::shared_ptr<Expr> _expr)
-    : op(_op), arg(std::move(_expr)) {}
+    : op(_op), arg(std::move(_expr)) {
+    setShowsSubtreeUB({arg.get()});
+}
 
 std::shared_ptr<Expr> UnaryExpr::copy() {
-    auto new_arg = arg->copy();
-    return std::make_shared<UnaryExpr>(op, new_arg);
+    return std::make_shared<UnaryExpr>(op, share(arg));
+}
+
+std::shared_ptr<ExprKey> UnaryExpr::getKey() {
+    return std::make_shared<ExprKey>(getKind(), static_cast<uint32_t>(op),
+                                     nullptr,
+                                     std::vector<std::shared_ptr<Expr>>{arg});
 }
 
 bool BinaryExpr::propagateType() {
+    if (areTypesValid({lhs.get(), rhs.get()}))
+        return true;
     lhs->propagateType();
     rhs->propagateType();
 
@@ -1440,26 +1672,13 @@ bool BinaryExpr::propagateType() {
             std::static_pointer_cast<IntegralType>(bool_type->makeVarying());
     value = std::make_shared<TypedData>(
         result_is_bool ? bool_type : lhs->getValue()->getType());
+    setTypesValid();
 
     return true;
 }
 
-Expr::EvalResType BinaryExpr::evaluate(EvalCtx &ctx) {
-    propagateType();
-    EvalResType lhs_eval_res = lhs->evaluate(ctx);
-    EvalResType rhs_eval_res = rhs->evaluate(ctx);
-
-    if (lhs_eval_res->getKind() != DataKind::VAR ||
-        rhs_eval_res->getKind() != DataKind::VAR) {
-        ERROR("Binary operations are supported only for scalar variables");
-    }
-
-    auto lhs_scalar_var = std::static_pointer_cast<ScalarVar>(lhs_eval_res);
-    auto rhs_scalar_var = std::static_pointer_cast<ScalarVar>(rhs_eval_res);
-
-    IRValue lhs_val = lhs_scalar_var->getCurrentValue();
-    IRValue rhs_val = rhs_scalar_var->getCurrentValue();
-
+static IRValue applyBinaryOp(BinaryOp op, IRValue lhs_val,
+                             IRValue rhs_val) {
     IRValue new_val(lhs_val.getIntTypeID());
 
     switch (op) {
@@ -1521,6 +1740,26 @@ Expr::EvalResType BinaryExpr::evaluate(EvalCtx &ctx) {
             ERROR("Bad operator code");
             break;
     }
+    return new_val;
+}
+
+Expr::EvalResType BinaryExpr::evaluate(EvalCtx &ctx) {
+    if (isMemoValid(ctx, {lhs.get(), rhs.get()}))
+        return value;
+    propagateType();
+    EvalResType lhs_eval_res = lhs->evaluate(ctx);
+    EvalResType rhs_eval_res = rhs->evaluate(ctx);
+
+    if (lhs_eval_res->getKind() != DataKind::VAR ||
+        rhs_eval_res->getKind() != DataKind::VAR) {
+        ERROR("Binary operations are supported only for scalar variables");
+    }
+
+    auto lhs_scalar_var = std::static_pointer_cast<ScalarVar>(lhs_eval_res);
+    auto rhs_scalar_var = std::static_pointer_cast<ScalarVar>(rhs_eval_res);
+
+    IRValue new_val = applyBinaryOp(op, lhs_scalar_var->getCurrentValue(),
+                                    rhs_scalar_var->getCurrentValue());
 
     value = replaceValueWith(
         value,
@@ -1529,13 +1768,14 @@ Expr::EvalResType BinaryExpr::evaluate(EvalCtx &ctx) {
             IntegralType::init(new_val.getIntTypeID(), false, CVQualifier::NONE,
                                lhs->getValue()->getType()->isUniform()),
             new_val));
+    setMemo(ctx);
     return value;
 }
 
 Expr::EvalResType BinaryExpr::rebuild(EvalCtx &ctx) {
     propagateType();
-    lhs->rebuild(ctx);
-    rhs->rebuild(ctx);
+    rebuildChild(lhs, ctx);
+    rebuildChild(rhs, ctx);
     std::shared_ptr<Data> eval_res = evaluate(ctx);
     assert(eval_res->getKind() == DataKind::VAR &&
            "Binary operations are supported only for Scalar Variables");
@@ -1549,6 +1789,7 @@ Expr::EvalResType BinaryExpr::rebuild(EvalCtx &ctx) {
 
     UBKind ub = eval_scalar_res->getCurrentValue().getUBCode();
 
+    invalidateMemo();
     switch (op) {
         case BinaryOp::ADD:
             op = BinaryOp::SUB;
@@ -1677,6 +1918,31 @@ Expr::EvalResType BinaryExpr::rebuild(EvalCtx &ctx) {
     return eval_res;
 }
 
+bool BinaryExpr::evaluateLanes(EvalCtx &ctx, LaneValues &lanes) {
+    propagateType();
+    LaneValues lhs_lanes;
+    LaneValues rhs_lanes;
+    if (!lhs->evaluateLanes(ctx, lhs_lanes) ||
+        !rhs->evaluateLanes(ctx, rhs_lanes))
+        return false;
+    size_t vals_number = Options::getInstance().getValsNumber();
+    for (size_t i = 0; i < vals_number; ++i) {
+        lanes.vals[i] = applyBinaryOp(op, lhs_lanes.vals[i], rhs_lanes.vals[i]);
+        lanes.ub_codes[i] = lanes.vals[i].getUBCode();
+    }
+
+    IRValue &main_val = lanes.vals[Options::main_val_idx];
+    value = replaceValueWith(
+        value,
+        std::make_shared<ScalarVar>(
+            "",
+            IntegralType::init(main_val.getIntTypeID(), false,
+                               CVQualifier::NONE,
+                               lhs->getValue()->getType()->isUniform()),
+            main_val));
+    return true;
+}
+
 void BinaryExpr::emit(std::shared_ptr<EmitCtx> ctx, std::ostream &stream,
                       std::string offset) {
     stream << offset << "((";
@@ -1748,7 +2014,9 @@ void BinaryExpr::emit(std::shared_ptr<EmitCtx> ctx, std::ostream &stream,
 
 BinaryExpr::BinaryExpr(BinaryOp _op, std::shared_ptr<Expr> _lhs,
                        std::shared_ptr<Expr> _rhs)
-    : op(_op), lhs(std::move(_lhs)), rhs(std::move(_rhs)) {}
+    : op(_op), lhs(std::move(_lhs)), rhs(std::move(_rhs)) {
+    setShowsSubtreeUB({lhs.get(), rhs.get()});
+}
 
 std::shared_ptr<BinaryExpr>
 BinaryExpr::create(std::shared_ptr<PopulateCtx> ctx) {
@@ -1760,9 +2028,13 @@ BinaryExpr::create(std::shared_ptr<PopulateCtx> ctx) {
 }
 
 std::shared_ptr<Expr> BinaryExpr::copy() {
-    auto new_lhs = lhs->copy();
-    auto new_rhs = rhs->copy();
-    return std::make_shared<BinaryExpr>(op, new_lhs, new_rhs);
+    return std::make_shared<BinaryExpr>(op, share(lhs), share(rhs));
+}
+
+std::shared_ptr<ExprKey> BinaryExpr::getKey() {
+    return std::make_shared<ExprKey>(
+        getKind(), static_cast<uint32_t>(op), nullptr,
+        std::vector<std::shared_ptr<Expr>>{lhs, rhs});
 }
 
 TernaryExpr::TernaryExpr(std::shared_ptr<Expr> _cond,
@@ -1772,6 +2044,8 @@ TernaryExpr::TernaryExpr(std::shared_ptr<Expr> _cond,
       false_br(std::move(_false_br)) {}
 
 bool TernaryExpr::propagateType() {
+    if (areTypesValid({cond.get(), true_br.get(), false_br.get()}))
+        return true;
     cond->propagateType();
     true_br->propagateType();
     false_br->propagateType();
@@ -1793,11 +2067,14 @@ bool TernaryExpr::propagateType() {
     arithConv(true_br, false_br);
 
     value = std::make_shared<TypedData>(true_br->getValue()->getType());
+    setTypesValid();
 
     return true;
 }
 
 Expr::EvalResType TernaryExpr::evaluate(EvalCtx &ctx) {
+    if (isMemoValid(ctx, {cond.get(), true_br.get(), false_br.get()}))
+        return value;
     propagateType();
     EvalResType cond_eval = cond->evaluate(ctx);
     if (cond_eval->getKind() != DataKind::VAR)
@@ -1807,9 +2084,16 @@ Expr::EvalResType TernaryExpr::evaluate(EvalCtx &ctx) {
         std::static_pointer_cast<ScalarVar>(cond_eval)->getCurrentValue();
 
     if (cond_val.getValueRef<bool>())
-        value = replaceValueWith(value, true_br->evaluate(ctx));
+        selectValue(cond_eval, true_br->evaluate(ctx));
     else
-        value = replaceValueWith(value, false_br->evaluate(ctx));
+        selectValue(cond_eval, false_br->evaluate(ctx));
+
+    setMemo(ctx);
+    return value;
+}
+
+void TernaryExpr::selectValue(EvalResType cond_eval, EvalResType br_eval) {
+    value = replaceValueWith(value, std::move(br_eval));
 
     if (cond_eval->hasUB()) {
         auto scalar_var = std::static_pointer_cast<ScalarVar>(value);
@@ -1819,14 +2103,50 @@ Expr::EvalResType TernaryExpr::evaluate(EvalCtx &ctx) {
             "", std::static_pointer_cast<IntegralType>(scalar_var->getType()),
             scalar_val);
     }
+}
 
-    return value;
+bool TernaryExpr::evaluateLanes(EvalCtx &ctx, LaneValues &lanes) {
+    propagateType();
+    LaneValues cond_lanes;
+    if (!cond->evaluateLanes(ctx, cond_lanes))
+        return false;
+
+    // Only the branches that are taken in some lane are evaluated
+    size_t vals_number = Options::getInstance().getValsNumber();
+    std::array<bool, Options::max_vals_number> cond_vals;
+    bool eval_true_br = false;
+    bool eval_false_br = false;
+    for (size_t i = 0; i < vals_number; ++i) {
+        cond_vals[i] = cond_lanes.vals[i].getValueRef<bool>();
+        eval_true_br |= cond_vals[i];
+        eval_false_br |= !cond_vals[i];
+    }
+    LaneValues true_lanes;
+    LaneValues false_lanes;
+    if ((eval_true_br && !true_br->evaluateLanes(ctx, true_lanes)) ||
+        (eval_false_br && !false_br->evaluateLanes(ctx, false_lanes)))
+        return false;
+
+    for (size_t i = 0; i < vals_number; ++i) {
+        LaneValues &br_lanes = cond_vals[i] ? true_lanes : false_lanes;
+        lanes.vals[i] = br_lanes.vals[i];
+        lanes.ub_codes[i] = br_lanes.ub_codes[i];
+        if (cond_lanes.ub_codes[i] != UBKind::NoUB) {
+            lanes.vals[i].setUBCode(cond_lanes.ub_codes[i]);
+            lanes.ub_codes[i] = cond_lanes.ub_codes[i];
+        }
+    }
+
+    selectValue(cond->getValue(), cond_vals[Options::main_val_idx]
+                                      ? true_br->getValue()
+                                      : false_br->getValue());
+    return true;
 }
 
 Expr::EvalResType TernaryExpr::rebuild(EvalCtx &ctx) {
-    cond->rebuild(ctx);
-    true_br->rebuild(ctx);
-    false_br->rebuild(ctx);
+    rebuildChild(cond, ctx);
+    rebuildChild(true_br, ctx);
+    rebuildChild(false_br, ctx);
     return evaluate(ctx);
 }
 
@@ -1851,10 +2171,8 @@ TernaryExpr::create(std::shared_ptr<PopulateCtx> ctx) {
 }
 
 std::shared_ptr<Expr> TernaryExpr::copy() {
-    auto new_cond = cond->copy();
-    auto new_true_br = true_br->copy();
-    auto new_false_br = false_br->copy();
-    return std::make_shared<TernaryExpr>(new_cond, new_true_br, new_false_br);
+    return std::make_shared<TernaryExpr>(share(cond), share(true_br),
+                                         share(false_br));
 }
 
 bool SubscriptExpr::propagateType() {
@@ -1914,24 +2232,21 @@ bool SubscriptExpr::inBounds(size_t dim, std::shared_ptr<Data> idx_val,
 Expr::EvalResType SubscriptExpr::evaluate(EvalCtx &ctx) {
     propagateType();
 
-    bool old_use_main_vals = ctx.use_main_vals;
-    bool flip_main_vals =
-        at_mul_val_axis &&
-        std::abs(stencil_offset) % Options::vals_number == Options::alt_val_idx;
+    size_t old_lane = ctx.lane;
+    size_t vals_number = Options::getInstance().getValsNumber();
+    // The offset along the multiple values axis shifts the lane
     // TODO: check if this escapes the scope
-    ctx.use_main_vals = flip_main_vals ? !ctx.use_main_vals : ctx.use_main_vals;
+    if (at_mul_val_axis)
+        ctx.lane = (ctx.lane + std::abs(stencil_offset)) % vals_number;
 
     EvalResType idx_eval_res = idx->evaluate(ctx);
 
-    if (at_mul_val_axis && idx->getKind() == IRNodeKind::CONST) {
-        bool use_main_vals = std::static_pointer_cast<ScalarVar>(idx_eval_res)
-                                     ->getCurrentValue()
-                                     .getAbsValue()
-                                     .value %
-                                 Options::vals_number ==
-                             Options::main_val_idx;
-        ctx.use_main_vals = use_main_vals;
-    }
+    if (at_mul_val_axis && idx->getKind() == IRNodeKind::CONST)
+        ctx.lane = std::static_pointer_cast<ScalarVar>(idx_eval_res)
+                       ->getCurrentValue()
+                       .getAbsValue()
+                       .value %
+                   vals_number;
 
     EvalResType array_eval_res = array->evaluate(ctx);
 
@@ -1954,7 +2269,7 @@ Expr::EvalResType SubscriptExpr::evaluate(EvalCtx &ctx) {
     // TODO: this is a hack. We do not allow multiple values in the
     // expressions that are used to define iteration space.
     auto new_ctx = ctx;
-    new_ctx.use_main_vals = true;
+    new_ctx.lane = Options::main_val_idx;
     if (!inBounds(active_size, idx_eval_res, new_ctx))
         ub_code = UBKind::OutOfBounds;
 
@@ -1973,20 +2288,66 @@ Expr::EvalResType SubscriptExpr::evaluate(EvalCtx &ctx) {
                        "",
                        std::static_pointer_cast<IntegralType>(
                            array_type->getBaseType()),
-                       array_val->getCurrentValues(ctx.use_main_vals)));
+                       array_val->getCurrentValues(ctx.lane)));
 
         // Restore saved value
-        ctx.use_main_vals = old_use_main_vals;
+        ctx.lane = old_lane;
     }
 
     value->setUBCode(ub_code);
+    // The value changes only with the children, the values of the array are
+    // the same during the evaluation
+    value_time = std::max({value_time, idx->getValueTime(),
+                           array->getValueTime()});
     return value;
 }
 
+bool SubscriptExpr::evaluateLanes(EvalCtx &ctx, LaneValues &lanes) {
+    size_t old_lane = ctx.lane;
+    ctx.lane = Options::main_val_idx;
+    EvalResType eval_res = evaluate(ctx);
+    ctx.lane = old_lane;
+
+    auto array_data = getArrayData();
+    if (!eval_res->isScalarVar() || array_data == ctx.lanes_written_data)
+        return false;
+
+    auto array_val = std::static_pointer_cast<Array>(array_data);
+    size_t vals_number = Options::getInstance().getValsNumber();
+    for (size_t i = 0; i < vals_number; ++i) {
+        lanes.vals[i] = array_val->getCurrentValues(getArrayLane(i));
+        lanes.ub_codes[i] = value->getUBCode();
+    }
+    return true;
+}
+
+size_t SubscriptExpr::getArrayLane(size_t lane) {
+    if (at_mul_val_axis) {
+        size_t vals_number = Options::getInstance().getValsNumber();
+        lane = (lane + std::abs(stencil_offset)) % vals_number;
+        if (idx->getKind() == IRNodeKind::CONST)
+            lane = std::static_pointer_cast<ScalarVar>(idx->getValue())
+                       ->getCurrentValue()
+                       .getAbsValue()
+                       .value %
+                   vals_number;
+    }
+    if (array->getKind() == IRNodeKind::SUBSCRIPT)
+        return std::static_pointer_cast<SubscriptExpr>(array)->getArrayLane(
+            lane);
+    return lane;
+}
+
+std::shared_ptr<Data> SubscriptExpr::getArrayData() {
+    if (array->getKind() == IRNodeKind::SUBSCRIPT)
+        return std::static_pointer_cast<SubscriptExpr>(array)->getArrayData();
+    return array->getValue();
+}
+
 Expr::EvalResType SubscriptExpr::rebuild(EvalCtx &ctx) {
     propagateType();
-    idx->rebuild(ctx);
-    array->rebuild(ctx);
+    rebuildChild(idx, ctx);
+    rebuildChild(array, ctx);
     EvalResType eval_res = evaluate(ctx);
     if (!eval_res->hasUB())
         return eval_res;
@@ -2059,20 +2420,27 @@ SubscriptExpr::SubscriptExpr(std::shared_ptr<Expr> _arr,
     propagateType();
 }
 
-void SubscriptExpr::setValue(std::shared_ptr<Expr> _expr, bool use_main_vals) {
-    bool flip_main_vals =
-        at_mul_val_axis &&
-        std::abs(stencil_offset) % Options::vals_number == Options::alt_val_idx;
+void SubscriptExpr::setValue(std::shared_ptr<Expr> _expr, size_t lane) {
+    if (!_expr->getValue()->isScalarVar())
+        ERROR("Only scalar variables are supported for now");
+    setValue(std::static_pointer_cast<ScalarVar>(_expr->getValue())
+                 ->getCurrentValue(),
+             lane);
+}
+
+void SubscriptExpr::setValue(IRValue _val, size_t lane) {
     // TODO: check if this escapes the scope
-    use_main_vals = flip_main_vals ? !use_main_vals : use_main_vals;
+    if (at_mul_val_axis)
+        lane = (lane + std::abs(stencil_offset)) %
+               Options::getInstance().getValsNumber();
 
     if (array->getKind() == IRNodeKind::SUBSCRIPT) {
         auto subs = std::static_pointer_cast<SubscriptExpr>(array);
-        subs->setValue(_expr, use_main_vals);
+        subs->setValue(_val, lane);
     }
     else if (array->getKind() == IRNodeKind::ARRAY_USE) {
         auto array_use = std::static_pointer_cast<ArrayUseExpr>(array);
-        array_use->setValue(_expr, use_main_vals);
+        array_use->setValue(_val, lane);
     }
     else
         ERROR("Bad IRNodeKind");
@@ -2250,7 +2618,8 @@ SubscriptExpr::initImpl(ArrayStencilParams array_params,
             };
             uint64_t init_val = roll_const();
             if (single_val_override) {
-                while (init_val % Options::vals_number != Options::main_val_idx)
+                size_t vals_number = Options::getInstance().getValsNumber();
+                while (init_val % vals_number != Options::main_val_idx)
                     init_val = roll_const();
             }
             IRValue new_val(rand_val_gen->getRandId(gen_pol->int_type_distr));
@@ -2394,13 +2763,12 @@ SubscriptExpr::initImpl(ArrayStencilParams array_params,
 }
 
 std::shared_ptr<Expr> SubscriptExpr::copy() {
-    auto new_arr = array->copy();
-    auto new_idx = idx->copy();
-    auto ret = std::make_shared<SubscriptExpr>(new_arr, new_idx);
+    auto ret = std::make_shared<SubscriptExpr>(share(array), share(idx));
     ret->active_dim = active_dim;
     ret->active_size = active_size;
     ret->idx_int_type_id = idx_int_type_id;
     ret->stencil_offset = stencil_offset;
+    ret->at_mul_val_axis = at_mul_val_axis;
     return ret;
 }
 
@@ -2418,95 +2786,155 @@ bool AssignmentExpr::propagateType() {
         from->propagateType();
     }
 
-    if (second_from != nullptr) {
-        second_from->propagateType();
-        auto second_from_int_type = std::static_pointer_cast<IntegralType>(
-            second_from->getValue()->getType());
-        if (to_int_type != second_from_int_type)
-            second_from =
-                std::make_shared<TypeCastExpr>(second_from, to_int_type, true);
-        second_from->propagateType();
+    for (auto &alt_from : alt_froms) {
+        alt_from->propagateType();
+        auto alt_from_int_type = std::static_pointer_cast<IntegralType>(
+            alt_from->getValue()->getType());
+        if (to_int_type != alt_from_int_type)
+            alt_from =
+                std::make_shared<TypeCastExpr>(alt_from, to_int_type, true);
+        alt_from->propagateType();
     }
 
-    // TODO: what do we do with the second value? For now it doesn't really
-    //  matter, because the types match, and it's all we care about here
+    // TODO: what do we do with the alternate values? For now it doesn't
+    //  really matter, because the types match, and it's all we care about here
     value = std::make_shared<TypedData>(from->getValue()->getType());
 
     return true;
 }
 
+std::shared_ptr<Expr> &AssignmentExpr::getLaneFrom(size_t lane) {
+    if (lane == Options::main_val_idx)
+        return from;
+    while (alt_froms.size() < lane)
+        alt_froms.push_back(from->copyTree());
+    return alt_froms.at(lane - 1);
+}
+
 Expr::EvalResType AssignmentExpr::evaluate(EvalCtx &ctx) {
-    if (!ctx.use_main_vals && second_from == nullptr) {
-        second_from = from->copy();
-    }
+    // Creates the tree of the lane if it doesn't exist yet
+    getLaneFrom(ctx.lane);
 
     propagateType();
     if (!to->getValue()->getType()->isIntType() ||
         !from->getValue()->getType()->isIntType())
         ERROR("We support only Integral Type for now");
 
-    bool use_main_vals = ctx.mul_vals_iter == nullptr;
-    use_main_vals |= ctx.mul_vals_iter != nullptr && ctx.use_main_vals;
-
-    bool old_use_main_vals = ctx.use_main_vals;
-    ctx.use_main_vals = use_main_vals;
+    size_t lane =
+        ctx.mul_vals_iter == nullptr ? Options::main_val_idx : ctx.lane;
+    size_t old_lane = ctx.lane;
+    ctx.lane = lane;
 
     EvalResType to_eval_res = to->evaluate(ctx);
-    EvalResType from_eval_res =
-        use_main_vals ? from->evaluate(ctx) : second_from->evaluate(ctx);
+    // The type cast of propagateType() could have replaced the tree
+    EvalResType from_eval_res = getLaneFrom(lane)->evaluate(ctx);
     if (to_eval_res->getKind() != from_eval_res->getKind())
         ERROR("We can't assign incompatible data types");
 
-    ctx.use_main_vals = old_use_main_vals;
+    ctx.lane = old_lane;
     return from_eval_res;
 }
 
 void AssignmentExpr::propagateValue(EvalCtx &ctx) {
-    bool use_main_vals = ctx.mul_vals_iter == nullptr;
-    use_main_vals |= ctx.mul_vals_iter != nullptr && ctx.use_main_vals;
+    size_t lane =
+        ctx.mul_vals_iter == nullptr ? Options::main_val_idx : ctx.lane;
     if (ctx.mul_vals_iter != nullptr &&
-        to->getKind() == IRNodeKind::SCALAR_VAR_USE)
-        use_main_vals = ctx.mul_vals_iter->getMainValsOnLastIter();
+        to->getKind() == IRNodeKind::SCALAR_VAR_USE) {
+        // The scalar keeps the value of the last iteration, it is stored once
+        // all lanes are evaluated and rebuilt
+        if (ctx.lane + 1 < Options::getInstance().getValsNumber())
+            return;
+        lane = ctx.mul_vals_iter->getLastIterLane();
+    }
 
-    bool old_use_main_vals = ctx.use_main_vals;
-    ctx.use_main_vals = use_main_vals;
+    size_t old_lane = ctx.lane;
+    ctx.lane = lane;
 
     EvalResType to_eval_res = to->evaluate(ctx);
-    EvalResType from_eval_res =
-        use_main_vals ? from->evaluate(ctx) : second_from->evaluate(ctx);
+    EvalResType from_eval_res = getLaneFrom(lane)->evaluate(ctx);
     if (to_eval_res->getKind() != from_eval_res->getKind())
         ERROR("We can't assign incompatible data types");
 
     if (!taken) {
-        ctx.use_main_vals = old_use_main_vals;
+        ctx.lane = old_lane;
         return;
     }
 
     if (to->getKind() == IRNodeKind::SCALAR_VAR_USE) {
         auto to_scalar = std::static_pointer_cast<ScalarVarUseExpr>(to);
-        to_scalar->setValue(use_main_vals ? from : second_from);
+        to_scalar->setValue(getLaneFrom(lane));
     }
     else if (to->getKind() == IRNodeKind::SUBSCRIPT) {
         auto to_array = std::static_pointer_cast<SubscriptExpr>(to);
         // TODO: adjust for multiple values
-        to_array->setValue(use_main_vals ? from : second_from,
-                           ctx.use_main_vals);
+        to_array->setValue(getLaneFrom(lane), lane);
     }
     else
         ERROR("Bad IRNodeKind");
 
-    ctx.use_main_vals = old_use_main_vals;
+    ctx.lane = old_lane;
+}
+
+bool AssignmentExpr::evaluateLanes(EvalCtx &ctx, LaneValues &lanes) {
+    if (!alt_froms.empty())
+        return false;
+
+    propagateType();
+    if (!to->getValue()->getType()->isIntType() ||
+        !from->getValue()->getType()->isIntType())
+        ERROR("We support only Integral Type for now");
+
+    size_t old_lane = ctx.lane;
+    auto old_written_data = ctx.lanes_written_data;
+    ctx.lane = Options::main_val_idx;
+    to->evaluate(ctx);
+    if (to->getKind() == IRNodeKind::SUBSCRIPT)
+        ctx.lanes_written_data =
+            std::static_pointer_cast<SubscriptExpr>(to)->getArrayData();
+    else
+        ctx.lanes_written_data = to->getValue();
+
+    bool res = from->evaluateLanes(ctx, lanes);
+
+    ctx.lane = old_lane;
+    ctx.lanes_written_data = old_written_data;
+    return res;
+}
+
+void AssignmentExpr::propagateLanes(EvalCtx &ctx, LaneValues &lanes) {
+    // The alternate lanes get their own trees, as in evaluate()
+    size_t vals_number = Options::getInstance().getValsNumber();
+    getLaneFrom(vals_number - 1);
+    propagateType();
+
+    if (!taken)
+        return;
+
+    if (to->getKind() == IRNodeKind::SCALAR_VAR_USE) {
+        size_t lane = ctx.mul_vals_iter == nullptr
+                          ? Options::main_val_idx
+                          : ctx.mul_vals_iter->getLastIterLane();
+        auto to_scalar = std::static_pointer_cast<ScalarVarUseExpr>(to);
+        to_scalar->setValue(lanes.vals[lane]);
+    }
+    else if (to->getKind() == IRNodeKind::SUBSCRIPT) {
+        auto to_array = std::static_pointer_cast<SubscriptExpr>(to);
+        for (size_t i = 0; i < vals_number; ++i)
+            to_array->setValue(lanes.vals[i], i);
+    }
+    else
+        ERROR("Bad IRNodeKind");
 }
 
 Expr::EvalResType AssignmentExpr::rebuild(EvalCtx &ctx) {
     propagateType();
-    to->rebuild(ctx);
+    rebuildChild(to, ctx);
     auto new_ctx = ctx;
-    new_ctx.use_main_vals = true;
-    from->rebuild(new_ctx);
-    if (second_from != nullptr) {
-        new_ctx.use_main_vals = false;
-        second_from->rebuild(new_ctx);
+    new_ctx.lane = Options::main_val_idx;
+    rebuildChild(from, new_ctx);
+    for (size_t i = 0; i < alt_froms.size(); ++i) {
+        new_ctx.lane = i + 1;
+        rebuildChild(alt_froms.at(i), new_ctx);
         versioning_iter = ctx.mul_vals_iter;
         evaluate(new_ctx);
     }
@@ -2523,6 +2951,7 @@ void AssignmentExpr::emit(std::shared_ptr<EmitCtx> ctx, std::ostream &stream,
     // we assign to can be uniform. In this case we need to cast the
     // assigned value to uniform.
     bool cast_to_uniform = false;
+    size_t vals_number = Options::getInstance().getValsNumber();
     if (versioning_iter != nullptr) {
         Options &options = Options::getInstance();
         cast_to_uniform = options.isISPC() &&
@@ -2534,26 +2963,30 @@ void AssignmentExpr::emit(std::shared_ptr<EmitCtx> ctx, std::ostream &stream,
             rand_val_gen->getRandId(gen_pol.hide_zero_in_versioning_prob);
         if (cast_to_uniform)
             stream << "extract(";
-        stream << "("
-               << (cast_to_uniform ? "programIndex"
-                                   : versioning_iter->getName(ctx))
-               << " % " << Options::vals_number << " == ";
-        stream << (use_zero_as_var ? "zero"
-                                   : std::to_string(Options::main_val_idx))
-               << ") ? (";
-    }
-
-    from->emit(ctx, stream);
-
-    if (versioning_iter != nullptr) {
-        stream << ") : (";
-        second_from->emit(ctx, stream);
-        stream << ")";
+        // The lanes are selected by a chain of ternary operators, the last
+        // lane takes the rest
+        for (size_t i = 0; i < alt_froms.size(); ++i) {
+            stream << "("
+                   << (cast_to_uniform ? "programIndex"
+                                       : versioning_iter->getName(ctx))
+                   << " % " << vals_number << " == ";
+            stream << (use_zero_as_var && i == Options::main_val_idx
+                           ? "zero"
+                           : std::to_string(i))
+                   << ") ? (";
+            (i == Options::main_val_idx ? from : alt_froms.at(i - 1))
+                ->emit(ctx, stream);
+            stream << ") : (";
+        }
+        alt_froms.back()->emit(ctx, stream);
+        for (size_t i = 0; i < alt_froms.size(); ++i)
+            stream << ")";
         // TODO: we need to check that this is emitted only for scalar variables
         if (cast_to_uniform)
-            stream << ", " << (ISPC_MAX_VECTOR_SIZE % Options::vals_number)
-                   << ")";
+            stream << ", " << (ISPC_MAX_VECTOR_SIZE % vals_number) << ")";
     }
+    else
+        from->emit(ctx, stream);
 }
 
 std::shared_ptr<AssignmentExpr>
@@ -2618,10 +3051,9 @@ AssignmentExpr::create(std::shared_ptr<PopulateCtx> ctx) {
 }
 
 std::shared_ptr<Expr> AssignmentExpr::copy() {
-    auto new_from = from->copy();
-    auto new_to = to->copy();
-    auto ret = std::make_shared<AssignmentExpr>(new_to, new_from, taken);
-    ret->second_from = second_from;
+    auto ret = std::make_shared<AssignmentExpr>(share(to), share(from), taken);
+    for (auto &alt_from : alt_froms)
+        ret->alt_froms.push_back(share(alt_from));
     ret->versioning_iter = versioning_iter;
     return ret;
 }
@@ -2629,7 +3061,6 @@ std::shared_ptr<Expr> AssignmentExpr::copy() {
 AssignmentExpr::AssignmentExpr(std::shared_ptr<Expr> _to,
                                std::shared_ptr<Expr> _from, bool _taken) {
     from = std::move(_from);
-    second_from = nullptr;
     taken = _taken;
     to = std::move(_to);
     versioning_iter = nullptr;
@@ -2783,7 +3214,7 @@ void ReductionExpr::propagateValue(EvalCtx &ctx) {
     }
     else if (to->getKind() == IRNodeKind::SUBSCRIPT) {
         auto to_array = std::static_pointer_cast<SubscriptExpr>(to);
-        to_array->setValue(result_expr, true);
+        to_array->setValue(result_expr, Options::main_val_idx);
     }
     else
         ERROR("Bad IRNodeKind");
@@ -2793,8 +3224,8 @@ Expr::EvalResType ReductionExpr::rebuild(EvalCtx &ctx) {
     if (is_degenerate)
         return AssignmentExpr::rebuild(ctx);
     propagateType();
-    to->rebuild(ctx);
-    from->rebuild(ctx);
+    rebuildChild(to, ctx);
+    rebuildChild(from, ctx);
     auto ret = evaluate(ctx);
     if (ret->hasUB()) {
         is_degenerate = true;
@@ -2927,12 +3358,11 @@ ReductionExpr::create(std::shared_ptr<PopulateCtx> ctx) {
 }
 
 std::shared_ptr<Expr> ReductionExpr::copy() {
-    auto new_result_expr = result_expr->copy();
     auto new_assign = AssignmentExpr::copy();
     auto new_reduction = std::make_shared<ReductionExpr>(
         std::static_pointer_cast<AssignmentExpr>(new_assign), bin_op,
         lib_call_kind, is_degenerate, taken);
-    new_reduction->result_expr = new_result_expr;
+    new_reduction->result_expr = result_expr;
     return new_reduction;
 }
 
@@ -3259,9 +3689,9 @@ Expr::EvalResType SelectCall::evaluate(EvalCtx &ctx) {
 }
 
 Expr::EvalResType SelectCall::rebuild(EvalCtx &ctx) {
-    cond->rebuild(ctx);
-    true_arg->rebuild(ctx);
-    false_arg->rebuild(ctx);
+    rebuildChild(cond, ctx);
+    rebuildChild(true_arg, ctx);
+    rebuildChild(false_arg, ctx);
     return evaluate(ctx);
 }
 
@@ -3447,6 +3877,10 @@ ExtractCall::ExtractCall(std::shared_ptr<Expr> _arg)
     idx = std::make_shared<ConstantExpr>(idx_val);
 }
 
+ExtractCall::ExtractCall(std::shared_ptr<Expr> _arg,
+                         std::shared_ptr<Expr> _idx)
+    : arg(std::move(_arg)), idx(std::move(_idx)), is_implicit(false) {}
+
 bool ExtractCall::propagateType() {
     arg->propagateType();
     auto arg_int_type_id =
@@ -3491,3 +3925,220 @@ ExtractCall::create(std::shared_ptr<PopulateCtx> ctx) {
     auto arg = ArithmeticExpr::create(std::move(ctx));
     return std::make_shared<ExtractCall>(arg);
 }
+
+std::vector<std::shared_ptr<InjectedCallExpr::InjectedFunc>>
+    InjectedCallExpr::functions;
+
+InjectedCallExpr::InjectedCallExpr(std::shared_ptr<InjectedFunc> _func)
+    : func(std::move(_func)) {
+    value = std::make_shared<ScalarVar>(
+        "", IntegralType::init(func->result.getIntTypeID()), func->result);
+    setShowsSubtreeUB({});
+}
+
+void InjectedCallExpr::emit(std::shared_ptr<EmitCtx> ctx,
+                            std::ostream &stream, std::string offset) {
+    stream << offset;
+    // Templates like std::min need the same types of the arguments, so the
+    // value gets the type of the IR if the names differ ("long", "char")
+    auto ret_type = std::static_pointer_cast<IntegralType>(value->getType());
+    if (ret_type->getName(ctx) != func->info.return_type)
+        stream << "((" << ret_type->getName(ctx) << ") ";
+    stream << func->info.function_name << "(";
+    for (size_t i = 0; i < func->args.size(); ++i) {
+        stream << (i == 0 ? "" : ", ");
+        ConstantExpr(func->args[i]).emit(ctx, stream);
+    }
+    stream << ")";
+    if (ret_type->getName(ctx) != func->info.return_type)
+        stream << ")";
+}
+
+std::shared_ptr<InjectedCallExpr>
+InjectedCallExpr::create(std::shared_ptr<PopulateCtx> ctx) {
+    auto func = functions.at(
+        rand_val_gen->getRandValue<size_t>(0, functions.size() - 1));
+    func->is_used = true;
+    return std::make_shared<InjectedCallExpr>(func);
+}
+
+// "long" is assumed to be 64-bit (LP64), like on the targets that the library
+// was recorded on. The signedness of "char" is implementation-defined, so
+// only the values that are the same for both are accepted for it.
+static bool parseInjectedValue(std::string type, const std::string &str,
+                               IRValue &res) {
+    static const std::map<std::string, IntTypeID> types = {
+        {"char", IntTypeID::SCHAR},
+        {"signed char", IntTypeID::SCHAR},
+        {"unsigned char", IntTypeID::UCHAR},
+        {"short", IntTypeID::SHORT},
+        {"unsigned short", IntTypeID::USHORT},
+        {"int", IntTypeID::INT},
+        {"signed", IntTypeID::INT},
+        {"unsigned", IntTypeID::UINT},
+        {"unsigned int", IntTypeID::UINT},
+        {"long", IntTypeID::LLONG},
+        {"unsigned long", IntTypeID::ULLONG},
+        {"long long", IntTypeID::LLONG},
+        {"unsigned long long", IntTypeID::ULLONG}};
+    auto type_it = types.find(type);
+    if (type_it == types.end())
+        return false;
+
+    size_t begin = str.find_first_not_of(" \t\n");
+    size_t end = str.find_last_not_of(" \t\n");
+    if (begin == std::string::npos)
+        return false;
+    bool is_negative = str[begin] == '-';
+    std::string digits =
+        str.substr(begin + is_negative, end + 1 - begin - is_negative);
+    if (digits.empty() || digits.size() > 20 ||
+        !std::all_of(digits.begin(), digits.end(),
+                     [](char c) { return std::isdigit(c); }))
+        return false;
+    uint64_t abs_val = 0;
+    try {
+        abs_val = std::stoull(digits);
+    }
+    catch (const std::exception &e) {
+        return false;
+    }
+
+    auto int_type = IntegralType::init(type_it->second);
+    IRValue::AbsValue limit = is_negative ? int_type->getMin().getAbsValue()
+                                          : int_type->getMax().getAbsValue();
+    if ((is_negative && abs_val != 0 && !limit.isNegative) ||
+        abs_val > limit.value)
+        return false;
+    if (type == "char" && (is_negative || abs_val > 127))
+        return false;
+    res = IRValue(type_it->second, {is_negative && abs_val != 0, abs_val});
+    return true;
+}
+
+static bool isIdentChar(char c) {
+    return std::isalnum(static_cast<unsigned char>(c)) || c == '_';
+}
+
+// Positions of the whole-word occurrences of the name
+static std::vector<size_t> findWord(const std::string &text,
+                                    const std::string &word) {
+    std::vector<size_t> res;
+    for (size_t pos = text.find(word); pos != std::string::npos;
+         pos = text.find(word, pos + 1)) {
+        if ((pos == 0 || !isIdentChar(text[pos - 1])) &&
+            (pos + word.size() == text.size() ||
+             !isIdentChar(text[pos + word.size()])))
+            res.push_back(pos);
+    }
+    return res;
+}
+
+// It is a conservative syntactic check, the library functions are small
+// and don't use pointers to the globals
+static bool hasPersistentState(const FunctionInfo &func) {
+    size_t body_begin = func.function_body.find('{');
+    if (body_begin == std::string::npos)
+        return true;
+    std::string body = func.function_body.substr(body_begin);
+    if (!findWord(body, "static").empty())
+        return true;
+
+    for (const auto &line : func.misc) {
+        // The declared name is the last identifier before the initializer
+        std::string decl = line.substr(0, line.find_first_of("=;["));
+        size_t name_end = decl.find_last_not_of(" \t");
+        if (name_end == std::string::npos)
+            continue;
+        size_t name_begin = name_end + 1;
+        while (name_begin > 0 && isIdentChar(decl[name_begin - 1]))
+            --name_begin;
+        std::string name = decl.substr(name_begin, name_end + 1 - name_begin);
+        if (name.empty())
+            continue;
+
+        for (size_t pos : findWord(body, name)) {
+            size_t prev = body.find_last_not_of(" \t\n", pos - 1);
+            if (prev != std::string::npos && prev > 0 &&
+                ((body[prev] == '+' && body[prev - 1] == '+') ||
+                 (body[prev] == '-' && body[prev - 1] == '-')))
+                return true;
+            // Address of the global
+            if (prev != std::string::npos && body[prev] == '&') {
+                size_t before = body.find_last_not_of(" \t\n", prev - 1);
+                if (before == std::string::npos ||
+                    (!isIdentChar(body[before]) && body[before] != ')' &&
+                     body[before] != ']' && body[before] != '&'))
+                    return true;
+            }
+
+            // Skip the subscripts of the arrays
+            size_t next = pos + name.size();
+            while (true) {
+                next = body.find_first_not_of(" \t\n", next);
+                if (next == std::string::npos || body[next] != '[')
+                    break;
+                size_t depth = 0;
+                for (; next < body.size(); ++next) {
+                    depth += body[next] == '[';
+                    depth -= body[next] == ']';
+                    if (depth == 0)
+                        break;
+                }
+                ++next;
+            }
+            if (next == std::string::npos || next >= body.size())
+                continue;
+            std::string rest = body.substr(next, 3);
+            if (rest.compare(0, 2, "++") == 0 || rest.compare(0, 2, "--") == 0)
+                return true;
+            if (rest[0] == '=' && (rest.size() < 2 || rest[1] != '='))
+                return true;
+            if (rest.size() >= 2 && rest[1] == '=' &&
+                std::string("+-*/%&|^").find(rest[0]) != std::string::npos)
+                return true;
+            if (rest == "<<=" || rest == ">>=")
+                return true;
+        }
+    }
+    return false;
+}
+
+bool InjectedCallExpr::addFunction(const FunctionInfo &func) {
+    auto new_func = std::make_shared<InjectedFunc>();
+    new_func->info = func;
+    std::vector<std::string> params = func.parameter_types;
+    if (params.size() == 1 && params.front() == "void")
+        params.clear();
+    if (params.size() != func.input.size())
+        return false;
+    for (size_t i = 0; i < params.size(); ++i) {
+        IRValue arg;
+        if (!parseInjectedValue(params[i], func.input[i], arg))
+            return false;
+        new_func->args.push_back(arg);
+    }
+    if (!parseInjectedValue(func.return_type, func.output, new_func->result))
+        return false;
+    // Preprocessor directives would leak into the rest of the test
+    std::istringstream body(func.function_body);
+    for (std::string line; std::getline(body, line);) {
+        size_t first = line.find_first_not_of(" \t");
+        if (first != std::string::npos && line[first] == '#')
+            return false;
+    }
+    if (func.function_name.empty() || hasPersistentState(func))
+        return false;
+    functions.push_back(new_func);
+    return true;
+}
+
+void InjectedCallExpr::emitDefinitions(std::ostream &stream) {
+    for (const auto &func : functions) {
+        if (!func->is_used)
+            continue;
+        for (const auto &line : func->info.misc)
+            stream << line << "\n";
+        stream << func->info.function_body << "\n\n";
+    }
+}
@@ -19,13 +19,19 @@ limitations under the License.
 
 #pragma once
 
+#include <array>
 #include <deque>
+#include <functional>
+#include <limits>
 #include <map>
 #include <memory>
+#include <unordered_map>
 #include <utility>
 
 #include "data.h"
+#include "func_lib.h"
 #include "gen_policy.h"
+#include "hash.h"
 #include "ir_node.h"
 #include "ir_value.h"
 
@@ -37,8 +43,11 @@ class PopulateCtx;
 // Common ancestor for all classes that represent various expressions
 class Expr : public IRNode {
   public:
-    explicit Expr(std::shared_ptr<Data> _value) : value(std::move(_value)) {}
-    Expr() = default;
+    explicit Expr(std::shared_ptr<Data> _value)
+        : value(std::move(_value)), value_time(++memo_clock) {
+        ++total_expr_count;
+    }
+    Expr() : value_time(++memo_clock) { ++total_expr_count; }
 
     // This type represent result of computation. We keep it simple for now,
     // but it might change in the future.
@@ -59,26 +68,126 @@ class Expr : public IRNode {
     // Similar to evaluate method, but it eliminates UB by rebuilding the tree.
     virtual EvalResType rebuild(EvalCtx &ctx) = 0;
 
+    // Values of the expression in every lane of multiple values (see
+    // Options::max_vals_number), only the first Options::getValsNumber()
+    // lanes are used. The UB of the value as a whole is kept apart from the
+    // UB of the IRValue, because they differ for subscripts (only the former
+    // reports out-of-bounds access).
+    struct LaneValues {
+        std::array<IRValue, Options::max_vals_number> vals;
+        std::array<UBKind, Options::max_vals_number> ub_codes;
+        bool hasUB() const;
+    };
+
+    // Lane-parallel version of evaluate(): every node computes the values of
+    // all lanes at once, so the tree is traversed only once. It returns false
+    // if some node doesn't support it, then the lanes have to be evaluated
+    // one by one. The value of the node is the main one afterwards, as after
+    // evaluate().
+    virtual bool evaluateLanes(EvalCtx &ctx, LaneValues &lanes) {
+        return false;
+    }
+
     virtual IRNodeKind getKind() { return IRNodeKind::MAX_EXPR_KIND; }
     virtual std::shared_ptr<Data> getValue();
 
-    // Deep copy of the expression. We use it to duplicate expressions in
-    // case of UB for multiple values
+    // Copy of the expression that shares the children with it. We use it to
+    // duplicate expressions in case of UB for multiple values. The shared
+    // subtrees are copied when rebuild changes them (see rebuildChild).
+    // It creates exactly one node, so that the expression count stays right.
     virtual std::shared_ptr<Expr> copy() = 0;
 
+    // Calls func for every operand that can be replaced with another
+    // expression of the same type (the test reducer replaces them with
+    // constants). Leaves, lvalues and subscripts don't have such operands.
+    using OperandFunc = std::function<void(std::shared_ptr<Expr> &)>;
+    virtual void forEachOperand(const OperandFunc &func) {}
+    // Calls func for every child of the expression
+    virtual void forEachChild(const OperandFunc &func) {}
+
+    // Replaces the shared subtrees of the expression with its own copies
+    static void unshare(std::shared_ptr<Expr> &expr);
+    // Copy of the whole tree, it counts as if every node was copied
+    std::shared_ptr<Expr> copyTree();
+
+    // Hash-consing (see --hash-cons). Returns the expression that was built
+    // before from the same operator and operands, or registers the new one.
+    // The registered expressions can be shared by several trees, so rebuild
+    // copies them (see rebuildChild).
+    static std::shared_ptr<Expr> intern(std::shared_ptr<Expr> expr);
+    // Drops the folding set (see ProgramGenerator::resetGlobalState)
+    static void clearExprSet() { expr_set.clear(); }
+
+    // Count of expressions created over all test program. The difference of
+    // two snapshots gives the size of the expression that was created in
+    // between (including the nodes that were added by rebuild).
+    static uint64_t getTotalExprCount() { return total_expr_count; }
+
+    // The time of the last change of the value of the expression or of its
+    // subtree (see isMemoValid). The leaves are set at creation, the nodes
+    // that don't track it are assumed to change all the time.
+    virtual uint64_t getValueTime() {
+        return std::numeric_limits<uint64_t>::max();
+    }
+    // Unique stamp for EvalCtx::memo_stamp
+    static uint64_t newMemoStamp() { return ++memo_clock; }
+
   protected:
+    // All lanes get the current value of the scalar node
+    void setUniformLanes(LaneValues &lanes);
+
+    // Memoization of evaluate(). Rebuild evaluates every node after its
+    // children are rebuilt, so each subtree used to be evaluated again at
+    // every level above it. The saved value is reused if it was computed with
+    // the same stamp and lane of the EvalCtx and no child has changed since.
+    // Rebuild only replaces children with new nodes, which are newer than the
+    // parent, or changes the operator, which has to call invalidateMemo().
+    bool isMemoValid(EvalCtx &ctx, std::initializer_list<Expr *> children);
+    // Saves the value that was just computed
+    void setMemo(EvalCtx &ctx);
+    // The same for propagateType(), which depends only on the children
+    bool areTypesValid(std::initializer_list<Expr *> children);
+    void setTypesValid() { types_time = ++memo_clock; }
+    void invalidateMemo() {
+        memo_stamp = 0;
+        types_time = 0;
+    }
+
+    // Marks the child as shared with a copy of the expression
+    static const std::shared_ptr<Expr> &
+    share(const std::shared_ptr<Expr> &child);
+    // Rebuild of a child. Rebuild changes only the subtrees with UB, so the
+    // shared child is copied (copy-on-write) only if it has UB somewhere. The
+    // copy replaces the nodes that are already counted.
+    static EvalResType rebuildChild(std::shared_ptr<Expr> &child,
+                                    EvalCtx &ctx);
+    // The UB of any node of the subtree shows in the value of the expression
+    // if the expression and its children pass it on (the arithmetic nodes).
+    // Rebuild replaces the children only with such nodes on top of them.
+    void setShowsSubtreeUB(std::initializer_list<Expr *> children);
+
+    // Key of the expression in the folding set. Only the arithmetic
+    // operators and the library calls have it, the leaves are shared already.
+    virtual std::shared_ptr<ExprKey> getKey() { return nullptr; }
+
     std::shared_ptr<Data> value;
+    uint64_t value_time;
 
   private:
-    // TODO: add complexity tracker
-    /*
-    uint32_t complexity;
-
-    // Count of expression over all test program
-    static uint32_t total_expr_count;
-    // Count of expression per single test function
-    static uint32_t func_expr_count;
-    */
+    static uint64_t total_expr_count;
+    // Source of the times and the stamps of the memoization
+    static uint64_t memo_clock;
+
+    uint64_t memo_stamp = 0;
+    size_t memo_lane = 0;
+    uint64_t types_time = 0;
+    std::shared_ptr<Data> memo_value;
+
+    bool shared = false;
+    bool shows_subtree_ub = false;
+
+    static std::unordered_map<ExprKey, std::shared_ptr<Expr>, ExprKeyHasher>
+        expr_set;
 };
 
 // Constant representation
@@ -86,10 +195,12 @@ class ConstantExpr : public Expr {
   public:
     explicit ConstantExpr(IRValue _value);
     IRNodeKind getKind() final { return IRNodeKind::CONST; }
+    uint64_t getValueTime() final { return value_time; }
 
     bool propagateType() final { return true; }
     EvalResType evaluate(EvalCtx &ctx) final;
     EvalResType rebuild(EvalCtx &ctx) final;
+    bool evaluateLanes(EvalCtx &ctx, LaneValues &lanes) final;
 
     void emit(std::shared_ptr<EmitCtx> ctx, std::ostream &stream,
               std::string offset = "") final;
@@ -98,6 +209,8 @@ class ConstantExpr : public Expr {
 
     std::shared_ptr<Expr> copy() final;
 
+    static void clearUsedConsts() { used_consts.clear(); }
+
   private:
     static std::vector<std::shared_ptr<ConstantExpr>> used_consts;
 };
@@ -105,8 +218,11 @@ class ConstantExpr : public Expr {
 // Abstract class that represents access to all sorts of variables
 class VarUseExpr : public Expr {
   public:
-    explicit VarUseExpr(std::shared_ptr<Data> _val) : Expr(std::move(_val)) {}
+    explicit VarUseExpr(std::shared_ptr<Data> _val) : Expr(std::move(_val)) {
+        setShowsSubtreeUB({});
+    }
     void setIsDead(bool val) { value->setIsDead(val); }
+    uint64_t getValueTime() final { return value_time; }
 };
 
 class ScalarVarUseExpr : public VarUseExpr {
@@ -119,10 +235,12 @@ class ScalarVarUseExpr : public VarUseExpr {
     IRNodeKind getKind() final { return IRNodeKind::SCALAR_VAR_USE; }
 
     void setValue(std::shared_ptr<Expr> _expr);
+    void setValue(IRValue _val);
 
     bool propagateType() final { return true; }
     EvalResType evaluate(EvalCtx &ctx) final;
     EvalResType rebuild(EvalCtx &ctx) final;
+    bool evaluateLanes(EvalCtx &ctx, LaneValues &lanes) final;
 
     void emit(std::shared_ptr<EmitCtx> ctx, std::ostream &stream,
               std::string offset = "") final {
@@ -133,6 +251,8 @@ class ScalarVarUseExpr : public VarUseExpr {
 
     std::shared_ptr<Expr> copy() final;
 
+    static void clearUseSet() { scalar_var_use_set.clear(); }
+
   private:
     static std::unordered_map<std::shared_ptr<Data>,
                               std::shared_ptr<ScalarVarUseExpr>>
@@ -146,7 +266,8 @@ class ArrayUseExpr : public VarUseExpr {
     static std::shared_ptr<ArrayUseExpr> init(std::shared_ptr<Data> _val);
     IRNodeKind getKind() final { return IRNodeKind::ARRAY_USE; }
 
-    void setValue(std::shared_ptr<Expr> _expr, bool main_val);
+    void setValue(std::shared_ptr<Expr> _expr, size_t lane);
+    void setValue(IRValue _val, size_t lane);
 
     bool propagateType() final { return true; }
     EvalResType evaluate(EvalCtx &ctx) final;
@@ -159,6 +280,8 @@ class ArrayUseExpr : public VarUseExpr {
 
     std::shared_ptr<Expr> copy() final;
 
+    static void clearUseSet() { array_use_set.clear(); }
+
   private:
     static std::unordered_map<std::shared_ptr<Data>,
                               std::shared_ptr<ArrayUseExpr>>
@@ -185,6 +308,8 @@ class IterUseExpr : public VarUseExpr {
 
     std::shared_ptr<Expr> copy() final;
 
+    static void clearUseSet() { iter_use_set.clear(); }
+
   private:
     static std::unordered_map<std::shared_ptr<Data>,
                               std::shared_ptr<IterUseExpr>>
@@ -196,11 +321,13 @@ class TypeCastExpr : public Expr {
     TypeCastExpr(std::shared_ptr<Expr> _expr, std::shared_ptr<Type> _to_type,
                  bool _is_implicit);
     IRNodeKind getKind() final { return IRNodeKind::TYPE_CAST; }
+    uint64_t getValueTime() final { return value_time; }
 
     bool propagateType() final;
     // We assume that if we cast between compatible types we can't cause UB.
     EvalResType evaluate(EvalCtx &ctx) final;
     EvalResType rebuild(EvalCtx &ctx) final;
+    bool evaluateLanes(EvalCtx &ctx, LaneValues &lanes) final;
 
     void emit(std::shared_ptr<EmitCtx> ctx, std::ostream &stream,
               std::string offset = "") final;
@@ -208,8 +335,12 @@ class TypeCastExpr : public Expr {
     create(std::shared_ptr<PopulateCtx> ctx);
 
     std::shared_ptr<Expr> copy() final;
+    void forEachOperand(const OperandFunc &func) final { func(expr); }
+    void forEachChild(const OperandFunc &func) final { func(expr); }
 
   private:
+    std::shared_ptr<ExprKey> getKey() final;
+
     std::shared_ptr<Expr> expr;
     std::shared_ptr<Type> to_type;
     bool is_implicit;
@@ -236,18 +367,24 @@ class UnaryExpr : public ArithmeticExpr {
   public:
     UnaryExpr(UnaryOp _op, std::shared_ptr<Expr> _expr);
     IRNodeKind getKind() final { return IRNodeKind::UNARY; }
+    uint64_t getValueTime() final { return value_time; }
 
     bool propagateType() final;
     EvalResType evaluate(EvalCtx &ctx) final;
     EvalResType rebuild(EvalCtx &ctx) final;
+    bool evaluateLanes(EvalCtx &ctx, LaneValues &lanes) final;
 
     void emit(std::shared_ptr<EmitCtx> ctx, std::ostream &stream,
               std::string offset = "") final;
     static std::shared_ptr<UnaryExpr> create(std::shared_ptr<PopulateCtx> ctx);
 
     std::shared_ptr<Expr> copy() final;
+    void forEachOperand(const OperandFunc &func) final { func(arg); }
+    void forEachChild(const OperandFunc &func) final { func(arg); }
 
   private:
+    std::shared_ptr<ExprKey> getKey() final;
+
     UnaryOp op;
     std::shared_ptr<Expr> arg;
 };
@@ -257,18 +394,27 @@ class BinaryExpr : public ArithmeticExpr {
     BinaryExpr(BinaryOp _op, std::shared_ptr<Expr> _lhs,
                std::shared_ptr<Expr> _rhs);
     IRNodeKind getKind() final { return IRNodeKind::BINARY; }
+    uint64_t getValueTime() final { return value_time; }
 
     bool propagateType() final;
     EvalResType evaluate(EvalCtx &ctx) final;
     EvalResType rebuild(EvalCtx &ctx) final;
+    bool evaluateLanes(EvalCtx &ctx, LaneValues &lanes) final;
 
     void emit(std::shared_ptr<EmitCtx> ctx, std::ostream &stream,
               std::string offset = "") final;
     static std::shared_ptr<BinaryExpr> create(std::shared_ptr<PopulateCtx> ctx);
 
     std::shared_ptr<Expr> copy() final;
+    void forEachOperand(const OperandFunc &func) final {
+        func(lhs);
+        func(rhs);
+    }
+    void forEachChild(const OperandFunc &func) final { forEachOperand(func); }
 
   private:
+    std::shared_ptr<ExprKey> getKey() final;
+
     BinaryOp op;
     std::shared_ptr<Expr> lhs;
     std::shared_ptr<Expr> rhs;
@@ -279,10 +425,12 @@ class TernaryExpr : public ArithmeticExpr {
     TernaryExpr(std::shared_ptr<Expr> _cond, std::shared_ptr<Expr> _true_br,
                 std::shared_ptr<Expr> _false_br);
     IRNodeKind getKind() final { return IRNodeKind::TERNARY; }
+    uint64_t getValueTime() final { return value_time; }
 
     bool propagateType() final;
     EvalResType evaluate(EvalCtx &ctx) final;
     EvalResType rebuild(EvalCtx &ctx) final;
+    bool evaluateLanes(EvalCtx &ctx, LaneValues &lanes) final;
 
     void emit(std::shared_ptr<EmitCtx> ctx, std::ostream &stream,
               std::string offset = "") final;
@@ -290,8 +438,17 @@ class TernaryExpr : public ArithmeticExpr {
     create(std::shared_ptr<PopulateCtx> ctx);
 
     std::shared_ptr<Expr> copy() final;
+    void forEachOperand(const OperandFunc &func) final {
+        func(cond);
+        func(true_br);
+        func(false_br);
+    }
+    void forEachChild(const OperandFunc &func) final { forEachOperand(func); }
 
   private:
+    // Sets the value of the taken branch, the UB of the condition is passed on
+    void selectValue(EvalResType cond_eval, EvalResType br_eval);
+
     std::shared_ptr<Expr> cond;
     std::shared_ptr<Expr> true_br;
     std::shared_ptr<Expr> false_br;
@@ -303,12 +460,15 @@ class SubscriptExpr : public Expr {
   public:
     SubscriptExpr(std::shared_ptr<Expr> _arr, std::shared_ptr<Expr> _idx);
     IRNodeKind getKind() final { return IRNodeKind::SUBSCRIPT; }
+    uint64_t getValueTime() final { return value_time; }
 
     size_t getActiveDim() { return active_dim; }
 
     bool propagateType() final;
     EvalResType evaluate(EvalCtx &ctx) final;
     EvalResType rebuild(EvalCtx &ctx) final;
+    // Only the last dimension has scalar values that can be split into lanes
+    bool evaluateLanes(EvalCtx &ctx, LaneValues &lanes) final;
 
     void emit(std::shared_ptr<EmitCtx> ctx, std::ostream &stream,
               std::string offset = "") final;
@@ -318,16 +478,26 @@ class SubscriptExpr : public Expr {
     getSuitableArrays(std::shared_ptr<PopulateCtx> ctx);
     static std::shared_ptr<SubscriptExpr>
     create(std::shared_ptr<PopulateCtx> ctx);
-    void setValue(std::shared_ptr<Expr> _expr, bool use_main_vals);
+    void setValue(std::shared_ptr<Expr> _expr, size_t lane);
+    void setValue(IRValue _val, size_t lane);
 
     void setIsDead(bool val);
+    // Array that is accessed by the subscript
+    std::shared_ptr<Data> getArrayData();
 
     std::shared_ptr<Expr> copy() final;
+    void forEachChild(const OperandFunc &func) final {
+        func(array);
+        func(idx);
+    }
 
   private:
     static std::shared_ptr<SubscriptExpr>
     initImpl(ArrayStencilParams array_params, std::shared_ptr<PopulateCtx> ctx);
     bool inBounds(size_t dim, std::shared_ptr<Data> idx_val, EvalCtx &ctx);
+    // Lane of the array values that is read by the given lane of the
+    // expression (the same switches of the lanes as in evaluate())
+    size_t getArrayLane(size_t lane);
 
     void setOffset(int64_t _offset) { stencil_offset = _offset; }
     int64_t getOffset() { return stencil_offset; }
@@ -357,6 +527,14 @@ class AssignmentExpr : public Expr {
     // This function sets the value of the expression. It has to be called
     // after the expression is evaluated and rebuilt.
     virtual void propagateValue(EvalCtx &ctx);
+    // The lanes of the assigned value can be computed at once only before the
+    // alternate lanes get their own trees (alt_froms) and if the tree
+    // doesn't read the data that is written (the main values are stored
+    // before the alternate ones are evaluated).
+    bool evaluateLanes(EvalCtx &ctx, LaneValues &lanes) override;
+    // The same as propagateValue() for every lane, but the values are taken
+    // from evaluateLanes()
+    void propagateLanes(EvalCtx &ctx, LaneValues &lanes);
 
     void emit(std::shared_ptr<EmitCtx> ctx, std::ostream &stream,
               std::string offset = "") override;
@@ -364,13 +542,30 @@ class AssignmentExpr : public Expr {
     create(std::shared_ptr<PopulateCtx> ctx);
 
     std::shared_ptr<Expr> copy() override;
+    void forEachOperand(const OperandFunc &func) override {
+        func(from);
+        for (auto &alt_from : alt_froms)
+            func(alt_from);
+    }
 
     std::shared_ptr<Expr> getTo() { return to; }
+    // Gives the trees of the lanes their own nodes, so that every node holds
+    // the value of a single lane and a single place in the test
+    void unshareTrees() {
+        Expr::unshare(from);
+        for (auto &alt_from : alt_froms)
+            Expr::unshare(alt_from);
+    }
 
   protected:
+    // The tree that computes the value of the lane. The trees of the
+    // alternate lanes are created on demand.
+    std::shared_ptr<Expr> &getLaneFrom(size_t lane);
+
     std::shared_ptr<Expr> from;
-    // TODO: fold into a single array
-    std::shared_ptr<Expr> second_from;
+    // Trees of the alternate lanes (the lane i is at i - 1), they diverge
+    // from the main one when UB is eliminated in them
+    std::vector<std::shared_ptr<Expr>> alt_froms;
     bool taken;
     std::shared_ptr<Expr> to;
     // Iterator that we use to fix UB in case of multiple values
@@ -390,6 +585,8 @@ class ReductionExpr : public AssignmentExpr {
     EvalResType evaluate(EvalCtx &ctx) final;
     EvalResType rebuild(EvalCtx &ctx) final;
     virtual void propagateValue(EvalCtx &ctx) final;
+    // Reductions don't have multiple values
+    bool evaluateLanes(EvalCtx &ctx, LaneValues &lanes) final { return false; }
 
     void emit(std::shared_ptr<EmitCtx> ctx, std::ostream &stream,
               std::string offset = "") final;
@@ -431,6 +628,14 @@ class LibCallExpr : public CallExpr {
     static void cxxArgPromotion(std::shared_ptr<Expr> &arg, IntTypeID type_id);
     static bool isAnyArgVarying(std::vector<std::shared_ptr<Expr>> args);
     static void ispcArgPromotion(std::shared_ptr<Expr> &arg);
+
+    // Key of the call in the folding set of the expressions
+    static std::shared_ptr<ExprKey>
+    getCallKey(LibCallKind kind, std::vector<std::shared_ptr<Expr>> args) {
+        return std::make_shared<ExprKey>(IRNodeKind::CALL,
+                                         static_cast<uint32_t>(kind), nullptr,
+                                         std::move(args));
+    }
 };
 
 class MinMaxCallBase : public LibCallExpr {
@@ -438,12 +643,17 @@ class MinMaxCallBase : public LibCallExpr {
     bool propagateType() final;
     EvalResType evaluate(EvalCtx &ctx) final;
     EvalResType rebuild(EvalCtx &ctx) final {
-        a->rebuild(ctx);
-        b->rebuild(ctx);
+        rebuildChild(a, ctx);
+        rebuildChild(b, ctx);
         return evaluate(ctx);
     }
     void emit(std::shared_ptr<EmitCtx> ctx, std::ostream &stream,
               std::string offset = "") override;
+    void forEachOperand(const OperandFunc &func) final {
+        func(a);
+        func(b);
+    }
+    void forEachChild(const OperandFunc &func) final { forEachOperand(func); }
 
   protected:
     MinMaxCallBase(std::shared_ptr<Expr> _a, std::shared_ptr<Expr> _b,
@@ -453,6 +663,10 @@ class MinMaxCallBase : public LibCallExpr {
     static void emitCDefinitionImpl(std::shared_ptr<EmitCtx> ctx,
                                     std::ostream &stream, std::string offset,
                                     LibCallKind kind);
+    std::shared_ptr<ExprKey> getKey() final {
+        return getCallKey(kind, {a, b});
+    }
+
     std::shared_ptr<Expr> a;
     std::shared_ptr<Expr> b;
     LibCallKind kind;
@@ -471,9 +685,7 @@ class MinCall : public MinMaxCallBase {
         emitCDefinitionImpl(ctx, stream, offset, LibCallKind::MAX);
     }
     std::shared_ptr<Expr> copy() final {
-        auto new_a = a->copy();
-        auto new_b = b->copy();
-        return std::make_shared<MinCall>(new_a, new_b);
+        return std::make_shared<MinCall>(share(a), share(b));
     }
 };
 
@@ -490,9 +702,7 @@ class MaxCall : public MinMaxCallBase {
         emitCDefinitionImpl(ctx, stream, offset, LibCallKind::MIN);
     }
     std::shared_ptr<Expr> copy() final {
-        auto new_a = a->copy();
-        auto new_b = b->copy();
-        return std::make_shared<MaxCall>(new_a, new_b);
+        return std::make_shared<MaxCall>(share(a), share(b));
     }
 };
 
@@ -509,14 +719,22 @@ class SelectCall : public LibCallExpr {
     create(std::shared_ptr<PopulateCtx> ctx);
 
     std::shared_ptr<Expr> copy() final {
-        auto new_cond = cond->copy();
-        auto new_true_arg = true_arg->copy();
-        auto new_false_arg = false_arg->copy();
-        return std::make_shared<SelectCall>(new_cond, new_true_arg,
-                                            new_false_arg);
+        return std::make_shared<SelectCall>(share(cond), share(true_arg),
+                                            share(false_arg));
     }
 
+    void forEachOperand(const OperandFunc &func) final {
+        func(cond);
+        func(true_arg);
+        func(false_arg);
+    }
+    void forEachChild(const OperandFunc &func) final { forEachOperand(func); }
+
   private:
+    std::shared_ptr<ExprKey> getKey() final {
+        return getCallKey(LibCallKind::SELECT, {cond, true_arg, false_arg});
+    }
+
     std::shared_ptr<Expr> cond;
     std::shared_ptr<Expr> true_arg;
     std::shared_ptr<Expr> false_arg;
@@ -527,9 +745,10 @@ class LogicalReductionBase : public LibCallExpr {
     bool propagateType() final;
     EvalResType evaluate(EvalCtx &ctx) final;
     EvalResType rebuild(EvalCtx &ctx) final {
-        arg->rebuild(ctx);
+        rebuildChild(arg, ctx);
         return evaluate(ctx);
     }
+    void forEachChild(const OperandFunc &func) final { func(arg); }
     void emit(std::shared_ptr<EmitCtx> ctx, std::ostream &stream,
               std::string offset = "") final;
 
@@ -537,6 +756,8 @@ class LogicalReductionBase : public LibCallExpr {
     LogicalReductionBase(std::shared_ptr<Expr> _arg, LibCallKind _kind);
     static std::shared_ptr<LibCallExpr>
     createHelper(std::shared_ptr<PopulateCtx> ctx, LibCallKind kind);
+    std::shared_ptr<ExprKey> getKey() final { return getCallKey(kind, {arg}); }
+
     std::shared_ptr<Expr> arg;
     LibCallKind kind;
 };
@@ -552,8 +773,7 @@ class AnyCall : public LogicalReductionBase {
     }
 
     std::shared_ptr<Expr> copy() final {
-        auto new_arg = arg->copy();
-        return std::make_shared<AnyCall>(new_arg);
+        return std::make_shared<AnyCall>(share(arg));
     }
 };
 
@@ -567,8 +787,7 @@ class AllCall : public LogicalReductionBase {
                                                   LibCallKind::ALL);
     }
     std::shared_ptr<Expr> copy() final {
-        auto new_arg = arg->copy();
-        return std::make_shared<AllCall>(new_arg);
+        return std::make_shared<AllCall>(share(arg));
     }
 };
 
@@ -582,8 +801,7 @@ class NoneCall : public LogicalReductionBase {
                                                   LibCallKind::NONE);
     }
     std::shared_ptr<Expr> copy() final {
-        auto new_arg = arg->copy();
-        return std::make_shared<NoneCall>(new_arg);
+        return std::make_shared<NoneCall>(share(arg));
     }
 };
 
@@ -592,9 +810,10 @@ class MinMaxEqReductionBase : public LibCallExpr {
     bool propagateType() final;
     EvalResType evaluate(EvalCtx &ctx) final;
     EvalResType rebuild(EvalCtx &ctx) final {
-        arg->rebuild(ctx);
+        rebuildChild(arg, ctx);
         return evaluate(ctx);
     }
+    void forEachChild(const OperandFunc &func) final { func(arg); }
     void emit(std::shared_ptr<EmitCtx> ctx, std::ostream &stream,
               std::string offset = "") final;
 
@@ -602,6 +821,8 @@ class MinMaxEqReductionBase : public LibCallExpr {
     MinMaxEqReductionBase(std::shared_ptr<Expr> _arg, LibCallKind _kind);
     static std::shared_ptr<LibCallExpr>
     createHelper(std::shared_ptr<PopulateCtx> ctx, LibCallKind kind);
+    std::shared_ptr<ExprKey> getKey() final { return getCallKey(kind, {arg}); }
+
     std::shared_ptr<Expr> arg;
     LibCallKind kind;
 };
@@ -616,8 +837,7 @@ class ReduceMinCall : public MinMaxEqReductionBase {
                                                    LibCallKind::RED_MIN);
     }
     std::shared_ptr<Expr> copy() final {
-        auto new_arg = arg->copy();
-        return std::make_shared<ReduceMinCall>(new_arg);
+        return std::make_shared<ReduceMinCall>(share(arg));
     }
 };
 
@@ -631,8 +851,7 @@ class ReduceMaxCall : public MinMaxEqReductionBase {
                                                    LibCallKind::RED_MAX);
     }
     std::shared_ptr<Expr> copy() final {
-        auto new_arg = arg->copy();
-        return std::make_shared<ReduceMaxCall>(new_arg);
+        return std::make_shared<ReduceMaxCall>(share(arg));
     }
 };
 
@@ -646,8 +865,7 @@ class ReduceEqCall : public MinMaxEqReductionBase {
                                                    LibCallKind::RED_EQ);
     }
     std::shared_ptr<Expr> copy() final {
-        auto new_arg = arg->copy();
-        return std::make_shared<ReduceEqCall>(new_arg);
+        return std::make_shared<ReduceEqCall>(share(arg));
     }
 };
 
@@ -655,28 +873,88 @@ class ExtractCall : public LibCallExpr {
     // TODO: it is not a real extract call. We will always use zero as an index
   public:
     explicit ExtractCall(std::shared_ptr<Expr> _arg);
+    ExtractCall(std::shared_ptr<Expr> _arg, std::shared_ptr<Expr> _idx);
     bool propagateType() final;
     EvalResType evaluate(EvalCtx &ctx) final;
     EvalResType rebuild(EvalCtx &ctx) final {
-        arg->rebuild(ctx);
+        rebuildChild(arg, ctx);
         return evaluate(ctx);
     };
+    void forEachChild(const OperandFunc &func) final {
+        func(arg);
+        func(idx);
+    }
     void emit(std::shared_ptr<EmitCtx> ctx, std::ostream &stream,
               std::string offset = "") final;
     static std::shared_ptr<LibCallExpr>
     create(std::shared_ptr<PopulateCtx> ctx);
 
     std::shared_ptr<Expr> copy() final {
-        auto new_arg = arg->copy();
-        return std::make_shared<ExtractCall>(new_arg);
+        return std::make_shared<ExtractCall>(share(arg), share(idx));
     }
 
     void setIsImplicit(bool _val) { is_implicit = _val; }
 
   protected:
+    // The index is always zero, so it isn't a part of the key
+    std::shared_ptr<ExprKey> getKey() final {
+        return getCallKey(LibCallKind::EXTRACT, {arg});
+    }
+
     std::shared_ptr<Expr> arg;
     std::shared_ptr<Expr> idx;
     // We use extract call ISPC to convert varying to uniform
     bool is_implicit;
 };
+
+// Call of a function from the function library (see FunctionLibrary). The
+// library records an input of every function and the output for it, so the
+// call always gets the recorded input as constant arguments and the value of
+// the call is known without executing the function. Parent nodes do the usual
+// promotions and conversions of the return type.
+class InjectedCallExpr : public CallExpr {
+  public:
+    // Function with the parsed types and values of the call
+    struct InjectedFunc {
+        FunctionInfo info;
+        std::vector<IRValue> args;
+        IRValue result;
+        bool is_used = false;
+    };
+
+    explicit InjectedCallExpr(std::shared_ptr<InjectedFunc> _func);
+    uint64_t getValueTime() final { return value_time; }
+    bool propagateType() final { return true; }
+    EvalResType evaluate(EvalCtx &ctx) final { return value; }
+    EvalResType rebuild(EvalCtx &ctx) final { return evaluate(ctx); }
+    bool evaluateLanes(EvalCtx &ctx, LaneValues &lanes) final {
+        setUniformLanes(lanes);
+        return true;
+    }
+    void emit(std::shared_ptr<EmitCtx> ctx, std::ostream &stream,
+              std::string offset = "") final;
+    static std::shared_ptr<InjectedCallExpr>
+    create(std::shared_ptr<PopulateCtx> ctx);
+
+    // The arguments have to stay equal to the recorded input, so they are not
+    // operands that can be replaced
+    std::shared_ptr<Expr> copy() final {
+        return std::make_shared<InjectedCallExpr>(func);
+    }
+
+    // Makes the function available for the calls. Returns false if it can't
+    // be injected: the types are not integral, the input or the output don't
+    // fit into them, or the function can change a state that outlives the
+    // call (it writes the globals from misc or has static locals), so the
+    // result of the call depends on the previous ones.
+    static bool addFunction(const FunctionInfo &func);
+    static bool hasFunctions() { return !functions.empty(); }
+    static void clearFunctions() { functions.clear(); }
+    // Globals and definitions of the called functions
+    static void emitDefinitions(std::ostream &stream);
+
+  private:
+    std::shared_ptr<InjectedFunc> func;
+    static std::vector<std::shared_ptr<InjectedFunc>> functions;
+};
 } // namespace yarpgen
@@ -0,0 +1,482 @@
+/*
+Copyright (c) 2015-2020, Intel Corporation
+Copyright (c) 2019-2020, University of Utah
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+//////////////////////////////////////////////////////////////////////////////
+
+#include "func_lib.h"
+#include "utils.h"
+
+#include <algorithm>
+#include <climits>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <set>
+#include <sstream>
+
+#include <yaml-cpp/yaml.h>
+
+#ifdef YARPGEN_HAS_ZLIB
+#include <zlib.h>
+#endif
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace yarpgen;
+
+static bool parseFunction(const YAML::Node &node, FunctionInfo &func) {
+    try {
+        func.function_name = node["function_name"].as<std::string>();
+        if (node["parameter_types"]) {
+            for (const auto &param : node["parameter_types"]) {
+                func.parameter_types.push_back(param.as<std::string>());
+            }
+        }
+        func.return_type = node["return_type"].as<std::string>();
+        func.function_body = node["function"].as<std::string>();
+        if (node["input"]) {
+            for (const auto &input_val : node["input"]) {
+                func.input.push_back(input_val.as<std::string>());
+            }
+        }
+        func.output = node["output"].as<std::string>();
+        if (node["misc"]) {
+            for (const auto &misc_line : node["misc"]) {
+                func.misc.push_back(misc_line.as<std::string>());
+            }
+        }
+    }
+    catch (const std::exception &e) {
+        return false;
+    }
+    return true;
+}
+
+static bool isYamlFile(const std::string &name) {
+    auto ends_with = [&name](const std::string &suffix) {
+        return name.size() >= suffix.size() &&
+               name.compare(name.size() - suffix.size(), suffix.size(),
+                            suffix) == 0;
+    };
+    return ends_with(".yaml") || ends_with(".yml");
+}
+
+// Little-endian fields of the zip headers and of the binary library
+static uint32_t readLE(const char *ptr, size_t bytes) {
+    uint32_t res = 0;
+    for (size_t i = 0; i < bytes; ++i)
+        res |= static_cast<uint32_t>(static_cast<unsigned char>(ptr[i]))
+               << (8 * i);
+    return res;
+}
+
+static uint64_t readLE64(const char *ptr) {
+    return readLE(ptr, 4) | static_cast<uint64_t>(readLE(ptr + 4, 4)) << 32;
+}
+
+static void writeLE(std::string &buf, uint64_t val, size_t bytes) {
+    for (size_t i = 0; i < bytes; ++i)
+        buf.push_back(static_cast<char>((val >> (8 * i)) & 0xFF));
+}
+
+static char constexpr bin_magic[8] = {'Y', 'F', 'L', 'B', 1, 0, 0, 0};
+static size_t constexpr bin_header_size = 32;
+// Four string refs and three list refs
+static size_t constexpr bin_record_size = 56;
+static size_t constexpr bin_ref_size = 8;
+
+FunctionLibrary::~FunctionLibrary() { unload(); }
+
+void FunctionLibrary::unload() {
+    funcs_num = 0;
+    entries.clear();
+    functions.clear();
+    if (bin_data) {
+#ifdef _WIN32
+        delete[] bin_data;
+#else
+        munmap(const_cast<char *>(bin_data), bin_size);
+#endif
+    }
+    bin_data = nullptr;
+    bin_size = 0;
+}
+
+bool FunctionLibrary::load(const std::string &_path) {
+    unload();
+    path = _path;
+
+    std::error_code err;
+    bool res = false;
+    if (std::filesystem::is_directory(path, err))
+        res = loadDir();
+    else if (std::filesystem::exists(path, err)) {
+        char magic[sizeof(bin_magic)] = {};
+        std::ifstream file(path, std::ios::binary);
+        file.read(magic, sizeof(magic));
+        if (file && std::equal(magic, magic + sizeof(magic), bin_magic))
+            res = loadBinary();
+        else
+            res = isYamlFile(path) ? loadYamlList() : loadZip();
+    }
+    if (!res)
+        unload();
+    else if (!bin_data)
+        funcs_num = entries.size();
+    return res;
+}
+
+bool FunctionLibrary::loadBinary() {
+#ifdef _WIN32
+    std::ifstream file(path, std::ios::binary);
+    std::stringstream buf;
+    buf << file.rdbuf();
+    std::string content = buf.str();
+    bin_size = content.size();
+    char *data = new char[bin_size];
+    std::copy(content.begin(), content.end(), data);
+    bin_data = data;
+#else
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd == -1)
+        return false;
+    struct stat file_stat {};
+    if (fstat(fd, &file_stat) == -1 || file_stat.st_size <= 0) {
+        close(fd);
+        return false;
+    }
+    bin_size = static_cast<size_t>(file_stat.st_size);
+    void *data = mmap(nullptr, bin_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        bin_size = 0;
+        return false;
+    }
+    bin_data = static_cast<const char *>(data);
+#endif
+
+    if (bin_size < bin_header_size)
+        return false;
+    uint64_t header_funcs_num = readLE64(bin_data + 8);
+    bin_lists_num = readLE64(bin_data + 16);
+    bin_strings_size = readLE64(bin_data + 24);
+    // Checked by parts, so the sum can't overflow
+    uint64_t rest = bin_size - bin_header_size;
+    if (header_funcs_num > rest / bin_record_size)
+        return false;
+    rest -= header_funcs_num * bin_record_size;
+    if (bin_lists_num > rest / bin_ref_size)
+        return false;
+    rest -= bin_lists_num * bin_ref_size;
+    if (bin_strings_size != rest)
+        return false;
+    funcs_num = header_funcs_num;
+    return true;
+}
+
+bool FunctionLibrary::loadYamlList() {
+    try {
+        YAML::Node root = YAML::LoadFile(path);
+        if (!root.IsSequence())
+            return false;
+        for (const auto &node : root) {
+            auto func = std::make_shared<FunctionInfo>();
+            functions[entries.size()] =
+                parseFunction(node, *func) ? func : nullptr;
+            entries.push_back({EntryKind::PARSED, "", 0, 0, 0});
+        }
+    }
+    catch (const std::exception &e) {
+        return false;
+    }
+    return true;
+}
+
+bool FunctionLibrary::loadDir() {
+    std::vector<std::string> files;
+    std::error_code err;
+    for (const auto &dir_entry :
+         std::filesystem::directory_iterator(path, err)) {
+        if (dir_entry.is_regular_file() &&
+            isYamlFile(dir_entry.path().filename().string()))
+            files.push_back(dir_entry.path().string());
+    }
+    if (err)
+        return false;
+    // The order of the directory entries is not stable
+    std::sort(files.begin(), files.end());
+    for (auto &file : files)
+        entries.push_back({EntryKind::FILE, std::move(file), 0, 0, 0});
+    return true;
+}
+
+bool FunctionLibrary::loadZip() {
+    std::ifstream file(path, std::ios::binary);
+    if (!file)
+        return false;
+    file.seekg(0, std::ios::end);
+    uint64_t file_size = static_cast<uint64_t>(file.tellg());
+
+    // End of central directory record: signature, 16 bytes of fields and a
+    // comment of up to 64 KB
+    size_t constexpr eocd_size = 22;
+    if (file_size < eocd_size)
+        return false;
+    uint64_t tail_size = std::min<uint64_t>(file_size, eocd_size + 0xFFFF);
+    std::string tail(tail_size, '\0');
+    file.seekg(static_cast<std::streamoff>(file_size - tail_size));
+    file.read(&tail[0], static_cast<std::streamsize>(tail_size));
+    if (!file)
+        return false;
+    size_t eocd = std::string::npos;
+    for (size_t pos = tail_size - eocd_size + 1; pos-- > 0;) {
+        if (readLE(&tail[pos], 4) == 0x06054b50) {
+            eocd = pos;
+            break;
+        }
+    }
+    if (eocd == std::string::npos)
+        return false;
+    uint32_t entries_num = readLE(&tail[eocd + 10], 2);
+    uint32_t dir_size = readLE(&tail[eocd + 12], 4);
+    uint32_t dir_offset = readLE(&tail[eocd + 16], 4);
+    if (static_cast<uint64_t>(dir_offset) + dir_size > file_size)
+        return false;
+
+    std::string dir(dir_size, '\0');
+    file.seekg(dir_offset);
+    file.read(&dir[0], dir_size);
+    if (!file)
+        return false;
+
+    // Central directory file headers
+    size_t constexpr header_size = 46;
+    size_t pos = 0;
+    for (uint32_t i = 0; i < entries_num; ++i) {
+        if (pos + header_size > dir.size() ||
+            readLE(&dir[pos], 4) != 0x02014b50)
+            return false;
+        uint32_t method = readLE(&dir[pos + 10], 2);
+        uint32_t comp_size = readLE(&dir[pos + 20], 4);
+        uint32_t uncomp_size = readLE(&dir[pos + 24], 4);
+        uint32_t name_len = readLE(&dir[pos + 28], 2);
+        uint32_t extra_len = readLE(&dir[pos + 30], 2);
+        uint32_t comment_len = readLE(&dir[pos + 32], 2);
+        uint32_t local_offset = readLE(&dir[pos + 42], 4);
+        if (pos + header_size + name_len > dir.size())
+            return false;
+        std::string name = dir.substr(pos + header_size, name_len);
+        pos += header_size + name_len + extra_len + comment_len;
+
+        if (!isYamlFile(name))
+            continue;
+        EntryKind kind;
+        if (method == 0)
+            kind = EntryKind::STORED;
+        else if (method == 8)
+            kind = EntryKind::DEFLATED;
+        else
+            continue;
+        entries.push_back({kind, "", local_offset, comp_size, uncomp_size});
+    }
+    return true;
+}
+
+bool FunctionLibrary::readEntry(const Entry &entry, std::string &text) {
+    if (entry.kind == EntryKind::FILE) {
+        std::ifstream file(entry.file);
+        if (!file)
+            return false;
+        std::stringstream buf;
+        buf << file.rdbuf();
+        text = buf.str();
+        return true;
+    }
+
+    // The size of the local header is known only from the header itself
+    std::ifstream file(path, std::ios::binary);
+    char header[30];
+    file.seekg(static_cast<std::streamoff>(entry.offset));
+    file.read(header, sizeof(header));
+    if (!file || readLE(header, 4) != 0x04034b50)
+        return false;
+    uint64_t data_offset = entry.offset + sizeof(header) +
+                           readLE(&header[26], 2) + readLE(&header[28], 2);
+    std::string data(entry.size, '\0');
+    file.seekg(static_cast<std::streamoff>(data_offset));
+    file.read(&data[0], static_cast<std::streamsize>(entry.size));
+    if (!file)
+        return false;
+
+    if (entry.kind == EntryKind::STORED) {
+        text = std::move(data);
+        return true;
+    }
+#ifdef YARPGEN_HAS_ZLIB
+    // Raw deflate stream without the zlib header
+    text.assign(entry.uncompressed_size, '\0');
+    z_stream stream{};
+    if (inflateInit2(&stream, -MAX_WBITS) != Z_OK)
+        return false;
+    stream.next_in = reinterpret_cast<Bytef *>(&data[0]);
+    stream.avail_in = static_cast<uInt>(data.size());
+    stream.next_out = reinterpret_cast<Bytef *>(&text[0]);
+    stream.avail_out = static_cast<uInt>(text.size());
+    int res = inflate(&stream, Z_FINISH);
+    inflateEnd(&stream);
+    return res == Z_STREAM_END && stream.total_out == text.size();
+#else
+    return false;
+#endif
+}
+
+std::shared_ptr<FunctionInfo> FunctionLibrary::get(size_t idx) {
+    auto parsed = functions.find(idx);
+    if (parsed != functions.end())
+        return parsed->second;
+    if (bin_data)
+        return functions[idx] = getBinary(idx);
+
+    std::shared_ptr<FunctionInfo> res;
+    std::string text;
+    if (readEntry(entries.at(idx), text)) {
+        try {
+            auto func = std::make_shared<FunctionInfo>();
+            if (parseFunction(YAML::Load(text), *func))
+                res = func;
+        }
+        catch (const std::exception &e) {
+        }
+    }
+    return functions[idx] = res;
+}
+
+std::shared_ptr<FunctionInfo> FunctionLibrary::getBinary(size_t idx) {
+    const char *index = bin_data + bin_header_size;
+    const char *lists = index + funcs_num * bin_record_size;
+    const char *strings = lists + bin_lists_num * bin_ref_size;
+    const char *record = index + idx * bin_record_size;
+
+    bool valid = true;
+    auto get_string = [&](const char *ref) {
+        uint64_t offset = readLE(ref, 4);
+        uint64_t len = readLE(ref + 4, 4);
+        if (offset + len > bin_strings_size) {
+            valid = false;
+            return std::string();
+        }
+        return std::string(strings + offset, len);
+    };
+    auto get_list = [&](const char *ref) {
+        uint64_t first = readLE(ref, 4);
+        uint64_t num = readLE(ref + 4, 4);
+        std::vector<std::string> res;
+        if (first + num > bin_lists_num) {
+            valid = false;
+            return res;
+        }
+        for (uint64_t i = first; i < first + num; ++i)
+            res.push_back(get_string(lists + i * bin_ref_size));
+        return res;
+    };
+
+    auto func = std::make_shared<FunctionInfo>();
+    func->function_name = get_string(record);
+    func->return_type = get_string(record + 8);
+    func->function_body = get_string(record + 16);
+    func->output = get_string(record + 24);
+    func->parameter_types = get_list(record + 32);
+    func->input = get_list(record + 40);
+    func->misc = get_list(record + 48);
+    return valid ? func : nullptr;
+}
+
+std::vector<FunctionInfo> FunctionLibrary::sample(size_t batch_size) {
+    std::vector<FunctionInfo> res;
+    if (batch_size == 0 || batch_size >= size()) {
+        for (size_t i = 0; i < size(); ++i) {
+            auto func = get(i);
+            if (func)
+                res.push_back(*func);
+        }
+        return res;
+    }
+
+    std::set<size_t> tried;
+    while (res.size() < batch_size && tried.size() < size()) {
+        size_t idx = rand_val_gen->getRandValue<size_t>(0, size() - 1);
+        if (!tried.insert(idx).second)
+            continue;
+        auto func = get(idx);
+        if (func)
+            res.push_back(*func);
+    }
+    return res;
+}
+
+int64_t FunctionLibrary::save(const std::string &out_path) {
+    std::string index;
+    std::string lists;
+    std::string strings;
+    uint64_t lists_num = 0;
+    int64_t saved_num = 0;
+
+    auto add_string = [&](std::string &buf, const std::string &str) {
+        writeLE(buf, strings.size(), 4);
+        writeLE(buf, str.size(), 4);
+        strings += str;
+    };
+    auto add_list = [&](const std::vector<std::string> &list) {
+        writeLE(index, lists_num, 4);
+        writeLE(index, list.size(), 4);
+        for (const auto &str : list)
+            add_string(lists, str);
+        lists_num += list.size();
+    };
+
+    for (size_t i = 0; i < size(); ++i) {
+        auto func = get(i);
+        if (!func)
+            continue;
+        add_string(index, func->function_name);
+        add_string(index, func->return_type);
+        add_string(index, func->function_body);
+        add_string(index, func->output);
+        add_list(func->parameter_types);
+        add_list(func->input);
+        add_list(func->misc);
+        saved_num++;
+        // The refs are 32-bit
+        if (strings.size() > UINT32_MAX || lists_num > UINT32_MAX)
+            return -1;
+    }
+
+    std::string header(bin_magic, sizeof(bin_magic));
+    writeLE(header, static_cast<uint64_t>(saved_num), 8);
+    writeLE(header, lists_num, 8);
+    writeLE(header, strings.size(), 8);
+
+    std::ofstream out(out_path, std::ios::binary);
+    out << header << index << lists << strings;
+    out.close();
+    return out ? saved_num : -1;
+}
@@ -0,0 +1,116 @@
+/*
+Copyright (c) 2015-2020, Intel Corporation
+Copyright (c) 2019-2020, University of Utah
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+//////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace yarpgen {
+
+struct FunctionInfo {
+    std::string function_name;
+    std::vector<std::string> parameter_types;
+    std::string return_type;
+    std::string function_body;
+    std::vector<std::string> input;
+    std::string output;
+    std::vector<std::string> misc;
+};
+
+// Library of the functions for the injection (--func-lib). It can be
+//   - a zip archive of YAML files with one function each (functions.zip);
+//   - a directory of such YAML files;
+//   - a single YAML file with a list of functions;
+//   - a binary library (see save()).
+// Only the list of the entries is read on load. A function is parsed when it
+// is used for the first time, so sampling a few functions from a large
+// archive doesn't touch the rest of it. The binary library is mapped into
+// memory and nothing is read on load except the header.
+//
+// Binary library (little-endian):
+//   header:  magic "YFLB\1\0\0\0", number of functions, number of list
+//            items, size of the string table (u64 each)
+//   index:   a record for every function: name, return type, body, output
+//            (string refs), parameter types, inputs, misc (list refs)
+//   lists:   string refs of the list items
+//   strings: the bytes of all strings
+// A string ref is (offset in the string table, length), a list ref is
+// (index of the first item, number of items), all of them are u32.
+class FunctionLibrary {
+  public:
+    FunctionLibrary() = default;
+    ~FunctionLibrary();
+    FunctionLibrary(const FunctionLibrary &) = delete;
+    FunctionLibrary &operator=(const FunctionLibrary &) = delete;
+
+    // Returns false if the library can't be read (the library is empty then)
+    bool load(const std::string &_path);
+    const std::string &getPath() { return path; }
+    size_t size() { return funcs_num; }
+
+    // Returns nullptr if the function is malformed
+    std::shared_ptr<FunctionInfo> get(size_t idx);
+
+    // Chooses batch_size different functions with the random generator of the
+    // test, so the choice is reproducible from the seed. Malformed functions
+    // are skipped. If batch_size is 0 or the library is not larger than that,
+    // all functions are returned in the library order without random choices.
+    std::vector<FunctionInfo> sample(size_t batch_size);
+
+    // Writes the well-formed functions of the library to a binary library.
+    // Returns the number of the written functions or -1 on error.
+    int64_t save(const std::string &out_path);
+
+  private:
+    enum class EntryKind { PARSED, FILE, STORED, DEFLATED };
+
+    struct Entry {
+        EntryKind kind;
+        // FILE: path of the file, archive entries: offset of the local header
+        std::string file;
+        uint64_t offset;
+        uint64_t size;
+        uint64_t uncompressed_size;
+    };
+
+    void unload();
+    bool loadZip();
+    bool loadDir();
+    bool loadYamlList();
+    bool loadBinary();
+    bool readEntry(const Entry &entry, std::string &text);
+    std::shared_ptr<FunctionInfo> getBinary(size_t idx);
+
+    std::string path;
+    size_t funcs_num = 0;
+    std::vector<Entry> entries;
+    // Functions that are already parsed (nullptr for malformed ones)
+    std::map<size_t, std::shared_ptr<FunctionInfo>> functions;
+
+    // Mapped binary library
+    const char *bin_data = nullptr;
+    size_t bin_size = 0;
+    uint64_t bin_lists_num = 0;
+    uint64_t bin_strings_size = 0;
+};
+} // namespace yarpgen
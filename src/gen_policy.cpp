@@ -352,6 +352,10 @@ GenPolicy::GenPolicy() {
     ub_in_dc_prob.emplace_back(Probability<bool>(false, 70));
     shuffleProbProxy(ub_in_dc_prob);
 
+    // Not shuffled, the tests without injected functions mustn't change
+    injected_call_prob.emplace_back(Probability<bool>(true, 50));
+    injected_call_prob.emplace_back(Probability<bool>(false, 50));
+
     allow_stencil_prob.emplace_back(Probability<bool>(true, 40));
     allow_stencil_prob.emplace_back(Probability<bool>(false, 60));
     shuffleProbProxy(allow_stencil_prob);
@@ -183,6 +183,9 @@ class GenPolicy {
     double stencil_prob_weight_alternation = 0.3;
     // Probability to leave UB in DeadCode when it is allowed
     std::vector<Probability<bool>> ub_in_dc_prob;
+    // Probability to call an injected function from the function library
+    // instead of a library call (when there are any)
+    std::vector<Probability<bool>> injected_call_prob;
 
     // Probability to generate array with dims that are in natural order of
     // context
@@ -107,3 +107,23 @@ std::size_t ArrayTypeKeyHasher::operator()(const ArrayTypeKey &key) const {
 
     return hash.getSeed();
 }
+
+ExprKey::ExprKey(IRNodeKind _kind, uint32_t _op, std::shared_ptr<Type> _type,
+                 std::vector<std::shared_ptr<Expr>> _operands)
+    : kind(_kind), op(_op), type(std::move(_type)),
+      operands(std::move(_operands)) {}
+
+bool ExprKey::operator==(const ExprKey &other) const {
+    return (kind == other.kind) && (op == other.op) && (type == other.type) &&
+           (operands == other.operands);
+}
+
+std::size_t ExprKeyHasher::operator()(const ExprKey &key) const {
+    Hash hash;
+    hash(key.kind);
+    hash(key.op);
+    hash(reinterpret_cast<uintptr_t>(key.type.get()));
+    for (const auto &operand : key.operands)
+        hash(reinterpret_cast<uintptr_t>(operand.get()));
+    return hash.getSeed();
+}
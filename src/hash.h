@@ -122,4 +122,29 @@ class ArrayTypeKeyHasher {
   public:
     std::size_t operator()(const ArrayTypeKey &key) const;
 };
+
+class Expr;
+
+// This class is used as a key in the folding set of expressions (see
+// Expr::intern). The operands are identified by their nodes, so the key
+// matches only the expressions that are built from the same nodes.
+class ExprKey {
+  public:
+    ExprKey(IRNodeKind _kind, uint32_t _op, std::shared_ptr<Type> _type,
+            std::vector<std::shared_ptr<Expr>> _operands);
+    bool operator==(const ExprKey &other) const;
+
+    IRNodeKind kind;
+    // Operator of the node or the kind of the library call
+    uint32_t op;
+    // Target type of the type cast
+    std::shared_ptr<Type> type;
+    std::vector<std::shared_ptr<Expr>> operands;
+};
+
+// This class provides a hashing mechanism for folding set.
+class ExprKeyHasher {
+  public:
+    std::size_t operator()(const ExprKey &key) const;
+};
 } // namespace yarpgen
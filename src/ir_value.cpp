@@ -18,6 +18,7 @@ limitations under the License.
 //////////////////////////////////////////////////////////////////////////////
 
 #include "ir_value.h"
+#include "ir_value_impl.h"
 #include "type.h"
 
 using namespace yarpgen;
@@ -125,16 +126,11 @@ addOperator(IRValue &lhs, IRValue &rhs) {
     IRValue ret(rhs.getIntTypeID());
     if (lhs.hasUB() || rhs.hasUB())
         return ret;
-    using unsigned_T = typename std::make_unsigned<T>::type;
-    auto ua = static_cast<unsigned_T>(lhs.getValueRef<T>());
-    auto ub = static_cast<unsigned_T>(rhs.getValueRef<T>());
-    unsigned_T u_tmp = ua + ub;
-    ua = (ua >> std::numeric_limits<T>::digits) + std::numeric_limits<T>::max();
-    if (static_cast<T>((ua ^ ub) | ~(ub ^ u_tmp)) >= 0) {
+    T res;
+    if (addOverflow<T>(lhs.getValueRef<T>(), rhs.getValueRef<T>(), res))
         ret.setUBCode(UBKind::SignOvf);
-    }
     else {
-        ret.getValueRef<T>() = lhs.getValueRef<T>() + rhs.getValueRef<T>();
+        ret.getValueRef<T>() = res;
         ret.setUBCode(UBKind::NoUB);
     }
     return ret;
@@ -169,15 +165,11 @@ subOperator(IRValue &lhs, IRValue &rhs) {
     IRValue ret(rhs.getIntTypeID());
     if (lhs.hasUB() || rhs.hasUB())
         return ret;
-    using unsigned_T = typename std::make_unsigned<T>::type;
-    auto ua = static_cast<unsigned_T>(lhs.getValueRef<T>());
-    auto ub = static_cast<unsigned_T>(rhs.getValueRef<T>());
-    unsigned_T u_tmp = ua - ub;
-    ua = (ua >> std::numeric_limits<T>::digits) + std::numeric_limits<T>::max();
-    if (static_cast<T>((ua ^ ub) & (ua ^ u_tmp)) < 0)
+    T res;
+    if (subOverflow<T>(lhs.getValueRef<T>(), rhs.getValueRef<T>(), res))
         ret.setUBCode(UBKind::SignOvf);
     else {
-        ret.getValueRef<T>() = static_cast<T>(u_tmp);
+        ret.getValueRef<T>() = res;
         ret.setUBCode(UBKind::NoUB);
     }
     return ret;
@@ -189,49 +181,6 @@ IRValue yarpgen::operator-(IRValue lhs, IRValue rhs) {
 
 //////////////////////////////////////////////////////////////////////////////
 
-template <typename T> static bool checkMulIsOk(T a, T b, IRValue &res) {
-    // Special thanks to http://www.fefe.de/intof.html
-
-    using unsigned_T = typename std::make_unsigned<T>::type;
-    unsigned_T ret = 0;
-
-    int32_t sign = (((a > 0) && (b > 0)) || ((a < 0) && (b < 0))) ? 1 : -1;
-    unsigned_T a_abs = std::abs(a);
-    unsigned_T b_abs = std::abs(b);
-
-    using unsigned_half_T =
-        std::conditional_t<std::is_same<T, int32_t>::value, uint16_t, uint32_t>;
-    unsigned_half_T half_all_one =
-        (std::is_same<unsigned_half_T, uint32_t>::value) ? 0xFFFFFFFF : 0xFFFF;
-    int32_t half_bit_size = sizeof(unsigned_half_T) * CHAR_BIT;
-    auto a_low = static_cast<unsigned_half_T>(a_abs & half_all_one);
-    auto b_low = static_cast<unsigned_half_T>(b_abs & half_all_one);
-    auto a_high = static_cast<unsigned_half_T>(a_abs >> half_bit_size);
-    auto b_high = static_cast<unsigned_half_T>(b_abs >> half_bit_size);
-
-    if ((a_high != 0) && (b_high != 0))
-        return false;
-
-    unsigned_T tmp = (static_cast<unsigned_T>(a_high) * b_low) +
-                     (static_cast<unsigned_T>(b_high) * a_low);
-    if (tmp > half_all_one)
-        return false;
-
-    ret = (tmp << half_bit_size) + (static_cast<unsigned_T>(a_low) * b_low);
-    if (ret < (tmp << half_bit_size))
-        return false;
-
-    if (((sign < 0) && (ret > static_cast<unsigned_T>(
-                                  std::abs(std::numeric_limits<T>::min())))) ||
-        ((sign > 0) &&
-         (ret > static_cast<unsigned_T>(std::numeric_limits<T>::max()))))
-        return false;
-    else
-        res.getValueRef<T>() = ret * static_cast<T>(sign);
-
-    return true;
-}
-
 template <typename T>
 static typename std::enable_if<std::is_unsigned<T>::value, IRValue>::type
 mulOperator(IRValue &lhs, IRValue &rhs) {
@@ -266,12 +215,15 @@ mulOperator(IRValue &lhs, IRValue &rhs) {
                 a.getValueRef<T>() == -1);
     };
 
+    T res;
     if (special_check(lhs, rhs) || special_check(rhs, lhs))
         ret.setUBCode(UBKind::SignOvfMin);
-    else if (!checkMulIsOk<T>(lhs.getValueRef<T>(), rhs.getValueRef<T>(), ret))
+    else if (mulOverflow<T>(lhs.getValueRef<T>(), rhs.getValueRef<T>(), res))
         ret.setUBCode(UBKind::SignOvf);
-    else
+    else {
+        ret.getValueRef<T>() = res;
         ret.setUBCode(UBKind::NoUB);
+    }
     return ret;
 }
 
@@ -494,17 +446,16 @@ template <typename T, typename U>
 static IRValue shiftOperatorCommonChecks(IRValue &lhs, IRValue &rhs) {
     IRValue ret(lhs.getIntTypeID());
 
-    if (std::is_signed<U>::value && rhs.getValueRef<U>() < 0) {
-        ret.setUBCode(UBKind::ShiftRhsNeg);
-        return ret;
-    }
-
+    // A negative shift becomes a large unsigned one, so a single comparison
+    // accepts all valid shifts. The kind of UB is found out only after that.
+    using unsigned_U = typename std::make_unsigned<U>::type;
     size_t lhs_bit_size = sizeof(T) * CHAR_BIT;
-    if (rhs.getValueRef<U>() >= static_cast<U>(lhs_bit_size)) {
-        ret.setUBCode(UBKind::ShiftRhsLarge);
+    if (static_cast<unsigned_U>(rhs.getValueRef<U>()) < lhs_bit_size)
         return ret;
-    }
 
+    ret.setUBCode(std::is_signed<U>::value && rhs.getValueRef<U>() < 0
+                      ? UBKind::ShiftRhsNeg
+                      : UBKind::ShiftRhsLarge);
     return ret;
 }
 
@@ -527,12 +478,11 @@ static IRValue leftShiftOperator(IRValue &lhs, IRValue &rhs) {
     size_t lhs_bit_size = sizeof(T) * CHAR_BIT;
     if (std::is_signed<T>::value) {
         size_t max_avail_shift = lhs_bit_size - lhs.getMSB();
-        Options &options = Options::getInstance();
-        // C and C++ have different rules for UB in left shift operator
-        if ((options.isC() &&
-             rhs.getValueRef<U>() >= static_cast<U>(max_avail_shift)) ||
-            (!options.isC() &&
-             rhs.getValueRef<U>() > static_cast<U>(max_avail_shift))) {
+        // C and C++ have different rules for UB in left shift operator: the
+        // shift into the sign bit is UB only in C
+        size_t max_shift =
+            max_avail_shift - (Options::getInstance().isC() ? 1 : 0);
+        if (static_cast<size_t>(rhs.getValueRef<U>()) > max_shift) {
             ret.setUBCode(UBKind::ShiftRhsLarge);
             return ret;
         }
@@ -702,12 +652,18 @@ template <typename T> static inline size_t getMSBImpl(T x) {
     // TODO: implementation-defined!
     if (std::is_signed<T>::value && x < 0)
         return sizeof(T) * CHAR_BIT;
+#ifdef YARPGEN_HAS_INT_BUILTINS
+    auto ux = static_cast<unsigned long long>(x);
+    return ux == 0 ? 0
+                   : sizeof(unsigned long long) * CHAR_BIT - __builtin_clzll(ux);
+#else
     size_t ret = 0;
     while (x != 0) {
         ret++;
         x = x >> 1;
     }
     return ret;
+#endif
 }
 
 template <> inline size_t getMSBImpl<bool>(bool x) { return x; }
@@ -0,0 +1,148 @@
+/*
+Copyright (c) 2019-2020, Intel Corporation
+Copyright (c) 2019-2020, University of Utah
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+//////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+// Integer helpers of IRValue that are shared only by ir_value.cpp and its
+// test (ir_value_test.cpp), they aren't a part of the IRValue interface.
+
+#include <climits>
+#include <cstdint>
+#include <limits>
+#include <type_traits>
+
+namespace yarpgen {
+
+// GCC and Clang have builtins that check the overflow of the signed arithmetic
+// and count the leading zero bits. Other compilers use the portable checks.
+#if defined(__GNUC__) || defined(__clang__)
+#define YARPGEN_HAS_INT_BUILTINS
+#endif
+
+// Overflow checks of the signed arithmetic. They return true if the result
+// doesn't fit into T, otherwise the result is written to res.
+template <typename T> static bool addOverflowPortable(T a, T b, T &res) {
+    using unsigned_T = typename std::make_unsigned<T>::type;
+    auto ua = static_cast<unsigned_T>(a);
+    auto ub = static_cast<unsigned_T>(b);
+    unsigned_T u_tmp = ua + ub;
+    ua = (ua >> std::numeric_limits<T>::digits) + std::numeric_limits<T>::max();
+    if (static_cast<T>((ua ^ ub) | ~(ub ^ u_tmp)) >= 0)
+        return true;
+    res = static_cast<T>(u_tmp);
+    return false;
+}
+
+template <typename T> static bool addOverflow(T a, T b, T &res) {
+#ifdef YARPGEN_HAS_INT_BUILTINS
+    return __builtin_add_overflow(a, b, &res);
+#else
+    return addOverflowPortable<T>(a, b, res);
+#endif
+}
+
+template <typename T> static bool subOverflowPortable(T a, T b, T &res) {
+    using unsigned_T = typename std::make_unsigned<T>::type;
+    auto ua = static_cast<unsigned_T>(a);
+    auto ub = static_cast<unsigned_T>(b);
+    unsigned_T u_tmp = ua - ub;
+    ua = (ua >> std::numeric_limits<T>::digits) + std::numeric_limits<T>::max();
+    if (static_cast<T>((ua ^ ub) & (ua ^ u_tmp)) < 0)
+        return true;
+    res = static_cast<T>(u_tmp);
+    return false;
+}
+
+template <typename T> static bool subOverflow(T a, T b, T &res) {
+#ifdef YARPGEN_HAS_INT_BUILTINS
+    return __builtin_sub_overflow(a, b, &res);
+#else
+    return subOverflowPortable<T>(a, b, res);
+#endif
+}
+
+template <typename T> static bool mulOverflowPortable(T a, T b, T &res) {
+    // The types narrower than int can't overflow the exact product in int64_t
+    if constexpr (sizeof(T) < sizeof(int32_t)) {
+        int64_t wide = static_cast<int64_t>(a) * static_cast<int64_t>(b);
+        if (wide < std::numeric_limits<T>::min() ||
+            wide > std::numeric_limits<T>::max())
+            return true;
+        res = static_cast<T>(wide);
+        return false;
+    }
+    else {
+        // Special thanks to http://www.fefe.de/intof.html
+
+        using unsigned_T = typename std::make_unsigned<T>::type;
+        unsigned_T ret = 0;
+
+        int32_t sign =
+            (((a > 0) && (b > 0)) || ((a < 0) && (b < 0))) ? 1 : -1;
+        // The absolute value of the minimal value doesn't fit into T
+        unsigned_T a_abs = a < 0 ? unsigned_T(0) - static_cast<unsigned_T>(a)
+                                 : static_cast<unsigned_T>(a);
+        unsigned_T b_abs = b < 0 ? unsigned_T(0) - static_cast<unsigned_T>(b)
+                                 : static_cast<unsigned_T>(b);
+
+        using unsigned_half_T =
+            std::conditional_t<std::is_same<T, int32_t>::value, uint16_t,
+                               uint32_t>;
+        unsigned_half_T half_all_one =
+            (std::is_same<unsigned_half_T, uint32_t>::value) ? 0xFFFFFFFF
+                                                             : 0xFFFF;
+        int32_t half_bit_size = sizeof(unsigned_half_T) * CHAR_BIT;
+        auto a_low = static_cast<unsigned_half_T>(a_abs & half_all_one);
+        auto b_low = static_cast<unsigned_half_T>(b_abs & half_all_one);
+        auto a_high = static_cast<unsigned_half_T>(a_abs >> half_bit_size);
+        auto b_high = static_cast<unsigned_half_T>(b_abs >> half_bit_size);
+
+        if ((a_high != 0) && (b_high != 0))
+            return true;
+
+        unsigned_T tmp = (static_cast<unsigned_T>(a_high) * b_low) +
+                         (static_cast<unsigned_T>(b_high) * a_low);
+        if (tmp > half_all_one)
+            return true;
+
+        ret = (tmp << half_bit_size) + (static_cast<unsigned_T>(a_low) * b_low);
+        if (ret < (tmp << half_bit_size))
+            return true;
+
+        unsigned_T min_abs =
+            static_cast<unsigned_T>(std::numeric_limits<T>::max()) + 1;
+        if (((sign < 0) && (ret > min_abs)) ||
+            ((sign > 0) &&
+             (ret > static_cast<unsigned_T>(std::numeric_limits<T>::max()))))
+            return true;
+        else
+            res = static_cast<T>(ret * static_cast<unsigned_T>(sign));
+
+        return false;
+    }
+}
+
+template <typename T> static bool mulOverflow(T a, T b, T &res) {
+#ifdef YARPGEN_HAS_INT_BUILTINS
+    return __builtin_mul_overflow(a, b, &res);
+#else
+    return mulOverflowPortable<T>(a, b, res);
+#endif
+}
+} // namespace yarpgen
@@ -0,0 +1,420 @@
+/*
+Copyright (c) 2019-2020, Intel Corporation
+Copyright (c) 2019-2020, University of Utah
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+//////////////////////////////////////////////////////////////////////////////
+
+// Differential test of the UB checks of IRValue. The overflow checks that the
+// operators use (the builtins with GCC and Clang) and the portable ones are
+// compared against the checks that were used before the builtins:
+// exhaustively for 8-bit types, on the cross product of the edge values and on
+// random values for 32- and 64-bit types (the only ones that IRValue uses).
+// The arithmetic operators of IRValue are checked on the same values, and the
+// shift operators are compared against the per-case checks that they used
+// before.
+
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <type_traits>
+#include <vector>
+
+#include "ir_value.h"
+#include "ir_value_impl.h"
+#include "options.h"
+
+using namespace yarpgen;
+
+static size_t failures_num = 0;
+static constexpr size_t max_reported_failures = 20;
+
+template <typename T> static long long toPrintable(T val) {
+    return static_cast<long long>(val);
+}
+
+static void reportFailure(const std::string &msg) {
+    if (failures_num++ < max_reported_failures)
+        std::cerr << "FAIL: " << msg << std::endl;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// Overflow checks
+
+// The overflow checks as they were written before the builtins
+template <typename T> static bool addOverflowBaseline(T a, T b, T &res) {
+    using unsigned_T = typename std::make_unsigned<T>::type;
+    auto ua = static_cast<unsigned_T>(a);
+    auto ub = static_cast<unsigned_T>(b);
+    unsigned_T u_tmp = ua + ub;
+    ua = (ua >> std::numeric_limits<T>::digits) + std::numeric_limits<T>::max();
+    if (static_cast<T>((ua ^ ub) | ~(ub ^ u_tmp)) >= 0)
+        return true;
+    res = static_cast<T>(u_tmp);
+    return false;
+}
+
+template <typename T> static bool subOverflowBaseline(T a, T b, T &res) {
+    using unsigned_T = typename std::make_unsigned<T>::type;
+    auto ua = static_cast<unsigned_T>(a);
+    auto ub = static_cast<unsigned_T>(b);
+    unsigned_T u_tmp = ua - ub;
+    ua = (ua >> std::numeric_limits<T>::digits) + std::numeric_limits<T>::max();
+    if (static_cast<T>((ua ^ ub) & (ua ^ u_tmp)) < 0)
+        return true;
+    res = static_cast<T>(u_tmp);
+    return false;
+}
+
+template <typename T> static bool mulOverflowBaseline(T a, T b, T &res) {
+    // Special thanks to http://www.fefe.de/intof.html
+
+    using unsigned_T = typename std::make_unsigned<T>::type;
+    unsigned_T ret = 0;
+
+    int32_t sign = (((a > 0) && (b > 0)) || ((a < 0) && (b < 0))) ? 1 : -1;
+    unsigned_T a_abs = std::abs(a);
+    unsigned_T b_abs = std::abs(b);
+
+    using unsigned_half_T =
+        std::conditional_t<std::is_same<T, int32_t>::value, uint16_t, uint32_t>;
+    unsigned_half_T half_all_one =
+        (std::is_same<unsigned_half_T, uint32_t>::value) ? 0xFFFFFFFF : 0xFFFF;
+    int32_t half_bit_size = sizeof(unsigned_half_T) * CHAR_BIT;
+    auto a_low = static_cast<unsigned_half_T>(a_abs & half_all_one);
+    auto b_low = static_cast<unsigned_half_T>(b_abs & half_all_one);
+    auto a_high = static_cast<unsigned_half_T>(a_abs >> half_bit_size);
+    auto b_high = static_cast<unsigned_half_T>(b_abs >> half_bit_size);
+
+    if ((a_high != 0) && (b_high != 0))
+        return true;
+
+    unsigned_T tmp = (static_cast<unsigned_T>(a_high) * b_low) +
+                     (static_cast<unsigned_T>(b_high) * a_low);
+    if (tmp > half_all_one)
+        return true;
+
+    ret = (tmp << half_bit_size) + (static_cast<unsigned_T>(a_low) * b_low);
+    if (ret < (tmp << half_bit_size))
+        return true;
+
+    if (((sign < 0) && (ret > static_cast<unsigned_T>(
+                                  std::abs(std::numeric_limits<T>::min())))) ||
+        ((sign > 0) &&
+         (ret > static_cast<unsigned_T>(std::numeric_limits<T>::max()))))
+        return true;
+    else
+        res = ret * static_cast<T>(sign);
+
+    return false;
+}
+
+// The baseline multiplication check supports only int32_t and int64_t, the
+// narrower types are checked against the exact product
+template <typename T> static bool mulOverflowReference(T a, T b, T &res) {
+    if constexpr (sizeof(T) < sizeof(int32_t)) {
+        int64_t wide = static_cast<int64_t>(a) * static_cast<int64_t>(b);
+        if (wide < std::numeric_limits<T>::min() ||
+            wide > std::numeric_limits<T>::max())
+            return true;
+        res = static_cast<T>(wide);
+        return false;
+    }
+    else
+        return mulOverflowBaseline<T>(a, b, res);
+}
+
+template <typename T> static void checkOverflow(T a, T b) {
+    using Check = bool (*)(T, T, T &);
+    auto check = [a, b](const char *op, Check reference, Check portable,
+                        Check used) {
+        T reference_res = 0;
+        bool reference_ovf = reference(a, b, reference_res);
+        for (auto checked : {std::make_pair("portable", portable),
+                             std::make_pair("used", used)}) {
+            T res = 0;
+            bool ovf = checked.second(a, b, res);
+            if (reference_ovf == ovf && (ovf || reference_res == res))
+                continue;
+            reportFailure(std::string(op) + "<" + std::to_string(sizeof(T)) +
+                          " bytes>(" + std::to_string(toPrintable(a)) + ", " +
+                          std::to_string(toPrintable(b)) + "): baseline " +
+                          std::to_string(reference_ovf) + " " +
+                          std::to_string(toPrintable(reference_res)) + ", " +
+                          checked.first + " " + std::to_string(ovf) + " " +
+                          std::to_string(toPrintable(res)));
+        }
+    };
+
+    check("add", addOverflowBaseline<T>, addOverflowPortable<T>,
+          addOverflow<T>);
+    check("sub", subOverflowBaseline<T>, subOverflowPortable<T>,
+          subOverflow<T>);
+    check("mul", mulOverflowReference<T>, mulOverflowPortable<T>,
+          mulOverflow<T>);
+}
+
+template <typename T> static void checkOverflowExhaustive() {
+    using limits = std::numeric_limits<T>;
+    for (int64_t a = limits::min(); a <= limits::max(); ++a)
+        for (int64_t b = limits::min(); b <= limits::max(); ++b)
+            checkOverflow<T>(static_cast<T>(a), static_cast<T>(b));
+}
+
+// The values where the checks change their decision: the limits, zero, the
+// powers of two and the square roots of the limits
+template <typename T> static std::vector<T> getEdgeValues() {
+    using unsigned_T = typename std::make_unsigned<T>::type;
+    using limits = std::numeric_limits<T>;
+    std::vector<T> ret = {0, 1, 2, 3, limits::max(), limits::max() - 1,
+                          limits::max() / 2, limits::max() / 3};
+    if (std::is_signed<T>::value)
+        for (T val : {T(-1), T(-2), T(-3), limits::min(), T(limits::min() + 1),
+                      T(limits::min() / 2), T(limits::min() / 3)})
+            ret.push_back(val);
+    for (int i = 1; i < limits::digits; ++i) {
+        auto pow2 = static_cast<unsigned_T>(1) << i;
+        for (unsigned_T val : {pow2, pow2 - 1, pow2 + 1}) {
+            ret.push_back(static_cast<T>(val));
+            if (std::is_signed<T>::value)
+                ret.push_back(static_cast<T>(unsigned_T(0) - val));
+        }
+    }
+    return ret;
+}
+
+// Random values of all magnitudes: a random number of the low bits is kept
+template <typename T> static T getRandValue(std::mt19937_64 &gen) {
+    using unsigned_T = typename std::make_unsigned<T>::type;
+    auto bit_size = static_cast<int>(sizeof(T) * CHAR_BIT);
+    auto val = static_cast<unsigned_T>(gen());
+    int keep_bits = static_cast<int>(gen() % bit_size) + 1;
+    if (keep_bits < bit_size)
+        val &= (static_cast<unsigned_T>(1) << keep_bits) - 1;
+    if (std::is_signed<T>::value && gen() % 2)
+        val = unsigned_T(0) - val;
+    return static_cast<T>(val);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// Values of IRValue
+
+template <typename T> static IntTypeID getIntTypeID() {
+    if (std::is_same<T, int32_t>::value)
+        return IntTypeID::INT;
+    if (std::is_same<T, uint32_t>::value)
+        return IntTypeID::UINT;
+    if (std::is_same<T, int64_t>::value)
+        return IntTypeID::LLONG;
+    return IntTypeID::ULLONG;
+}
+
+template <typename T> static IRValue makeValue(T val) {
+    IRValue ret(getIntTypeID<T>());
+    ret.getValueRef<T>() = val;
+    ret.setUBCode(UBKind::NoUB);
+    return ret;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// Arithmetic operators
+
+template <typename T> static void checkOperators(T a, T b) {
+    using Check = bool (*)(T, T, T &);
+    // min_ovf: the operator reports min * -1 as SignOvfMin before the
+    // overflow check
+    auto check = [a, b](const char *op, IRValue ret, Check reference,
+                        bool min_ovf) {
+        T expected_res = 0;
+        UBKind expected_ub = UBKind::NoUB;
+        if constexpr (std::is_signed<T>::value) {
+            using limits = std::numeric_limits<T>;
+            if (min_ovf && ((a == limits::min() && b == -1) ||
+                            (b == limits::min() && a == -1)))
+                expected_ub = UBKind::SignOvfMin;
+            else if (reference(a, b, expected_res))
+                expected_ub = UBKind::SignOvf;
+        }
+        else
+            reference(a, b, expected_res);
+        if (ret.getUBCode() == expected_ub &&
+            (expected_ub != UBKind::NoUB ||
+             ret.getValueRef<T>() == expected_res))
+            return;
+        reportFailure(std::string(op) + "<" + std::to_string(sizeof(T)) +
+                      " bytes>(" + std::to_string(a) + ", " +
+                      std::to_string(b) + "): expected " +
+                      std::to_string(static_cast<int>(expected_ub)) + " " +
+                      std::to_string(expected_res) + ", got " +
+                      std::to_string(static_cast<int>(ret.getUBCode())) +
+                      " " + std::to_string(ret.getValueRef<T>()));
+    };
+
+    IRValue sum = makeValue(a) + makeValue(b);
+    IRValue diff = makeValue(a) - makeValue(b);
+    IRValue prod = makeValue(a) * makeValue(b);
+    if constexpr (std::is_signed<T>::value) {
+        check("+", sum, addOverflowBaseline<T>, false);
+        check("-", diff, subOverflowBaseline<T>, false);
+        check("*", prod, mulOverflowBaseline<T>, true);
+    }
+    else {
+        // Unsigned operations wrap around
+        check("+", sum, [](T x, T y, T &res) { res = x + y; return false; },
+              false);
+        check("-", diff, [](T x, T y, T &res) { res = x - y; return false; },
+              false);
+        check("*", prod, [](T x, T y, T &res) { res = x * y; return false; },
+              false);
+    }
+}
+
+// The overflow checks and the operators on the cross product of the edge
+// values and on random pairs
+template <typename T> static void checkArithmetic(size_t rand_pairs_num) {
+    auto check_pair = [](T a, T b) {
+        if constexpr (std::is_signed<T>::value)
+            checkOverflow<T>(a, b);
+        checkOperators<T>(a, b);
+    };
+
+    auto edge_values = getEdgeValues<T>();
+    for (T a : edge_values)
+        for (T b : edge_values)
+            check_pair(a, b);
+
+    std::mt19937_64 gen(sizeof(T));
+    for (size_t i = 0; i < rand_pairs_num; ++i) {
+        T a = getRandValue<T>(gen);
+        T b = gen() % 4 == 0 ? edge_values.at(gen() % edge_values.size())
+                             : getRandValue<T>(gen);
+        check_pair(a, b);
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// Shift checks
+
+template <typename T> static size_t getMSBReference(T x) {
+    if (std::is_signed<T>::value && x < 0)
+        return sizeof(T) * CHAR_BIT;
+    size_t ret = 0;
+    while (x != 0) {
+        ret++;
+        x = x >> 1;
+    }
+    return ret;
+}
+
+// The checks of the shift operators as they were written case by case
+template <typename T, typename U>
+static UBKind shiftReference(bool is_left, T lhs, U rhs, bool is_c, T &res) {
+    if (std::is_signed<U>::value && rhs < 0)
+        return UBKind::ShiftRhsNeg;
+
+    size_t lhs_bit_size = sizeof(T) * CHAR_BIT;
+    if (rhs >= static_cast<U>(lhs_bit_size))
+        return UBKind::ShiftRhsLarge;
+
+    if (std::is_signed<T>::value && lhs < 0)
+        return UBKind::NegShift;
+
+    if (is_left && std::is_signed<T>::value) {
+        size_t max_avail_shift = lhs_bit_size - getMSBReference(lhs);
+        if ((is_c && rhs >= static_cast<U>(max_avail_shift)) ||
+            (!is_c && rhs > static_cast<U>(max_avail_shift)))
+            return UBKind::ShiftRhsLarge;
+    }
+
+    res = is_left ? lhs << rhs : lhs >> rhs;
+    return UBKind::NoUB;
+}
+
+template <typename T, typename U> static void checkShift(T lhs, U rhs) {
+    Options &options = Options::getInstance();
+    for (bool is_left : {true, false}) {
+        T expected_res = 0;
+        UBKind expected_ub =
+            shiftReference<T, U>(is_left, lhs, rhs, options.isC(), expected_res);
+        IRValue ret = is_left ? makeValue(lhs) << makeValue(rhs)
+                              : makeValue(lhs) >> makeValue(rhs);
+        if (ret.getUBCode() == expected_ub &&
+            (expected_ub != UBKind::NoUB ||
+             ret.getValueRef<T>() == expected_res))
+            continue;
+        reportFailure(std::string(is_left ? "<<" : ">>") + "<" +
+                      std::to_string(sizeof(T)) + ", " +
+                      std::to_string(sizeof(U)) + " bytes>(" +
+                      std::to_string(lhs) + ", " + std::to_string(rhs) +
+                      ") in " + (options.isC() ? "C" : "C++") + ": expected " +
+                      std::to_string(static_cast<int>(expected_ub)) +
+                      ", got " +
+                      std::to_string(static_cast<int>(ret.getUBCode())));
+    }
+}
+
+template <typename T, typename U> static void checkShifts() {
+    std::vector<T> lhs_values = getEdgeValues<T>();
+    std::vector<U> rhs_values = getEdgeValues<U>();
+    for (int i = -70; i <= 70; ++i)
+        rhs_values.push_back(static_cast<U>(i));
+
+    std::mt19937_64 gen(sizeof(T) * 16 + sizeof(U));
+    for (size_t i = 0; i < 1000; ++i)
+        lhs_values.push_back(getRandValue<T>(gen));
+
+    for (T lhs : lhs_values)
+        for (U rhs : rhs_values)
+            checkShift<T, U>(lhs, rhs);
+}
+
+template <typename T> static void checkShiftsOfLhs() {
+    checkShifts<T, int32_t>();
+    checkShifts<T, uint32_t>();
+    checkShifts<T, int64_t>();
+    checkShifts<T, uint64_t>();
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
+int main() {
+#ifndef YARPGEN_HAS_INT_BUILTINS
+    std::cerr << "The compiler has no overflow builtins, only the portable "
+                 "checks are tested"
+              << std::endl;
+#endif
+
+    checkOverflowExhaustive<int8_t>();
+    checkArithmetic<int32_t>(1000000);
+    checkArithmetic<uint32_t>(100000);
+    checkArithmetic<int64_t>(1000000);
+    checkArithmetic<uint64_t>(100000);
+
+    Options &options = Options::getInstance();
+    for (LangStd std : {LangStd::C, LangStd::CXX}) {
+        options.setLangStd(std);
+        checkShiftsOfLhs<int32_t>();
+        checkShiftsOfLhs<uint32_t>();
+        checkShiftsOfLhs<int64_t>();
+        checkShiftsOfLhs<uint64_t>();
+    }
+
+    if (failures_num != 0) {
+        std::cerr << failures_num << " checks failed" << std::endl;
+        return 1;
+    }
+    std::cout << "All checks passed" << std::endl;
+    return 0;
+}
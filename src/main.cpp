@@ -18,6 +18,12 @@ limitations under the License.
 //////////////////////////////////////////////////////////////////////////////
 #include "options.h"
 #include "program.h"
+#ifdef YARPGEN_HAS_REDUCER
+#include "reducer.h"
+#endif
+#ifdef YARPGEN_HAS_SERVER
+#include "server.h"
+#endif
 #include "utils.h"
 
 #include <iostream>
@@ -26,21 +32,73 @@ limitations under the License.
 
 using namespace yarpgen;
 
+// Generates a single test with the current options. The test is written to
+// the stream or, if there is no stream, to the output file.
+static int generateTest(std::ostream *stream) {
+    ProgramGenerator::initRandValGen(std::cout);
+    ProgramGenerator new_program;
+    if (!new_program.fitsCostBudget()) {
+        std::cerr << "Test exceeds the cost budget" << std::endl;
+        return ProgramGenerator::cost_budget_exit_code;
+    }
+    if (stream)
+        new_program.emit(*stream);
+    else
+        new_program.emit();
+
+    return 0;
+}
+
 int main(int argc, char *argv[]) {
     OptionParser::initOptions();
     OptionParser::parse(argc, argv);
 
     Options &options = Options::getInstance();
-    rand_val_gen = std::make_shared<RandValGen>(options.getSeed());
-    options.setSeed(rand_val_gen->getSeed());
+    if (!options.getServeSocket().empty()) {
+#ifdef YARPGEN_HAS_SERVER
+        std::vector<std::string> base_args;
+        for (int i = 0; i < argc; ++i) {
+            std::string arg(argv[i]);
+            if (arg.rfind("--serve", 0) != 0)
+                base_args.push_back(arg);
+        }
+        GeneratorServer server(
+            options.getServeSocket(), options.getServeWorkers(), base_args,
+            [](std::ostream &stream) { return generateTest(&stream); });
+        return server.run();
+#else
+        std::cerr << "Server mode is not supported on this platform"
+                  << std::endl;
+        return -1;
+#endif
+    }
 
-    if (options.getMutationKind() == MutationKind::EXPRS ||
-        options.getMutationKind() == MutationKind::ALL) {
-        rand_val_gen->setMutationSeed(options.getMutationSeed());
+    if (!options.getSaveFuncLib().empty()) {
+        FunctionLibrary &library = ProgramGenerator::getFunctionLibrary();
+        int64_t saved_num = library.save(options.getSaveFuncLib());
+        if (saved_num < 0) {
+            std::cerr << "Can't write the function library to "
+                      << options.getSaveFuncLib() << std::endl;
+            return -1;
+        }
+        std::cerr << "Saved " << saved_num << " of " << library.size()
+                  << " functions to " << options.getSaveFuncLib() << std::endl;
+        return 0;
     }
 
-    ProgramGenerator new_program;
-    new_program.emit();
+    if (!options.getReduceCmd().empty()) {
+#ifdef YARPGEN_HAS_REDUCER
+        ProgramGenerator::initRandValGen(std::cout);
+        ProgramGenerator program;
+        TestReducer reducer(options.getReduceCmd(), options.getReduceJobs(),
+                            options.getOutDir());
+        return reducer.run(program);
+#else
+        std::cerr << "Test reduction is not supported on this platform"
+                  << std::endl;
+        return -1;
+#endif
+    }
 
-    return 0;
+    return generateTest(nullptr);
 }
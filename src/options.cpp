@@ -47,6 +47,8 @@ using namespace yarpgen;
 
 static const size_t PADDING = 30;
 
+bool OptionParser::exit_on_error = true;
+
 // Short argument, long argument, has_value, help message, error message,
 // action function, default, possible values
 std::vector<OptionDescr> yarpgen::OptionParser::options_set{
@@ -204,6 +206,159 @@ std::vector<OptionDescr> yarpgen::OptionParser::options_set{
      OptionParser::parseAllowUBInDC,
      "none",
      {"none", "some", "all"}},
+    {OptionKind::VALS_NUMBER,
+     "",
+     "--vals-number",
+     true,
+     "Number of divergent values (lanes) in loops with multiple values",
+     "Can't parse vals number",
+     OptionParser::parseValsNumber,
+     "2",
+     {"2", "4", "8", "16"}},
+    {OptionKind::HASH_CONS,
+     "",
+     "--hash-cons",
+     true,
+     "Share structurally identical subexpressions during generation (the "
+     "test doesn't change)",
+     "Can't parse hash cons",
+     OptionParser::parseHashCons,
+     "false",
+     {"true", "false"}},
+    {OptionKind::MAX_RUN_COST,
+     "",
+     "--max-run-cost",
+     true,
+     "Reject tests with bigger estimated number of executed expression nodes "
+     "(0 is reserved for no limit)",
+     "Can't parse max run cost",
+     OptionParser::parseMaxRunCost,
+     "0",
+     {}},
+    {OptionKind::MAX_COMPILE_COST,
+     "",
+     "--max-compile-cost",
+     true,
+     "Reject tests with bigger estimated compile time in seconds (0 is "
+     "reserved for no limit)",
+     "Can't parse max compile cost",
+     OptionParser::parseMaxCompileCost,
+     "0",
+     {}},
+    {OptionKind::COST_WEIGHTS,
+     "",
+     "--cost-weights",
+     true,
+     "Weights of expression nodes, statements and arrays in the compile cost "
+     "(default is calibrated for g++ -O2, see scripts/calibrate_cost.py)",
+     "Can't parse cost weights",
+     OptionParser::parseCostWeights,
+     "0.00065,0,0.0105",
+     {}},
+    {OptionKind::COST_SIDECAR,
+     "",
+     "--cost-sidecar",
+     false,
+     "Write the cost estimation of the test to <out-dir>.cost",
+     "Can't parse cost sidecar",
+     OptionParser::parseCostSidecar,
+     "false",
+     {"true", "false"}},
+    {OptionKind::MAX_DYNAMIC_OPS,
+     "",
+     "--max-dynamic-ops",
+     true,
+     "Limit for the number of expression statements (not expression nodes) "
+     "executed in loops. Tests that can't fit are rejected like the ones "
+     "that exceed the cost budget (0 is reserved for no limit)",
+     "Can't parse max dynamic ops",
+     OptionParser::parseMaxDynamicOps,
+     "0",
+     {}},
+    {OptionKind::PERF_REPS,
+     "",
+     "--perf-reps",
+     true,
+     "Run the test function this many times under a timer and print min and "
+     "median cycles after the checksum (0 is reserved for a single untimed "
+     "run)",
+     "Can't parse perf reps",
+     OptionParser::parsePerfReps,
+     "0",
+     {}},
+    {OptionKind::SERVE,
+     "",
+     "--serve",
+     true,
+     "Run as a generation server on the Unix socket. Every connection sends "
+     "one line of options (e.g. \"--seed=42\") and gets the test back",
+     "Can't parse serve socket",
+     OptionParser::parseServe,
+     "",
+     {}},
+    {OptionKind::SERVE_WORKERS,
+     "",
+     "--serve-workers",
+     true,
+     "Maximum number of tests that the server generates at once (0 is "
+     "reserved for the number of CPUs)",
+     "Can't parse serve workers",
+     OptionParser::parseServeWorkers,
+     "0",
+     {}},
+    {OptionKind::REDUCE,
+     "",
+     "--reduce",
+     true,
+     "Reduce the test with the interestingness test: a shell command that "
+     "gets the name of the candidate file and exits with 0 if it is "
+     "interesting. The reduced test is written to the output file",
+     "Can't parse reduce command",
+     OptionParser::parseReduce,
+     "",
+     {}},
+    {OptionKind::REDUCE_JOBS,
+     "",
+     "--reduce-jobs",
+     true,
+     "Maximum number of candidates that the reducer tests at once (0 is "
+     "reserved for the number of CPUs)",
+     "Can't parse reduce jobs",
+     OptionParser::parseReduceJobs,
+     "0",
+     {}},
+    {OptionKind::FUNC_LIB,
+     "",
+     "--func-lib",
+     true,
+     "Library of the functions for the injection: a zip archive or a "
+     "directory of YAML files with one function each, or a YAML file with a "
+     "list of functions",
+     "Can't parse function library",
+     OptionParser::parseFuncLib,
+     "",
+     {}},
+    {OptionKind::FUNC_BATCH,
+     "",
+     "--func-batch",
+     true,
+     "Number of the library functions that are chosen for the test with its "
+     "seed (0 is reserved for all functions)",
+     "Can't parse function batch",
+     OptionParser::parseFuncBatch,
+     "0",
+     {}},
+    {OptionKind::SAVE_FUNC_LIB,
+     "",
+     "--save-func-lib",
+     true,
+     "Convert the function library (--func-lib) to the binary format, which "
+     "is mapped into memory instead of being parsed, write it to the file "
+     "and exit",
+     "Can't parse binary function library",
+     OptionParser::parseSaveFuncLib,
+     "",
+     {}},
 };
 
 static void dumpVersion(std::ostream &stream) {
@@ -213,6 +368,8 @@ static void dumpVersion(std::ostream &stream) {
 }
 
 void OptionParser::printVersion(std::string arg) {
+    if (!exit_on_error)
+        throw OptionError(arg.empty() ? "Version was requested" : arg);
     dumpVersion(std::cout);
     if (!arg.empty())
         exit(-1);
@@ -220,6 +377,8 @@ void OptionParser::printVersion(std::string arg) {
 }
 
 void OptionParser::printHelpAndExit(std::string error_msg) {
+    if (!exit_on_error)
+        throw OptionError(error_msg.empty() ? "Help was requested" : error_msg);
     if (!error_msg.empty())
         std::cerr << error_msg << std::endl;
 
@@ -513,6 +672,148 @@ void OptionParser::parseAllowUBInDC(std::string allow_ub_in_dc_str) {
         printHelpAndExit("Can't recognize input as arguments use level");
 }
 
+void OptionParser::parseValsNumber(std::string val) {
+    Options &options = Options::getInstance();
+    if (val == "2")
+        options.setValsNumber(2);
+    else if (val == "4")
+        options.setValsNumber(4);
+    else if (val == "8")
+        options.setValsNumber(8);
+    else if (val == "16")
+        options.setValsNumber(16);
+    else
+        printHelpAndExit("Can't recognize vals number");
+}
+
+void OptionParser::parseHashCons(std::string val) {
+    Options &options = Options::getInstance();
+    if (val == "true")
+        options.setHashCons(true);
+    else if (val == "false")
+        options.setHashCons(false);
+    else
+        printHelpAndExit("Can't recognize hash cons");
+}
+
+void OptionParser::parseMaxRunCost(std::string val) {
+    std::stringstream arg_ss(val);
+    Options &options = Options::getInstance();
+    uint64_t max_run_cost = 0;
+    arg_ss >> max_run_cost;
+    if (arg_ss.fail())
+        printHelpAndExit("Can't recognize max run cost");
+    options.setMaxRunCost(max_run_cost);
+}
+
+void OptionParser::parseMaxCompileCost(std::string val) {
+    std::stringstream arg_ss(val);
+    Options &options = Options::getInstance();
+    double max_compile_cost = 0;
+    arg_ss >> max_compile_cost;
+    if (arg_ss.fail())
+        printHelpAndExit("Can't recognize max compile cost");
+    options.setMaxCompileCost(max_compile_cost);
+}
+
+void OptionParser::parseCostWeights(std::string val) {
+    std::stringstream arg_ss(val);
+    Options &options = Options::getInstance();
+    std::vector<double> weights;
+    std::string weight_str;
+    while (std::getline(arg_ss, weight_str, ',')) {
+        std::stringstream weight_ss(weight_str);
+        double weight = 0;
+        weight_ss >> weight;
+        if (weight_ss.fail())
+            printHelpAndExit("Can't recognize cost weights");
+        weights.push_back(weight);
+    }
+    if (weights.size() != 3)
+        printHelpAndExit("Cost weights should have exactly three values");
+    options.setCostWeights(weights);
+}
+
+void OptionParser::parseCostSidecar(std::string val) {
+    Options &options = Options::getInstance();
+    if (val.empty())
+        options.setCostSidecar(true);
+    else if (val == "false")
+        options.setCostSidecar(false);
+    else
+        printHelpAndExit("Can't recognize cost sidecar");
+}
+
+void OptionParser::parseMaxDynamicOps(std::string val) {
+    std::stringstream arg_ss(val);
+    Options &options = Options::getInstance();
+    uint64_t max_dynamic_ops = 0;
+    arg_ss >> max_dynamic_ops;
+    if (arg_ss.fail())
+        printHelpAndExit("Can't recognize max dynamic ops");
+    options.setMaxDynamicOps(max_dynamic_ops);
+}
+
+void OptionParser::parsePerfReps(std::string val) {
+    std::stringstream arg_ss(val);
+    Options &options = Options::getInstance();
+    uint32_t perf_reps = 0;
+    arg_ss >> perf_reps;
+    if (arg_ss.fail())
+        printHelpAndExit("Can't recognize perf reps");
+    options.setPerfReps(perf_reps);
+}
+
+void OptionParser::parseServe(std::string val) {
+    Options &options = Options::getInstance();
+    options.setServeSocket(std::move(val));
+}
+
+void OptionParser::parseServeWorkers(std::string val) {
+    std::stringstream arg_ss(val);
+    Options &options = Options::getInstance();
+    uint32_t serve_workers = 0;
+    arg_ss >> serve_workers;
+    if (arg_ss.fail())
+        printHelpAndExit("Can't recognize serve workers");
+    options.setServeWorkers(serve_workers);
+}
+
+void OptionParser::parseReduce(std::string val) {
+    Options &options = Options::getInstance();
+    options.setReduceCmd(std::move(val));
+}
+
+void OptionParser::parseReduceJobs(std::string val) {
+    std::stringstream arg_ss(val);
+    Options &options = Options::getInstance();
+    uint32_t reduce_jobs = 0;
+    arg_ss >> reduce_jobs;
+    if (arg_ss.fail())
+        printHelpAndExit("Can't recognize reduce jobs");
+    options.setReduceJobs(reduce_jobs);
+}
+
+void OptionParser::parseFuncLib(std::string val) {
+    Options &options = Options::getInstance();
+    options.setFuncLib(std::move(val));
+}
+
+void OptionParser::parseFuncBatch(std::string val) {
+    std::stringstream arg_ss(val);
+    Options &options = Options::getInstance();
+    uint32_t func_batch = 0;
+    arg_ss >> func_batch;
+    if (arg_ss.fail())
+        printHelpAndExit("Can't recognize function batch");
+    options.setFuncBatch(func_batch);
+}
+
+void OptionParser::parseSaveFuncLib(std::string val) {
+    Options &options = Options::getInstance();
+    options.setSaveFuncLib(std::move(val));
+}
+
 void Options::dump(std::ostream &stream) {
     dumpVersion(stream);
     stream << "Seed: " << seed << "\n";
@@ -524,6 +825,7 @@ void Options::dump(std::ostream &stream) {
 }
 
 void Options::setRawOptions(size_t argc, char *argv[]) {
+    raw_options.clear();
     raw_options.reserve(argc);
     for (size_t i = 0; i < argc; ++i)
         raw_options.emplace_back(argv[i]);
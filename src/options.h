@@ -23,6 +23,7 @@ limitations under the License.
 #include <cstdlib>
 #include <functional>
 #include <map>
+#include <stdexcept>
 #include <string>
 #include <tuple>
 #include <utility>
@@ -65,15 +66,25 @@ class OptionDescr {
 
 class Options;
 
+// Error in the options. It is thrown instead of printing the help and exiting
+// when the parser is used by a library (see OptionParser::setExitOnError).
+class OptionError : public std::runtime_error {
+  public:
+    explicit OptionError(const std::string &msg) : std::runtime_error(msg) {}
+};
+
 class OptionParser {
   public:
     static void parse(size_t argc, char *argv[]);
     // Initialize options with default values
     static void initOptions();
+    static void setExitOnError(bool val) { exit_on_error = val; }
 
     static std::vector<OptionDescr> options_set;
 
   private:
+    static bool exit_on_error;
+
     static void printVersion(std::string arg);
     static void printHelpAndExit(std::string error_msg = "");
     static bool optionStartsWith(char *option, const char *test);
@@ -99,16 +110,31 @@ class OptionParser {
     static void parseMutationKind(std::string mutate_str);
     static void parseMutationSeed(std::string mutation_seed_str);
     static void parseAllowUBInDC(std::string allow_ub_in_dc_str);
+    static void parseValsNumber(std::string val);
+    static void parseHashCons(std::string val);
+    static void parseMaxRunCost(std::string val);
+    static void parseMaxCompileCost(std::string val);
+    static void parseCostWeights(std::string val);
+    static void parseCostSidecar(std::string val);
+    static void parseMaxDynamicOps(std::string val);
+    static void parsePerfReps(std::string val);
+    static void parseServe(std::string val);
+    static void parseServeWorkers(std::string val);
+    static void parseReduce(std::string val);
+    static void parseReduceJobs(std::string val);
+    static void parseFuncLib(std::string val);
+    static void parseFuncBatch(std::string val);
+    static void parseSaveFuncLib(std::string val);
 };
 
 class Options {
   public:
-    // The number of divergent values that we support in loops
-    // In theory, it can be made higher, but we assume that 2 is enough
-    // for now. The agreement that main values are tied to the 0-th index
-    static size_t constexpr vals_number = 2;
+    // The maximal number of divergent values (lanes) that we support in
+    // loops, the actual number is set by --vals-number. The values of all
+    // lanes are kept in the arrays of this size. The agreement is that main
+    // values are tied to the 0-th index.
+    static size_t constexpr max_vals_number = 16;
     static size_t constexpr main_val_idx = 0;
-    static size_t constexpr alt_val_idx = 1;
 
     static Options &getInstance() {
         static Options instance;
@@ -168,6 +194,49 @@ class Options {
     void setAllowUBInDC(OptionLevel _val) { allow_ub_in_dc = _val; }
     OptionLevel getAllowUBInDC() { return allow_ub_in_dc; }
 
+    void setValsNumber(size_t val) { vals_number = val; }
+    size_t getValsNumber() { return vals_number; }
+
+    void setHashCons(bool val) { hash_cons = val; }
+    bool getHashCons() { return hash_cons; }
+
+    void setMaxRunCost(uint64_t val) { max_run_cost = val; }
+    uint64_t getMaxRunCost() { return max_run_cost; }
+
+    void setMaxCompileCost(double val) { max_compile_cost = val; }
+    double getMaxCompileCost() { return max_compile_cost; }
+
+    void setCostWeights(std::vector<double> val) {
+        cost_weights = std::move(val);
+    }
+    std::vector<double> getCostWeights() { return cost_weights; }
+
+    void setCostSidecar(bool val) { cost_sidecar = val; }
+    bool getCostSidecar() { return cost_sidecar; }
+
+    void setMaxDynamicOps(uint64_t val) { max_dynamic_ops = val; }
+    uint64_t getMaxDynamicOps() { return max_dynamic_ops; }
+
+    void setPerfReps(uint32_t val) { perf_reps = val; }
+    uint32_t getPerfReps() { return perf_reps; }
+
+    void setServeSocket(std::string val) { serve_socket = std::move(val); }
+    std::string getServeSocket() { return serve_socket; }
+    void setServeWorkers(uint32_t val) { serve_workers = val; }
+    uint32_t getServeWorkers() { return serve_workers; }
+
+    void setReduceCmd(std::string val) { reduce_cmd = std::move(val); }
+    std::string getReduceCmd() { return reduce_cmd; }
+    void setReduceJobs(uint32_t val) { reduce_jobs = val; }
+    uint32_t getReduceJobs() { return reduce_jobs; }
+
+    void setFuncLib(std::string val) { func_lib = std::move(val); }
+    std::string getFuncLib() { return func_lib; }
+    void setFuncBatch(uint32_t val) { func_batch = val; }
+    uint32_t getFuncBatch() { return func_batch; }
+    void setSaveFuncLib(std::string val) { save_func_lib = std::move(val); }
+    std::string getSaveFuncLib() { return save_func_lib; }
+
     void dump(std::ostream &stream);
 
   private:
@@ -179,7 +248,10 @@ class Options {
           emit_pragmas(OptionLevel::SOME), out_dir("."),
           use_param_shuffle(false), expl_loop_params(false),
           mutation_kind(MutationKind::NONE), mutation_seed(0),
-          allow_ub_in_dc(OptionLevel::NONE) {}
+          allow_ub_in_dc(OptionLevel::NONE), vals_number(2), hash_cons(false),
+          max_run_cost(0), max_compile_cost(0), cost_sidecar(false),
+          max_dynamic_ops(0),
+          perf_reps(0), serve_workers(0), reduce_jobs(0), func_batch(0) {}
 
     std::vector<std::string> raw_options;
 
@@ -210,5 +282,50 @@ class Options {
 
     // If we want to allow Undefined Behavior in Dead Code
     OptionLevel allow_ub_in_dc;
+
+    // The number of divergent values in loops (see max_vals_number)
+    size_t vals_number;
+
+    // Identical subexpressions are shared by the trees (see Expr::intern)
+    bool hash_cons;
+
+    // Budgets for the estimated cost of the test (0 means no limit).
+    // Run cost is measured in dynamic expression nodes, compile cost is
+    // a weighted sum of the test features (see ProgramGenerator::CostInfo),
+    // which approximates compile time in seconds
+    uint64_t max_run_cost;
+    double max_compile_cost;
+    std::vector<double> cost_weights;
+    // Write the cost estimation next to the test
+    bool cost_sidecar;
+
+    // Hard limit for the number of expression statements executed by the
+    // loops of the test (0 means no limit). Unlike the cost budgets above, it
+    // is enforced during generation (see LoopSeqStmt::populate). It counts
+    // statements rather than expression nodes, because the iteration spaces
+    // are chosen before the expressions of the loop bodies exist.
+    uint64_t max_dynamic_ops;
+
+    // Number of timed repetitions of the test function (0 means that the
+    // test is executed once without timing)
+    uint32_t perf_reps;
+
+    // Path of the Unix socket of the generation server (empty string means
+    // that a single test is generated, see GeneratorServer)
+    std::string serve_socket;
+    uint32_t serve_workers;
+
+    // Interestingness test of the test reducer (empty string means that the
+    // test is not reduced, see TestReducer)
+    std::string reduce_cmd;
+    uint32_t reduce_jobs;
+
+    // Library of the functions for the injection (empty string means that no
+    // functions are injected) and the number of the functions that are chosen
+    // for the test
+    std::string func_lib;
+    uint32_t func_batch;
+    // Output file of the function library converter (see FunctionLibrary)
+    std::string save_func_lib;
 };
 } // namespace yarpgen
@@ -0,0 +1,514 @@
+/*
+Copyright (c) 2015-2020, Intel Corporation
+Copyright (c) 2019-2020, University of Utah
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+//////////////////////////////////////////////////////////////////////////////
+
+#include "process.h"
+#include "utils.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <csignal>
+#include <cstring>
+
+#include <fcntl.h>
+#include <spawn.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+extern char **environ;
+
+using namespace yarpgen;
+
+// Time to read the rest of the output after the job has exited. The pipes are
+// closed then even if something that has left the process group still holds
+// them.
+static auto constexpr drain_time = std::chrono::seconds(1);
+
+std::string yarpgen::statusToStr(ProcessStatus status) {
+    switch (status) {
+        case ProcessStatus::EXITED:
+            return "exited";
+        case ProcessStatus::SIGNALED:
+            return "signaled";
+        case ProcessStatus::TIMEOUT:
+            return "timeout";
+        case ProcessStatus::SPAWN_ERROR:
+            return "spawn_error";
+        case ProcessStatus::SKIPPED:
+            return "skipped";
+    }
+    ERROR("Bad process status");
+}
+
+static int pidfdOpen(pid_t pid) {
+#ifdef SYS_pidfd_open
+    return static_cast<int>(syscall(SYS_pidfd_open, pid, 0));
+#else
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+static double toSeconds(const struct timeval &val) {
+    return static_cast<double>(val.tv_sec) +
+           static_cast<double>(val.tv_usec) / 1e6;
+}
+
+static void closeFd(int &fd) {
+    if (fd != -1)
+        close(fd);
+    fd = -1;
+}
+
+ProcessExecutor::ProcessExecutor(std::string _trampoline_path)
+    : trampoline_path(std::move(_trampoline_path)) {
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd == -1)
+        ERROR(std::string("Can't create epoll: ") + strerror(errno));
+    // Jobs can exit before they consume their input
+    signal(SIGPIPE, SIG_IGN);
+}
+
+ProcessExecutor::~ProcessExecutor() {
+    for (auto &job : jobs) {
+        if (!job->exited) {
+            kill(-job->pid, SIGKILL);
+            waitpid(job->pid, nullptr, 0);
+        }
+        closeFd(job->pid_fd);
+        closeFd(job->out_fd);
+        closeFd(job->err_fd);
+        closeFd(job->in_fd);
+    }
+    close(epoll_fd);
+}
+
+void ProcessExecutor::addFd(int fd, uint32_t events, std::shared_ptr<Job> job) {
+    struct epoll_event event = {};
+    event.events = events;
+    event.data.fd = fd;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event) == -1)
+        ERROR(std::string("Can't add fd to epoll: ") + strerror(errno));
+    if (job)
+        jobs_by_fd[fd] = job;
+}
+
+void ProcessExecutor::removeFd(int fd) {
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
+    jobs_by_fd.erase(fd);
+}
+
+void ProcessExecutor::watchFd(int fd, std::function<void()> on_ready,
+                              bool writable) {
+    watched_fds[fd] = std::move(on_ready);
+    addFd(fd, writable ? EPOLLOUT : EPOLLIN, nullptr);
+}
+
+void ProcessExecutor::unwatchFd(int fd) {
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
+    watched_fds.erase(fd);
+}
+
+bool ProcessExecutor::spawn(Job &job) {
+    int out_pipe[2], err_pipe[2], in_pipe[2] = {-1, -1};
+    if (pipe2(out_pipe, O_CLOEXEC) == -1)
+        ERROR(std::string("Can't create pipe: ") + strerror(errno));
+    if (pipe2(err_pipe, O_CLOEXEC) == -1)
+        ERROR(std::string("Can't create pipe: ") + strerror(errno));
+    bool has_input = !job.request.input.empty();
+    if (has_input && pipe2(in_pipe, O_CLOEXEC) == -1)
+        ERROR(std::string("Can't create pipe: ") + strerror(errno));
+
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    if (has_input)
+        posix_spawn_file_actions_adddup2(&actions, in_pipe[0], STDIN_FILENO);
+    else
+        posix_spawn_file_actions_addopen(&actions, STDIN_FILENO, "/dev/null",
+                                         O_RDONLY, 0);
+    posix_spawn_file_actions_adddup2(&actions, out_pipe[1], STDOUT_FILENO);
+    posix_spawn_file_actions_adddup2(&actions, err_pipe[1], STDERR_FILENO);
+    if (!job.request.cwd.empty())
+        posix_spawn_file_actions_addchdir_np(&actions,
+                                             job.request.cwd.c_str());
+
+    // Each job gets its own process group, so the timeout kills everything
+    // that it has started (e.g. cc1 and as for a compiler driver)
+    posix_spawnattr_t attr;
+    posix_spawnattr_init(&attr);
+    sigset_t empty_set, default_set;
+    sigemptyset(&empty_set);
+    sigemptyset(&default_set);
+    sigaddset(&default_set, SIGPIPE);
+    posix_spawnattr_setsigmask(&attr, &empty_set);
+    posix_spawnattr_setsigdefault(&attr, &default_set);
+    posix_spawnattr_setpgroup(&attr, 0);
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETPGROUP |
+                                        POSIX_SPAWN_SETSIGMASK |
+                                        POSIX_SPAWN_SETSIGDEF);
+
+    std::vector<std::string> args;
+    bool limited = job.request.mem_limit != 0 || job.request.cpu_limit != 0;
+    if (limited) {
+        args = {trampoline_path, "--limited",
+                std::to_string(job.request.mem_limit),
+                std::to_string(job.request.cpu_limit), "--"};
+    }
+    args.insert(args.end(), job.request.cmd.begin(), job.request.cmd.end());
+    std::vector<char *> argv;
+    for (auto &arg : args)
+        argv.push_back(&arg[0]);
+    argv.push_back(nullptr);
+
+    job.start = std::chrono::steady_clock::now();
+    int err = limited ? posix_spawn(&job.pid, trampoline_path.c_str(),
+                                    &actions, &attr, argv.data(), environ)
+                      : posix_spawnp(&job.pid, argv[0], &actions, &attr,
+                                     argv.data(), environ);
+    posix_spawn_file_actions_destroy(&actions);
+    posix_spawnattr_destroy(&attr);
+
+    close(out_pipe[1]);
+    close(err_pipe[1]);
+    closeFd(in_pipe[0]);
+    job.out_fd = out_pipe[0];
+    job.err_fd = err_pipe[0];
+    job.in_fd = in_pipe[1];
+
+    if (err != 0) {
+        job.result.status = ProcessStatus::SPAWN_ERROR;
+        job.result.error = strerror(err);
+        closeFd(job.out_fd);
+        closeFd(job.err_fd);
+        closeFd(job.in_fd);
+        return false;
+    }
+
+    job.pid_fd = pidfdOpen(job.pid);
+    if (job.pid_fd == -1)
+        ERROR(std::string("Can't open pidfd (Linux 5.3 or newer is "
+                          "required): ") +
+              strerror(errno));
+    return true;
+}
+
+void ProcessExecutor::submit(const ProcessRequest &request, DoneCallback done) {
+    auto job = std::make_shared<Job>();
+    job->request = request;
+    job->done = std::move(done);
+    job->pid = -1;
+    job->pid_fd = job->out_fd = job->err_fd = job->in_fd = -1;
+    job->input_pos = 0;
+    job->exited = false;
+    job->timed_out = false;
+    job->status = 0;
+    job->usage = {};
+    job->result.id = request.id;
+
+    if (request.cmd.empty()) {
+        job->result.status = ProcessStatus::SPAWN_ERROR;
+        job->result.error = "Empty command";
+        job->done(job->result);
+        return;
+    }
+
+    if (!spawn(*job)) {
+        job->done(job->result);
+        return;
+    }
+
+    job->deadline =
+        job->start + std::chrono::duration_cast<std::chrono::nanoseconds>(
+                         std::chrono::duration<double>(request.timeout));
+    jobs.push_back(job);
+    for (int fd : {job->out_fd, job->err_fd})
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    addFd(job->pid_fd, EPOLLIN, job);
+    addFd(job->out_fd, EPOLLIN, job);
+    addFd(job->err_fd, EPOLLIN, job);
+    if (job->in_fd != -1) {
+        fcntl(job->in_fd, F_SETFL, fcntl(job->in_fd, F_GETFL) | O_NONBLOCK);
+        addFd(job->in_fd, EPOLLOUT, job);
+    }
+}
+
+void ProcessExecutor::handleFd(int fd) {
+    auto watched = watched_fds.find(fd);
+    if (watched != watched_fds.end()) {
+        // Copy, because the callback may unwatch the fd
+        auto on_ready = watched->second;
+        on_ready();
+        return;
+    }
+
+    // The fd can be already closed by an earlier event in the same batch
+    auto job_it = jobs_by_fd.find(fd);
+    if (job_it == jobs_by_fd.end())
+        return;
+    auto job = job_it->second;
+
+    if (fd == job->out_fd || fd == job->err_fd) {
+        std::string &dest = fd == job->out_fd ? job->result.out
+                                              : job->result.err;
+        char buf[65536];
+        while (true) {
+            ssize_t len = read(fd, buf, sizeof(buf));
+            if (len > 0) {
+                size_t room = max_output_size - std::min(max_output_size,
+                                                         dest.size());
+                dest.append(buf, std::min(room, static_cast<size_t>(len)));
+                continue;
+            }
+            if (len == -1 && errno == EINTR)
+                continue;
+            if (len == -1 && errno == EAGAIN)
+                break;
+            // EOF or an error
+            removeFd(fd);
+            closeFd(fd == job->out_fd ? job->out_fd : job->err_fd);
+            break;
+        }
+    }
+    else if (fd == job->in_fd) {
+        const std::string &input = job->request.input;
+        while (job->input_pos < input.size()) {
+            ssize_t len = write(fd, input.data() + job->input_pos,
+                                input.size() - job->input_pos);
+            if (len > 0) {
+                job->input_pos += len;
+                continue;
+            }
+            if (len == -1 && errno == EINTR)
+                continue;
+            if (len == -1 && errno == EAGAIN)
+                return;
+            // EPIPE: the job doesn't want the rest of its input
+            break;
+        }
+        removeFd(fd);
+        closeFd(job->in_fd);
+    }
+    else if (fd == job->pid_fd) {
+        // pidfd of a new job can reuse the number of a closed one
+        siginfo_t info = {};
+        if (waitid(P_PID, job->pid, &info, WEXITED | WNOHANG | WNOWAIT) != 0 ||
+            info.si_pid != job->pid)
+            return;
+        // The processes that the job has left behind would hold the pipes
+        // until the timeout (or forever without it). The job isn't reaped
+        // yet, so its process group can't be reused.
+        kill(-job->pid, SIGKILL);
+        if (wait4(job->pid, &job->status, WNOHANG, &job->usage) != job->pid)
+            return;
+        job->exited = true;
+        auto now = std::chrono::steady_clock::now();
+        job->result.wall_time =
+            std::chrono::duration<double>(now - job->start).count();
+        if (!job->timed_out)
+            job->deadline = now + drain_time;
+        removeFd(fd);
+        closeFd(job->pid_fd);
+    }
+    finishIfDone(job);
+}
+
+void ProcessExecutor::finishIfDone(std::shared_ptr<Job> job) {
+    if (!job->exited || job->out_fd != -1 || job->err_fd != -1)
+        return;
+    if (job->in_fd != -1) {
+        removeFd(job->in_fd);
+        closeFd(job->in_fd);
+    }
+
+    ProcessResult &result = job->result;
+    if (job->timed_out)
+        result.status = ProcessStatus::TIMEOUT;
+    else if (WIFSIGNALED(job->status)) {
+        result.status = ProcessStatus::SIGNALED;
+        result.signal = WTERMSIG(job->status);
+    }
+    else {
+        result.status = ProcessStatus::EXITED;
+        result.exit_code = WEXITSTATUS(job->status);
+    }
+    result.user_time = toSeconds(job->usage.ru_utime);
+    result.sys_time = toSeconds(job->usage.ru_stime);
+    result.max_rss = job->usage.ru_maxrss;
+
+    jobs.erase(std::find(jobs.begin(), jobs.end(), job));
+    job->done(result);
+}
+
+void ProcessExecutor::killExpired() {
+    auto now = std::chrono::steady_clock::now();
+    std::vector<std::shared_ptr<Job>> expired;
+    for (auto &job : jobs)
+        if ((job->request.timeout > 0 || job->exited) && now >= job->deadline)
+            expired.push_back(job);
+    for (auto &job : expired) {
+        if (!job->exited) {
+            if (!job->timed_out) {
+                job->timed_out = true;
+                kill(-job->pid, SIGKILL);
+            }
+            continue;
+        }
+        // The job has exited, but something that it has started has left
+        // its process group and still holds the pipes
+        for (int *fd : {&job->out_fd, &job->err_fd}) {
+            if (*fd != -1) {
+                removeFd(*fd);
+                closeFd(*fd);
+            }
+        }
+        finishIfDone(job);
+    }
+}
+
+int ProcessExecutor::getWaitTime(int max_wait_ms) {
+    auto now = std::chrono::steady_clock::now();
+    int64_t wait_ms = max_wait_ms;
+    for (auto &job : jobs) {
+        bool has_deadline = job->request.timeout > 0 || job->exited;
+        if (!has_deadline || (job->timed_out && !job->exited))
+            continue;
+        auto left = std::chrono::duration<double, std::milli>(job->deadline -
+                                                               now)
+                        .count();
+        auto left_ms = static_cast<int64_t>(std::ceil(std::max(left, 0.0)));
+        if (wait_ms < 0 || left_ms < wait_ms)
+            wait_ms = left_ms;
+    }
+    return static_cast<int>(wait_ms);
+}
+
+void ProcessExecutor::runOnce(int max_wait_ms) {
+    struct epoll_event events[64];
+    int num = epoll_wait(epoll_fd, events, 64, getWaitTime(max_wait_ms));
+    if (num == -1 && errno != EINTR)
+        ERROR(std::string("epoll_wait failed: ") + strerror(errno));
+    for (int i = 0; i < num; ++i)
+        handleFd(events[i].data.fd);
+    killExpired();
+}
+
+void ProcessExecutor::execLimited(int argc, char *argv[]) {
+    if (argc < 4 || std::string(argv[2]) != "--") {
+        std::cerr << "Bad trampoline invocation" << std::endl;
+        _exit(127);
+    }
+    uint64_t mem_limit = std::stoull(argv[0]);
+    uint64_t cpu_limit = std::stoull(argv[1]);
+    if (mem_limit != 0) {
+        struct rlimit limit = {mem_limit, mem_limit};
+        setrlimit(RLIMIT_AS, &limit);
+    }
+    if (cpu_limit != 0) {
+        // SIGXCPU at the soft limit, SIGKILL a second later
+        struct rlimit limit = {cpu_limit, cpu_limit + 1};
+        setrlimit(RLIMIT_CPU, &limit);
+    }
+    execvp(argv[3], argv + 3);
+    std::cerr << "Can't execute " << argv[3] << ": " << strerror(errno)
+              << std::endl;
+    _exit(127);
+}
+
+MemFileRegistry::~MemFileRegistry() {
+    for (auto &file : fds)
+        close(file.second);
+}
+
+std::string MemFileRegistry::getPath(const std::string &name) {
+    auto file = fds.find(name);
+    int fd = -1;
+    if (file != fds.end())
+        fd = file->second;
+    else {
+        fd = memfd_create(name.c_str(), MFD_CLOEXEC);
+        if (fd == -1)
+            ERROR(std::string("Can't create memfd: ") + strerror(errno));
+        fds[name] = fd;
+    }
+    return "/proc/" + std::to_string(getpid()) + "/fd/" + std::to_string(fd);
+}
+
+std::string MemFileRegistry::substitute(const std::string &arg) {
+    static const std::string prefix = "{memfd:";
+    std::string res;
+    size_t pos = 0;
+    while (true) {
+        size_t start = arg.find(prefix, pos);
+        size_t end = start == std::string::npos ? start : arg.find('}', start);
+        if (end == std::string::npos) {
+            res += arg.substr(pos);
+            return res;
+        }
+        res += arg.substr(pos, start - pos);
+        res += getPath(arg.substr(start + prefix.size(),
+                                  end - start - prefix.size()));
+        pos = end + 1;
+    }
+}
+
+bool MemFileRegistry::release(const std::string &name) {
+    auto file = fds.find(name);
+    if (file == fds.end())
+        return false;
+    close(file->second);
+    fds.erase(file);
+    return true;
+}
+
+bool MemFileRegistry::save(const std::string &name, const std::string &path,
+                           std::string &error) {
+    auto file = fds.find(name);
+    if (file == fds.end()) {
+        error = "Unknown memfd " + name;
+        return false;
+    }
+    struct stat file_stat;
+    if (fstat(file->second, &file_stat) == -1) {
+        error = strerror(errno);
+        return false;
+    }
+    int out_fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                      file_stat.st_mode & 0777);
+    if (out_fd == -1) {
+        error = strerror(errno);
+        return false;
+    }
+    off_t offset = 0;
+    while (offset < file_stat.st_size) {
+        ssize_t len = sendfile(out_fd, file->second, &offset,
+                               file_stat.st_size - offset);
+        if (len <= 0) {
+            error = len == 0 ? "Unexpected end of memfd" : strerror(errno);
+            close(out_fd);
+            return false;
+        }
+    }
+    close(out_fd);
+    return true;
+}
@@ -0,0 +1,169 @@
+/*
+Copyright (c) 2015-2020, Intel Corporation
+Copyright (c) 2019-2020, University of Utah
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+//////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <sys/resource.h>
+#include <sys/types.h>
+
+namespace yarpgen {
+
+// Description of a single job (a compiler or a test invocation)
+struct ProcessRequest {
+    std::string id;
+    std::vector<std::string> cmd;
+    // Working directory of the job (empty string means "inherit")
+    std::string cwd;
+    // Wall clock limit in seconds (0 means no limit)
+    double timeout;
+    // RLIMIT_AS in bytes and RLIMIT_CPU in seconds (0 means no limit)
+    uint64_t mem_limit;
+    uint64_t cpu_limit;
+    // Data that is fed to stdin of the job
+    std::string input;
+
+    ProcessRequest() : timeout(0), mem_limit(0), cpu_limit(0) {}
+};
+
+enum class ProcessStatus { EXITED, SIGNALED, TIMEOUT, SPAWN_ERROR, SKIPPED };
+
+struct ProcessResult {
+    std::string id;
+    ProcessStatus status;
+    int exit_code;
+    int signal;
+    double wall_time;
+    double user_time;
+    double sys_time;
+    // Peak resident set size in kilobytes
+    long max_rss;
+    std::string out;
+    std::string err;
+    // Description of the spawn error
+    std::string error;
+
+    ProcessResult()
+        : status(ProcessStatus::EXITED), exit_code(0), signal(0), wall_time(0),
+          user_time(0), sys_time(0), max_rss(0) {}
+};
+
+std::string statusToStr(ProcessStatus status);
+
+// Executor of child processes without polling. Every job is launched with
+// posix_spawn, its stdout and stderr are captured through pipes and its
+// termination is detected through pidfd, so a single epoll loop waits for
+// all active jobs and the timeouts are precise.
+class ProcessExecutor {
+  public:
+    using DoneCallback = std::function<void(const ProcessResult &)>;
+
+    // Resource limits can't be set by posix_spawn, so jobs with limits are
+    // launched through a trampoline: trampoline_path is re-executed as
+    // "trampoline_path --limited <mem> <cpu> -- cmd...", sets the limits and
+    // executes the command. See execLimited().
+    explicit ProcessExecutor(std::string _trampoline_path);
+    ~ProcessExecutor();
+    ProcessExecutor(const ProcessExecutor &) = delete;
+    ProcessExecutor &operator=(const ProcessExecutor &) = delete;
+
+    void submit(const ProcessRequest &request, DoneCallback done);
+    // Calls on_ready every time when fd becomes readable (or writable if
+    // writable is set) or is closed
+    void watchFd(int fd, std::function<void()> on_ready, bool writable = false);
+    void unwatchFd(int fd);
+    // Waits for the events at most max_wait_ms (-1 means no limit) and
+    // processes them
+    void runOnce(int max_wait_ms);
+    size_t getActiveNum() { return jobs.size(); }
+
+    // Output of a job that exceeds this limit is truncated
+    static size_t constexpr max_output_size = 64 << 20;
+
+    // Entry point of the trampoline mode. argv points to
+    // "<mem> <cpu> -- cmd...". Never returns.
+    static void execLimited(int argc, char *argv[]);
+
+  private:
+    struct Job {
+        ProcessRequest request;
+        DoneCallback done;
+        pid_t pid;
+        int pid_fd;
+        int out_fd;
+        int err_fd;
+        int in_fd;
+        size_t input_pos;
+        bool exited;
+        bool timed_out;
+        int status;
+        struct rusage usage;
+        std::chrono::steady_clock::time_point start;
+        // The timeout, and after the exit the end of the time to drain the
+        // pipes (see drain_time)
+        std::chrono::steady_clock::time_point deadline;
+        ProcessResult result;
+    };
+
+    bool spawn(Job &job);
+    void addFd(int fd, uint32_t events, std::shared_ptr<Job> job);
+    void removeFd(int fd);
+    void handleFd(int fd);
+    void killExpired();
+    void finishIfDone(std::shared_ptr<Job> job);
+    int getWaitTime(int max_wait_ms);
+
+    std::string trampoline_path;
+    int epoll_fd;
+    std::map<int, std::shared_ptr<Job>> jobs_by_fd;
+    std::map<int, std::function<void()>> watched_fds;
+    std::vector<std::shared_ptr<Job>> jobs;
+};
+
+// Named in-memory files for the zero-disk mode. Every file is a memfd that
+// any process can reach through /proc/<executor pid>/fd/<N>, so a compiler can
+// write an executable there and the executable can be started from there (the
+// same way fexecve does it) without any filesystem traffic.
+class MemFileRegistry {
+  public:
+    MemFileRegistry() = default;
+    ~MemFileRegistry();
+    MemFileRegistry(const MemFileRegistry &) = delete;
+    MemFileRegistry &operator=(const MemFileRegistry &) = delete;
+
+    // Returns the path of the file, creates the file if it doesn't exist
+    std::string getPath(const std::string &name);
+    // Replaces every "{memfd:NAME}" in arg with the path of the file NAME
+    std::string substitute(const std::string &arg);
+    bool release(const std::string &name);
+    // Copies the file to the disk (e.g. to debug an interesting test)
+    bool save(const std::string &name, const std::string &path,
+              std::string &error);
+
+  private:
+    std::map<std::string, int> fds;
+};
+} // namespace yarpgen
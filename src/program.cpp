@@ -18,66 +18,29 @@ limitations under the License.
 #include "program.h"
 #include "data.h"
 #include "emit_policy.h"
+#include "statistics.h"
 #include "stmt.h"
 #include <fstream>
 #include <memory>
 #include <sstream>
 #include <string>
-#include <yaml-cpp/yaml.h>
 #include <iostream>
-#include <filesystem>
 
 using namespace yarpgen;
 
-static std::vector<FunctionInfo> loadFunctionsFromYaml(const std::string& yaml_path) {
-    std::vector<FunctionInfo> functions;
-
-    try {
-        if (!std::filesystem::exists(yaml_path)) {
-            return {};
-        }
-        YAML::Node root = YAML::LoadFile(yaml_path);
-        if (!root.IsSequence()) {
-            return {};
-        }
-
-        for (const auto& node : root) {
-            FunctionInfo func;
-            try {
-                func.function_name = node["function_name"].as<std::string>();
-                if (node["parameter_types"]) {
-                    for (const auto& param : node["parameter_types"]) {
-                        func.parameter_types.push_back(param.as<std::string>());
-                    }
-                }
-                func.return_type = node["return_type"].as<std::string>();
-                func.function_body = node["function"].as<std::string>();
-                if (node["input"]) {
-                    for (const auto& input_val : node["input"]) {
-                        func.input.push_back(input_val.as<std::string>());
-                    }
-                }
-                func.output = node["output"].as<std::string>();
-                if (node["misc"]) {
-                    for (const auto& misc_line : node["misc"]) {
-                        func.misc.push_back(misc_line.as<std::string>());
-                    }
-                }
-            }
-            catch (const std::exception& e) {
-                return {};
-            }
-            functions.push_back(func);
-        }
-    }
-    catch (const std::exception& e) {
-        return {};
-    }
-
-    return functions;
+FunctionLibrary &ProgramGenerator::getFunctionLibrary() {
+    // The library doesn't depend on the seed, so a long-lived process (see
+    // GeneratorServer) loads it only once
+    static FunctionLibrary library;
+    Options &options = Options::getInstance();
+    // Without --func-lib the library is empty and nothing is injected
+    std::string path = options.getFuncLib();
+    if (library.getPath() != path && !library.load(path) && !path.empty())
+        ERROR("Can't load the function library " + path);
+    return library;
 }
 
-ProgramGenerator::ProgramGenerator() : hash_seed(0) {
+ProgramGenerator::ProgramGenerator() : cost_info({}), hash_seed(0) {
     // Generate the general structure of the test
     auto gen_ctx = std::make_shared<GenCtx>();
     new_test = ScopeStmt::generateStructure(gen_ctx);
@@ -99,11 +62,16 @@ ProgramGenerator::ProgramGenerator() : hash_seed(0) {
             std::make_shared<ScalarVarUseExpr>(new_var));
     }
 
-    auto functions = loadFunctionsFromYaml("../runner/functions.yaml");
-
-    if (!functions.empty()) {
-            // Inject function here
-        }
+    Options &options = Options::getInstance();
+    auto functions = getFunctionLibrary().sample(options.getFuncBatch());
+
+    // The functions are C code, so they can't be called from ISPC or SYCL
+    // kernels
+    InjectedCallExpr::clearFunctions();
+    if (options.isC() || options.isCXX()) {
+        for (const auto &func : functions)
+            InjectedCallExpr::addFunction(func);
+    }
 
     pop_ctx->setExtInpSymTable(ext_inp_sym_tbl);
     pop_ctx->setExtOutSymTable(ext_out_sym_tbl);
@@ -117,6 +85,69 @@ ProgramGenerator::ProgramGenerator() : hash_seed(0) {
         IRValue(IntTypeID::INT, IRValue::AbsValue{false, 0}));
     zero_var->setIsDead(false);
     ext_inp_sym_tbl->addVar(zero_var);
+
+    estimateCost();
+}
+
+bool ProgramGenerator::reevaluate() {
+    for (auto &sym_tbl : {ext_inp_sym_tbl, ext_out_sym_tbl}) {
+        for (auto &var : sym_tbl->getVars())
+            var->setCurrentValue(var->getInitValue());
+        for (auto &array : sym_tbl->getArrays()) {
+            array->setCurrentValue(array->getInitValues(Options::main_val_idx),
+                                   Options::main_val_idx);
+            if (array->getMulValsAxisIdx() != -1) {
+                size_t vals_number = Options::getInstance().getValsNumber();
+                for (size_t i = 1; i < vals_number; ++i)
+                    array->setCurrentValue(array->getInitValues(i), i);
+            }
+        }
+    }
+    bool res = new_test->reevaluate();
+    estimateCost();
+    return res;
+}
+
+void ProgramGenerator::estimateCost() {
+    Statistics &stats = Statistics::getInstance();
+    cost_info.expr_num = new_test->getStaticCost();
+    cost_info.stmt_num = stats.getStmtNum();
+    cost_info.arrays_num = ext_inp_sym_tbl->getArrays().size() +
+                           ext_out_sym_tbl->getArrays().size();
+    cost_info.dynamic_ops = new_test->getDynamicCost();
+
+    Options &options = Options::getInstance();
+    auto weights = options.getCostWeights();
+    cost_info.compile_cost =
+        weights.at(0) * static_cast<double>(cost_info.expr_num) +
+        weights.at(1) * static_cast<double>(cost_info.stmt_num) +
+        weights.at(2) * static_cast<double>(cost_info.arrays_num);
+}
+
+bool ProgramGenerator::fitsCostBudget() {
+    Options &options = Options::getInstance();
+    if (options.getMaxRunCost() != 0 &&
+        cost_info.dynamic_ops > options.getMaxRunCost())
+        return false;
+    if (options.getMaxCompileCost() != 0 &&
+        cost_info.compile_cost > options.getMaxCompileCost())
+        return false;
+    // The loops reserve their work during generation, but they can't always
+    // shrink it into the budget (see fitIterSpaceIntoBudget)
+    Statistics &stats = Statistics::getInstance();
+    if (options.getMaxDynamicOps() != 0 &&
+        stats.getDynamicOps() > options.getMaxDynamicOps())
+        return false;
+    return true;
+}
+
+void ProgramGenerator::emitCostInfo(std::ostream &stream,
+                                    const std::string &prefix) {
+    stream << prefix << "expr_num: " << cost_info.expr_num << "\n";
+    stream << prefix << "stmt_num: " << cost_info.stmt_num << "\n";
+    stream << prefix << "arrays_num: " << cost_info.arrays_num << "\n";
+    stream << prefix << "dynamic_ops: " << cost_info.dynamic_ops << "\n";
+    stream << prefix << "compile_cost: " << cost_info.compile_cost << "\n";
 }
 
 void ProgramGenerator::emitCheckFunc(std::ostream &stream) {
@@ -139,6 +170,24 @@ void ProgramGenerator::emitCheckFunc(std::ostream &stream) {
                 "int const v) {\n";
     out_file << "    *seed ^= v + 0x9e3779b9 + ((*seed)<<6) + ((*seed)>>2);\n";
     out_file << "}\n\n";
+
+    if (options.getPerfReps() == 0)
+        return;
+
+    // Time stamp counter is the most precise timer on x86. Other targets
+    // fall back to a monotonic clock, so "cycles" are nanoseconds there.
+    out_file << "#if defined(__x86_64__) || defined(__i386__)\n";
+    out_file << "#include <x86intrin.h>\n";
+    out_file << "static unsigned long long int read_cycles() {\n";
+    out_file << "    return __rdtsc();\n";
+    out_file << "}\n";
+    out_file << "#else\n";
+    out_file << "#include <chrono>\n";
+    out_file << "static unsigned long long int read_cycles() {\n";
+    out_file << "    return std::chrono::duration_cast<std::chrono::nanoseconds>(\n";
+    out_file << "        std::chrono::steady_clock::now().time_since_epoch()).count();\n";
+    out_file << "}\n";
+    out_file << "#endif\n\n";
 }
 
 // These buffers track parameters which are members of struct or class
@@ -426,6 +475,27 @@ static void emitClassDecl(std::shared_ptr<EmitCtx> ctx, std::ostream &stream, st
     stream << "}object_1;\n\n";
 }
 
+// Initialization value of the array element at the loop indices i_*. The
+// lanes of multiple values are selected by the index along their axis:
+// (i_k % N == 0) ? v_0 : (i_k % N == 1) ? v_1 : ... v_(N-1)
+static void emitArrayInitValue(std::shared_ptr<EmitCtx> ctx,
+                               std::ostream &stream,
+                               const std::shared_ptr<Array> &array) {
+    size_t vals_number = array->getMulValsAxisIdx() == -1
+                             ? 1
+                             : Options::getInstance().getValsNumber();
+    for (size_t i = 0; i < vals_number; ++i) {
+        if (i + 1 < vals_number)
+            stream << "(i_" << array->getMulValsAxisIdx() << " % "
+                   << vals_number << " == " << i << ") ? ";
+        auto init_const =
+            std::make_shared<ConstantExpr>(array->getInitValues(i));
+        init_const->emit(ctx, stream);
+        if (i + 1 < vals_number)
+            stream << " : ";
+    }
+}
+
 static void emitDynamicClassDecl(std::shared_ptr<EmitCtx> ctx, std::ostream &stream, std::vector<std::shared_ptr<ScalarVar>> vars,
                           std::vector<std::shared_ptr<Array>> arrays) {
     stream << "class DynamicClass{\n";
@@ -493,21 +563,7 @@ static void emitDynamicClassDecl(std::shared_ptr<EmitCtx> ctx, std::ostream &str
         for (size_t i = 0; i < idx; ++i)
             stream << "[i_" << i << "] ";
         stream << "= ";
-        auto emit_const_expr = [&array, &ctx, &stream](bool use_main_vals) {
-            auto init_val = array->getInitValues(use_main_vals);
-            auto init_const = std::make_shared<ConstantExpr>(init_val);
-            init_const->emit(ctx, stream);
-        };
-        if (array->getMulValsAxisIdx() != -1) {
-            stream << "(i_" << array->getMulValsAxisIdx() << " % "
-                   << Options::vals_number << " == " << Options::main_val_idx
-                   << ") ? ";
-        }
-        emit_const_expr(true);
-        if (array->getMulValsAxisIdx() != -1) {
-            stream << " : ";
-            emit_const_expr(false);
-        }
+        emitArrayInitValue(ctx, stream, array);
         stream << ";\n";
     }
 
@@ -565,21 +621,7 @@ static void emitArrayInit(std::shared_ptr<EmitCtx> ctx, std::ostream &stream,
         for (size_t i = 0; i < idx; ++i)
             stream << "[i_" << i << "] ";
         stream << "= ";
-        auto emit_const_expr = [&array, &ctx, &stream](bool use_main_vals) {
-            auto init_val = array->getInitValues(use_main_vals);
-            auto init_const = std::make_shared<ConstantExpr>(init_val);
-            init_const->emit(ctx, stream);
-        };
-        if (array->getMulValsAxisIdx() != -1) {
-            stream << "(i_" << array->getMulValsAxisIdx() << " % "
-                   << Options::vals_number << " == " << Options::main_val_idx
-                   << ") ? ";
-        }
-        emit_const_expr(true);
-        if (array->getMulValsAxisIdx() != -1) {
-            stream << " : ";
-            emit_const_expr(false);
-        }
+        emitArrayInitValue(ctx, stream, array);
         stream << ";\n";
     }
 }
@@ -599,9 +641,50 @@ static void emitVarMemberInit(std::shared_ptr<EmitCtx> ctx, std::ostream &stream
     }
 }
 
+// In the performance mode test() is executed several times, so init() also
+// has to restore the scalars it may change. Unique pointers are moved into
+// test(), so they are created anew.
+static void emitScalarRestore(std::shared_ptr<EmitCtx> ctx, std::ostream &stream,
+                              std::vector<std::shared_ptr<ScalarVar>> vars) {
+    Options &options = Options::getInstance();
+    if (options.isSYCL())
+        ctx->setSYCLPrefix("app_");
+    std::string offset = "    ";
+    for (auto &var : vars) {
+        auto init_val = std::make_shared<ConstantExpr>(var->getInitValue());
+        if (var->getVarKind() == VarKindID::PTR) {
+            if (var->getPtrType() == PtrTypeID::UNIQUE) {
+                stream << offset << var->getNameWithoutPrefix(ctx)
+                       << " = std::make_unique<"
+                       << var->getType()->getName(ctx) << ">(";
+                init_val->emit(ctx, stream);
+                stream << ");\n";
+                continue;
+            }
+        }
+        else if (var->getVarKind() != VarKindID::NORMAL ||
+                 (!options.getAllowDeadData() && var->getIsDead()) ||
+                 var->getIsFunc() ||
+                 var->getDeclMod() == DeclModID::CONST ||
+                 var->getDeclMod() == DeclModID::CONSTEXPR)
+            continue;
+        auto assign_stmt = std::make_shared<AssignStmt>(var, init_val);
+        stream << offset;
+        assign_stmt->emit(ctx, stream);
+        stream << "\n";
+    }
+    ctx->setSYCLPrefix("");
+}
+
 void ProgramGenerator::emitInit(std::shared_ptr<EmitCtx> ctx,
                                 std::ostream &stream) {
     stream << "void init() {\n";
+    if (Options::getInstance().getPerfReps() > 0) {
+        stream << "/* -- Scalars -- */\n";
+        emitScalarRestore(ctx, stream, ext_inp_sym_tbl->getVars());
+        emitScalarRestore(ctx, stream, ext_out_sym_tbl->getVars());
+        stream << "\n";
+    }
     stream << "/* -- Arrays -- */\n";
     emitArrayInit(ctx, stream, ext_inp_sym_tbl->getArrays());
     emitArrayInit(ctx, stream, ext_out_sym_tbl->getArrays());
@@ -686,8 +769,8 @@ void ProgramGenerator::emitCheck(std::shared_ptr<EmitCtx> ctx,
         stream << arr_name;
 
         if (options.getCheckAlgo() == CheckAlgo::ASSERTS) {
-            auto const_val =
-                std::make_shared<ConstantExpr>((array->getCurrentValues(true)));
+            auto const_val = std::make_shared<ConstantExpr>(
+                (array->getCurrentValues(Options::main_val_idx)));
             stream << "!= ";
             const_val->emit(ctx, stream);
             auto emit_cmp = [&arr_name, &ctx, &stream](IRValue val) {
@@ -695,10 +778,12 @@ void ProgramGenerator::emitCheck(std::shared_ptr<EmitCtx> ctx,
                 auto const_val = std::make_shared<ConstantExpr>(val);
                 const_val->emit(ctx, stream);
             };
-            emit_cmp(array->getInitValues(true));
+            emit_cmp(array->getInitValues(Options::main_val_idx));
             if (array->getMulValsAxisIdx() != -1) {
-                emit_cmp(array->getCurrentValues(false));
-                emit_cmp(array->getInitValues(false));
+                for (size_t i = 1; i < options.getValsNumber(); ++i) {
+                    emit_cmp(array->getCurrentValues(i));
+                    emit_cmp(array->getInitValues(i));
+                }
             }
         }
         else
@@ -1035,8 +1120,24 @@ void ProgramGenerator::emitMain(std::shared_ptr<EmitCtx> ctx,
         stream << " }\n";
     stream << "\n\n";
     stream << "int main() {\n";
-    stream << "    init();\n";
-    stream << "    test(";
+
+    // In the performance mode init() restores the inputs before every run,
+    // so each repetition has to produce exactly the same checksum
+    uint32_t perf_reps = options.getPerfReps();
+    std::string offset = "    ";
+    if (perf_reps > 0) {
+        stream << "    unsigned long long int cycles[" << perf_reps << "];\n";
+        stream << "    unsigned long long int first_seed = 0;\n";
+        stream << "    bool rerun_mismatch = false;\n";
+        stream << "    for (int rep = 0; rep < " << perf_reps
+               << "; ++rep) {\n";
+        offset += "    ";
+        stream << offset << "seed = 0;\n";
+    }
+    stream << offset << "init();\n";
+    if (perf_reps > 0)
+        stream << offset << "unsigned long long int start = read_cycles();\n";
+    stream << offset << "test(";
 
     bool emit_any =
         emitVarFuncParamInMain(ctx, stream, ext_inp_sym_tbl->getVars(), false, false);
@@ -1045,9 +1146,25 @@ void ProgramGenerator::emitMain(std::shared_ptr<EmitCtx> ctx,
                        false, false, false);
 
     stream << ");\n";
-    stream << "    checksum();\n";
+    if (perf_reps > 0)
+        stream << offset << "cycles[rep] = read_cycles() - start;\n";
+    stream << offset << "checksum();\n";
+    if (perf_reps > 0) {
+        stream << offset << "if (rep == 0)\n";
+        stream << offset << "    first_seed = seed;\n";
+        stream << offset << "rerun_mismatch |= seed != first_seed;\n";
+        stream << "    }\n";
+    }
     stream << "    Release();\n";
     stream << "    printf(\"%llu\\n\", seed);\n";
+    if (perf_reps > 0) {
+        stream << "    std::sort(cycles, cycles + " << perf_reps << ");\n";
+        stream << "    printf(\"cycles: min %llu median %llu\\n\", cycles[0], "
+               << "cycles[" << perf_reps / 2 << "]);\n";
+        stream << "    if (rerun_mismatch) \n";
+        stream << "        printf(\"ERROR: checksum differs between "
+                  "repetitions\\n\");\n";
+    }
     if (options.getCheckAlgo() == CheckAlgo::PRECOMPUTE) {
         stream << "    if (seed != " << hash_seed << "ULL) \n";
         stream << "        printf(\"ERROR: hash mismatch\\n\");\n";
@@ -1059,7 +1176,7 @@ void ProgramGenerator::emitMain(std::shared_ptr<EmitCtx> ctx,
     stream << "}\n";
 }
 
-void ProgramGenerator::emit() {
+void ProgramGenerator::emit(std::ostream &stream) {
     Options &options = Options::getInstance();
     auto emit_ctx = std::make_shared<EmitCtx>();
     // We need to narrow options if we were asked to do so
@@ -1074,24 +1191,77 @@ void ProgramGenerator::emit() {
     emitExtDecl(emit_ctx, null_stream);
     null_stream.close();
 
+    stream << "/*\n";
+    options.dump(stream);
+    emitCostInfo(stream, "Estimated ");
+    stream << "*/\n";
+    emitCheckFunc(stream);
+    emitDecl(emit_ctx, stream);
+    emitInit(emit_ctx, stream);
+    emitCheck(emit_ctx, stream);
+    InjectedCallExpr::emitDefinitions(stream);
+    emitTest(emit_ctx, stream);
+    emitRelease(emit_ctx, stream);
+    emitMain(emit_ctx, stream);
+}
 
+void ProgramGenerator::emit() {
+    Options &options = Options::getInstance();
     std::ofstream out_file;
     // TODO: probably won't work on Windows
     std::string out_dir = options.getOutDir();
     out_file.open(out_dir);
     if (!out_file)
         ERROR(std::string("Can't open file ") + out_dir);
-    out_file << "/*\n";
-    options.dump(out_file);
-    out_file << "*/\n";
-    emitCheckFunc(out_file);
-    emitDecl(emit_ctx, out_file);
-    emitInit(emit_ctx, out_file);
-    emitCheck(emit_ctx, out_file);
-    emitTest(emit_ctx, out_file);
-    emitRelease(emit_ctx, out_file);
-    emitMain(emit_ctx, out_file);
+    emit(out_file);
     out_file.close();
+
+    if (options.getCostSidecar()) {
+        std::ofstream cost_file(out_dir + ".cost");
+        if (!cost_file)
+            ERROR(std::string("Can't open file ") + out_dir + ".cost");
+        cost_file << "seed: " << options.getSeed() << "\n";
+        emitCostInfo(cost_file, "");
+    }
+}
+
+void ProgramGenerator::initRandValGen(std::ostream &seed_log) {
+    Options &options = Options::getInstance();
+    rand_val_gen = std::make_shared<RandValGen>(options.getSeed(), seed_log);
+    options.setSeed(rand_val_gen->getSeed());
+
+    if (options.getMutationKind() == MutationKind::EXPRS ||
+        options.getMutationKind() == MutationKind::ALL) {
+        rand_val_gen->setMutationSeed(options.getMutationSeed(), seed_log);
+    }
+}
+
+void ProgramGenerator::resetGlobalState() {
+    OptionParser::initOptions();
+    Statistics::getInstance().reset();
+    NameHandler::getInstance().reset();
+    rand_val_gen.reset();
+
+    IntegralType::clearTypeSet();
+    ArrayType::clearTypeSet();
+    ConstantExpr::clearUsedConsts();
+    Expr::clearExprSet();
+    ScalarVarUseExpr::clearUseSet();
+    ArrayUseExpr::clearUseSet();
+    IterUseExpr::clearUseSet();
+    InjectedCallExpr::clearFunctions();
+
+    for (auto buffer :
+         {&struct_var_mbr_buffer, &class_var_mbr_buffer,
+          &class_private_var_mbr_buffer, &dyn_struct_var_mbr_buffer,
+          &dyn_class_var_mbr_buffer, &need_delete_param_buffer})
+        buffer->clear();
+    for (auto buffer : {&struct_arr_mbr_buffer, &class_arr_mbr_buffer,
+                        &dyn_struct_arr_mbr_buffer, &dyn_class_arr_mbr_buffer})
+        buffer->clear();
+    pass_as_param_buffer.clear();
+    any_vars_as_params = false;
+    any_arrays_as_params = false;
 }
 
 void ProgramGenerator::hash(unsigned long long int const v) {
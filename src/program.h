@@ -16,6 +16,7 @@ limitations under the License.
 //////////////////////////////////////////////////////////////////////////////
 #pragma once
 
+#include "func_lib.h"
 #include "stmt.h"
 
 #include <memory>
@@ -24,22 +25,65 @@ limitations under the License.
 
 namespace yarpgen {
 
-struct FunctionInfo {
-    std::string function_name;
-    std::vector<std::string> parameter_types;
-    std::string return_type;
-    std::string function_body;
-    std::vector<std::string> input;
-    std::string output;
-    std::vector<std::string> misc;
-};
-
 class ProgramGenerator {
   public:
+    // Rough estimation of the cost of the test. Dynamic ops is the number of
+    // expression nodes executed at runtime. Compile cost is a weighted sum of
+    // the number of expression nodes, statements and arrays.
+    struct CostInfo {
+        uint64_t expr_num;
+        uint64_t stmt_num;
+        uint64_t arrays_num;
+        uint64_t dynamic_ops;
+        double compile_cost;
+    };
+
+    // The test that doesn't fit into the budget is rejected with this code,
+    // so the caller can generate a new one
+    static int constexpr cost_budget_exit_code = 3;
+
     ProgramGenerator();
+    // Writes the test to the output file (and the cost sidecar if requested)
     void emit();
+    // Writes the test to the stream
+    void emit(std::ostream &stream);
+
+    // Function library for the injection (--func-lib). It is loaded on the
+    // first use.
+    static FunctionLibrary &getFunctionLibrary();
+
+    // Expected checksum of the test. It is known only after emit() and only
+    // if the check algorithm isn't hash (it is 0 for asserts).
+    uint64_t getExpectedChecksum() { return hash_seed; }
+
+    // Creates the random generator for the seed and the mutation seed from
+    // the options (and stores the actual seed back to the options). The seeds
+    // are reported to seed_log.
+    static void initRandValGen(std::ostream &seed_log);
+
+    // Brings the global state of the generator (options, statistics, name
+    // counters, folding sets and emission buffers) back to the state of a
+    // fresh process, so that one process can generate many tests
+    static void resetGlobalState();
+
+    // Body of the test. The test reducer modifies it in place.
+    std::shared_ptr<ScopeStmt> getTest() { return new_test; }
+    // Global variables and arrays of the test. The reducer removes the unused
+    // ones from them.
+    std::shared_ptr<SymbolTable> getExtInpSymTable() { return ext_inp_sym_tbl; }
+    std::shared_ptr<SymbolTable> getExtOutSymTable() { return ext_out_sym_tbl; }
+    // Evaluates the modified test once more from the initial values of the
+    // variables, so that the values for the precomputed checksum and the cost
+    // estimation match it. Returns false if the test has UB now.
+    bool reevaluate();
+
+    CostInfo getCostInfo() { return cost_info; }
+    bool fitsCostBudget();
 
   private:
+    void estimateCost();
+    void emitCostInfo(std::ostream &stream, const std::string &prefix);
+
     void emitCheckFunc(std::ostream &stream);
     void emitDecl(std::shared_ptr<EmitCtx> ctx, std::ostream &stream);
     void emitInit(std::shared_ptr<EmitCtx> ctx, std::ostream &stream);
@@ -53,6 +97,8 @@ class ProgramGenerator {
     std::shared_ptr<SymbolTable> ext_out_sym_tbl;
     std::shared_ptr<ScopeStmt> new_test;
 
+    CostInfo cost_info;
+
     unsigned long long int hash_seed;
     void hash(unsigned long long int const v);
     void hashArray(std::shared_ptr<Array> const &arr);
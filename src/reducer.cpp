@@ -0,0 +1,539 @@
+/*
+Copyright (c) 2015-2020, Intel Corporation
+Copyright (c) 2019-2020, University of Utah
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+//////////////////////////////////////////////////////////////////////////////
+
+#include "reducer.h"
+#include "utils.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <set>
+#include <thread>
+
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+using namespace yarpgen;
+
+// The child process reports the rejected candidates with this byte
+static char constexpr rejected_mark = 'R';
+
+TestReducer::TestReducer(std::string _test_cmd, size_t _max_jobs,
+                         std::string _out_file)
+    : test_cmd(std::move(_test_cmd)), max_jobs(_max_jobs),
+      out_file(std::move(_out_file)), tests_num(0), rejected_num(0) {
+    if (max_jobs == 0)
+        max_jobs = std::max(1U, std::thread::hardware_concurrency());
+    file_name = std::filesystem::path(out_file).filename().string();
+    if (file_name.empty())
+        file_name = "test.cpp";
+
+    const char *tmp_dir = std::getenv("TMPDIR");
+    std::string dir_template =
+        std::string(tmp_dir != nullptr ? tmp_dir : "/tmp") +
+        "/yarpgen-reduce-XXXXXX";
+    if (mkdtemp(dir_template.data()) == nullptr)
+        ERROR(std::string("Can't create temporary directory: ") +
+              strerror(errno));
+    work_dir = dir_template;
+}
+
+TestReducer::~TestReducer() {
+    std::error_code err;
+    std::filesystem::remove_all(work_dir, err);
+}
+
+int64_t TestReducer::addSite(Site site) {
+    sites.push_back(std::move(site));
+    return static_cast<int64_t>(sites.size()) - 1;
+}
+
+void TestReducer::collectBlock(const std::shared_ptr<StmtBlock> &block,
+                               int64_t parent) {
+    if (!block)
+        return;
+    for (auto &stmt : block->getStmts())
+        collectStmt(block, stmt, parent);
+}
+
+void TestReducer::collectStmt(const std::shared_ptr<StmtBlock> &block,
+                              const std::shared_ptr<Stmt> &stmt,
+                              int64_t parent) {
+    Site remove_site{};
+    remove_site.kind = SiteKind::REMOVE_STMT;
+    remove_site.parent = parent;
+    remove_site.block = block;
+    remove_site.stmt = stmt;
+    int64_t stmt_site = addSite(remove_site);
+
+    switch (stmt->getKind()) {
+        case IRNodeKind::EXPR:
+            collectOperands(std::static_pointer_cast<ExprStmt>(stmt)->getExpr(),
+                            stmt_site);
+            break;
+        case IRNodeKind::BLOCK:
+        case IRNodeKind::SCOPE:
+            collectBlock(std::static_pointer_cast<StmtBlock>(stmt), stmt_site);
+            break;
+        case IRNodeKind::LOOP_SEQ: {
+            auto loop_seq = std::static_pointer_cast<LoopSeqStmt>(stmt);
+            for (auto &loop : loop_seq->getLoops()) {
+                Site loop_site{};
+                loop_site.kind = SiteKind::REMOVE_LOOP;
+                loop_site.parent = stmt_site;
+                loop_site.loop_seq = loop_seq;
+                loop_site.loop_head = loop.first;
+                int64_t loop_site_idx = addSite(loop_site);
+                collectBlock(loop.first->getPrefix(), loop_site_idx);
+                collectBlock(loop.second, loop_site_idx);
+                collectBlock(loop.first->getSuffix(), loop_site_idx);
+            }
+            break;
+        }
+        case IRNodeKind::LOOP_NEST: {
+            auto loop_nest = std::static_pointer_cast<LoopNestStmt>(stmt);
+            for (auto &loop_head : loop_nest->getLoops())
+                collectBlock(loop_head->getPrefix(), stmt_site);
+            collectBlock(loop_nest->getBody(), stmt_site);
+            for (auto &loop_head : loop_nest->getLoops())
+                collectBlock(loop_head->getSuffix(), stmt_site);
+            break;
+        }
+        case IRNodeKind::IF_ELSE: {
+            auto if_else = std::static_pointer_cast<IfElseStmt>(stmt);
+            collectOperands(if_else->getCond(), stmt_site);
+            // Only the taken branch can replace the statement: the values
+            // that the other one assigns were never propagated
+            bool cond_taken = if_else->isCondTaken();
+            auto taken_br =
+                cond_taken ? if_else->getThenBr() : if_else->getElseBr();
+            auto other_br =
+                cond_taken ? if_else->getElseBr() : if_else->getThenBr();
+            int64_t other_br_parent = stmt_site;
+            if (taken_br != nullptr) {
+                Site branch_site{};
+                branch_site.kind = SiteKind::TAKE_BRANCH;
+                branch_site.parent = stmt_site;
+                branch_site.block = block;
+                branch_site.stmt = stmt;
+                branch_site.branch = taken_br;
+                other_br_parent = addSite(branch_site);
+            }
+            collectBlock(taken_br, stmt_site);
+            collectBlock(other_br, other_br_parent);
+            break;
+        }
+        default:
+            break;
+    }
+}
+
+void TestReducer::collectOperands(const std::shared_ptr<Expr> &expr,
+                                  int64_t parent) {
+    expr->forEachOperand([this, parent](std::shared_ptr<Expr> &operand) {
+        int64_t operand_parent = parent;
+        auto value = operand->getValue();
+        if (operand->getKind() != IRNodeKind::CONST && value != nullptr &&
+            value->isScalarVar() && value->getType()->isIntType() &&
+            !std::static_pointer_cast<ScalarVar>(value)
+                 ->getCurrentValue()
+                 .hasUB()) {
+            Site const_site{};
+            const_site.kind = SiteKind::CONST_EXPR;
+            const_site.parent = parent;
+            const_site.operand = &operand;
+            operand_parent = addSite(const_site);
+        }
+        collectOperands(operand, operand_parent);
+    });
+}
+
+// Names of the variables and arrays that are read or written in the test
+static void collectExprUses(const std::shared_ptr<Expr> &expr,
+                            std::set<std::string> &names) {
+    if (!expr)
+        return;
+    auto kind = expr->getKind();
+    if (kind == IRNodeKind::SCALAR_VAR_USE || kind == IRNodeKind::ARRAY_USE)
+        names.insert(expr->getValue()->getName(EmitCtx::default_emit_ctx));
+    auto collect_child = [&names](std::shared_ptr<Expr> &child) {
+        collectExprUses(child, names);
+    };
+    // The assignments don't list their trees as children
+    if (kind == IRNodeKind::ASSIGN || kind == IRNodeKind::REDUCTION) {
+        auto assign = std::static_pointer_cast<AssignmentExpr>(expr);
+        collectExprUses(assign->getTo(), names);
+        assign->forEachOperand(collect_child);
+        return;
+    }
+    expr->forEachChild(collect_child);
+}
+
+static void collectBlockUses(const std::shared_ptr<StmtBlock> &block,
+                             std::set<std::string> &names);
+
+static void collectLoopHeadUses(const std::shared_ptr<LoopHead> &loop_head,
+                                std::set<std::string> &names) {
+    for (auto &iter : loop_head->getIterators()) {
+        collectExprUses(iter->getStart(), names);
+        collectExprUses(iter->getEnd(), names);
+        collectExprUses(iter->getStep(), names);
+    }
+    collectBlockUses(loop_head->getPrefix(), names);
+    collectBlockUses(loop_head->getSuffix(), names);
+}
+
+static void collectBlockUses(const std::shared_ptr<StmtBlock> &block,
+                             std::set<std::string> &names) {
+    if (!block)
+        return;
+    for (auto &stmt : block->getStmts()) {
+        switch (stmt->getKind()) {
+            case IRNodeKind::EXPR:
+                collectExprUses(
+                    std::static_pointer_cast<ExprStmt>(stmt)->getExpr(),
+                    names);
+                break;
+            case IRNodeKind::BLOCK:
+            case IRNodeKind::SCOPE:
+                collectBlockUses(std::static_pointer_cast<StmtBlock>(stmt),
+                                 names);
+                break;
+            case IRNodeKind::LOOP_SEQ:
+                for (auto &loop :
+                     std::static_pointer_cast<LoopSeqStmt>(stmt)->getLoops()) {
+                    collectLoopHeadUses(loop.first, names);
+                    collectBlockUses(loop.second, names);
+                }
+                break;
+            case IRNodeKind::LOOP_NEST: {
+                auto loop_nest = std::static_pointer_cast<LoopNestStmt>(stmt);
+                for (auto &loop_head : loop_nest->getLoops())
+                    collectLoopHeadUses(loop_head, names);
+                collectBlockUses(loop_nest->getBody(), names);
+                break;
+            }
+            case IRNodeKind::IF_ELSE: {
+                auto if_else = std::static_pointer_cast<IfElseStmt>(stmt);
+                collectExprUses(if_else->getCond(), names);
+                collectBlockUses(if_else->getThenBr(), names);
+                collectBlockUses(if_else->getElseBr(), names);
+                break;
+            }
+            default:
+                break;
+        }
+    }
+}
+
+void TestReducer::collectDecls(ProgramGenerator &program) {
+    std::set<std::string> used_names;
+    collectBlockUses(program.getTest(), used_names);
+    auto add_site = [this, &used_names](
+                        const std::shared_ptr<SymbolTable> &sym_tbl,
+                        const std::shared_ptr<Data> &decl) {
+        if (used_names.count(decl->getName(EmitCtx::default_emit_ctx)) != 0)
+            return;
+        Site decl_site{};
+        decl_site.kind = SiteKind::REMOVE_DECL;
+        decl_site.parent = -1;
+        decl_site.sym_tbl = sym_tbl;
+        decl_site.decl = decl;
+        addSite(decl_site);
+    };
+    for (auto &sym_tbl :
+         {program.getExtInpSymTable(), program.getExtOutSymTable()}) {
+        // The parameter lists of test() always start with "zero"
+        for (auto &var : sym_tbl->getVars())
+            if (var->getName(EmitCtx::default_emit_ctx) != "zero")
+                add_site(sym_tbl, var);
+        for (auto &array : sym_tbl->getArrays())
+            add_site(sym_tbl, array);
+    }
+}
+
+TestReducer::SitePhase TestReducer::getPhase(SiteKind kind) {
+    switch (kind) {
+        case SiteKind::CONST_EXPR:
+            return SitePhase::EXPR;
+        case SiteKind::REMOVE_DECL:
+            return SitePhase::DECL;
+        default:
+            return SitePhase::STMT;
+    }
+}
+
+bool TestReducer::isApplicable(size_t site_idx,
+                               const std::vector<bool> &applied) {
+    for (int64_t i = sites.at(site_idx).parent; i != -1; i = sites.at(i).parent)
+        if (applied.at(i))
+            return false;
+    return true;
+}
+
+void TestReducer::applySites(const std::vector<bool> &applied) {
+    // The constants are taken from the values of the original test, so all of
+    // them are computed before anything is changed
+    std::vector<std::pair<std::shared_ptr<Expr> *, IRValue>> consts;
+    for (size_t i = 0; i < sites.size(); ++i) {
+        if (!applied.at(i) || !isApplicable(i, applied))
+            continue;
+        auto &site = sites.at(i);
+        if (site.kind == SiteKind::CONST_EXPR)
+            consts.emplace_back(
+                site.operand,
+                std::static_pointer_cast<ScalarVar>((*site.operand)->getValue())
+                    ->getCurrentValue());
+    }
+    for (auto &const_val : consts)
+        *const_val.first = std::make_shared<ConstantExpr>(const_val.second);
+
+    for (size_t i = 0; i < sites.size(); ++i) {
+        if (!applied.at(i) || !isApplicable(i, applied))
+            continue;
+        auto &site = sites.at(i);
+        switch (site.kind) {
+            case SiteKind::REMOVE_STMT:
+                site.block->removeStmt(site.stmt);
+                break;
+            case SiteKind::REMOVE_LOOP:
+                site.loop_seq->removeLoop(site.loop_head);
+                break;
+            case SiteKind::TAKE_BRANCH:
+                site.block->replaceStmt(site.stmt, site.branch);
+                break;
+            case SiteKind::CONST_EXPR:
+                break;
+            case SiteKind::REMOVE_DECL:
+                if (site.decl->isArray())
+                    site.sym_tbl->removeArray(
+                        std::static_pointer_cast<Array>(site.decl));
+                else
+                    site.sym_tbl->removeVar(
+                        std::static_pointer_cast<ScalarVar>(site.decl));
+                break;
+        }
+    }
+}
+
+std::vector<TestReducer::TestResult>
+TestReducer::testCandidates(ProgramGenerator &program,
+                            const std::vector<std::vector<bool>> &candidates,
+                            bool show_output) {
+    struct Job {
+        pid_t pid;
+        // Read end of the pipe for the rejected_mark
+        int status_fd;
+    };
+    std::vector<Job> jobs;
+    std::cout.flush();
+    std::cerr.flush();
+
+    for (size_t i = 0; i < candidates.size(); ++i) {
+        std::string job_dir = work_dir + "/" + std::to_string(i);
+        std::error_code err;
+        std::filesystem::remove_all(job_dir, err);
+        std::filesystem::create_directory(job_dir);
+
+        int status_fds[2];
+        if (pipe(status_fds) == -1)
+            ERROR(std::string("Can't create pipe: ") + strerror(errno));
+        fcntl(status_fds[1], F_SETFD, FD_CLOEXEC);
+
+        pid_t pid = fork();
+        if (pid == -1)
+            ERROR(std::string("Can't fork: ") + strerror(errno));
+        if (pid == 0) {
+            close(status_fds[0]);
+            applySites(candidates.at(i));
+            if (!program.reevaluate()) {
+                if (write(status_fds[1], &rejected_mark, 1) == -1) {
+                }
+                _exit(1);
+            }
+            if (chdir(job_dir.c_str()) == -1)
+                _exit(1);
+            std::ofstream file(file_name);
+            program.emit(file);
+            file.close();
+            if (!file)
+                _exit(1);
+
+            if (!show_output) {
+                int null_fd = open("/dev/null", O_WRONLY);
+                dup2(null_fd, STDOUT_FILENO);
+                dup2(null_fd, STDERR_FILENO);
+                close(null_fd);
+            }
+            std::string cmd = test_cmd + " " + file_name;
+            execl("/bin/sh", "sh", "-c", cmd.c_str(), nullptr);
+            _exit(127);
+        }
+        close(status_fds[1]);
+        jobs.push_back({pid, status_fds[0]});
+    }
+
+    std::vector<TestResult> results;
+    for (auto &job : jobs) {
+        int status = 0;
+        while (waitpid(job.pid, &status, 0) == -1 && errno == EINTR) {
+        }
+        char mark = 0;
+        ssize_t len = 0;
+        do {
+            len = read(job.status_fd, &mark, 1);
+        } while (len == -1 && errno == EINTR);
+        close(job.status_fd);
+
+        if (len == 1 && mark == rejected_mark) {
+            ++rejected_num;
+            results.push_back(TestResult::REJECTED);
+            continue;
+        }
+        ++tests_num;
+        results.push_back(WIFEXITED(status) && WEXITSTATUS(status) == 0
+                              ? TestResult::INTERESTING
+                              : TestResult::BORING);
+    }
+    return results;
+}
+
+bool TestReducer::reduceSites(ProgramGenerator &program, SitePhase phase) {
+    auto collect_active = [this, phase]() {
+        std::vector<size_t> active;
+        for (size_t i = 0; i < sites.size(); ++i)
+            if (getPhase(sites.at(i).kind) == phase &&
+                !applied_sites.at(i) && isApplicable(i, applied_sites))
+                active.push_back(i);
+        return active;
+    };
+
+    bool reduced = false;
+    std::vector<size_t> active = collect_active();
+    size_t chunk_size = (active.size() + 1) / 2;
+    while (chunk_size > 0 && !active.empty()) {
+        chunk_size = std::min(chunk_size, active.size());
+        bool accepted = false;
+        for (size_t start = 0; start < active.size() && !accepted;
+             start += chunk_size * max_jobs) {
+            // Every candidate applies one chunk of the active sites
+            std::vector<std::vector<bool>> candidates;
+            for (size_t chunk_start = start;
+                 chunk_start < active.size() &&
+                 candidates.size() < max_jobs;
+                 chunk_start += chunk_size) {
+                auto candidate = applied_sites;
+                size_t chunk_end =
+                    std::min(chunk_start + chunk_size, active.size());
+                for (size_t i = chunk_start; i < chunk_end; ++i)
+                    candidate.at(active.at(i)) = true;
+                candidates.push_back(std::move(candidate));
+            }
+
+            auto results = testCandidates(program, candidates, false);
+            for (size_t i = 0; i < results.size(); ++i) {
+                if (results.at(i) == TestResult::INTERESTING) {
+                    applied_sites = candidates.at(i);
+                    accepted = true;
+                    break;
+                }
+            }
+        }
+
+        if (accepted) {
+            reduced = true;
+            active = collect_active();
+        }
+        else
+            chunk_size /= 2;
+    }
+    return reduced;
+}
+
+int TestReducer::run(ProgramGenerator &program) {
+    auto start_time = std::chrono::steady_clock::now();
+    uint64_t orig_expr_num = program.getCostInfo().expr_num;
+    // The trees of the lanes (and the identical subexpressions with
+    // --hash-cons) share the nodes after generation, so a node holds the
+    // value of the last place where it was evaluated. The constants are taken
+    // from the values of the nodes, so the trees get their own nodes and
+    // values first.
+    if (!program.reevaluate())
+        ERROR("Original test has UB");
+    collectBlock(program.getTest(), -1);
+    applied_sites.assign(sites.size(), false);
+
+    auto orig_res = testCandidates(program, {applied_sites}, true);
+    if (orig_res.front() != TestResult::INTERESTING) {
+        std::cerr << "The original test is not interesting" << std::endl;
+        return -1;
+    }
+
+    while (reduceSites(program, SitePhase::STMT) |
+           reduceSites(program, SitePhase::EXPR)) {
+    }
+
+    size_t stmt_num = 0;
+    size_t stmt_removed = 0;
+    size_t expr_num = 0;
+    size_t expr_replaced = 0;
+    for (size_t i = 0; i < sites.size(); ++i) {
+        bool is_expr = sites.at(i).kind == SiteKind::CONST_EXPR;
+        (is_expr ? expr_num : stmt_num)++;
+        if (applied_sites.at(i) && isApplicable(i, applied_sites))
+            (is_expr ? expr_replaced : stmt_removed)++;
+    }
+
+    // The test is reduced for good, so the declarations that it doesn't use
+    // anymore can be found
+    applySites(applied_sites);
+    if (!program.reevaluate())
+        ERROR("Reduced test has UB");
+    sites.clear();
+    collectDecls(program);
+    applied_sites.assign(sites.size(), false);
+    reduceSites(program, SitePhase::DECL);
+    size_t decl_removed = static_cast<size_t>(
+        std::count(applied_sites.begin(), applied_sites.end(), true));
+
+    applySites(applied_sites);
+    if (!program.reevaluate())
+        ERROR("Reduced test has UB");
+    program.emit();
+
+    std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start_time;
+    std::cerr << "Reduced " << orig_expr_num << " -> "
+              << program.getCostInfo().expr_num << " expression nodes: "
+              << stmt_removed << " of " << stmt_num
+              << " statement reductions, " << expr_replaced << " of "
+              << expr_num << " constant replacements, " << decl_removed
+              << " of " << sites.size() << " declaration removals, "
+              << tests_num << " tests (" << rejected_num
+              << " candidates rejected), " << std::fixed
+              << std::setprecision(1) << elapsed.count() << " s" << std::endl;
+    return 0;
+}
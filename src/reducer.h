@@ -0,0 +1,134 @@
+/*
+Copyright (c) 2015-2020, Intel Corporation
+Copyright (c) 2019-2020, University of Utah
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+//////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include "program.h"
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace yarpgen {
+
+// Test reducer (yarpgen --reduce=CMD). It works on the IR of the test instead
+// of the text, so every candidate is a valid test by construction and no time
+// is spent on parsing.
+//
+// The test is regenerated from the seed and the options, after that the
+// reducer collects the sites of the reductions:
+//   - removal of a statement (including loops and if-else statements);
+//   - removal of a loop from a loop sequence;
+//   - replacement of an if-else statement with its taken branch;
+//   - replacement of an operand of an expression with a constant that holds
+//     the value of the operand;
+//   - removal of a global variable or array that the reduced test doesn't
+//     use anymore (with its initialization and checksum).
+// A candidate is a set of sites. It is applied to a fork of the reducer, so
+// the original IR stays intact. The candidate is evaluated once more from the
+// initial values (see ProgramGenerator::reevaluate): candidates with UB or
+// with a changed control flow are rejected without the test, the others are
+// emitted with the new values and passed to the interestingness test
+//   sh -c "CMD <file>"
+// in a separate directory. Exit code 0 means that the candidate is
+// interesting. The sites are reduced by delta debugging (statements first,
+// then expressions), up to max_jobs candidates are tested at once. The unused
+// declarations are known only when the test is reduced, so they are collected
+// and reduced last.
+class TestReducer {
+  public:
+    // out_file is used for the name of the candidate files and the result
+    TestReducer(std::string _test_cmd, size_t _max_jobs,
+                std::string _out_file);
+    ~TestReducer();
+    TestReducer(const TestReducer &) = delete;
+    TestReducer &operator=(const TestReducer &) = delete;
+
+    // Reduces the test and writes it to the output file. Returns the exit
+    // code.
+    int run(ProgramGenerator &program);
+
+  private:
+    enum class SiteKind {
+        REMOVE_STMT,
+        REMOVE_LOOP,
+        TAKE_BRANCH,
+        CONST_EXPR,
+        REMOVE_DECL
+    };
+    // Sites that are reduced together
+    enum class SitePhase { STMT, EXPR, DECL };
+    static SitePhase getPhase(SiteKind kind);
+
+    struct Site {
+        SiteKind kind;
+        // Site that makes this one redundant (the enclosing statement or
+        // expression). -1 if there is no such site.
+        int64_t parent;
+        // REMOVE_STMT and TAKE_BRANCH: the statement and its block,
+        // TAKE_BRANCH replaces it with the branch
+        std::shared_ptr<StmtBlock> block;
+        std::shared_ptr<Stmt> stmt;
+        std::shared_ptr<Stmt> branch;
+        // REMOVE_LOOP
+        std::shared_ptr<LoopSeqStmt> loop_seq;
+        std::shared_ptr<LoopHead> loop_head;
+        // CONST_EXPR: the operand inside of its parent expression
+        std::shared_ptr<Expr> *operand;
+        // REMOVE_DECL: the variable or the array and its symbol table
+        std::shared_ptr<SymbolTable> sym_tbl;
+        std::shared_ptr<Data> decl;
+    };
+
+    enum class TestResult { INTERESTING, BORING, REJECTED };
+
+    int64_t addSite(Site site);
+    void collectBlock(const std::shared_ptr<StmtBlock> &block, int64_t parent);
+    void collectStmt(const std::shared_ptr<StmtBlock> &block,
+                     const std::shared_ptr<Stmt> &stmt, int64_t parent);
+    void collectOperands(const std::shared_ptr<Expr> &expr, int64_t parent);
+    // Has to be called after the reductions of the test are applied
+    void collectDecls(ProgramGenerator &program);
+
+    bool isApplicable(size_t site_idx, const std::vector<bool> &applied);
+    void applySites(const std::vector<bool> &applied);
+
+    std::vector<TestResult>
+    testCandidates(ProgramGenerator &program,
+                   const std::vector<std::vector<bool>> &candidates,
+                   bool show_output);
+    // Delta debugging over the sites of one phase. Returns true if something
+    // was reduced.
+    bool reduceSites(ProgramGenerator &program, SitePhase phase);
+
+    std::string test_cmd;
+    size_t max_jobs;
+    std::string out_file;
+    std::string file_name;
+    // Temporary directory with a subdirectory for every job
+    std::string work_dir;
+
+    std::vector<Site> sites;
+    std::vector<bool> applied_sites;
+
+    uint64_t tests_num;
+    uint64_t rejected_num;
+};
+} // namespace yarpgen
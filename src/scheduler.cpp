@@ -0,0 +1,161 @@
+/*
+Copyright (c) 2015-2020, Intel Corporation
+Copyright (c) 2019-2020, University of Utah
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+//////////////////////////////////////////////////////////////////////////////
+
+#include "scheduler.h"
+
+#include <algorithm>
+
+using namespace yarpgen;
+
+JobScheduler::JobScheduler(ProcessExecutor &_executor, size_t _max_parallel)
+    : executor(_executor), max_parallel(_max_parallel), running(0),
+      next_seq(0) {
+    if (max_parallel == 0)
+        max_parallel = 1;
+}
+
+bool JobScheduler::submit(const ProcessRequest &request,
+                          const std::vector<std::string> &deps,
+                          int64_t priority, int64_t dependents_num,
+                          ProcessExecutor::DoneCallback done,
+                          std::string &error) {
+    // Otherwise the job would wait for the dependency forever
+    for (const auto &dep : deps)
+        if (unfinished.count(dep) == 0 && finished.count(dep) == 0) {
+            error = "Unknown dependency " + dep +
+                    " (it was never submitted or its result was dropped)";
+            return false;
+        }
+
+    unfinished[request.id]++;
+    uint64_t seq = next_seq++;
+    waiting[seq] =
+        Node{request, deps, priority, dependents_num, std::move(done)};
+    if (resolve(seq))
+        startReady();
+    return true;
+}
+
+bool JobScheduler::resolve(uint64_t seq) {
+    Node &node = waiting.at(seq);
+    while (!node.deps.empty()) {
+        auto dep = finished.find(node.deps.back());
+        if (dep == finished.end()) {
+            // We will be back when this dependency is finished
+            dependents[node.deps.back()].push_back(seq);
+            return false;
+        }
+        bool dep_success = dep->second.success;
+        node.deps.pop_back();
+        releaseResult(dep);
+        if (!dep_success) {
+            Node skipped = std::move(node);
+            waiting.erase(seq);
+            skip(skipped);
+            return true;
+        }
+    }
+    int64_t priority = node.priority;
+    ready.emplace(std::make_pair(priority, seq), std::move(node));
+    waiting.erase(seq);
+    return true;
+}
+
+void JobScheduler::finish(const std::string &id, bool success,
+                          int64_t dependents_num) {
+    auto unfinished_it = unfinished.find(id);
+    if (unfinished_it != unfinished.end() && --unfinished_it->second == 0)
+        unfinished.erase(unfinished_it);
+    auto abandoned_it = abandoned.find(id);
+    if (abandoned_it != abandoned.end()) {
+        if (dependents_num != unknown_dependents_num)
+            dependents_num -= std::min(dependents_num, abandoned_it->second);
+        abandoned.erase(abandoned_it);
+    }
+    finished[id] = FinishedJob{success, dependents_num};
+
+    auto dep_it = dependents.find(id);
+    if (dep_it != dependents.end()) {
+        std::vector<uint64_t> seqs = std::move(dep_it->second);
+        dependents.erase(dep_it);
+        for (uint64_t seq : seqs)
+            if (waiting.count(seq) != 0)
+                resolve(seq);
+    }
+
+    // Nobody is going to ask for the result
+    auto job = finished.find(id);
+    if (job != finished.end() && job->second.unseen_dependents_num == 0)
+        finished.erase(job);
+}
+
+void JobScheduler::releaseResult(FinishedIter job) {
+    if (job->second.unseen_dependents_num == unknown_dependents_num)
+        return;
+    if (job->second.unseen_dependents_num > 0)
+        --job->second.unseen_dependents_num;
+    if (job->second.unseen_dependents_num == 0)
+        finished.erase(job);
+}
+
+void JobScheduler::skip(Node &node) {
+    // The dependencies that weren't checked yet won't be seen by this job
+    for (auto &dep_id : node.deps) {
+        auto dep = finished.find(dep_id);
+        if (dep != finished.end())
+            releaseResult(dep);
+        else
+            abandoned[dep_id]++;
+    }
+    node.deps.clear();
+
+    ProcessResult result;
+    result.id = node.request.id;
+    result.status = ProcessStatus::SKIPPED;
+    node.done(result);
+    finish(node.request.id, false, node.dependents_num);
+}
+
+void JobScheduler::skipWaiting() {
+    while (!waiting.empty()) {
+        Node node = std::move(waiting.begin()->second);
+        waiting.erase(waiting.begin());
+        skip(node);
+    }
+}
+
+void JobScheduler::startReady() {
+    while (running < max_parallel && !ready.empty()) {
+        Node node = std::move(ready.begin()->second);
+        ready.erase(ready.begin());
+        ++running;
+        auto done = std::move(node.done);
+        int64_t dependents_num = node.dependents_num;
+        executor.submit(node.request, [this, done, dependents_num](
+                                          const ProcessResult &result) {
+            --running;
+            done(result);
+            finish(result.id,
+                   result.status == ProcessStatus::EXITED &&
+                       result.exit_code == 0,
+                   dependents_num);
+            startReady();
+        });
+    }
+}
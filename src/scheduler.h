@@ -0,0 +1,108 @@
+/*
+Copyright (c) 2015-2020, Intel Corporation
+Copyright (c) 2019-2020, University of Utah
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+//////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include "process.h"
+
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace yarpgen {
+
+// Scheduler of a job graph (e.g. compile -> run for every configuration of
+// every test) on top of ProcessExecutor.
+// A job becomes ready when all of its dependencies have exited with zero exit
+// code. If any of them has failed, the job is skipped (and so are its own
+// dependents). The dependencies have to be submitted before the job. At most
+// max_parallel jobs are running at once and the ready job with the smallest
+// priority value (submission order breaks ties) is started first, so the
+// runner can finish in-flight tests before it starts the new ones.
+// The result of a finished job is kept until all of its dependents have seen
+// it, so a long-running executor doesn't accumulate the ids of all the jobs.
+class JobScheduler {
+  public:
+    // The number of the dependents of a job is not known, so its result is
+    // kept until the end
+    static int64_t constexpr unknown_dependents_num = -1;
+
+    JobScheduler(ProcessExecutor &_executor, size_t _max_parallel);
+
+    // dependents_num is the number of the jobs that will list this job in
+    // their deps (or unknown_dependents_num). Returns false (and doesn't
+    // submit the job) if a dependency was never submitted or its result was
+    // already dropped.
+    bool submit(const ProcessRequest &request,
+                const std::vector<std::string> &deps, int64_t priority,
+                int64_t dependents_num, ProcessExecutor::DoneCallback done,
+                std::string &error);
+    // The number of jobs that are not finished yet
+    size_t getPendingNum() {
+        return waiting.size() + ready.size() + running;
+    }
+    // Nothing can be started anymore, but some jobs still wait. It can't
+    // happen with known dependencies, but the jobs are skipped anyway.
+    void skipWaiting();
+
+  private:
+    struct Node {
+        ProcessRequest request;
+        std::vector<std::string> deps;
+        int64_t priority;
+        int64_t dependents_num;
+        ProcessExecutor::DoneCallback done;
+    };
+
+    struct FinishedJob {
+        bool success;
+        // The dependents that haven't seen the result yet
+        int64_t unseen_dependents_num;
+    };
+    using FinishedIter = std::map<std::string, FinishedJob>::iterator;
+
+    // Returns false if the node is not ready yet
+    bool resolve(uint64_t seq);
+    void finish(const std::string &id, bool success, int64_t dependents_num);
+    // A dependent has seen the result of the job
+    void releaseResult(FinishedIter job);
+    void skip(Node &node);
+    void startReady();
+
+    ProcessExecutor &executor;
+    size_t max_parallel;
+    size_t running;
+    uint64_t next_seq;
+
+    // Job id -> the number of the submitted jobs with this id that haven't
+    // finished yet
+    std::map<std::string, size_t> unfinished;
+    // Job id -> whether it has succeeded
+    std::map<std::string, FinishedJob> finished;
+    // Job id -> sequence numbers of the jobs that wait for it
+    std::map<std::string, std::vector<uint64_t>> dependents;
+    // Job id -> the number of its dependents that were skipped before it has
+    // finished, they will never see its result
+    std::map<std::string, int64_t> abandoned;
+    std::map<uint64_t, Node> waiting;
+    // (priority, sequence number) -> ready job
+    std::map<std::pair<int64_t, uint64_t>, Node> ready;
+};
+} // namespace yarpgen
@@ -0,0 +1,443 @@
+/*
+Copyright (c) 2015-2020, Intel Corporation
+Copyright (c) 2019-2020, University of Utah
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+//////////////////////////////////////////////////////////////////////////////
+
+#include "server.h"
+#include "options.h"
+#include "program.h"
+#include "utils.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <thread>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+using namespace yarpgen;
+
+// Requests are short, so a client that doesn't send a line in time is dropped
+static int constexpr request_timeout_sec = 5;
+// A worker gives up on a client that doesn't read the response for that long
+static int constexpr response_timeout_sec = 30;
+static size_t constexpr max_request_size = 64 << 10;
+
+static int signal_write_fd = -1;
+static volatile sig_atomic_t stop_requested = 0;
+
+static void handleSignal(int sig) {
+    if (sig != SIGCHLD)
+        stop_requested = 1;
+    int saved_errno = errno;
+    char c = 0;
+    // The pipe is non-blocking, a full pipe already has a wake-up for us
+    if (write(signal_write_fd, &c, 1) == -1) {
+    }
+    errno = saved_errno;
+}
+
+static bool writeAll(int fd, const std::string &data) {
+    size_t pos = 0;
+    while (pos < data.size()) {
+        ssize_t len = write(fd, data.data() + pos, data.size() - pos);
+        if (len == -1 && errno == EINTR)
+            continue;
+        if (len <= 0)
+            return false;
+        pos += len;
+    }
+    return true;
+}
+
+static void setNonBlocking(int fd) {
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+}
+
+GeneratorServer::GeneratorServer(std::string _socket_path, size_t _max_workers,
+                                 std::vector<std::string> _base_args,
+                                 GenerateFunc _generate)
+    : socket_path(std::move(_socket_path)), max_workers(_max_workers),
+      base_args(std::move(_base_args)), generate(std::move(_generate)),
+      listen_fd(-1), signal_fds{-1, -1}, generated_num(0), rejected_num(0),
+      failed_num(0), total_latency(0) {
+    if (max_workers == 0)
+        max_workers = std::max(1U, std::thread::hardware_concurrency());
+}
+
+GeneratorServer::~GeneratorServer() {
+    for (auto &conn : connections)
+        close(conn.first);
+    for (auto &request : queue)
+        close(request.conn_fd);
+    for (auto &worker : workers) {
+        close(worker.second.conn_fd);
+        close(worker.second.err_fd);
+    }
+    if (listen_fd != -1) {
+        close(listen_fd);
+        unlink(socket_path.c_str());
+    }
+    for (int fd : signal_fds)
+        if (fd != -1)
+            close(fd);
+}
+
+bool GeneratorServer::listen() {
+    sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    if (socket_path.size() >= sizeof(addr.sun_path)) {
+        std::cerr << "Socket path is too long: " << socket_path << std::endl;
+        return false;
+    }
+    std::strcpy(addr.sun_path, socket_path.c_str());
+
+    // A socket that is left by a previous server would block bind()
+    struct stat st;
+    if (stat(socket_path.c_str(), &st) == 0 && S_ISSOCK(st.st_mode))
+        unlink(socket_path.c_str());
+
+    listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listen_fd == -1 ||
+        bind(listen_fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) ||
+        ::listen(listen_fd, SOMAXCONN)) {
+        std::cerr << "Can't listen on " << socket_path << ": "
+                  << strerror(errno) << std::endl;
+        if (listen_fd != -1)
+            close(listen_fd);
+        listen_fd = -1;
+        return false;
+    }
+    setNonBlocking(listen_fd);
+    return true;
+}
+
+int GeneratorServer::run() {
+    if (pipe(signal_fds))
+        ERROR(std::string("Can't create a pipe: ") + strerror(errno));
+    setNonBlocking(signal_fds[0]);
+    setNonBlocking(signal_fds[1]);
+    signal_write_fd = signal_fds[1];
+
+    struct sigaction action {};
+    action.sa_handler = handleSignal;
+    sigemptyset(&action.sa_mask);
+    action.sa_flags = SA_RESTART;
+    sigaction(SIGCHLD, &action, nullptr);
+    sigaction(SIGINT, &action, nullptr);
+    sigaction(SIGTERM, &action, nullptr);
+    // Clients can go away at any moment
+    signal(SIGPIPE, SIG_IGN);
+
+    if (!listen())
+        return -1;
+
+    // Everything that doesn't depend on the seed is done here once, so the
+    // workers inherit it
+    ProgramGenerator::getFunctionLibrary();
+    start_time = std::chrono::steady_clock::now();
+    std::cerr << "Serving on " << socket_path << " with " << max_workers
+              << " workers" << std::endl;
+
+    while (!stop_requested) {
+        std::vector<pollfd> fds = {{signal_fds[0], POLLIN, 0},
+                                   {listen_fd, POLLIN, 0}};
+        for (auto &conn : connections)
+            fds.push_back({conn.first, POLLIN, 0});
+        if (poll(fds.data(), fds.size(), getPollTimeout()) == -1) {
+            if (errno == EINTR)
+                continue;
+            ERROR(std::string("Can't poll: ") + strerror(errno));
+        }
+        if (fds[0].revents) {
+            char buf[256];
+            while (read(signal_fds[0], buf, sizeof(buf)) > 0) {
+            }
+            reapWorkers();
+        }
+        if (fds[1].revents)
+            acceptConnection();
+        for (size_t i = 2; i < fds.size(); ++i)
+            if (fds[i].revents)
+                readConnection(fds[i].fd);
+        dropExpiredConnections();
+        startWorkers();
+    }
+
+    // Let the workers finish the tests that were already started
+    while (!workers.empty()) {
+        int status = 0;
+        pid_t pid = waitpid(-1, &status, 0);
+        if (pid == -1 && errno == EINTR)
+            continue;
+        if (pid == -1)
+            break;
+        auto worker = workers.find(pid);
+        if (worker == workers.end())
+            continue;
+        finishWorker(worker->second, status);
+        workers.erase(worker);
+    }
+    return 0;
+}
+
+void GeneratorServer::acceptConnection() {
+    while (true) {
+        int conn_fd = accept(listen_fd, nullptr, nullptr);
+        if (conn_fd == -1) {
+            if (errno == EINTR)
+                continue;
+            return;
+        }
+        // Accepted sockets don't inherit O_NONBLOCK everywhere
+        setNonBlocking(conn_fd);
+        connections[conn_fd] =
+            Connection{"", std::chrono::steady_clock::now() +
+                               std::chrono::seconds(request_timeout_sec)};
+    }
+}
+
+void GeneratorServer::readConnection(int conn_fd) {
+    Connection &conn = connections.at(conn_fd);
+    char buf[4096];
+    while (conn.buffer.find('\n') == std::string::npos) {
+        ssize_t len = read(conn_fd, buf, sizeof(buf));
+        if (len == -1 && errno == EINTR)
+            continue;
+        // The rest of the line will come with the next poll
+        if (len == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return;
+        // EOF also ends the request, so "echo --seed=1 | nc -U" works
+        if (len == 0)
+            break;
+        if (len == -1 || conn.buffer.size() + len > max_request_size) {
+            close(conn_fd);
+            connections.erase(conn_fd);
+            return;
+        }
+        conn.buffer.append(buf, len);
+    }
+    // The client has closed the connection without a request (e.g. a health
+    // check), there is nobody to generate the test for
+    if (conn.buffer.empty()) {
+        close(conn_fd);
+        connections.erase(conn_fd);
+        return;
+    }
+    std::string line = conn.buffer.substr(0, conn.buffer.find('\n'));
+    if (!line.empty() && line.back() == '\r')
+        line.pop_back();
+    connections.erase(conn_fd);
+    dispatchRequest(conn_fd, std::move(line));
+}
+
+void GeneratorServer::dispatchRequest(int conn_fd, std::string line) {
+    // Stats are cheap, so they are answered right away even if all the
+    // workers are busy. They fit into the socket buffer, so the server
+    // doesn't wait for the client.
+    if (line == "stats") {
+        std::string stats = getStats();
+        writeAll(conn_fd, "OK " + std::to_string(stats.size()) + "\n" + stats);
+        close(conn_fd);
+        return;
+    }
+    // The worker sends the whole test with blocking writes, but a client that
+    // stops reading can't hold the worker forever
+    fcntl(conn_fd, F_SETFL, fcntl(conn_fd, F_GETFL) & ~O_NONBLOCK);
+    timeval send_timeout{response_timeout_sec, 0};
+    setsockopt(conn_fd, SOL_SOCKET, SO_SNDTIMEO, &send_timeout,
+               sizeof(send_timeout));
+    queue.push_back(Request{conn_fd, std::move(line)});
+}
+
+void GeneratorServer::dropExpiredConnections() {
+    auto now = std::chrono::steady_clock::now();
+    for (auto conn = connections.begin(); conn != connections.end();) {
+        if (conn->second.deadline > now) {
+            ++conn;
+            continue;
+        }
+        close(conn->first);
+        conn = connections.erase(conn);
+    }
+}
+
+int GeneratorServer::getPollTimeout() {
+    if (connections.empty())
+        return -1;
+    auto deadline = connections.begin()->second.deadline;
+    for (auto &conn : connections)
+        deadline = std::min(deadline, conn.second.deadline);
+    auto timeout = std::chrono::duration_cast<std::chrono::milliseconds>(
+                       deadline - std::chrono::steady_clock::now())
+                       .count();
+    // Rounded up, so the poll doesn't wake up right before the deadline
+    return static_cast<int>(std::max<int64_t>(timeout + 1, 0));
+}
+
+void GeneratorServer::startWorkers() {
+    while (workers.size() < max_workers && !queue.empty()) {
+        Request request = std::move(queue.front());
+        queue.pop_front();
+
+        int err_fds[2];
+        if (pipe(err_fds))
+            ERROR(std::string("Can't create a pipe: ") + strerror(errno));
+        pid_t pid = fork();
+        if (pid == -1)
+            ERROR(std::string("Can't fork: ") + strerror(errno));
+        if (pid == 0) {
+            close(err_fds[0]);
+            runWorker(request, err_fds[1]);
+        }
+        close(err_fds[1]);
+        setNonBlocking(err_fds[0]);
+        workers[pid] =
+            Worker{request.conn_fd, err_fds[0], std::chrono::steady_clock::now()};
+    }
+}
+
+void GeneratorServer::runWorker(const Request &request, int err_fd) {
+    // The worker is a copy of the server, so it has to drop everything that
+    // belongs to the other requests. Otherwise their clients won't see the
+    // end of the response until this worker exits.
+    signal(SIGCHLD, SIG_DFL);
+    signal(SIGINT, SIG_DFL);
+    signal(SIGTERM, SIG_DFL);
+    close(listen_fd);
+    close(signal_fds[0]);
+    close(signal_fds[1]);
+    for (auto &conn : connections)
+        close(conn.first);
+    for (auto &other : queue)
+        close(other.conn_fd);
+    for (auto &worker : workers) {
+        close(worker.second.conn_fd);
+        close(worker.second.err_fd);
+    }
+
+    // Error output goes back to the server, which reports it to the client.
+    // The write end is non-blocking, so a long message can't hang the worker,
+    // it is truncated instead.
+    setNonBlocking(err_fd);
+    dup2(err_fd, STDERR_FILENO);
+    close(err_fd);
+    int null_fd = open("/dev/null", O_WRONLY);
+    if (null_fd != -1) {
+        dup2(null_fd, STDOUT_FILENO);
+        close(null_fd);
+    }
+
+    std::vector<std::string> args = base_args;
+    std::istringstream line_ss(request.line);
+    std::string arg;
+    while (line_ss >> arg)
+        args.push_back(arg);
+    std::vector<char *> argv;
+    for (auto &item : args)
+        argv.push_back(&item[0]);
+    argv.push_back(nullptr);
+
+    OptionParser::initOptions();
+    OptionParser::parse(args.size(), argv.data());
+
+    std::ostringstream test;
+    int exit_code = generate(test);
+    if (exit_code == 0) {
+        std::string test_str = test.str();
+        if (!writeAll(request.conn_fd,
+                      "OK " + std::to_string(test_str.size()) + "\n" +
+                          test_str))
+            exit_code = -1;
+    }
+    _exit(exit_code);
+}
+
+void GeneratorServer::reapWorkers() {
+    while (true) {
+        int status = 0;
+        pid_t pid = waitpid(-1, &status, WNOHANG);
+        if (pid <= 0)
+            return;
+        auto worker = workers.find(pid);
+        if (worker == workers.end())
+            continue;
+        finishWorker(worker->second, status);
+        workers.erase(worker);
+    }
+}
+
+void GeneratorServer::finishWorker(Worker &worker, int status) {
+    total_latency += std::chrono::duration<double>(
+                         std::chrono::steady_clock::now() - worker.start)
+                         .count();
+    if (WIFEXITED(status) && WEXITSTATUS(status) == 0)
+        generated_num++;
+    else {
+        int exit_code =
+            WIFEXITED(status) ? WEXITSTATUS(status) : -WTERMSIG(status);
+        if (exit_code == ProgramGenerator::cost_budget_exit_code)
+            rejected_num++;
+        else
+            failed_num++;
+        std::string error;
+        char buf[4096];
+        ssize_t len;
+        while ((len = read(worker.err_fd, buf, sizeof(buf))) > 0)
+            error.append(buf, len);
+        // The client may have stopped reading (that's why the worker has
+        // failed), the server doesn't wait for it
+        setNonBlocking(worker.conn_fd);
+        writeAll(worker.conn_fd, "ERROR " + std::to_string(exit_code) + " " +
+                                     std::to_string(error.size()) + "\n" +
+                                     error);
+    }
+    close(worker.conn_fd);
+    close(worker.err_fd);
+}
+
+std::string GeneratorServer::getStats() {
+    double uptime = std::chrono::duration<double>(
+                        std::chrono::steady_clock::now() - start_time)
+                        .count();
+    uint64_t finished_num = generated_num + rejected_num + failed_num;
+    std::ostringstream stats;
+    stats << std::fixed << std::setprecision(3);
+    stats << "uptime: " << uptime << "\n";
+    stats << "workers: " << max_workers << "\n";
+    stats << "active: " << workers.size() << "\n";
+    stats << "queued: " << queue.size() << "\n";
+    stats << "generated: " << generated_num << "\n";
+    stats << "rejected: " << rejected_num << "\n";
+    stats << "failed: " << failed_num << "\n";
+    stats << "tests_per_sec: " << (uptime > 0 ? generated_num / uptime : 0)
+          << "\n";
+    stats << "mean_latency_ms: "
+          << (finished_num ? total_latency * 1000 / finished_num : 0) << "\n";
+    return stats.str();
+}
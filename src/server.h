@@ -0,0 +1,125 @@
+/*
+Copyright (c) 2015-2020, Intel Corporation
+Copyright (c) 2019-2020, University of Utah
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+//////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include <sys/types.h>
+
+namespace yarpgen {
+
+// Long-lived generation server (yarpgen --serve=SOCKET). It saves the process
+// startup and the initialization for every test.
+//
+// Every connection to the Unix socket sends one line and gets one response:
+//   "--seed=42 --mutation-seed=7 --std=c"  ->  "OK <size>\n<test>"
+//   "stats"                                ->  "OK <size>\n<key: value lines>"
+// The options of the line are applied on top of the options of the server.
+// If the generation has failed, the response is
+//   "ERROR <exit code> <size>\n<error output>"
+// and the exit code is the same as the one of yarpgen (e.g. 3 for the tests
+// that exceed the cost budget). A connection that is closed without a request
+// (e.g. a health check) is ignored, and the response is cut off if the client
+// doesn't read it for 30 seconds.
+//
+// The generator keeps its state in singletons (Options, Statistics, the
+// random generator and the name counters), so it is not reentrant. Instead of
+// resetting all of them, the server acts as a warmed-up template process: every
+// request is generated by a fork of it, which starts from the clean state for
+// the price of copy-on-write. At most max_workers of them run at once, the
+// other requests wait in the queue.
+class GeneratorServer {
+  public:
+    // Generates a test with the current options. Returns the exit code.
+    using GenerateFunc = std::function<int(std::ostream &)>;
+
+    // base_args are the command line options of the server (without the
+    // server options), the options of the requests are appended to them
+    GeneratorServer(std::string _socket_path, size_t _max_workers,
+                    std::vector<std::string> _base_args,
+                    GenerateFunc _generate);
+    ~GeneratorServer();
+    GeneratorServer(const GeneratorServer &) = delete;
+    GeneratorServer &operator=(const GeneratorServer &) = delete;
+
+    // Serves the requests until SIGINT or SIGTERM. Returns the exit code.
+    int run();
+
+  private:
+    struct Request {
+        int conn_fd;
+        std::string line;
+    };
+
+    // Connection that hasn't sent its request line yet
+    struct Connection {
+        std::string buffer;
+        std::chrono::steady_clock::time_point deadline;
+    };
+
+    struct Worker {
+        int conn_fd;
+        // Error output of the worker
+        int err_fd;
+        std::chrono::steady_clock::time_point start;
+    };
+
+    bool listen();
+    void acceptConnection();
+    void readConnection(int conn_fd);
+    void dispatchRequest(int conn_fd, std::string line);
+    void dropExpiredConnections();
+    int getPollTimeout();
+    void startWorkers();
+    [[noreturn]] void runWorker(const Request &request, int err_fd);
+    void reapWorkers();
+    void finishWorker(Worker &worker, int status);
+    std::string getStats();
+
+    std::string socket_path;
+    size_t max_workers;
+    std::vector<std::string> base_args;
+    GenerateFunc generate;
+
+    int listen_fd;
+    // SIGCHLD, SIGINT and SIGTERM are delivered through this pipe
+    int signal_fds[2];
+
+    // The request lines are assembled as the data arrives, so a slow client
+    // can't stall the other ones
+    std::map<int, Connection> connections;
+    std::deque<Request> queue;
+    std::map<pid_t, Worker> workers;
+
+    std::chrono::steady_clock::time_point start_time;
+    uint64_t generated_num;
+    uint64_t rejected_num;
+    uint64_t failed_num;
+    // Total time from the start to the end of the finished workers
+    double total_latency;
+};
+} // namespace yarpgen
@@ -35,12 +35,23 @@ class Statistics {
 
     void addUB(UBKind kind) { ub_num.at(static_cast<size_t>(kind))++; }
 
+    // Work that was reserved by the loops for --max-dynamic-ops
+    void addDynamicOps(uint64_t val) { dynamic_ops += val; }
+    uint64_t getDynamicOps() { return dynamic_ops; }
+
+    void reset() {
+        stmt_num = 0;
+        ub_num = {};
+        dynamic_ops = 0;
+    }
+
   private:
-    Statistics() : stmt_num(0), ub_num({}) {}
+    Statistics() : stmt_num(0), ub_num({}), dynamic_ops(0) {}
 
     size_t stmt_num;
     // TODO: count undefined behavior stats
     std::array<size_t, static_cast<size_t>(UBKind::MaxUB)> ub_num;
+    uint64_t dynamic_ops;
 };
 
 } // namespace yarpgen
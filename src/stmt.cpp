@@ -22,6 +22,7 @@ limitations under the License.
 #include "statistics.h"
 
 #include <algorithm>
+#include <cmath>
 #include <utility>
 
 using namespace yarpgen;
@@ -37,6 +38,7 @@ std::shared_ptr<ExprStmt> ExprStmt::create(std::shared_ptr<PopulateCtx> ctx) {
     auto gen_pol = ctx->getGenPolicy();
 
     auto new_active_ctx = std::make_shared<PopulateCtx>(*ctx);
+    uint64_t start_expr_count = Expr::getTotalExprCount();
 
     std::shared_ptr<AssignmentExpr> expr;
     int64_t total_iters_num =
@@ -66,24 +68,69 @@ std::shared_ptr<ExprStmt> ExprStmt::create(std::shared_ptr<PopulateCtx> ctx) {
 
     EvalCtx eval_ctx;
     eval_ctx.total_iter_num = total_iters_num;
-    auto eval_res = expr->evaluate(eval_ctx);
-    if (eval_res->hasUB())
-        expr->rebuild(eval_ctx);
-    expr->propagateValue(eval_ctx);
-    if (new_active_ctx->getAllowMulVals()) {
+    // Multiple values are computed in a single traversal of the tree if no
+    // lane has UB. Otherwise, the main and the alternate values are evaluated
+    // and rebuilt one after another.
+    Expr::LaneValues lanes;
+    if (new_active_ctx->getAllowMulVals() &&
+        new_active_ctx->getMulValsIter() != nullptr &&
+        expr->evaluateLanes(eval_ctx, lanes) && !lanes.hasUB()) {
         eval_ctx.mul_vals_iter = new_active_ctx->getMulValsIter();
-        eval_ctx.use_main_vals = false;
-        eval_res = expr->evaluate(eval_ctx);
+        expr->propagateLanes(eval_ctx, lanes);
     }
-
-    if (eval_res->hasUB()) {
-        expr->rebuild(eval_ctx);
+    else {
+        // Each phase sees the values that were propagated by the previous one
+        eval_ctx.memo_stamp = Expr::newMemoStamp();
+        auto eval_res = expr->evaluate(eval_ctx);
+        if (eval_res->hasUB())
+            expr->rebuild(eval_ctx);
+        expr->propagateValue(eval_ctx);
+        if (new_active_ctx->getAllowMulVals()) {
+            eval_ctx.mul_vals_iter = new_active_ctx->getMulValsIter();
+            size_t vals_number = Options::getInstance().getValsNumber();
+            for (size_t i = 1; i < vals_number; ++i) {
+                eval_ctx.lane = i;
+                eval_ctx.memo_stamp = Expr::newMemoStamp();
+                eval_res = expr->evaluate(eval_ctx);
+                if (eval_res->hasUB())
+                    expr->rebuild(eval_ctx);
+                expr->propagateValue(eval_ctx);
+            }
+        }
+        else if (eval_res->hasUB()) {
+            eval_ctx.memo_stamp = Expr::newMemoStamp();
+            expr->rebuild(eval_ctx);
+        }
     }
 
+    auto new_stmt = std::make_shared<ExprStmt>(
+        expr, Expr::getTotalExprCount() - start_expr_count);
+    new_stmt->total_iters_num = total_iters_num;
     if (new_active_ctx->getAllowMulVals())
-        expr->propagateValue(eval_ctx);
+        new_stmt->mul_vals_iter = new_active_ctx->getMulValsIter();
+    return new_stmt;
+}
 
-    return std::make_shared<ExprStmt>(expr);
+bool ExprStmt::reevaluate() {
+    // We repeat the evaluation of create(), but we can't rebuild anything
+    auto assign_expr = std::static_pointer_cast<AssignmentExpr>(expr);
+    assign_expr->unshareTrees();
+    EvalCtx eval_ctx;
+    eval_ctx.total_iter_num = total_iters_num;
+    if (assign_expr->evaluate(eval_ctx)->hasUB())
+        return false;
+    assign_expr->propagateValue(eval_ctx);
+    if (mul_vals_iter != nullptr) {
+        eval_ctx.mul_vals_iter = mul_vals_iter;
+        size_t vals_number = Options::getInstance().getValsNumber();
+        for (size_t i = 1; i < vals_number; ++i) {
+            eval_ctx.lane = i;
+            if (assign_expr->evaluate(eval_ctx)->hasUB())
+                return false;
+            assign_expr->propagateValue(eval_ctx);
+        }
+    }
+    return true;
 }
 
 void DeclStmt::emit(std::shared_ptr<EmitCtx> ctx, std::ostream &stream,
@@ -186,6 +233,24 @@ void StmtBlock::emit(std::shared_ptr<EmitCtx> ctx, std::ostream &stream,
     }
 }
 
+// Auxiliary function for --max-dynamic-ops.
+// Even the smallest iteration space of a loop tree has to fit into the budget,
+// otherwise its work can't be shrunk later (see fitIterSpaceIntoBudget). ISPC
+// loops with foreach loops inside require a bigger iteration space.
+static bool loopDepthFitsIntoBudget(std::shared_ptr<GenPolicy> gen_pol,
+                                    size_t depth) {
+    Options &options = Options::getInstance();
+    uint64_t max_dynamic_ops = options.getMaxDynamicOps();
+    if (max_dynamic_ops == 0)
+        return true;
+
+    size_t min_iter_space = options.isISPC() ? gen_pol->ispc_iter_end_limit_max
+                                             : gen_pol->iters_end_limit_min;
+    return std::pow(static_cast<double>(min_iter_space),
+                    static_cast<double>(depth)) <=
+           static_cast<double>(max_dynamic_ops);
+}
+
 std::shared_ptr<StmtBlock>
 StmtBlock::generateStructure(std::shared_ptr<GenCtx> ctx) {
     std::vector<std::shared_ptr<Stmt>> stmts;
@@ -216,10 +281,12 @@ StmtBlock::generateStructure(std::shared_ptr<GenCtx> ctx) {
             break;
 
         if (stmt_kind == IRNodeKind::LOOP_SEQ &&
-            ctx->getLoopDepth() < gen_policy->loop_depth_limit)
+            ctx->getLoopDepth() < gen_policy->loop_depth_limit &&
+            loopDepthFitsIntoBudget(gen_policy, ctx->getLoopDepth() + 1))
             new_stmt = LoopSeqStmt::generateStructure(ctx);
         else if (stmt_kind == IRNodeKind::LOOP_NEST &&
-                 ctx->getLoopDepth() + 2 <= gen_policy->loop_depth_limit) {
+                 ctx->getLoopDepth() + 2 <= gen_policy->loop_depth_limit &&
+                 loopDepthFitsIntoBudget(gen_policy, ctx->getLoopDepth() + 2)) {
             new_stmt = LoopNestStmt::generateStructure(ctx);
         }
         else if (stmt_kind == IRNodeKind::IF_ELSE &&
@@ -246,6 +313,30 @@ void StmtBlock::populate(std::shared_ptr<PopulateCtx> ctx) {
     }
 }
 
+bool StmtBlock::removeStmt(const std::shared_ptr<Stmt> &stmt) {
+    auto find_res = std::find(stmts.begin(), stmts.end(), stmt);
+    if (find_res == stmts.end())
+        return false;
+    stmts.erase(find_res);
+    return true;
+}
+
+bool StmtBlock::replaceStmt(const std::shared_ptr<Stmt> &stmt,
+                            std::shared_ptr<Stmt> new_stmt) {
+    auto find_res = std::find(stmts.begin(), stmts.end(), stmt);
+    if (find_res == stmts.end())
+        return false;
+    *find_res = std::move(new_stmt);
+    return true;
+}
+
+bool StmtBlock::reevaluate() {
+    for (auto &stmt : stmts)
+        if (!stmt->reevaluate())
+            return false;
+    return true;
+}
+
 void ScopeStmt::emit(std::shared_ptr<EmitCtx> ctx, std::ostream &stream,
                      std::string offset) {
     stream << offset << "{\n";
@@ -396,6 +487,27 @@ void LoopHead::populateArrays(std::shared_ptr<PopulateCtx> ctx) {
     }
 }
 
+uint64_t LoopHead::getTotalItersNum() {
+    if (iters.empty())
+        return 0;
+    return iters.front()->getTotalItersNum();
+}
+
+uint64_t LoopHead::getStaticCost() {
+    return (prefix.use_count() != 0 ? prefix->getStaticCost() : 0) +
+           (suffix.use_count() != 0 ? suffix->getStaticCost() : 0);
+}
+
+uint64_t LoopHead::getDynamicCost() {
+    return (prefix.use_count() != 0 ? prefix->getDynamicCost() : 0) +
+           (suffix.use_count() != 0 ? suffix->getDynamicCost() : 0);
+}
+
+uint64_t LoopHead::getWorkBound(uint64_t iter_space) {
+    return (prefix.use_count() != 0 ? prefix->getWorkBound(iter_space) : 0) +
+           (suffix.use_count() != 0 ? suffix->getWorkBound(iter_space) : 0);
+}
+
 std::shared_ptr<Iterator>
 LoopHead::populateIterators(std::shared_ptr<PopulateCtx> ctx, size_t _end_val) {
     auto gen_pol = ctx->getGenPolicy();
@@ -475,6 +587,42 @@ static auto makeMutableRoll(std::shared_ptr<GenPolicy> gen_pol,
     return res;
 }
 
+// Auxiliary functions for --max-dynamic-ops.
+// All nested loops reuse the iteration space of the outermost one, so its size
+// defines the work of the whole loop tree. We shrink it until the work fits into
+// the remaining budget, and reserve the work of the final iteration space in the
+// global statistics. The iteration space can't go below one iteration and ISPC
+// nested foreach loops require a bigger one, so the reserved work can still
+// exceed the budget. Such tests are rejected by
+// ProgramGenerator::fitsCostBudget.
+static uint64_t getRemainingDynamicOps() {
+    Options &options = Options::getInstance();
+    Statistics &stats = Statistics::getInstance();
+    return options.getMaxDynamicOps() > stats.getDynamicOps()
+               ? options.getMaxDynamicOps() - stats.getDynamicOps()
+               : 0;
+}
+
+template <typename F> static size_t fitIterSpaceIntoBudget(size_t dim, F work) {
+    Options &options = Options::getInstance();
+    if (options.getMaxDynamicOps() == 0)
+        return dim;
+
+    uint64_t remaining = getRemainingDynamicOps();
+    while (dim > 1 && work(dim) > remaining)
+        --dim;
+    return dim;
+}
+
+template <typename F> static void reserveDynamicOps(size_t dim, F work) {
+    Options &options = Options::getInstance();
+    if (options.getMaxDynamicOps() == 0)
+        return;
+
+    Statistics &stats = Statistics::getInstance();
+    stats.addDynamicOps(work(dim));
+}
+
 void LoopSeqStmt::populate(std::shared_ptr<PopulateCtx> ctx) {
     auto gen_pol = ctx->getGenPolicy();
 
@@ -505,6 +653,7 @@ void LoopSeqStmt::populate(std::shared_ptr<PopulateCtx> ctx) {
         new_ctx->setInsideOMPSimd(loop_head->hasSIMDPragma() || old_simd_state);
 
         size_t new_dim = 0;
+        bool outermost_loop = false;
 
         std::shared_ptr<Iterator> new_iters = nullptr;
         if (same_iter_space_counter == 0) {
@@ -514,12 +663,18 @@ void LoopSeqStmt::populate(std::shared_ptr<PopulateCtx> ctx) {
                         active_gen_pol->iters_end_limit_min,
                         active_gen_pol->iter_end_limit_max);
                 });
+                auto loop_work = [this, cur_idx](uint64_t iter_space) {
+                    return getLoopWorkBound(cur_idx, iter_space);
+                };
+                new_dim = fitIterSpaceIntoBudget(new_dim, loop_work);
                 Options &options = Options::getInstance();
                 if (options.isISPC() && detectNestedForeach())
                     new_dim = std::max(gen_pol->ispc_iter_end_limit_max,
                                        (new_dim / ISPC_MAX_VECTOR_SIZE) *
                                                ISPC_MAX_VECTOR_SIZE +
                                            gen_pol->max_stencil_span);
+                reserveDynamicOps(new_dim, loop_work);
+                outermost_loop = true;
             }
             else
                 new_dim = new_ctx->getDimensions().front();
@@ -538,8 +693,7 @@ void LoopSeqStmt::populate(std::shared_ptr<PopulateCtx> ctx) {
                 prev_iter->isDegenerate(), prev_iter->getTotalItersNum());
             new_iters->setIsDead(false);
             new_iters->setSupportsMulValues(prev_iter->getSupportsMulValues());
-            new_iters->setMainValsOnLastIter(
-                prev_iter->getMainValsOnLastIter());
+            new_iters->setLastIterLane(prev_iter->getLastIterLane());
 
             // Foreach loop requires the iterator to have a step of 1 and
             // ISPC does not support nested foreach loops. Therefore,
@@ -575,6 +729,21 @@ void LoopSeqStmt::populate(std::shared_ptr<PopulateCtx> ctx) {
                              active_gen_pol->same_iter_space_span)) -
                 1;
             same_iter_space_dim = new_dim;
+            // The following loops of the group reuse the iteration space, so
+            // the group ends at the first loop that doesn't fit into the budget
+            Options &options = Options::getInstance();
+            if (outermost_loop && options.getMaxDynamicOps() != 0) {
+                size_t fitting_loops = 0;
+                while (fitting_loops < same_iter_space_counter) {
+                    uint64_t work =
+                        getLoopWorkBound(cur_idx + fitting_loops + 1, new_dim);
+                    if (work > getRemainingDynamicOps())
+                        break;
+                    Statistics::getInstance().addDynamicOps(work);
+                    ++fitting_loops;
+                }
+                same_iter_space_counter = fitting_loops;
+            }
             if (same_iter_space_counter > 0)
                 loop_head->setSameIterSpace();
         }
@@ -604,6 +773,64 @@ void LoopSeqStmt::populate(std::shared_ptr<PopulateCtx> ctx) {
     }
 }
 
+bool LoopSeqStmt::removeLoop(const std::shared_ptr<LoopHead> &loop_head) {
+    auto find_res = std::find_if(
+        loops.begin(), loops.end(),
+        [&loop_head](const std::pair<std::shared_ptr<LoopHead>,
+                                     std::shared_ptr<ScopeStmt>> &loop) {
+            return loop.first == loop_head;
+        });
+    if (find_res == loops.end())
+        return false;
+    loops.erase(find_res);
+    return true;
+}
+
+bool LoopSeqStmt::reevaluate() {
+    for (auto &loop : loops) {
+        auto &loop_head = loop.first;
+        if (loop_head->getPrefix().use_count() != 0 &&
+            !loop_head->getPrefix()->reevaluate())
+            return false;
+        if (!loop.second->reevaluate())
+            return false;
+        if (loop_head->getSuffix().use_count() != 0 &&
+            !loop_head->getSuffix()->reevaluate())
+            return false;
+    }
+    return true;
+}
+
+uint64_t LoopSeqStmt::getStaticCost() {
+    uint64_t res = 0;
+    // Each loop header counts as a single node
+    for (auto &loop : loops)
+        res += loop.first->getStaticCost() + loop.second->getStaticCost() + 1;
+    return res;
+}
+
+uint64_t LoopSeqStmt::getDynamicCost() {
+    uint64_t res = 0;
+    for (auto &loop : loops)
+        res += loop.first->getDynamicCost() +
+               loop.first->getTotalItersNum() *
+                   (loop.second->getDynamicCost() + 1);
+    return res;
+}
+
+uint64_t LoopSeqStmt::getLoopWorkBound(size_t idx, uint64_t iter_space) {
+    auto &loop = loops.at(idx);
+    return loop.first->getWorkBound(iter_space) +
+           iter_space * loop.second->getWorkBound(iter_space);
+}
+
+uint64_t LoopSeqStmt::getWorkBound(uint64_t iter_space) {
+    uint64_t res = 0;
+    for (size_t i = 0; i < loops.size(); ++i)
+        res += getLoopWorkBound(i, iter_space);
+    return res;
+}
+
 void LoopNestStmt::emit(std::shared_ptr<EmitCtx> ctx, std::ostream &stream,
                         std::string offset) {
     stream << offset << "/* LoopNest " << std::to_string(loops.size())
@@ -636,6 +863,10 @@ LoopNestStmt::generateStructure(std::shared_ptr<GenCtx> ctx) {
     nest_depth =
         std::min(gen_pol->loop_depth_limit - ctx->getLoopDepth(), nest_depth);
 
+    while (nest_depth > 1 &&
+           !loopDepthFitsIntoBudget(gen_pol, ctx->getLoopDepth() + nest_depth))
+        --nest_depth;
+
     Options &options = Options::getInstance();
 
     auto new_loop_nest = std::make_shared<LoopNestStmt>();
@@ -666,6 +897,14 @@ LoopNestStmt::generateStructure(std::shared_ptr<GenCtx> ctx) {
 
 void LoopNestStmt::populate(std::shared_ptr<PopulateCtx> ctx) {
     auto gen_pol = ctx->getGenPolicy();
+
+    // If even a single iteration of the outermost nest doesn't fit into the
+    // budget of dynamic ops, we reduce the nesting
+    Options &options = Options::getInstance();
+    if (options.getMaxDynamicOps() != 0 && ctx->getDimensions().empty())
+        while (loops.size() > 1 && getWorkBound(1) > getRemainingDynamicOps())
+            loops.pop_back();
+
     auto new_ctx = std::make_shared<PopulateCtx>(ctx);
     bool old_ctx_state = new_ctx->isTaken();
     auto taken_switch_id = loops.end();
@@ -689,12 +928,16 @@ void LoopNestStmt::populate(std::shared_ptr<PopulateCtx> ctx) {
                 return rand_val_gen->getRandValue(gen_pol->iters_end_limit_min,
                                                   gen_pol->iter_end_limit_max);
             });
-            Options &options = Options::getInstance();
+            auto nest_work = [this](uint64_t iter_space) {
+                return getWorkBound(iter_space);
+            };
+            new_dim = fitIterSpaceIntoBudget(new_dim, nest_work);
             if (options.isISPC() && detectNestedForeach())
                 new_dim = std::max(gen_pol->ispc_iter_end_limit_max,
                                    (new_dim / ISPC_MAX_VECTOR_SIZE) *
                                            ISPC_MAX_VECTOR_SIZE +
                                        gen_pol->max_stencil_span);
+            reserveDynamicOps(new_dim, nest_work);
         }
         else
             new_dim = new_ctx->getDimensions().front();
@@ -744,6 +987,48 @@ void LoopNestStmt::populate(std::shared_ptr<PopulateCtx> ctx) {
     }
 }
 
+bool LoopNestStmt::reevaluate() {
+    for (auto &loop : loops)
+        if (loop->getPrefix().use_count() != 0 &&
+            !loop->getPrefix()->reevaluate())
+            return false;
+    if (!body->reevaluate())
+        return false;
+    for (auto &loop : loops)
+        if (loop->getSuffix().use_count() != 0 &&
+            !loop->getSuffix()->reevaluate())
+            return false;
+    return true;
+}
+
+uint64_t LoopNestStmt::getStaticCost() {
+    uint64_t res = body->getStaticCost();
+    for (auto &loop : loops)
+        res += loop->getStaticCost() + 1;
+    return res;
+}
+
+uint64_t LoopNestStmt::getDynamicCost() {
+    uint64_t res = 0;
+    uint64_t iters_mult = 1;
+    for (auto &loop : loops) {
+        res += iters_mult * loop->getDynamicCost();
+        iters_mult *= loop->getTotalItersNum();
+        res += iters_mult;
+    }
+    return res + iters_mult * body->getDynamicCost();
+}
+
+uint64_t LoopNestStmt::getWorkBound(uint64_t iter_space) {
+    uint64_t res = 0;
+    uint64_t iters_mult = 1;
+    for (auto &loop : loops) {
+        res += iters_mult * loop->getWorkBound(iter_space);
+        iters_mult *= iter_space;
+    }
+    return res + iters_mult * body->getWorkBound(iter_space);
+}
+
 void IfElseStmt::emit(std::shared_ptr<EmitCtx> ctx, std::ostream &stream,
                       std::string offset) {
     stream << offset << "if (";
@@ -778,6 +1063,7 @@ IfElseStmt::generateStructure(std::shared_ptr<GenCtx> ctx) {
 void IfElseStmt::populate(std::shared_ptr<PopulateCtx> ctx) {
     auto new_ctx = std::make_shared<PopulateCtx>(ctx);
     new_ctx->setAllowMulVals(false);
+    uint64_t start_expr_count = Expr::getTotalExprCount();
     // TODO: for now, we do not allow multiple if-else statements' conditions
     // this leads to divergent taken branches and is incompatible with
     // the current implementation of value tracking
@@ -796,6 +1082,7 @@ void IfElseStmt::populate(std::shared_ptr<PopulateCtx> ctx) {
                                cond->getValue()->getType()->isUniform()),
             true);
     }
+    cond_expr_count = Expr::getTotalExprCount() - start_expr_count;
 
     EvalCtx eval_ctx;
     std::shared_ptr<Data> cond_eval_res = cond->evaluate(eval_ctx);
@@ -804,7 +1091,7 @@ void IfElseStmt::populate(std::shared_ptr<PopulateCtx> ctx) {
 
     new_ctx = std::make_shared<PopulateCtx>(*ctx);
     new_ctx->incIfElseDepth();
-    bool cond_taken = cond_val.getValueRef<bool>();
+    cond_taken = cond_val.getValueRef<bool>();
     new_ctx->setTaken(ctx->isTaken() && cond_taken);
 
     then_br->populate(new_ctx);
@@ -814,6 +1101,41 @@ void IfElseStmt::populate(std::shared_ptr<PopulateCtx> ctx) {
     }
 }
 
+bool IfElseStmt::reevaluate() {
+    Expr::unshare(cond);
+    EvalCtx eval_ctx;
+    std::shared_ptr<Data> cond_eval_res = cond->evaluate(eval_ctx);
+    if (cond_eval_res->hasUB())
+        return false;
+    // The statements of the branches know if they are taken, so we can't
+    // change the branch
+    IRValue cond_val =
+        std::static_pointer_cast<ScalarVar>(cond_eval_res)->getCurrentValue();
+    if (cond_val.getValueRef<bool>() != cond_taken)
+        return false;
+    return then_br->reevaluate() &&
+           (else_br.use_count() == 0 || else_br->reevaluate());
+}
+
+uint64_t IfElseStmt::getStaticCost() {
+    return cond_expr_count + then_br->getStaticCost() +
+           (else_br.use_count() != 0 ? else_br->getStaticCost() : 0);
+}
+
+uint64_t IfElseStmt::getDynamicCost() {
+    // Only one of the branches is executed, so we take the most expensive one
+    return cond_expr_count +
+           std::max(then_br->getDynamicCost(),
+                    else_br.use_count() != 0 ? else_br->getDynamicCost() : 0);
+}
+
+uint64_t IfElseStmt::getWorkBound(uint64_t iter_space) {
+    return 1 + std::max(then_br->getWorkBound(iter_space),
+                        else_br.use_count() != 0
+                            ? else_br->getWorkBound(iter_space)
+                            : 0);
+}
+
 void StubStmt::emit(std::shared_ptr<EmitCtx> ctx, std::ostream &stream,
                     std::string offset) {
     stream << offset << text;
@@ -38,21 +38,51 @@ class Stmt : public IRNode {
     // about the number of iterations. Those two decisions are made in
     // different places, so we need to have a way to communicate this
     virtual bool detectNestedForeach() { return false; }
+
+    // Rough cost model of the statement. Static cost is the number of
+    // expression nodes in it, dynamic cost is the number of expression nodes
+    // that are going to be executed at runtime.
+    virtual uint64_t getStaticCost() { return 0; }
+    virtual uint64_t getDynamicCost() { return 0; }
+
+    // Upper bound for the number of expression statements that are executed
+    // if every loop iterates over the iteration space of size iter_space.
+    // It relies only on the structure, so it can be used before populate.
+    virtual uint64_t getWorkBound(uint64_t iter_space) { return 0; }
+
+    // Evaluates the statement once more over the current values of the
+    // variables, in the same way as populate did. It is used after the test
+    // was modified (see reducer.h). Returns false if the statement has UB now
+    // or if the control flow differs from the one that populate has seen.
+    virtual bool reevaluate() { return true; }
 };
 
 class ExprStmt : public Stmt {
   public:
-    explicit ExprStmt(std::shared_ptr<Expr> _expr) : expr(std::move(_expr)) {}
+    explicit ExprStmt(std::shared_ptr<Expr> _expr, uint64_t _expr_count = 1)
+        : expr(std::move(_expr)), expr_count(_expr_count), total_iters_num(-1),
+          mul_vals_iter(nullptr) {}
     IRNodeKind getKind() final { return IRNodeKind::EXPR; }
 
     std::shared_ptr<Expr> getExpr() { return expr; }
 
+    uint64_t getStaticCost() final { return expr_count; }
+    uint64_t getDynamicCost() final { return expr_count; }
+    uint64_t getWorkBound(uint64_t iter_space) final { return 1; }
+
+    bool reevaluate() final;
+
     void emit(std::shared_ptr<EmitCtx> ctx, std::ostream &stream,
               std::string offset = "") final;
     static std::shared_ptr<ExprStmt> create(std::shared_ptr<PopulateCtx> ctx);
 
   private:
     std::shared_ptr<Expr> expr;
+    // Number of expression nodes that were created for the statement
+    uint64_t expr_count;
+    // Evaluation context that was used during populate
+    int64_t total_iters_num;
+    std::shared_ptr<Iterator> mul_vals_iter;
 };
 
 class DeclStmt : public Stmt {
@@ -179,6 +209,10 @@ class StmtBlock : public Stmt {
     }
 
     std::vector<std::shared_ptr<Stmt>> getStmts() { return stmts; }
+    // Both return false if there is no such statement in the block
+    bool removeStmt(const std::shared_ptr<Stmt> &stmt);
+    bool replaceStmt(const std::shared_ptr<Stmt> &stmt,
+                     std::shared_ptr<Stmt> new_stmt);
 
     void emit(std::shared_ptr<EmitCtx> ctx, std::ostream &stream,
               std::string offset = "") override;
@@ -193,6 +227,28 @@ class StmtBlock : public Stmt {
                                });
     }
 
+    uint64_t getStaticCost() override {
+        return std::accumulate(stmts.begin(), stmts.end(), uint64_t(0),
+                               [](uint64_t acc, const std::shared_ptr<Stmt> &stmt) {
+                                   return acc + stmt->getStaticCost();
+                               });
+    }
+    uint64_t getDynamicCost() override {
+        return std::accumulate(stmts.begin(), stmts.end(), uint64_t(0),
+                               [](uint64_t acc, const std::shared_ptr<Stmt> &stmt) {
+                                   return acc + stmt->getDynamicCost();
+                               });
+    }
+    uint64_t getWorkBound(uint64_t iter_space) override {
+        return std::accumulate(
+            stmts.begin(), stmts.end(), uint64_t(0),
+            [&iter_space](uint64_t acc, const std::shared_ptr<Stmt> &stmt) {
+                return acc + stmt->getWorkBound(iter_space);
+            });
+    }
+
+    bool reevaluate() override;
+
   protected:
     std::vector<std::shared_ptr<Stmt>> stmts;
 };
@@ -261,6 +317,13 @@ class LoopHead {
 
     void setVectorizable() { vectorizable = true; }
 
+    // Number of iterations of the loop (all iterators share the same space)
+    uint64_t getTotalItersNum();
+    // Costs of the prefix and suffix blocks
+    uint64_t getStaticCost();
+    uint64_t getDynamicCost();
+    uint64_t getWorkBound(uint64_t iter_space);
+
   private:
     std::shared_ptr<StmtBlock> prefix;
     // Loop iterations space is defined by the iterators that we can use
@@ -289,6 +352,12 @@ class LoopSeqStmt : public LoopStmt {
                 _loop) {
         loops.push_back(std::move(_loop));
     }
+    std::vector<
+        std::pair<std::shared_ptr<LoopHead>, std::shared_ptr<ScopeStmt>>>
+    getLoops() {
+        return loops;
+    }
+    bool removeLoop(const std::shared_ptr<LoopHead> &loop_head);
     void emit(std::shared_ptr<EmitCtx> ctx, std::ostream &stream,
               std::string offset = "") final;
     static std::shared_ptr<LoopSeqStmt>
@@ -305,7 +374,16 @@ class LoopSeqStmt : public LoopStmt {
             });
     }
 
+    uint64_t getStaticCost() final;
+    uint64_t getDynamicCost() final;
+    uint64_t getWorkBound(uint64_t iter_space) final;
+
+    bool reevaluate() final;
+
   private:
+    // Work bound of a single loop of the sequence (see getWorkBound)
+    uint64_t getLoopWorkBound(size_t idx, uint64_t iter_space);
+
     std::vector<
         std::pair<std::shared_ptr<LoopHead>, std::shared_ptr<ScopeStmt>>>
         loops;
@@ -318,6 +396,8 @@ class LoopNestStmt : public LoopStmt {
         loops.push_back(std::move(_loop));
     }
     void addBody(std::shared_ptr<ScopeStmt> _body) { body = std::move(_body); }
+    std::vector<std::shared_ptr<LoopHead>> getLoops() { return loops; }
+    std::shared_ptr<StmtBlock> getBody() { return body; }
     void emit(std::shared_ptr<EmitCtx> ctx, std::ostream &stream,
               std::string offset = "") final;
     static std::shared_ptr<LoopNestStmt>
@@ -333,6 +413,12 @@ class LoopNestStmt : public LoopStmt {
                body->detectNestedForeach();
     }
 
+    uint64_t getStaticCost() final;
+    uint64_t getDynamicCost() final;
+    uint64_t getWorkBound(uint64_t iter_space) final;
+
+    bool reevaluate() final;
+
   private:
     std::vector<std::shared_ptr<LoopHead>> loops;
     std::shared_ptr<StmtBlock> body;
@@ -343,8 +429,14 @@ class IfElseStmt : public Stmt {
     IfElseStmt(std::shared_ptr<Expr> _cond, std::shared_ptr<ScopeStmt> _then_br,
                std::shared_ptr<ScopeStmt> _else_br)
         : cond(std::move(_cond)), then_br(std::move(_then_br)),
-          else_br(std::move(_else_br)) {}
+          else_br(std::move(_else_br)), cond_expr_count(0),
+          cond_taken(false) {}
     IRNodeKind getKind() final { return IRNodeKind::IF_ELSE; }
+    std::shared_ptr<Expr> getCond() { return cond; }
+    std::shared_ptr<ScopeStmt> getThenBr() { return then_br; }
+    std::shared_ptr<ScopeStmt> getElseBr() { return else_br; }
+    // The value of the condition that populate has seen
+    bool isCondTaken() { return cond_taken; }
     void emit(std::shared_ptr<EmitCtx> ctx, std::ostream &stream,
               std::string offset = "") final;
     static std::shared_ptr<IfElseStmt>
@@ -356,16 +448,26 @@ class IfElseStmt : public Stmt {
                (else_br.use_count() != 0 && else_br->detectNestedForeach());
     }
 
+    uint64_t getStaticCost() final;
+    uint64_t getDynamicCost() final;
+    uint64_t getWorkBound(uint64_t iter_space) final;
+
+    bool reevaluate() final;
+
   private:
     std::shared_ptr<Expr> cond;
     std::shared_ptr<ScopeStmt> then_br;
     std::shared_ptr<ScopeStmt> else_br;
+    uint64_t cond_expr_count;
+    bool cond_taken;
 };
 
 class StubStmt : public Stmt {
   public:
     explicit StubStmt(std::string _text) : text(std::move(_text)) {}
     IRNodeKind getKind() final { return IRNodeKind::STUB; }
+    // Every stub is replaced with an expression statement later
+    uint64_t getWorkBound(uint64_t iter_space) final { return 1; }
 
     void emit(std::shared_ptr<EmitCtx> ctx, std::ostream &stream,
               std::string offset = "") final;
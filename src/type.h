@@ -128,6 +128,9 @@ class IntegralType : public ArithmeticType {
 
     std::shared_ptr<Type> makeVarying() override;
 
+    // Drops the folding set (see ProgramGenerator::resetGlobalState)
+    static void clearTypeSet() { int_type_set.clear(); }
+
   protected:
     // ISPC
     std::string getIspcNameHelper() {
@@ -327,6 +330,11 @@ class ArrayType : public Type {
 
     std::shared_ptr<Type> makeVarying() override;
 
+    static void clearTypeSet() {
+        array_type_set.clear();
+        uid_counter = 0;
+    }
+
   private:
     // Folding set for all of the array types.
     static std::unordered_map<ArrayTypeKey, std::shared_ptr<ArrayType>,
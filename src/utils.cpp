@@ -25,7 +25,7 @@ using namespace yarpgen;
 
 std::shared_ptr<RandValGen> yarpgen::rand_val_gen;
 
-RandValGen::RandValGen(uint64_t _seed) {
+RandValGen::RandValGen(uint64_t _seed, std::ostream &seed_log) {
     if (_seed != 0) {
         seed = _seed;
     }
@@ -33,7 +33,7 @@ RandValGen::RandValGen(uint64_t _seed) {
         std::random_device rd;
         seed = rd();
     }
-    std::cout << "/*SEED " << seed << "*/" << std::endl;
+    seed_log << "/*SEED " << seed << "*/" << std::endl;
     rand_gen = std::mt19937_64(seed);
 }
 
@@ -82,11 +82,13 @@ void RandValGen::setSeed(uint64_t new_seed) {
 
 // Mutations are driven by auxiliary random generator.
 // We use a separate mutation seed to set its initial state
-void RandValGen::setMutationSeed(uint64_t mutation_seed) {
+void RandValGen::setMutationSeed(uint64_t _mutation_seed,
+                                 std::ostream &seed_log) {
+    mutation_seed = _mutation_seed;
     if (mutation_seed == 0) {
         std::random_device rd;
         mutation_seed = rd();
     }
-    std::cout << "/*MUTATION_SEED " << mutation_seed << "*/" << std::endl;
+    seed_log << "/*MUTATION_SEED " << mutation_seed << "*/" << std::endl;
     prev_gen = std::mt19937_64(mutation_seed);
 }
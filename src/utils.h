@@ -22,6 +22,7 @@ limitations under the License.
 #include "enums.h"
 
 #include <algorithm>
+#include <cassert>
 #include <iostream>
 #include <memory>
 #include <random>
@@ -86,8 +87,9 @@ operator<<(std::ostream &os, const Probability<T> &_prob) {
 class RandValGen {
   public:
     // Specific seed can be passed to constructor to reproduce the test.
-    // Zero value is reserved (it notifies RandValGen that it can choose any)
-    explicit RandValGen(uint64_t _seed);
+    // Zero value is reserved (it notifies RandValGen that it can choose any).
+    // The actual seed is reported to seed_log.
+    RandValGen(uint64_t _seed, std::ostream &seed_log);
 
     template <typename T> T getRandValue(T from, T to) {
         assert(from <= to && "Invalid range for random value generation");
@@ -191,10 +193,13 @@ class RandValGen {
     uint64_t getSeed() const { return seed; }
     void setSeed(uint64_t new_seed);
     void switchMutationStates();
-    void setMutationSeed(uint64_t mutation_seed);
+    void setMutationSeed(uint64_t _mutation_seed, std::ostream &seed_log);
+    // 0 if the mutation is disabled
+    uint64_t getMutationSeed() const { return mutation_seed; }
 
   private:
     uint64_t seed;
+    uint64_t mutation_seed = 0;
     std::mt19937_64 rand_gen;
     // Auxiliary random generator, used for mutation
     std::mt19937_64 prev_gen;
@@ -227,6 +232,12 @@ class NameHandler {
     std::string getClassPrivateMbrName() { return "object_1.method_" + std::to_string(class_private_mbr_idx++) + "()"; }
     std::string getDynamicClassMbrName() { return "object_2->mbr_" + std::to_string(dyn_class_mbr_idx++); }
 
+    void reset() {
+        var_idx = arr_idx = iter_idx = stub_stmt_idx = ptr_idx = 0;
+        struct_mbr_idx = dyn_struct_mbr_idx = 0;
+        class_mbr_idx = class_private_mbr_idx = dyn_class_mbr_idx = 0;
+    }
+
   private:
     NameHandler() : var_idx(0), arr_idx(0), iter_idx(0), stub_stmt_idx(0), ptr_idx(0), struct_mbr_idx(0), dyn_struct_mbr_idx(0),
                     class_mbr_idx(0), class_private_mbr_idx(0), dyn_class_mbr_idx(0) {}
@@ -0,0 +1,105 @@
+/*
+Copyright (c) 2015-2020, Intel Corporation
+Copyright (c) 2019-2020, University of Utah
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+//////////////////////////////////////////////////////////////////////////////
+
+// C API of libyarpgen. It allows to generate tests without spawning yarpgen,
+// e.g. from a fuzzing harness or from Python through ctypes:
+//
+//   yarpgen_generator *gen = yarpgen_create(1, (const char *[]){"--std=c"});
+//   char *test; size_t size; yarpgen_metadata meta;
+//   if (yarpgen_generate(gen, 42, 0, &test, &size, &meta) == YARPGEN_OK) {
+//       ...
+//       yarpgen_free_buffer(test);
+//   }
+//   yarpgen_destroy(gen);
+//
+// Every generator keeps its own options, and every call generates the test
+// from scratch, so the result depends only on the options and the seeds, and
+// is the same as the output of the command line tool. The functions can be
+// called from several threads, but the generator state is process-wide, so
+// yarpgen_create and yarpgen_generate calls are serialized by one lock shared
+// by all handles: several handles don't generate tests in parallel.
+// Internal errors of the generator abort the process, as they do in yarpgen.
+
+#ifndef YARPGEN_H
+#define YARPGEN_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct yarpgen_generator yarpgen_generator;
+
+// Return codes of yarpgen_generate
+enum {
+    YARPGEN_OK = 0,
+    // Invalid options (see yarpgen_error)
+    YARPGEN_ERROR = 1,
+    // The test exceeds the cost budget (same as the exit code of yarpgen)
+    YARPGEN_REJECTED = 3
+};
+
+typedef struct yarpgen_metadata {
+    // Seeds of the test (random ones if 0 was requested)
+    uint64_t seed;
+    uint64_t mutation_seed;
+    // 64-bit FNV-1a hash of the test without the header comment (which
+    // contains the invocation), e.g. to find duplicates
+    uint64_t text_hash;
+    // Checksum that the test prints, if has_expected_checksum is set. With
+    // --check-algo=asserts the test checks the values itself and prints 0.
+    // With --check-algo=hash the checksum isn't known without running it.
+    uint64_t expected_checksum;
+    int has_expected_checksum;
+    // Cost estimation of the test (see --max-run-cost and --max-compile-cost)
+    uint64_t expr_num;
+    uint64_t stmt_num;
+    uint64_t arrays_num;
+    uint64_t dynamic_ops;
+    double compile_cost;
+} yarpgen_metadata;
+
+// Creates a generator with command line options (without the program name).
+// Returns NULL only if it is out of memory. Invalid options are reported by
+// yarpgen_error and yarpgen_generate.
+yarpgen_generator *yarpgen_create(int argc, const char *const *argv);
+void yarpgen_destroy(yarpgen_generator *gen);
+
+// Description of the last error or NULL if there was none
+const char *yarpgen_error(yarpgen_generator *gen);
+
+// Generates a test. Zero seeds are replaced with random ones (the mutation
+// seed is used only with --mutate). The seeds are not printed to stdout. On
+// success *test points to a NUL-terminated buffer of *size bytes that should
+// be released with yarpgen_free_buffer. Metadata is filled if the pointer is
+// not NULL. The return code covers only invalid options and rejected tests:
+// an internal error of the generator (ERROR()) still prints the message to
+// stderr and aborts the host process, so the caller can't recover from it.
+int yarpgen_generate(yarpgen_generator *gen, uint64_t seed,
+                     uint64_t mutation_seed, char **test, size_t *size,
+                     yarpgen_metadata *metadata);
+void yarpgen_free_buffer(char *buffer);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // YARPGEN_H